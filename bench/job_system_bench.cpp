@@ -0,0 +1,169 @@
+// JobSystem microbenchmarks: spawn overhead, dependency chains and parallelFor scaling up to the core count.
+// Every benchmark checks its result, a non-zero exit code means the scheduler lost or duplicated work.
+#include "JobSystem.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+
+using namespace std::chrono;
+
+static double MillisecondsSince(const steady_clock::time_point start)
+{
+	return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+static bool BenchSpawn(JobSystem& jobs, const uint32_t jobCount)
+{
+	atomic<uint32_t> executed{0};
+	JobCounter counter;
+
+	const auto start = steady_clock::now();
+	for(uint32_t i = 0; i < jobCount; ++i)
+		jobs.run([&executed] { executed.fetch_add(1, memory_order_relaxed); }, &counter);
+	jobs.wait(counter);
+	const double ms = MillisecondsSince(start);
+
+	printf("  spawn from one thread : %8.1f ns/job (%u jobs)\n", ms * 1e6 / jobCount, jobCount);
+	return executed.load() == jobCount;
+}
+
+static bool BenchNestedSpawn(JobSystem& jobs, const uint32_t parents, const uint32_t children)
+{
+	atomic<uint32_t> executed{0};
+	JobCounter counter;
+
+	const auto start = steady_clock::now();
+	for(uint32_t i = 0; i < parents; ++i)
+	{
+		jobs.run([&jobs, &executed, children]
+		{
+			JobCounter childCounter;
+			for(uint32_t j = 0; j < children; ++j)
+				jobs.run([&executed] { executed.fetch_add(1, memory_order_relaxed); }, &childCounter);
+			jobs.wait(childCounter);
+		}, &counter);
+	}
+	jobs.wait(counter);
+	const double ms = MillisecondsSince(start);
+
+	const uint32_t total = parents * children;
+	printf("  spawn from jobs       : %8.1f ns/job (%u x %u jobs)\n", ms * 1e6 / total, parents, children);
+	return executed.load() == total;
+}
+
+static bool BenchDependencyChain(JobSystem& jobs, const uint32_t length)
+{
+	// Each link only starts once the previous one finished, so the order is checked as well
+	vector<unique_ptr<JobCounter>> links(length);
+	for(auto& link : links)
+		link = make_unique<JobCounter>();
+	atomic<uint32_t> next{0};
+	atomic<bool> ordered{true};
+
+	const auto start = steady_clock::now();
+	jobs.run([&next] { next.fetch_add(1); }, links[0].get());
+	for(uint32_t i = 1; i < length; ++i)
+	{
+		jobs.runAfter(*links[i - 1], [&next, &ordered, i]
+		{
+			if(next.fetch_add(1) != i)
+				ordered.store(false);
+		}, links[i].get());
+	}
+	jobs.wait(*links.back());
+	const double ms = MillisecondsSince(start);
+
+	// Earlier links may still be unlocking their counters
+	for(auto& link : links)
+		jobs.wait(*link);
+
+	printf("  dependency chain      : %8.1f ns/link (%u links)\n", ms * 1e6 / length, length);
+	return ordered.load() && next.load() == length;
+}
+
+static double Work(const size_t begin, const size_t end)
+{
+	double sum = 0.0;
+	for(size_t i = begin; i < end; ++i)
+		sum += std::sin(static_cast<double>(i) * 1e-3) * std::sqrt(static_cast<double>(i));
+	return sum;
+}
+
+static bool BenchScaling(const size_t itemCount)
+{
+	const double expected = Work(0, itemCount);
+	const uint32_t hardwareThreads = std::max(thread::hardware_concurrency(), 1u);
+
+	printf("parallelFor scaling, %zu items:\n", itemCount);
+	bool ok = true;
+	double baselineMs = 0.0;
+	vector<uint32_t> threadCounts;
+	for(uint32_t threads = 1; threads < hardwareThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(hardwareThreads);
+
+	for(const uint32_t threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+		vector<double> partialSums(itemCount / 1024 + 1, 0.0);
+
+		const auto start = steady_clock::now();
+		jobs.parallelFor(itemCount, 1024, [&partialSums](const size_t begin, const size_t end)
+		{
+			// Chunks start at least one grain apart, so every chunk gets its own slot
+			partialSums[begin / 1024] = Work(begin, end);
+		});
+		const double ms = MillisecondsSince(start);
+		if(threads == 1)
+			baselineMs = ms;
+
+		const double sum = std::accumulate(partialSums.begin(), partialSums.end(), 0.0);
+		const bool correct = std::abs(sum - expected) <= 1e-6 * std::abs(expected);
+		ok = ok && correct;
+
+		const JobSystem::Stats stats = jobs.getStats();
+		printf("  %2u threads: %8.2f ms, speedup %5.2fx, %llu jobs, %llu stolen%s\n", threads, ms, baselineMs / ms,
+			   static_cast<unsigned long long>(stats.executed), static_cast<unsigned long long>(stats.stolen),
+			   correct ? "" : "  WRONG RESULT");
+	}
+	return ok;
+}
+
+static bool BenchScratch(JobSystem& jobs)
+{
+	// Every chunk fills thread-local scratch memory, rewinding keeps the arenas from growing
+	atomic<bool> ok{true};
+	const auto start = steady_clock::now();
+	jobs.parallelFor(1 << 16, 64, [&ok](const size_t begin, const size_t end)
+	{
+		ScratchScope scratch;
+		uint32_t* values = scratch.allocate<uint32_t>(end - begin);
+		for(size_t i = begin; i < end; ++i)
+			values[i - begin] = static_cast<uint32_t>(i);
+		for(size_t i = begin; i < end; ++i)
+		{
+			if(values[i - begin] != i)
+				ok.store(false);
+		}
+	});
+	printf("  scratch allocations   : %8.2f ms\n", MillisecondsSince(start));
+	return ok.load();
+}
+
+int main()
+{
+	bool ok = true;
+	{
+		JobSystem jobs;
+		printf("JobSystem with %u workers + caller:\n", jobs.getWorkerCount());
+		ok = BenchSpawn(jobs, 1'000'000) && ok;
+		ok = BenchNestedSpawn(jobs, 1'000, 1'000) && ok;
+		ok = BenchDependencyChain(jobs, 100'000) && ok;
+		ok = BenchScratch(jobs) && ok;
+	}
+	ok = BenchScaling(1 << 24) && ok;
+
+	printf("%s\n", ok ? "All results correct" : "FAILED: wrong results");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+// Shadow matrix recomputation: one light at a time (the scalar path), SoA SIMD batches, and batches split across
+// the job system. Batched results are checked against the scalar ones, a non-zero exit code means they disagree.
+#include "LightMatrices.hpp"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace std::chrono;
+
+static double MillisecondsSince(const steady_clock::time_point start)
+{
+	return duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+// Best of a few runs, the first one also warms the caches
+template<typename Function>
+static double BestOf(const int runs, const Function& function)
+{
+	double best = 1e30;
+	for(int i = 0; i < runs; ++i)
+	{
+		const auto start = steady_clock::now();
+		function();
+		best = std::min(best, MillisecondsSince(start));
+	}
+	return best;
+}
+
+// Relative to the element, with slack for the cancellation in translations of lights far from the origin
+static bool Close(const mat4& a, const mat4& b)
+{
+	for(int col = 0; col < 4; ++col)
+	{
+		for(int row = 0; row < 4; ++row)
+		{
+			if(std::abs(a[col][row] - b[col][row]) > 2e-3f * (1.0f + std::abs(a[col][row])))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool BenchPointLights(JobSystem& jobs, const size_t count)
+{
+	mt19937 rng(7);
+	uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+
+	vector<vec3> positions(count);
+	vector<array<mat4, 6>> scalar(count), batched(count), parallel(count);
+	PointLightBatch batch, parallelBatch;
+	for(size_t i = 0; i < count; ++i)
+	{
+		positions[i] = vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+		batch.push(positions[i], 50.0f, &batched[i]);
+		parallelBatch.push(positions[i], 50.0f, &parallel[i]);
+	}
+
+	const double scalarMs = BestOf(5, [&]
+	{
+		for(size_t i = 0; i < count; ++i)
+			scalar[i] = PointLightShadowMatrices(positions[i], 50.0f);
+	});
+	const double batchedMs = BestOf(5, [&] { ComputePointLightMatrices(batch); });
+	const double parallelMs = BestOf(5, [&] { ComputePointLightMatrices(parallelBatch, &jobs); });
+
+	bool ok = true;
+	for(size_t i = 0; i < count && ok; ++i)
+	{
+		for(int face = 0; face < 6; ++face)
+			ok = ok && Close(scalar[i][face], batched[i][face]) && Close(scalar[i][face], parallel[i][face]);
+	}
+
+	printf("  %6zu point lights: scalar %8.3f ms, SIMD %8.3f ms (%5.1fx), SIMD + jobs %8.3f ms (%5.1fx)%s\n", count,
+		   scalarMs, batchedMs, scalarMs / batchedMs, parallelMs, scalarMs / parallelMs, ok ? "" : "  MISMATCH");
+	return ok;
+}
+
+static bool BenchSpotlights(JobSystem& jobs, const size_t count)
+{
+	mt19937 rng(11);
+	uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+	uniform_real_distribution<float> axis(-1.0f, 1.0f);
+	uniform_real_distribution<float> cutOff(0.5f, 0.99f);
+
+	vector<vec3> positions(count), directions(count);
+	vector<float> cutOffs(count);
+	vector<mat4> scalar(count), batched(count), parallel(count);
+	SpotlightBatch batch, parallelBatch;
+	for(size_t i = 0; i < count; ++i)
+	{
+		positions[i] = vec3(coordinate(rng), coordinate(rng), coordinate(rng));
+		// Every eighth light points straight down, taking the other up vector
+		directions[i] = i % 8 == 0 ? vec3(0.0f, -1.0f, 0.0f) : vec3(axis(rng), axis(rng), axis(rng));
+		cutOffs[i] = cutOff(rng);
+		batch.push(positions[i], directions[i], cutOffs[i], &batched[i]);
+		parallelBatch.push(positions[i], directions[i], cutOffs[i], &parallel[i]);
+	}
+
+	const double scalarMs = BestOf(5, [&]
+	{
+		for(size_t i = 0; i < count; ++i)
+			scalar[i] = SpotLightSpaceMatrix(positions[i], directions[i], cutOffs[i]);
+	});
+	const double batchedMs = BestOf(5, [&] { ComputeSpotlightMatrices(batch); });
+	const double parallelMs = BestOf(5, [&] { ComputeSpotlightMatrices(parallelBatch, &jobs); });
+
+	bool ok = true;
+	for(size_t i = 0; i < count && ok; ++i)
+		ok = Close(scalar[i], batched[i]) && Close(scalar[i], parallel[i]);
+
+	printf("  %6zu spotlights  : scalar %8.3f ms, SIMD %8.3f ms (%5.1fx), SIMD + jobs %8.3f ms (%5.1fx)%s\n", count,
+		   scalarMs, batchedMs, scalarMs / batchedMs, parallelMs, scalarMs / parallelMs, ok ? "" : "  MISMATCH");
+	return ok;
+}
+
+int main()
+{
+	JobSystem jobs;
+	printf("Light matrices, %u workers + caller:\n", jobs.getWorkerCount());
+
+	bool ok = true;
+	for(const size_t count : {64u, 256u, 1024u, 16384u})
+	{
+		ok = BenchPointLights(jobs, count) && ok;
+		ok = BenchSpotlights(jobs, count) && ok;
+	}
+
+	printf("%s\n", ok ? "All results match" : "FAILED: batched matrices differ from the scalar path");
+	return ok ? 0 : 1;
+}
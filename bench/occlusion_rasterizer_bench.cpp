@@ -0,0 +1,73 @@
+// Software occlusion rasterizer timings on a grid of wall tiles, on the calling thread and across the job system.
+// Correctness is checked by occlusion_rasterizer_test.
+#include "OcclusionRasterizer.hpp"
+#include <glm/ext.hpp>
+#include <cstdio>
+
+// Camera at the origin looking down -z, the aspect matches the default buffer
+static const mat4 VIEW_PROJ = perspective(radians(60.0f), 2.0f, 0.1f, 100.0f);
+
+// Unit quad in the xy plane, facing +z
+static const vec3 QUAD_POSITIONS[] = {
+	vec3(-0.5f, -0.5f, 0.0f), vec3(0.5f, -0.5f, 0.0f), vec3(0.5f, 0.5f, 0.0f), vec3(-0.5f, 0.5f, 0.0f),
+};
+static const uint32_t QUAD_INDICES[] = {0, 1, 2, 0, 2, 3};
+
+static mat4 QuadAt(const vec3& center, const vec2& size)
+{
+	return scale(translate(mat4(1.0f), center), vec3(size, 1.0f));
+}
+
+static AABB Box(const vec3& center, const vec3& halfExtent)
+{
+	AABB box;
+	box.expand(center - halfExtent);
+	box.expand(center + halfExtent);
+	return box;
+}
+
+// Rows of wall tiles receding from the camera, then a grid of boxes behind them
+static void Bench(OcclusionRasterizer& rasterizer, const char* label)
+{
+	constexpr int TILES = 32;
+	constexpr int BOXES = 4096;
+
+	double rasterMs = 0.0;
+	uint32_t occluded = 0;
+	for(int run = 0; run < 5; ++run)
+	{
+		rasterizer.begin(VIEW_PROJ);
+		for(int y = 0; y < TILES; ++y)
+			for(int x = 0; x < TILES; ++x)
+				rasterizer.addOccluder(QUAD_POSITIONS, QUAD_INDICES,
+									   QuadAt(vec3(static_cast<float>(x - TILES / 2), static_cast<float>(y - TILES / 2), -8.0f - static_cast<float>(x % 4)),
+											  vec2(1.0f)));
+		rasterizer.rasterize();
+		rasterMs = run == 0 ? rasterizer.getStats().rasterMs : std::min(rasterMs, rasterizer.getStats().rasterMs);
+
+		occluded = 0;
+		for(int i = 0; i < BOXES; ++i)
+		{
+			const vec3 center(static_cast<float>(i % 64 - 32) * 0.5f, static_cast<float>(i / 64 - 32) * 0.25f, -20.0f);
+			occluded += rasterizer.isOccluded(Box(center, vec3(0.2f)));
+		}
+	}
+
+	printf("  %-16s %u occluder triangles in %7.3f ms, %u of %d boxes occluded\n", label,
+		   rasterizer.getStats().rasterizedTriangles, rasterMs, occluded, BOXES);
+}
+
+int main()
+{
+	JobSystem jobs;
+	printf("Occlusion rasterizer, %ux%u, %u workers + caller:\n", OcclusionRasterizer::DEFAULT_WIDTH,
+		   OcclusionRasterizer::DEFAULT_HEIGHT, jobs.getWorkerCount());
+
+	OcclusionRasterizer serial;
+	OcclusionRasterizer parallel;
+	parallel.setJobSystem(&jobs);
+
+	Bench(serial, "calling thread:");
+	Bench(parallel, "job system:");
+	return 0;
+}
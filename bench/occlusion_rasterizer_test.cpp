@@ -0,0 +1,113 @@
+// GPU-free checks of the software occlusion rasterizer on fixed scenes, on the calling thread and across the job
+// system. Registered with CTest, a non-zero exit code means a case failed.
+#include "OcclusionRasterizer.hpp"
+#include <glm/ext.hpp>
+#include <cmath>
+#include <cstdio>
+
+// Camera at the origin looking down -z, the aspect matches the default buffer
+static const mat4 VIEW_PROJ = perspective(radians(60.0f), 2.0f, 0.1f, 100.0f);
+
+// Unit quad in the xy plane, facing +z
+static const vec3 QUAD_POSITIONS[] = {
+	vec3(-0.5f, -0.5f, 0.0f), vec3(0.5f, -0.5f, 0.0f), vec3(0.5f, 0.5f, 0.0f), vec3(-0.5f, 0.5f, 0.0f),
+};
+static const uint32_t QUAD_INDICES[] = {0, 1, 2, 0, 2, 3};
+
+static mat4 QuadAt(const vec3& center, const vec2& size)
+{
+	return scale(translate(mat4(1.0f), center), vec3(size, 1.0f));
+}
+
+static AABB Box(const vec3& center, const vec3& halfExtent)
+{
+	AABB box;
+	box.expand(center - halfExtent);
+	box.expand(center + halfExtent);
+	return box;
+}
+
+// Center of tile (x, y) of a grid facing the camera at z = -5, the grid centered on the view axis
+static vec3 TileCenter(const int x, const int y, const int tilesX, const int tilesY, const float size)
+{
+	return vec3((static_cast<float>(x) - static_cast<float>(tilesX - 1) * 0.5f) * size,
+				(static_cast<float>(y) - static_cast<float>(tilesY - 1) * 0.5f) * size, -5.0f);
+}
+
+static bool Check(const char* what, const bool passed)
+{
+	if(!passed)
+		printf("  FAILED: %s\n", what);
+	return passed;
+}
+
+static bool RunCases(OcclusionRasterizer& rasterizer)
+{
+	bool ok = true;
+
+	// A 4 x 2 wall 5 units away covers the middle of the screen
+	rasterizer.begin(VIEW_PROJ);
+	rasterizer.addOccluder(QUAD_POSITIONS, QUAD_INDICES, QuadAt(vec3(0.0f, 0.0f, -5.0f), vec2(4.0f, 2.0f)));
+	rasterizer.rasterize();
+
+	const vec4 wallClip = VIEW_PROJ * vec4(0.0f, 0.0f, -5.0f, 1.0f);
+	const float wallDepth = wallClip.z / wallClip.w * 0.5f + 0.5f;
+	const uint32_t centerX = rasterizer.getWidth() / 2;
+	const uint32_t centerY = rasterizer.getHeight() / 2;
+	ok = Check("wall depth at the center", std::abs(rasterizer.depthAt(centerX, centerY) - wallDepth) < 1e-4f) && ok;
+	ok = Check("far plane at the corner", rasterizer.depthAt(0, 0) == 1.0f) && ok;
+	ok = Check("box behind the wall is occluded", rasterizer.isOccluded(Box(vec3(0.0f, 0.0f, -10.0f), vec3(0.5f)))) && ok;
+	ok = Check("box in front of the wall is visible", !rasterizer.isOccluded(Box(vec3(0.0f, 0.0f, -2.5f), vec3(0.5f)))) && ok;
+	ok = Check("off-screen box is visible", !rasterizer.isOccluded(Box(vec3(50.0f, 0.0f, -10.0f), vec3(0.5f)))) && ok;
+	ok = Check("partly covered box is visible", !rasterizer.isOccluded(Box(vec3(5.0f, 0.0f, -10.0f), vec3(3.0f, 0.5f, 0.5f)))) && ok;
+	ok = Check("wall triangles rasterized", rasterizer.getStats().rasterizedTriangles == 2) && ok;
+
+	// Coplanar camera-facing tiles, each tested against a buffer that holds itself and its neighbours
+	rasterizer.begin(VIEW_PROJ);
+	constexpr int TILES_X = 16;
+	constexpr int TILES_Y = 8;
+	constexpr float TILE_SIZE = 0.5f;
+	for(int y = 0; y < TILES_Y; ++y)
+		for(int x = 0; x < TILES_X; ++x)
+			rasterizer.addOccluder(QUAD_POSITIONS, QUAD_INDICES,
+								   QuadAt(TileCenter(x, y, TILES_X, TILES_Y, TILE_SIZE), vec2(TILE_SIZE)));
+	rasterizer.rasterize();
+
+	bool tilesVisible = true;
+	for(int y = 0; y < TILES_Y; ++y)
+		for(int x = 0; x < TILES_X; ++x)
+			tilesVisible = tilesVisible && !rasterizer.isOccluded(Box(TileCenter(x, y, TILES_X, TILES_Y, TILE_SIZE),
+																	 vec3(TILE_SIZE * 0.5f, TILE_SIZE * 0.5f, 0.0f)));
+	ok = Check("wall tiles don't occlude themselves", tilesVisible) && ok;
+	ok = Check("box behind the tiled wall is occluded", rasterizer.isOccluded(Box(vec3(0.0f, 0.0f, -6.0f), vec3(0.5f)))) && ok;
+
+	// Closer than the near plane the GPU clips the quad away, so it must not occlude anything
+	rasterizer.begin(VIEW_PROJ);
+	rasterizer.addOccluder(QUAD_POSITIONS, QUAD_INDICES, QuadAt(vec3(0.0f, 0.0f, -0.05f), vec2(2.0f, 2.0f)));
+	rasterizer.rasterize();
+
+	ok = Check("quad before the near plane dropped", rasterizer.getStats().rasterizedTriangles == 0) && ok;
+	ok = Check("far plane behind the dropped quad", rasterizer.depthAt(centerX, centerY) == 1.0f) && ok;
+	ok = Check("box behind the near plane quad is visible", !rasterizer.isOccluded(Box(vec3(0.0f, 0.0f, -10.0f), vec3(0.5f)))) && ok;
+	ok = Check("box crossing the near plane is visible", !rasterizer.isOccluded(Box(vec3(0.0f, 0.0f, -0.1f), vec3(0.5f)))) && ok;
+
+	return ok;
+}
+
+int main()
+{
+	JobSystem jobs;
+
+	OcclusionRasterizer serial;
+	OcclusionRasterizer parallel;
+	parallel.setJobSystem(&jobs);
+
+	bool ok = true;
+	printf("Occlusion rasterizer, calling thread:\n");
+	ok = RunCases(serial) && ok;
+	printf("Occlusion rasterizer, job system with %u workers:\n", jobs.getWorkerCount());
+	ok = RunCases(parallel) && ok;
+
+	printf("%s\n", ok ? "All results correct" : "FAILED: occlusion results differ from the expected ones");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// GPU-free check of the render stats JSON lines output: records a few frames, writes one line and parses it.
+// Registered with CTest, a non-zero exit code means the line is not valid JSON or misses a field.
+#include "RenderStats.hpp"
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <string_view>
+
+// Strict enough for what writeJson emits: objects, arrays, strings, numbers and literals
+class JsonValidator
+{
+public:
+	explicit JsonValidator(const string_view text) : text(text) {}
+
+	bool validate()
+	{
+		skipSpace();
+		if(!value())
+			return false;
+		skipSpace();
+		return position == text.size();
+	}
+
+	[[nodiscard]] size_t errorOffset() const { return position; }
+
+private:
+	bool value()
+	{
+		skipSpace();
+		if(position >= text.size())
+			return false;
+		switch(text[position])
+		{
+			case '{': return object();
+			case '[': return array();
+			case '"': return stringValue();
+			case 't': return literal("true");
+			case 'f': return literal("false");
+			case 'n': return literal("null");
+			default: return number();
+		}
+	}
+
+	bool object()
+	{
+		++position;
+		skipSpace();
+		if(consume('}'))
+			return true;
+		do
+		{
+			skipSpace();
+			if(position >= text.size() || text[position] != '"' || !stringValue())
+				return false;
+			skipSpace();
+			if(!consume(':') || !value())
+				return false;
+			skipSpace();
+		}
+		while(consume(','));
+		return consume('}');
+	}
+
+	bool array()
+	{
+		++position;
+		skipSpace();
+		if(consume(']'))
+			return true;
+		do
+		{
+			if(!value())
+				return false;
+			skipSpace();
+		}
+		while(consume(','));
+		return consume(']');
+	}
+
+	bool stringValue()
+	{
+		++position;
+		while(position < text.size() && text[position] != '"')
+		{
+			if(static_cast<unsigned char>(text[position]) < 0x20)
+				return false;
+			position += text[position] == '\\' ? 2 : 1;
+		}
+		return consume('"');
+	}
+
+	bool number()
+	{
+		const size_t start = position;
+		consume('-');
+		while(position < text.size() && (isdigit(static_cast<unsigned char>(text[position])) || text[position] == '.'
+			|| text[position] == 'e' || text[position] == 'E' || text[position] == '+' || text[position] == '-'))
+			++position;
+		return position > start && isdigit(static_cast<unsigned char>(text[position - 1]));
+	}
+
+	bool literal(const string_view word)
+	{
+		if(text.substr(position, word.size()) != word)
+			return false;
+		position += word.size();
+		return true;
+	}
+
+	bool consume(const char c)
+	{
+		if(position < text.size() && text[position] == c)
+		{
+			++position;
+			return true;
+		}
+		return false;
+	}
+
+	void skipSpace()
+	{
+		while(position < text.size() && isspace(static_cast<unsigned char>(text[position])))
+			++position;
+	}
+
+	string_view text;
+	size_t position = 0;
+};
+
+static bool Check(const char* what, const bool passed)
+{
+	if(!passed)
+		printf("  FAILED: %s\n", what);
+	return passed;
+}
+
+int main()
+{
+	RenderStats stats;
+	for(int frame = 0; frame < 3; ++frame)
+	{
+		stats.beginPass(StatsPass::Shadow);
+		stats.recordDraw(4, 1200);
+		stats.recordShadowMap();
+		stats.endPass();
+		stats.beginPass(StatsPass::Main);
+		stats.recordDraw(10, 36000);
+		stats.recordDraw(1, 12);
+		stats.endPass();
+		stats.recordBufferUpload(4096);
+		stats.recordLightsShaded(8);
+		stats.endFrame();
+	}
+
+	ostringstream out;
+	stats.writeJson(out);
+	const string line = out.str();
+
+	bool ok = true;
+	ok = Check("a single line", !line.empty() && line.back() == '\n' && line.find('\n') == line.size() - 1) && ok;
+	JsonValidator validator(line);
+	const bool valid = validator.validate();
+	if(!valid)
+		printf("  invalid JSON at offset %zu: %s", validator.errorOffset(), line.c_str());
+	ok = Check("valid JSON", valid) && ok;
+	ok = Check("first pass field", line.find("\"shadow\":{\"draw_calls\":1,") != string::npos) && ok;
+	ok = Check("later pass field", line.find("\"main\":{\"draw_calls\":2,") != string::npos) && ok;
+	ok = Check("frame field", line.find("},\"buffer_upload_bytes\":4096,") != string::npos) && ok;
+
+	printf("%s\n", ok ? "All results correct" : "FAILED: render stats JSON line is malformed");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#shader vertex
+#version 460 core
+
+// ================= VERTEX SHADER =================
+void main()
+{
+    // Fullscreen triangle, no vertex buffer needed
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+
+#shader fragment
+#version 460 core
+
+// ================= INPUTS =================
+uniform sampler2D lightBuffer;
+uniform sampler2D gDepth;
+
+out vec4 FragColor;
+
+// ================= CONSTANTS =================
+const float GAMMA = 2.2;
+
+// ================= MAIN FUNCTION =================
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth >= 1.0)
+    discard; // Background, left to the skybox
+
+    vec3 result = texelFetch(lightBuffer, texel, 0).rgb;
+
+    // Same gamma correction as main.glsl
+    FragColor = vec4(pow(result, vec3(1.0 / GAMMA)), 1.0);
+
+    // Scene depth for the skybox pass that follows
+    gl_FragDepth = depth;
+}
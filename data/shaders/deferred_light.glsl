@@ -0,0 +1,141 @@
+#shader vertex
+#version 460 core
+
+// ================= EXTENSIONS =================
+#extension GL_ARB_bindless_texture : require
+
+// ================= ATTRIBUTES =================
+layout (location = 0) in vec3 aPos; // Unit light volume: sphere for point lights, cone along +Z for spotlights
+
+// ================= SHARED CODE =================
+#include "include/lights.glsl"
+
+// ================= UNIFORMS =================
+uniform mat4 projection;
+uniform mat4 view;
+uniform int u_lightType;
+
+// ================= OUTPUTS =================
+flat out int vLightIndex;
+
+// ================= CONSTANTS =================
+const int LIGHT_DIR = 0;
+const int LIGHT_POINT = 1;
+const int LIGHT_SPOT = 2;
+
+// Distance where the brightest channel of an attenuated light drops below 1/256
+float lightRange(vec3 ambient, vec3 diffuse, vec3 specular, float constant, float linear, float quadratic)
+{
+    vec3 brightest = max(max(ambient, diffuse), specular);
+    float maxChannel = max(max(brightest.r, brightest.g), brightest.b);
+    float c = constant - 256.0 * maxChannel;
+    if (quadratic <= 0.0)
+    return linear > 0.0 ? max(-c / linear, 0.0) : 1.0e4;
+    return (-linear + sqrt(max(linear * linear - 4.0 * quadratic * c, 0.0))) / (2.0 * quadratic);
+}
+
+// ================= VERTEX SHADER =================
+void main()
+{
+    vLightIndex = gl_InstanceID;
+
+    if (u_lightType == LIGHT_DIR)
+    {
+        // Fullscreen triangle, no vertex buffer needed
+        vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+        return;
+    }
+
+    vec3 worldPos;
+    if (u_lightType == LIGHT_POINT)
+    {
+        PointLight light = pointLights.lights[gl_InstanceID];
+        float range = lightRange(light.ambient, light.diffuse, light.specular,
+        light.constant, light.linear, light.quadratic);
+        worldPos = light.position + aPos * range;
+    }
+    else
+    {
+        SpotLight light = spotLights.lights[gl_InstanceID];
+        float range = lightRange(light.ambient, light.diffuse, light.specular,
+        light.constant, light.linear, light.quadratic);
+
+        // tan(acos(outerCutOff)) without the trigonometry
+        float cosOuter = max(light.outerCutOff, 0.01);
+        float tanOuter = sqrt(max(1.0 - cosOuter * cosOuter, 0.0)) / cosOuter;
+
+        vec3 axis = normalize(light.direction);
+        vec3 up = abs(axis.y) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0);
+        vec3 tangent = normalize(cross(up, axis));
+        vec3 bitangent = cross(axis, tangent);
+
+        vec3 local = vec3(aPos.xy * tanOuter, aPos.z) * range;
+        worldPos = light.position + tangent * local.x + bitangent * local.y + axis * local.z;
+    }
+
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
+
+#shader fragment
+#version 460 core
+
+// ================= EXTENSIONS =================
+#extension GL_ARB_bindless_texture : require
+
+// ================= INPUTS =================
+flat in int vLightIndex;
+
+out vec4 FragColor;
+
+// ================= SHARED CODE =================
+#include "include/lights.glsl"
+#include "include/packing.glsl"
+
+// ================= G-BUFFER =================
+uniform sampler2D gAlbedo;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+// ================= UNIFORMS =================
+uniform mat4 invViewProj;
+uniform vec3 viewPos;
+uniform vec2 u_screenSize;
+uniform int u_lightType;
+
+// ================= CONSTANTS =================
+const int LIGHT_DIR = 0;
+const int LIGHT_POINT = 1;
+const int LIGHT_SPOT = 2;
+
+// ================= MAIN FUNCTION =================
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth >= 1.0)
+    discard; // Background, left to the skybox
+
+    // Reconstruct the world position at the pixel center, like the forward rasterizer does
+    vec2 uv = gl_FragCoord.xy / u_screenSize;
+    vec4 clipPos = vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec4 worldPos = invViewProj * clipPos;
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    vec3 normal = decodeNormal(texelFetch(gNormal, texel, 0).xy);
+    vec3 diffuseColor = texelFetch(gAlbedo, texel, 0).rgb;
+    vec3 specularColor = texelFetch(gSpecular, texel, 0).rgb;
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    vec3 result;
+    if (u_lightType == LIGHT_DIR)
+    result = calcDirLight(dirLights.lights[vLightIndex], vLightIndex, normal, fragPos, viewDir, diffuseColor, specularColor);
+    else if (u_lightType == LIGHT_POINT)
+    result = calcPointLight(pointLights.lights[vLightIndex], normal, fragPos, viewDir, diffuseColor, specularColor);
+    else
+    result = calcSpotLight(spotLights.lights[vLightIndex], vLightIndex, normal, fragPos, viewDir, diffuseColor, specularColor);
+
+    // Accumulated additively in linear space, gamma is applied by the composite pass
+    FragColor = vec4(result, 1.0);
+}
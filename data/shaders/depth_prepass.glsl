@@ -0,0 +1,24 @@
+#shader vertex
+#version 460 core
+layout (location = 0) in vec3 aPos;
+layout (location = 4) in mat4 aInstanceMatrix;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+// Must match main.glsl bit for bit, the main pass tests against this depth with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    vec3 fragPos = vec3(aInstanceMatrix * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
+
+#shader fragment
+#version 460 core
+
+void main()
+{
+    // Depth only, color writes are masked during the pre-pass
+}
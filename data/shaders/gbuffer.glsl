@@ -0,0 +1,64 @@
+#shader vertex
+#version 460 core
+
+// ================= ATTRIBUTES =================
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in mat4 aInstanceMatrix;
+
+// ================= UNIFORMS =================
+uniform mat4 projection;
+uniform mat4 view;
+
+// ================= OUTPUTS =================
+out vec3 FragPos;
+out vec2 TexCoord;
+out mat3 TBN;
+
+// ================= VERTEX SHADER =================
+void main()
+{
+    FragPos = vec3(aInstanceMatrix * vec4(aPos, 1.0));
+    TexCoord = aTexCoord;
+
+    // Same TBN as main.glsl so both paths shade identical normals
+    mat3 normalMatrix = mat3(transpose(inverse(aInstanceMatrix)));
+    vec3 N = normalize(normalMatrix * aNormal);
+    vec3 T = normalize(normalMatrix * aTangent);
+    T = normalize(T - dot(T, N) * N);
+    vec3 B = cross(N, T);
+    TBN = mat3(T, B, N);
+
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
+
+#shader fragment
+#version 460 core
+
+// ================= EXTENSIONS =================
+#extension GL_ARB_bindless_texture : require
+
+// ================= INPUTS =================
+in vec3 FragPos;
+in vec2 TexCoord;
+in mat3 TBN;
+
+// ================= G-BUFFER OUTPUTS =================
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gSpecular;
+layout (location = 2) out vec2 gNormal;
+
+// ================= SHARED CODE =================
+#include "include/material.glsl"
+#include "include/packing.glsl"
+
+// ================= MAIN FUNCTION =================
+void main()
+{
+    // Textures are sampled once here, the lighting pass only reads the G-buffer
+    gAlbedo = vec4(getDiffuseColor(), 1.0);
+    gSpecular = vec4(getSpecularColor(), 1.0);
+    gNormal = encodeNormal(getNormal());
+}
@@ -0,0 +1,35 @@
+#shader compute
+#version 460 core
+layout (local_size_x = 64) in;
+
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 12) readonly buffer Counts {
+    uint kept[];
+} counts;
+
+layout(std430, binding = 14) buffer Commands {
+    DrawCommand commands[];
+} commands;
+
+// Model index of every command
+layout(std430, binding = 15) readonly buffer CommandModels {
+    uint models[];
+} commandModels;
+
+uniform int u_commandCount;
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(u_commandCount))
+        return;
+
+    commands.commands[index].instanceCount = counts.kept[commandModels.models[index]];
+}
@@ -0,0 +1,139 @@
+#shader compute
+#version 460 core
+layout (local_size_x = 64) in;
+
+// Instance matrices of one model, as Model::updateInstances uploaded them
+layout(std430, binding = 9) readonly buffer Instances {
+    mat4 matrices[];
+} instances;
+
+// Compacted matrices of the kept instances, drawn through the model's culled vertex arrays
+layout(std430, binding = 10) writeonly buffer CulledInstances {
+    mat4 matrices[];
+} culled;
+
+// Whether each instance passed last frame's phase 2, phase 1 draws exactly those
+layout(std430, binding = 11) buffer Visibility {
+    uint visible[];
+} visibility;
+
+// Kept instances per model, both phases append to the same count
+layout(std430, binding = 12) buffer Counts {
+    uint kept[];
+} counts;
+
+layout(std430, binding = 13) buffer CullStats {
+    uint visibleCount;
+    uint occludedCount;
+    uint frustumCulledCount;
+} stats;
+
+uniform int u_phase;
+uniform mat4 u_viewProj;
+uniform vec4 u_planes[6];
+uniform sampler2D u_pyramid;
+uniform int u_model;
+uniform int u_instanceCount;
+uniform vec3 u_boundsMin;
+uniform vec3 u_boundsMax;
+
+void keep(uint index)
+{
+    uint slot = atomicAdd(counts.kept[u_model], 1u);
+    culled.matrices[slot] = instances.matrices[index];
+}
+
+bool insideFrustum(vec3 worldMin, vec3 worldMax)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        // Corner of the box farthest along the plane normal
+        vec3 positive = mix(worldMin, worldMax, greaterThanEqual(u_planes[i].xyz, vec3(0.0)));
+        if (dot(u_planes[i].xyz, positive) + u_planes[i].w < 0.0)
+            return false;
+    }
+    return true;
+}
+
+bool occluded(vec3 worldMin, vec3 worldMax)
+{
+    vec2 uvMin = vec2(1.0);
+    vec2 uvMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        vec3 position = mix(worldMin, worldMax, bvec3((corner & 1) != 0, (corner & 2) != 0, (corner & 4) != 0));
+        vec4 clip = u_viewProj * vec4(position, 1.0);
+        // Crosses the near plane, the projected rectangle means nothing
+        if (clip.w <= 0.0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+        uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    uvMin = clamp(uvMin, 0.0, 1.0);
+    uvMax = clamp(uvMax, 0.0, 1.0);
+
+    // The level where the rectangle covers at most 2x2 texels
+    vec2 size = vec2(textureSize(u_pyramid, 0));
+    vec2 extent = (uvMax - uvMin) * size;
+    int lastLevel = textureQueryLevels(u_pyramid) - 1;
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, lastLevel);
+
+    ivec2 levelSize = textureSize(u_pyramid, level);
+    ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+    ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+    float farthest = max(max(texelFetch(u_pyramid, texelMin, level).r,
+                             texelFetch(u_pyramid, ivec2(texelMax.x, texelMin.y), level).r),
+                         max(texelFetch(u_pyramid, ivec2(texelMin.x, texelMax.y), level).r,
+                             texelFetch(u_pyramid, texelMax, level).r));
+    return nearest > farthest;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(u_instanceCount))
+        return;
+
+    // World space box of the transformed local bounds (Arvo)
+    mat4 model = instances.matrices[index];
+    vec3 center = (u_boundsMin + u_boundsMax) * 0.5;
+    vec3 halfExtent = (u_boundsMax - u_boundsMin) * 0.5;
+    vec3 worldCenter = vec3(model * vec4(center, 1.0));
+    vec3 worldHalf = abs(mat3(model)[0]) * halfExtent.x + abs(mat3(model)[1]) * halfExtent.y
+                   + abs(mat3(model)[2]) * halfExtent.z;
+    vec3 worldMin = worldCenter - worldHalf;
+    vec3 worldMax = worldCenter + worldHalf;
+
+    bool inFrustum = insideFrustum(worldMin, worldMax);
+    bool wasVisible = visibility.visible[index] != 0u;
+    if (u_phase == 1)
+    {
+        if (inFrustum && wasVisible)
+            keep(index);
+        return;
+    }
+
+    if (!inFrustum)
+    {
+        atomicAdd(stats.frustumCulledCount, 1u);
+        visibility.visible[index] = 0u;
+        return;
+    }
+
+    bool visible = !occluded(worldMin, worldMax);
+    if (visible)
+    {
+        atomicAdd(stats.visibleCount, 1u);
+        // Phase 1 already drew the ones visible last frame
+        if (!wasVisible)
+            keep(index);
+    }
+    else
+    {
+        atomicAdd(stats.occludedCount, 1u);
+    }
+    visibility.visible[index] = visible ? 1u : 0u;
+}
@@ -0,0 +1,50 @@
+#shader compute
+#version 460 core
+layout (local_size_x = 8, local_size_y = 8) in;
+
+// Level 0 copies the depth target, every other level keeps the farthest depth of the level above it
+layout (binding = 0, r32f) readonly uniform image2D sourceLevel;
+layout (binding = 1, r32f) writeonly uniform image2D targetLevel;
+
+uniform sampler2D u_depth;
+uniform int u_level;
+
+void main()
+{
+    ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 targetSize = imageSize(targetLevel);
+    if (coord.x >= targetSize.x || coord.y >= targetSize.y)
+        return;
+
+    if (u_level == 0)
+    {
+        imageStore(targetLevel, coord, vec4(texelFetch(u_depth, coord, 0).r));
+        return;
+    }
+
+    ivec2 sourceSize = imageSize(sourceLevel);
+    ivec2 source = coord * 2;
+    ivec2 last = sourceSize - 1;
+    float farthest = max(max(imageLoad(sourceLevel, min(source, last)).r,
+                             imageLoad(sourceLevel, min(source + ivec2(1, 0), last)).r),
+                         max(imageLoad(sourceLevel, min(source + ivec2(0, 1), last)).r,
+                             imageLoad(sourceLevel, min(source + ivec2(1, 1), last)).r));
+
+    // An odd sized source has a row or column no texel of the smaller level would cover otherwise
+    bool oddX = (sourceSize.x & 1) != 0 && coord.x == targetSize.x - 1;
+    bool oddY = (sourceSize.y & 1) != 0 && coord.y == targetSize.y - 1;
+    if (oddX)
+    {
+        farthest = max(farthest, imageLoad(sourceLevel, min(source + ivec2(2, 0), last)).r);
+        farthest = max(farthest, imageLoad(sourceLevel, min(source + ivec2(2, 1), last)).r);
+    }
+    if (oddY)
+    {
+        farthest = max(farthest, imageLoad(sourceLevel, min(source + ivec2(0, 2), last)).r);
+        farthest = max(farthest, imageLoad(sourceLevel, min(source + ivec2(1, 2), last)).r);
+    }
+    if (oddX && oddY)
+        farthest = max(farthest, imageLoad(sourceLevel, min(source + ivec2(2, 2), last)).r);
+
+    imageStore(targetLevel, coord, vec4(farthest));
+}
@@ -0,0 +1,312 @@
+// ================= LIGHTS =================
+// Shared light structures, shadow lookups and Blinn-Phong lighting.
+// Requires GL_ARB_bindless_texture to be enabled by the including shader.
+//
+// The shader variant system may inject these switches to drop unused light loops
+// and shadow lookups at compile time. Left undefined, everything is enabled.
+#ifndef HAS_DIR_LIGHTS
+#define HAS_DIR_LIGHTS 1
+#endif
+#ifndef HAS_POINT_LIGHTS
+#define HAS_POINT_LIGHTS 1
+#endif
+#ifndef HAS_SPOT_LIGHTS
+#define HAS_SPOT_LIGHTS 1
+#endif
+#ifndef DIR_SHADOWS
+#define DIR_SHADOWS 1
+#endif
+#ifndef POINT_SHADOWS
+#define POINT_SHADOWS 1
+#endif
+#ifndef SPOT_SHADOWS
+#define SPOT_SHADOWS 1
+#endif
+
+// ================= CONSTANTS =================
+const float SHININESS = 32.0;
+
+// ================= LIGHT STRUCTURES =================
+// Shading records only (GpuPointLight/GpuSpotlight/GpuDirLight), the shadow matrices are in the shadow view SSBOs
+struct DirLight {
+    vec3 direction;      float pad0;
+    vec3 ambient;        float pad1;
+    vec3 diffuse;        float pad2;
+    vec3 specular;       float pad3;
+    sampler2DShadow shadowMap;
+    float pad4[2];
+};
+
+struct PointLight {
+    vec3 position;       float constant;
+    vec3 ambient;        float linear;
+    vec3 diffuse;        float quadratic;
+    vec3 specular;       float farPlane;
+    samplerCube shadowMap;
+    float _pad[2];
+};
+
+struct SpotLight {
+    vec3 position;       float cutOff;
+    vec3 direction;      float outerCutOff;
+    vec3 ambient;        float constant;
+    vec3 diffuse;        float linear;
+    vec3 specular;       float quadratic;
+    sampler2DShadow shadowMap;
+    float _pad[2];
+};
+
+// ================= LIGHT SSBOs =================
+layout(std430, binding = 3) readonly buffer PointLights {
+    PointLight lights[];
+} pointLights;
+layout(std430, binding = 4) readonly buffer SpotLights {
+    SpotLight lights[];
+} spotLights;
+layout(std430, binding = 5) readonly buffer DirLights {
+    DirLight lights[];
+} dirLights;
+
+// Light-space matrices by light index, only read for lights with a shadow map
+layout(std430, binding = 7) readonly buffer SpotShadowViews {
+    mat4 views[];
+} spotShadowViews;
+layout(std430, binding = 8) readonly buffer DirShadowViews {
+    mat4 views[];
+} dirShadowViews;
+
+// ================= LIGHT COUNTS =================
+uniform int u_numPointLights;
+uniform int u_numSpotLights;
+uniform int u_numDirLights;
+
+// ================= PCF SAMPLING =================
+const vec2 POISSON_DISK[4] = vec2[](
+vec2(-0.94201624, -0.39906216),
+vec2( 0.94558609, -0.76890725),
+vec2(-0.09418410, -0.92938870),
+vec2( 0.34495938,  0.29387760)
+);
+
+// ================= SHADOW FUNCTIONS =================
+
+// Directional light shadow calculation
+float calcDirShadow(DirLight light, int index, vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    // Lights created without a shadow map have a null handle
+    if (uvec2(light.shadowMap) == uvec2(0))
+    return 0.0;
+
+    // Transform to light space
+    vec4 fragPosLightSpace = dirShadowViews.views[index] * vec4(fragPos, 1.0);
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5; // Convert to [0,1] range
+
+    // Check if outside shadow map
+    if (projCoords.z > 1.0 ||
+    projCoords.x < 0.0 || projCoords.x > 1.0 ||
+    projCoords.y < 0.0 || projCoords.y > 1.0)
+    return 0.0;
+
+    // Calculate bias based on surface angle
+    float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.001);
+    float currentDepth = projCoords.z - bias;
+
+    // PCF sampling for soft shadows
+    float shadow = 0.0;
+    vec2 texelSize = 1.0 / textureSize(light.shadowMap, 0);
+
+    for (int i = 0; i < 4; i++) {
+        vec2 offset = POISSON_DISK[i] * texelSize;
+        shadow += texture(light.shadowMap, vec3(projCoords.xy + offset, currentDepth));
+    }
+
+    return 1.0 - (shadow / 4.0);
+}
+
+// Point light shadow calculation (omnidirectional)
+float calcPointShadow(PointLight light, vec3 fragPos, vec3 normal)
+{
+    // Lights created without a shadow map have a null handle
+    if (uvec2(light.shadowMap) == uvec2(0))
+    return 0.0;
+
+    vec3 fragToLight = fragPos - light.position;
+    float currentDepth = length(fragToLight);
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // Slope-based bias
+    float bias = max(0.005 * (1.0 - dot(normal, lightDir)), 0.0005);
+
+    // Normal offset to prevent shadow acne
+    vec3 samplePos = fragToLight + (normal * 0.15);
+
+    // 3D PCF sampling
+    float shadow = 0.0;
+    float samples = 2.0;
+    float offset = 0.01;
+
+    for (float x = -offset; x <= offset; x += offset / samples) {
+        for (float y = -offset; y <= offset; y += offset / samples) {
+            for (float z = -offset; z <= offset; z += offset / samples) {
+                float closestDepth = texture(light.shadowMap, samplePos + vec3(x, y, z)).r;
+                closestDepth *= light.farPlane; // Convert to linear depth
+                shadow += (currentDepth - bias > closestDepth) ? 1.0 : 0.0;
+            }
+        }
+    }
+
+    float totalSamples = pow(samples * 2.0 + 1.0, 3.0);
+    return shadow / totalSamples;
+}
+
+// Spotlight shadow calculation
+float calcSpotShadow(SpotLight light, int index, vec3 fragPos, vec3 normal, vec3 lightDir)
+{
+    // Lights created without a shadow map have a null handle
+    if (uvec2(light.shadowMap) == uvec2(0))
+    return 0.0;
+
+    // Check if fragment is in spotlight cone
+    vec3 toLight = light.position - fragPos;
+    float theta = dot(normalize(toLight), normalize(-light.direction));
+
+    if (theta < light.outerCutOff)
+    return 1.0; // Fully shadowed (outside cone)
+
+    // Transform to light space
+    vec4 fragPosLightSpace = spotShadowViews.views[index] * vec4(fragPos, 1.0);
+
+    if (fragPosLightSpace.w <= 0.0)
+    return 1.0; // Behind light
+
+    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+
+    projCoords.xy = clamp(projCoords.xy, 0.0, 1.0); // Avoid wrapping
+
+    if (projCoords.z > 1.0)
+    return 1.0; // Outside far plane
+
+    float bias = max(0.002 * (1.0 - dot(normal, lightDir)), 0.0005);
+    float currentDepth = projCoords.z - bias;
+
+    // Hardware PCF
+    return 1.0 - texture(light.shadowMap, vec3(projCoords.xy, currentDepth));
+}
+
+// ================= LIGHTING FUNCTIONS =================
+// Material colors are sampled once by the caller and passed in,
+// instead of being re-sampled for every light.
+
+// Calculate directional light contribution, index is the light's slot in its SSBO
+vec3 calcDirLight(DirLight light, int index, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    vec3 lightDir = normalize(-light.direction);
+
+    // Diffuse component
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Blinn-Phong specular (more efficient than Phong)
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), SHININESS);
+
+    // Lighting components
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+
+    // Apply shadows
+#if DIR_SHADOWS
+    float shadow = calcDirShadow(light, index, fragPos, normal, lightDir);
+#else
+    float shadow = 0.0;
+#endif
+    float visibility = 1.0 - shadow;
+
+    return ambient + visibility * (diffuse + specular);
+}
+
+// Calculate point light contribution
+vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // Diffuse component
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    // Blinn-Phong specular
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), SHININESS);
+
+    // Distance attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant +
+    light.linear * distance +
+    light.quadratic * distance * distance);
+
+    // Lighting components
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+
+    // Apply shadows
+#if POINT_SHADOWS
+    float shadow = calcPointShadow(light, fragPos, normal);
+#else
+    float shadow = 0.0;
+#endif
+    float visibility = 1.0 - shadow;
+
+    return (ambient + visibility * (diffuse + specular)) * attenuation;
+}
+
+// Calculate spotlight contribution
+vec3 calcSpotLight(SpotLight light, int index, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+
+    // Back-face culling
+    float facingLight = max(dot(normal, lightDir), 0.0);
+    if (facingLight <= 0.0)
+    return vec3(0.0);
+
+    // Check spotlight cone
+    vec3 spotDir = normalize(-light.direction);
+    float theta = dot(lightDir, spotDir);
+
+    if (theta < light.outerCutOff)
+    return vec3(0.0);
+
+    // Soft edge between inner and outer cone
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+
+    // Diffuse component
+    float diff = facingLight;
+
+    // Blinn-Phong specular
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), SHININESS);
+
+    // Distance attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant +
+    light.linear * distance +
+    light.quadratic * distance * distance);
+
+    // Lighting components
+    vec3 ambient = light.ambient * diffuseColor;
+    vec3 diffuse = light.diffuse * diff * diffuseColor;
+    vec3 specular = light.specular * spec * specularColor;
+
+    // Apply shadows
+#if SPOT_SHADOWS
+    float shadow = calcSpotShadow(light, index, fragPos, normal, lightDir);
+#else
+    float shadow = 0.0;
+#endif
+    float visibility = 1.0 - shadow;
+
+    return (ambient + visibility * (diffuse + specular)) * attenuation * intensity;
+}
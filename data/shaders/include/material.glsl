@@ -0,0 +1,109 @@
+// ================= MATERIAL =================
+// Shared by every shader that samples mesh materials.
+// Expects the including shader to declare `in vec2 TexCoord` and `in mat3 TBN`.
+//
+// The shader variant system may inject compile-time texture counts.
+// A count of -1 means "not specialized": the per-mesh u_num* uniforms are used instead.
+#ifndef NUM_DIFFUSE_MAPS
+#define NUM_DIFFUSE_MAPS -1
+#endif
+#ifndef NUM_SPECULAR_MAPS
+#define NUM_SPECULAR_MAPS -1
+#endif
+#ifndef NUM_NORMAL_MAPS
+#define NUM_NORMAL_MAPS -1
+#endif
+
+// ================= CONSTANTS =================
+const vec3 MISSING_TEXTURE_COLOR = vec3(1.0, 0.0, 1.0); // Magenta
+const vec3 DEFAULT_SPECULAR_COLOR = vec3(0.5);          // Gray
+
+// ================= TEXTURE SSBOs =================
+layout(std430, binding = 0) readonly buffer DiffuseTextures {
+    sampler2D diffuse[];
+};
+layout(std430, binding = 1) readonly buffer SpecularTextures {
+    sampler2D specular[];
+};
+layout(std430, binding = 2) readonly buffer NormalTextures {
+    sampler2D normal[];
+};
+
+uniform int u_numDiffuse;
+uniform int u_numSpecular;
+uniform int u_numNormal;
+
+#if NUM_DIFFUSE_MAPS >= 0
+#define DIFFUSE_COUNT NUM_DIFFUSE_MAPS
+#else
+#define DIFFUSE_COUNT u_numDiffuse
+#endif
+
+#if NUM_SPECULAR_MAPS >= 0
+#define SPECULAR_COUNT NUM_SPECULAR_MAPS
+#else
+#define SPECULAR_COUNT u_numSpecular
+#endif
+
+#if NUM_NORMAL_MAPS >= 0
+#define NORMAL_COUNT NUM_NORMAL_MAPS
+#else
+#define NORMAL_COUNT u_numNormal
+#endif
+
+// ================= MATERIAL FUNCTIONS =================
+
+// Get normal from normal map or vertex normal
+vec3 getNormal()
+{
+#if NUM_NORMAL_MAPS == 0
+    return normalize(TBN[2]); // Use vertex normal
+#else
+    if (NORMAL_COUNT <= 0)
+    return normalize(TBN[2]); // Use vertex normal
+
+    // Average all normal maps (typically one)
+    vec3 normalMap = vec3(0.0);
+    for (int i = 0; i < NORMAL_COUNT; i++)
+    normalMap += texture(normal[i], TexCoord).rgb;
+
+    normalMap /= float(NORMAL_COUNT);
+    normalMap = normalMap * 2.0 - 1.0; // Convert [0,1] to [-1,1]
+
+    return normalize(TBN * normalMap);
+#endif
+}
+
+// Get diffuse color from texture(s)
+vec3 getDiffuseColor()
+{
+#if NUM_DIFFUSE_MAPS == 0
+    return MISSING_TEXTURE_COLOR; // Error color
+#else
+    if (DIFFUSE_COUNT <= 0)
+    return MISSING_TEXTURE_COLOR; // Error color
+
+    vec3 color = vec3(0.0);
+    for (int i = 0; i < DIFFUSE_COUNT; i++)
+    color += texture(diffuse[i], TexCoord).rgb;
+
+    return color / float(DIFFUSE_COUNT);
+#endif
+}
+
+// Get specular color from texture(s)
+vec3 getSpecularColor()
+{
+#if NUM_SPECULAR_MAPS == 0
+    return DEFAULT_SPECULAR_COLOR; // Default gray
+#else
+    if (SPECULAR_COUNT <= 0)
+    return DEFAULT_SPECULAR_COLOR; // Default gray
+
+    vec3 color = vec3(0.0);
+    for (int i = 0; i < SPECULAR_COUNT; i++)
+    color += texture(specular[i], TexCoord).rgb;
+
+    return color / float(SPECULAR_COUNT);
+#endif
+}
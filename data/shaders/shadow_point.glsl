@@ -16,7 +16,16 @@ void main()
 layout (triangles) in;
 layout (triangle_strip, max_vertices = 18) out;
 
-uniform mat4 shadowMatrices[6];
+struct PointShadowView {
+    mat4 faces[6];
+};
+
+// Cube face view-projections of every point light, indexed by the light's slot
+layout(std430, binding = 6) readonly buffer PointShadowViews {
+    PointShadowView views[];
+} pointShadowViews;
+
+uniform int lightSlot;
 uniform vec3 lightPos;
 
 in vec3 FragPos[];
@@ -31,7 +40,7 @@ void main()
         for (int i = 0; i < 3; ++i)
         {
             GeoFragPos = vec4(FragPos[i].xyz, 1.0);
-            gl_Position = shadowMatrices[face] * GeoFragPos;
+            gl_Position = pointShadowViews.views[lightSlot].faces[face] * GeoFragPos;
             EmitVertex();
         }
         EndPrimitive();
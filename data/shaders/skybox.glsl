@@ -22,6 +22,7 @@ void main()
 // ================= BINDLESS TEXTURES EXTENSION =================
 #extension GL_ARB_bindless_texture : require
 
+// Same layout as DirLight in include/lights.glsl (GpuDirLight)
 struct DirLightComponent
 {
     vec3 direction;
@@ -36,7 +37,6 @@ struct DirLightComponent
     vec3 specular;
     float pad3;
 
-    mat4 lightSpaceMatrix;
     sampler2DShadow shadowMap;
     float pad4[2];
 };
@@ -1,4 +1,6 @@
 #include "Renderer.hpp"
+#include "PerfSuite.hpp"
+#include "Trace.hpp"
 #include <glm/ext.hpp>
 #define SDL_MAIN_USE_CALLBACKS 1
 #include <SDL3/SDL.h>
@@ -21,6 +23,7 @@ struct AppState
 	SDL_Window* window = nullptr;
 	Renderer renderer;
 	Data gameData;
+	string tracePath; // Chrome trace written at quit, empty when not tracing
 	bool initialized = false;
 };
 
@@ -130,6 +133,7 @@ static void setupScene(Renderer& renderer, Data& inGameData)
 	cout << "Number of directional lights: " << inGameData.dirLights.size() << endl;
 }
 
+// Runs on the simulation thread, overlapped with the previous frame's rendering
 static void updateScene(Renderer& renderer, const Data& gameData, const float deltaTime)
 {
 	/*
@@ -147,12 +151,74 @@ static void updateScene(Renderer& renderer, const Data& gameData, const float de
 	dirLight.direction = sunDirection;
 	lightManager.updateDirLight(aux);
 	*/
+}
+
+// --perf-suite [baseline.json] [--update-baseline] [--allow-missing-baseline]: renders the regression matrix in a hidden
+// window and compares it against the baseline, the exit status reports regressions. --update-baseline rewrites the
+// baseline instead. A configuration without a baseline entry fails the run unless --allow-missing-baseline is given,
+// so an empty baseline can't pass having checked nothing.
+static bool runPerfSuite(Renderer& renderer, const string& baselinePath, const bool updateBaseline, const bool allowMissing)
+{
+	PerfBaseline baseline;
+	const bool haveBaseline = ReadPerfBaseline(baselinePath, baseline);
+
+	// Frame times must not be capped by the display
+	SDL_GL_SetSwapInterval(0);
+	PerfSuite suite(PerfSuite::defaultMatrix());
+	suite.run(renderer);
+
+	if(updateBaseline)
+	{
+		suite.report(cout, baseline, {});
+		if(!WritePerfBaseline(baselinePath, baseline, suite.getResults()))
+			return false;
+		cout << "Perf baseline written: " << baselinePath << endl;
+		return true;
+	}
+
+	const vector<PerfRegression> regressions = suite.compare(baseline);
+	suite.report(cout, baseline, regressions);
 
-	renderer.update(deltaTime);
+	const vector<string> missing = suite.missingBaselines(baseline);
+	if(!missing.empty())
+	{
+		cout << missing.size() << " of " << suite.getResults().size() << " configurations have no baseline entry in "
+			<< baselinePath << ", record them with --update-baseline" << (allowMissing ? " (allowed)" : "") << endl;
+		if(!allowMissing)
+			return false;
+	}
+	return haveBaseline && regressions.empty();
 }
 
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 {
+	bool perfSuite = false;
+	bool updateBaseline = false;
+	bool allowMissingBaseline = false;
+	string baselinePath = DATA_DIR "/perf/baseline.json";
+	string scenePath;
+	string tracePath;
+	for(int i = 1; i < argc; ++i)
+	{
+		const string argument = argv[i];
+		if(argument == "--perf-suite")
+			perfSuite = true;
+		else if(argument == "--update-baseline")
+			updateBaseline = true;
+		else if(argument == "--allow-missing-baseline")
+			allowMissingBaseline = true;
+		else if(argument == "--trace" && i + 1 < argc)
+			tracePath = argv[++i];
+		else if(perfSuite)
+			baselinePath = argument;
+		else
+			scenePath = argument;
+	}
+
+	// Recorded from here on, so startup hitches show up too
+	if(!tracePath.empty())
+		Tracing().start();
+
 	// Force NVIDIA GPU on hybrid graphics systems (must be set before SDL_Init)
 	setenv("__NV_PRIME_RENDER_OFFLOAD", "1", 1);
 	setenv("__GLX_VENDOR_LIBRARY_NAME", "nvidia", 1);
@@ -164,7 +230,9 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 	}
 
 	auto* state = new AppState();
-	state->window = SDL_CreateWindow("LearnOpenGL", 1200, 720, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+	state->tracePath = tracePath;
+	const SDL_WindowFlags windowFlags = perfSuite ? SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN : SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
+	state->window = SDL_CreateWindow("LearnOpenGL", 1200, 720, windowFlags);
 
 	if(!state->window)
 	{
@@ -187,7 +255,25 @@ SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 		return SDL_APP_FAILURE;
 	}
 
-	setupScene(state->renderer, state->gameData);
+	if(perfSuite)
+	{
+		// Quits straight away, SDL_AppQuit cleans up
+		*appstate = state;
+		return runPerfSuite(state->renderer, baselinePath, updateBaseline, allowMissingBaseline) ? SDL_APP_SUCCESS : SDL_APP_FAILURE;
+	}
+
+	// A scene file given on the command line replaces the built-in scene
+	if(!scenePath.empty())
+	{
+		if(!state->renderer.loadScene(scenePath))
+			SDL_Log("Failed to load scene: %s", scenePath.c_str());
+	}
+	else
+		setupScene(state->renderer, state->gameData);
+	state->renderer.setSimulationCallback([state](const float deltaTime)
+	{
+		updateScene(state->renderer, state->gameData, deltaTime);
+	});
 	state->initialized = true;
 
 	*appstate = state;
@@ -207,7 +293,7 @@ SDL_AppResult SDL_AppIterate(void* appstate)
 	const float deltaTime = (currentTicks - lastTicks) / 1000.0f;
 	lastTicks = currentTicks;
 
-	updateScene(state->renderer, state->gameData, deltaTime);
+	state->renderer.update(deltaTime);
 	return SDL_APP_CONTINUE;
 }
 
@@ -241,8 +327,16 @@ void SDL_AppQuit(void* appstate, SDL_AppResult /*result*/)
 	if(!appstate)
 		return;
 	auto* state = static_cast<AppState*>(appstate);
+	const string tracePath = state->tracePath;
 	// Renderer destructor handles OpenGL cleanup, window is destroyed here
 	SDL_DestroyWindow(state->window);
 	state->initialized = false; // just in case
 	delete state;
+
+	// After the renderer is gone, so the trace includes shutdown
+	if(!tracePath.empty())
+	{
+		Tracing().stop();
+		Tracing().writeChromeTrace(tracePath);
+	}
 }
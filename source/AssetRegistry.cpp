@@ -0,0 +1,186 @@
+#include "AssetRegistry.hpp"
+#include "Components.hpp"
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+AssetRegistry::AssetRegistry(entt::registry& modelRegistry)
+: registry(modelRegistry)
+{}
+
+string AssetRegistry::canonicalize(const string& fullPath)
+{
+	// weakly_canonical resolves "..", "." and symlinks, and still works for missing files
+	error_code ec;
+	const fs::path canonical = fs::weakly_canonical(fs::path(fullPath), ec);
+	if(ec)
+		return fs::path(fullPath).lexically_normal().generic_string();
+	return canonical.generic_string();
+}
+
+AssetId AssetRegistry::intern(const string& modelPath)
+{
+	if(const auto it = bySpelling.find(modelPath); it != bySpelling.end())
+		return it->second;
+
+	const string canonicalPath = canonicalize(string(DATA_DIR) + "/models/" + modelPath);
+
+	AssetId id;
+	if(const auto it = byCanonical.find(canonicalPath); it != byCanonical.end())
+	{
+		id = it->second;
+	}
+	else
+	{
+		id = static_cast<AssetId>(assets.size());
+		assets.push_back({canonicalPath, modelPath});
+		byCanonical.emplace(canonicalPath, id);
+	}
+
+	bySpelling.emplace(modelPath, id);
+	return id;
+}
+
+AssetId AssetRegistry::acquire(const string& modelPath)
+{
+	const AssetId id = intern(modelPath);
+	acquire(id);
+	return id;
+}
+
+void AssetRegistry::acquire(const AssetId id)
+{
+	if(id >= assets.size())
+		return;
+	load(id);
+	++assets[id].refs;
+}
+
+void AssetRegistry::release(const AssetId id)
+{
+	if(id >= assets.size() || assets[id].refs == 0)
+		return;
+	--assets[id].refs;
+}
+
+entt::entity AssetRegistry::getModelEntity(const AssetId id) const
+{
+	if(id >= assets.size())
+		return entt::null;
+	return assets[id].modelEntity;
+}
+
+entt::entity AssetRegistry::load(const AssetId id)
+{
+	if(id >= assets.size())
+		return entt::null;
+
+	Asset& asset = assets[id];
+	if(asset.modelEntity != entt::null)
+		return asset.modelEntity;
+
+	asset.lastUsedFrame = currentFrame;
+	asset.modelEntity = registry.create();
+	registry.emplace<ModelComponent>(
+		asset.modelEntity,
+		asset.modelPath,
+		Model(asset.canonicalPath)
+	);
+	return asset.modelEntity;
+}
+
+void AssetRegistry::unload(const AssetId id)
+{
+	if(id >= assets.size())
+		return;
+
+	Asset& asset = assets[id];
+	if(asset.modelEntity == entt::null)
+		return;
+
+	// The model goes first, so its instances are destroyed without the swap-and-pop bookkeeping
+	const vector<entt::entity> instances = registry.get<ModelComponent>(asset.modelEntity).instances;
+	registry.destroy(asset.modelEntity);
+	registry.destroy(instances.begin(), instances.end());
+
+	cout << "Model unloaded: " << asset.modelPath << " (" << instances.size() << " instances)" << endl;
+	asset.modelEntity = entt::null;
+	asset.refs = 0;
+}
+
+uint32_t AssetRegistry::unloadUnused()
+{
+	uint32_t unloaded = 0;
+	for(AssetId id = 0; id < assets.size(); ++id)
+	{
+		const Asset& asset = assets[id];
+		if(asset.modelEntity == entt::null || asset.refs > 0)
+			continue;
+		if(!registry.get<ModelComponent>(asset.modelEntity).instances.empty())
+			continue;
+		unload(id);
+		++unloaded;
+	}
+	return unloaded;
+}
+
+void AssetRegistry::markUsed(const uint64_t frame)
+{
+	currentFrame = frame;
+	for(Asset& asset : assets)
+	{
+		if(asset.modelEntity != entt::null && !registry.get<ModelComponent>(asset.modelEntity).instances.empty())
+			asset.lastUsedFrame = frame;
+	}
+}
+
+bool AssetRegistry::evictLeastRecentlyUsed()
+{
+	AssetId oldest = INVALID_ASSET;
+	for(AssetId id = 0; id < assets.size(); ++id)
+	{
+		const Asset& asset = assets[id];
+		if(asset.modelEntity == entt::null || asset.refs > 0 || registry.all_of<OccluderComponent>(asset.modelEntity))
+			continue;
+		if(!registry.get<ModelComponent>(asset.modelEntity).instances.empty())
+			continue;
+		if(oldest == INVALID_ASSET || asset.lastUsedFrame < assets[oldest].lastUsedFrame)
+			oldest = id;
+	}
+	if(oldest == INVALID_ASSET)
+		return false;
+
+	cout << "GPU memory over budget, evicting the least recently used model" << endl;
+	unload(oldest);
+	return true;
+}
+
+void AssetRegistry::report(ostream& out) const
+{
+	constexpr double MB = 1024.0 * 1024.0;
+	MemoryUsage total;
+
+	out << "------------Assets------------" << endl;
+	out << fixed << setprecision(2);
+	for(const Asset& asset : assets)
+	{
+		if(asset.modelEntity == entt::null)
+			continue;
+
+		const auto& modelComp = registry.get<ModelComponent>(asset.modelEntity);
+		MemoryUsage usage = modelComp.model.memoryUsage();
+		usage.cpuBytes += modelComp.instanceMatrices.capacity() * sizeof(mat4)
+						  + modelComp.instances.capacity() * sizeof(entt::entity);
+		total.cpuBytes += usage.cpuBytes;
+		total.gpuBytes += usage.gpuBytes;
+
+		out << "\t" << asset.modelPath << " [" << asset.canonicalPath << "]" << endl;
+		out << "\t\trefs: " << asset.refs << ", instances: " << modelComp.instances.size()
+			<< ", last used in frame " << asset.lastUsedFrame
+			<< ", CPU: " << usage.cpuBytes / MB << " MB, GPU: " << usage.gpuBytes / MB << " MB" << endl;
+	}
+	out << "Total CPU: " << total.cpuBytes / MB << " MB, GPU: " << total.gpuBytes / MB << " MB" << endl;
+	out << defaultfloat << "----------------------------------------" << endl;
+}
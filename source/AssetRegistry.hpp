@@ -0,0 +1,68 @@
+#pragma once
+#include <entt/entity/registry.hpp>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Interned id of a canonicalized asset path
+using AssetId = uint32_t;
+static constexpr AssetId INVALID_ASSET = UINT32_MAX;
+
+// Owns the model resource entities of a registry, keyed by canonical path.
+// Every spelling of a path is resolved once, later lookups are a single hash lookup.
+// A reference keeps a model loaded, instances do not hold references;
+// unloadUnused() drops models that have neither, evictLeastRecentlyUsed() one at a time under memory pressure.
+class AssetRegistry
+{
+public:
+	explicit AssetRegistry(entt::registry& modelRegistry);
+
+	// Path relative to DATA_DIR/models, any spelling of the same file maps to the same id
+	AssetId intern(const string& modelPath);
+
+	// Loads the model on first use and adds a reference
+	AssetId acquire(const string& modelPath);
+	void acquire(AssetId id);
+	void release(AssetId id);
+
+	// Model resource entity of a loaded asset, entt::null when not loaded
+	[[nodiscard]] entt::entity getModelEntity(AssetId id) const;
+	// Loads the model if needed, without adding a reference
+	entt::entity load(AssetId id);
+
+	// Destroys the model and all of its instances, regardless of references
+	void unload(AssetId id);
+	// Unloads every model without references and instances, returns how many
+	uint32_t unloadUnused();
+
+	// Models with instances count as used in this frame
+	void markUsed(uint64_t frame);
+	// Unloads the least recently used model without references, instances or occluder role, false when none is left.
+	// Spawning it again loads it again.
+	bool evictLeastRecentlyUsed();
+
+	// Per asset CPU/GPU memory, references and instances
+	void report(ostream& out) const;
+
+private:
+	struct Asset
+	{
+		string canonicalPath;
+		string modelPath; // first spelling, kept for logs and ModelComponent::path
+		entt::entity modelEntity = entt::null;
+		uint32_t refs = 0;
+		uint64_t lastUsedFrame = 0;
+	};
+
+	static string canonicalize(const string& fullPath);
+
+	entt::registry& registry;
+	vector<Asset> assets;                    // indexed by AssetId
+	unordered_map<string, AssetId> byCanonical;
+	unordered_map<string, AssetId> bySpelling; // raw paths already resolved, skips the filesystem
+	uint64_t currentFrame = 0;
+};
@@ -0,0 +1,94 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cfloat>
+
+using namespace glm;
+
+// Axis aligned bounding box, empty when min > max
+struct AABB
+{
+	vec3 min{FLT_MAX};
+	vec3 max{-FLT_MAX};
+
+	[[nodiscard]] bool empty() const { return min.x > max.x; }
+	[[nodiscard]] vec3 center() const { return (min + max) * 0.5f; }
+	[[nodiscard]] vec3 extent() const { return max - min; }
+
+	[[nodiscard]] float surfaceArea() const
+	{
+		if(empty())
+			return 0.0f;
+		const vec3 e = extent();
+		return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+	}
+
+	void expand(const vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void expand(const AABB& other)
+	{
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	// Bounds of the box after an affine transform (Arvo's method)
+	[[nodiscard]] AABB transformed(const mat4& m) const
+	{
+		if(empty())
+			return {};
+		AABB result;
+		result.min = result.max = vec3(m[3]);
+		for(int axis = 0; axis < 3; ++axis)
+		{
+			const vec3 a = vec3(m[axis]) * min[axis];
+			const vec3 b = vec3(m[axis]) * max[axis];
+			result.min += glm::min(a, b);
+			result.max += glm::max(a, b);
+		}
+		return result;
+	}
+};
+
+// Six planes (xyz = inward normal, w = distance) extracted from a view-projection matrix
+struct Frustum
+{
+	vec4 planes[6];
+
+	static Frustum fromMatrix(const mat4& viewProj)
+	{
+		// Gribb/Hartmann: rows of the matrix combined, glm is column major
+		const vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+		const vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+		const vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+		const vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+		Frustum frustum{};
+		frustum.planes[0] = row3 + row0; // left
+		frustum.planes[1] = row3 - row0; // right
+		frustum.planes[2] = row3 + row1; // bottom
+		frustum.planes[3] = row3 - row1; // top
+		frustum.planes[4] = row3 + row2; // near
+		frustum.planes[5] = row3 - row2; // far
+		for(vec4& plane : frustum.planes)
+			plane /= length(vec3(plane));
+		return frustum;
+	}
+
+	// Conservative: true when the box may be at least partially inside
+	[[nodiscard]] bool intersects(const AABB& box) const
+	{
+		for(const vec4& plane : planes)
+		{
+			// Corner furthest along the plane normal
+			const vec3 p(plane.x >= 0.0f ? box.max.x : box.min.x,
+						 plane.y >= 0.0f ? box.max.y : box.min.y,
+						 plane.z >= 0.0f ? box.max.z : box.min.z);
+			if(dot(vec3(plane), p) + plane.w < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
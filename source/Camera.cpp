@@ -35,19 +35,16 @@ void Camera::update(const float deltaTime)
 	target = eye + front;
 }
 
-void Camera::sync() const
+void Camera::sync(const CameraState& state) const
 {
-	const mat4 proj = getProj();
-	const mat4 view = getView();
-
 	cachedMainShader.use();
-	cachedMainShader.setMat4("projection", proj);
-	cachedMainShader.setMat4("view", view);
-	cachedMainShader.setVec3("viewPos", eye);
+	cachedMainShader.setMat4("projection", state.proj);
+	cachedMainShader.setMat4("view", state.view);
+	cachedMainShader.setVec3("viewPos", state.eye);
 
 	cachedSkyShader.use();
-	cachedSkyShader.setMat4("projection", proj);
-	cachedSkyShader.setMat4("view", mat4(mat3(view))); // Remove translation
+	cachedSkyShader.setMat4("projection", state.proj);
+	cachedSkyShader.setMat4("view", mat4(mat3(state.view))); // Remove translation
 }
 
 mat4 Camera::getView() const
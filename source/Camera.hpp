@@ -4,6 +4,14 @@
 
 using namespace glm;
 
+// Camera matrices as captured for one frame
+struct CameraState
+{
+	mat4 view{1.0f};
+	mat4 proj{1.0f};
+	vec3 eye{0.0f};
+};
+
 class Camera
 {
 public:
@@ -16,12 +24,15 @@ public:
 	void mouse(float xoffset, float yoffset);
 	void update(float deltaTime);
 
-	void sync() const;
+	// Uploads a captured state, so the camera itself can keep moving on another thread
+	void sync(const CameraState& state) const;
 
-private:
 	[[nodiscard]] mat4 getView() const;
 	[[nodiscard]] mat4 getProj() const;
+	[[nodiscard]] const vec3& getEye() const { return eye; }
+	[[nodiscard]] CameraState getState() const { return {getView(), getProj(), eye}; }
 
+private:
 	// motion
 	vec3 eye{0.0f, 0.0f, 3.0f};
 	vec3 target{0.0f, 0.0f, 0.0f};
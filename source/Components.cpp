@@ -1,44 +1,74 @@
 #include "Components.hpp"
 #include <glm/ext.hpp>
+#include <algorithm>
 
 mat4 TransformComponent::bake() const
 {
-	mat4 modelMat(1.0f);
-	modelMat = translate(modelMat, position);
-	modelMat = rotate(modelMat, rotation.x, {1.0f, 0.0f, 0.0f});
-	modelMat = rotate(modelMat, rotation.y, {0.0f, 1.0f, 0.0f});
-	modelMat = rotate(modelMat, rotation.z, {0.0f, 0.0f, 1.0f});
-	modelMat = glm::scale(modelMat, scale);
-	return modelMat;
+	// Closed form of translate * rotateX * rotateY * rotateZ * scale, BakeTransforms uses the same terms
+	const float sa = sin(rotation.x), ca = cos(rotation.x);
+	const float sb = sin(rotation.y), cb = cos(rotation.y);
+	const float sc = sin(rotation.z), cc = cos(rotation.z);
+
+	return {
+		vec4(scale.x * vec3(cb * cc, ca * sc + sa * sb * cc, sa * sc - ca * sb * cc), 0.0f),
+		vec4(scale.y * vec3(-cb * sc, ca * cc - sa * sb * sc, sa * cc + ca * sb * sc), 0.0f),
+		vec4(scale.z * vec3(sb, -sa * cb, ca * cb), 0.0f),
+		vec4(position, 1.0f)
+	};
+}
+
+static void markInstanceDirty(entt::registry& registry, const entt::entity modelEntity, ModelComponent& modelComp,
+							  const uint32_t slot)
+{
+	if(!modelComp.hasDirtyInstances())
+		registry.emplace_or_replace<DirtyInstancesTag>(modelEntity);
+	modelComp.markDirty(slot);
 }
 
 void onInstanceAdded(entt::registry& registry, const entt::entity instanceEnt)
 {
-	auto& [modelEntity] = registry.get<InstanceComponent>(instanceEnt);
+	auto& instanceComp = registry.get<InstanceComponent>(instanceEnt);
 
-	if(!registry.valid(modelEntity))
+	if(!registry.valid(instanceComp.modelEntity))
 		return;
 
-	auto& modelComp = registry.get<ModelComponent>(modelEntity);
+	auto& modelComp = registry.get<ModelComponent>(instanceComp.modelEntity);
 
+	// Append to the pool, the matrix is filled in when the transform is baked
+	instanceComp.slot = static_cast<uint32_t>(modelComp.instances.size());
 	modelComp.instances.push_back(instanceEnt);
+	modelComp.instanceMatrices.emplace_back(1.0f);
+	++modelComp.generation;
+	markInstanceDirty(registry, instanceComp.modelEntity, modelComp, instanceComp.slot);
 }
 
 void onInstanceRemoved(entt::registry& registry, const entt::entity instanceEnt)
 {
 	// The component still exists at this point
-	auto& [modelEntity] = registry.get<InstanceComponent>(instanceEnt);
+	const auto& [modelEntity, slot] = registry.get<InstanceComponent>(instanceEnt);
 
 	if(!registry.valid(modelEntity))
 		return;
 
 	// Check if the ModelComponent still exists before accessing it
-	if(!registry.all_of<ModelComponent>(modelEntity))
+	auto* modelComp = registry.try_get<ModelComponent>(modelEntity);
+	if(!modelComp || slot >= modelComp->instances.size())
 		return;
 
-	auto& instances = registry.get<ModelComponent>(modelEntity).instances;
-
-	erase(instances, instanceEnt);
+	// Swap-and-pop: the last instance takes over the freed slot
+	const auto last = static_cast<uint32_t>(modelComp->instances.size() - 1);
+	if(slot != last)
+	{
+		const entt::entity moved = modelComp->instances[last];
+		modelComp->instances[slot] = moved;
+		modelComp->instanceMatrices[slot] = modelComp->instanceMatrices[last];
+		if(auto* movedInstance = registry.try_get<InstanceComponent>(moved))
+			movedInstance->slot = slot;
+		markInstanceDirty(registry, modelEntity, *modelComp, slot);
+	}
+	modelComp->instances.pop_back();
+	modelComp->instanceMatrices.pop_back();
+	++modelComp->generation;
 }
 
 void setupInstanceTracking(entt::registry& registry)
@@ -50,10 +80,20 @@ void setupInstanceTracking(entt::registry& registry)
 			.connect<&onInstanceRemoved>();
 }
 
-void ModelComponent::drawInstanced(const Shader& shader) const
+void ModelComponent::markDirty(const uint32_t slot)
 {
-	if(instances.empty())
-		return;
-	shader.use();
-	model.drawInstanced(shader, instanceMatrices);
+	dirtyBegin = std::min(dirtyBegin, slot);
+	dirtyEnd = std::max(dirtyEnd, slot + 1);
+}
+
+uint64_t InstanceStructureVersion(const entt::registry& registry)
+{
+	// Every instance add/remove bumps its model's generation, recycled entities carry a new version
+	uint64_t version = 0;
+	for(const auto [entity, modelComp] : registry.view<ModelComponent>().each())
+	{
+		version = version * 1099511628211ull
+				  + (static_cast<uint64_t>(entt::to_integral(entity)) << 32 | modelComp.generation);
+	}
+	return version;
 }
@@ -22,15 +22,23 @@ struct TextureComponent
 	GLuint64 handle; // Bindless texture handle
 	string type;
 	string path;
+	uint32_t streamId = UINT32_MAX; // TextureStreamer stream, id and handle change as it streams
 };
 
 struct InstanceComponent
 {
 	entt::entity modelEntity;
+	uint32_t slot; // Index of this instance in ModelComponent::instanceMatrices
 };
 
+// Keeps every ModelComponent's instance pool in sync with its InstanceComponents
 void setupInstanceTracking(entt::registry& registry);
 
+// Model entities with instance slots that still have to be uploaded
+struct DirtyInstancesTag {};
+
+// Instance pool of a model: slot i holds instances[i] and instanceMatrices[i].
+// Removal moves the last slot into the hole (swap-and-pop), so slots are dense but not stable across removals.
 struct ModelComponent
 {
 	string path;
@@ -38,8 +46,30 @@ struct ModelComponent
 	vector<entt::entity> instances;
 	vector<mat4> instanceMatrices;
 
-	void drawInstanced(const Shader& shader) const;
+	// Bumped on every add/remove, slots cached outside the pool are stale once it changes
+	uint32_t generation = 0;
+
+	// Slots changed since the last upload, [dirtyBegin, dirtyEnd)
+	uint32_t dirtyBegin = UINT32_MAX;
+	uint32_t dirtyEnd = 0;
+
+	void markDirty(uint32_t slot);
+	[[nodiscard]] bool hasDirtyInstances() const { return dirtyBegin < dirtyEnd; }
+	void clearDirty() { dirtyBegin = UINT32_MAX; dirtyEnd = 0; }
+};
+
+// Marks a model whose instances occlude others in the CPU occlusion culling. Keeps a model space copy of its
+// triangles, so designate only low-poly models (walls, floor tiles), see Renderer::setOccluder.
+struct OccluderComponent
+{
+	vector<vec3> positions;
+	vector<uint32_t> indices;
 };
+
+// Changes whenever a model is loaded/unloaded or any instance is added/removed, moves don't change it
+[[nodiscard]] uint64_t InstanceStructureVersion(const entt::registry& registry);
+
+// Light components are CPU-side only, LightManager packs them into the GPU records of Light.hpp
 struct PointLightComponent
 {
 	vec3 position;
@@ -56,7 +86,6 @@ struct PointLightComponent
     
 	std::array<mat4, 6> shadowMatrices;
 	GLuint64 cubeMapHandle; // Bindless handle to samplerCube
-	float _pad[3];
 };
 
 struct SpotlightComponent
@@ -78,26 +107,17 @@ struct SpotlightComponent
     
 	mat4 lightSpaceMatrix;
 	GLuint64 shadowMapHandle; // Bindless handle to sampler2DShadow
-	float _pad[2];
 };
 
 struct DirLightComponent
 {
 	vec3 direction;
-	float _pad0;
-    
 	vec3 ambient;
-	float _pad1;
-    
 	vec3 diffuse;
-	float _pad2;
-    
 	vec3 specular;
-	float _pad3;
     
 	mat4 lightSpaceMatrix;
 	GLuint64 shadowMapHandle; // Bindless handle to sampler2DShadow
-	float _pad4[2];
 };
 struct PointShadowMapComponent
 {
@@ -0,0 +1,328 @@
+#include "DeferredRenderer.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+#include <glm/ext.hpp>
+#include <iostream>
+#include <vector>
+
+// Light types as understood by deferred_light.glsl
+enum DeferredLightType
+{
+	LIGHT_DIR = 0,
+	LIGHT_POINT = 1,
+	LIGHT_SPOT = 2,
+};
+
+// Texture units used for the G-buffer during the lighting and composite passes
+enum GBufferUnit
+{
+	ALBEDO_UNIT = 0,
+	SPECULAR_UNIT = 1,
+	NORMAL_UNIT = 2,
+	DEPTH_UNIT = 3,
+	LIGHT_UNIT = 4,
+};
+
+// Flips triangles so they wind counter-clockwise seen from outside of a convex volume
+static void orientOutward(const vector<vec3>& vertices, vector<GLuint>& indices, const vec3& interiorPoint)
+{
+	for(size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const vec3& a = vertices[indices[i]];
+		const vec3& b = vertices[indices[i + 1]];
+		const vec3& c = vertices[indices[i + 2]];
+		const vec3 faceNormal = cross(b - a, c - a);
+		if(dot(faceNormal, (a + b + c) / 3.0f - interiorPoint) < 0.0f)
+			std::swap(indices[i + 1], indices[i + 2]);
+	}
+}
+
+static void uploadVolume(const vector<vec3>& vertices, const vector<GLuint>& indices, GLuint& vao, GLuint& vbo, GLuint& ebo)
+{
+	glGenVertexArrays(1, &vao);
+	glGenBuffers(1, &vbo);
+	glGenBuffers(1, &ebo);
+
+	GLState().bindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec3), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), nullptr);
+	GLState().bindVertexArray(0);
+
+	RenderCounters().recordBufferUpload(vertices.size() * sizeof(vec3) + indices.size() * sizeof(GLuint));
+	GpuMemory().track(ResidentMemory::Buffer, vbo, GpuMemoryCategory::LightBuffer, vertices.size() * sizeof(vec3));
+	GpuMemory().track(ResidentMemory::Buffer, ebo, GpuMemoryCategory::LightBuffer, indices.size() * sizeof(GLuint));
+}
+
+DeferredRenderer::DeferredRenderer(const Shader& lightShader, const Shader& compositeShader)
+: cachedLightShader(lightShader), cachedCompositeShader(compositeShader)
+{
+	glGenVertexArrays(1, &emptyVAO);
+	createVolumes();
+}
+
+DeferredRenderer::~DeferredRenderer()
+{
+	destroyTargets();
+
+	for(const GLuint vertexArray : {emptyVAO, sphereVAO, coneVAO})
+	{
+		if(vertexArray)
+		{
+			GLState().forgetVertexArray(vertexArray);
+			glDeleteVertexArrays(1, &vertexArray);
+		}
+	}
+	for(const GLuint buffer : {sphereVBO, sphereEBO, coneVBO, coneEBO})
+	{
+		if(buffer)
+		{
+			GpuMemory().untrack(ResidentMemory::Buffer, buffer);
+			glDeleteBuffers(1, &buffer);
+		}
+	}
+}
+
+void DeferredRenderer::resize(const int newWidth, const int newHeight)
+{
+	if(newWidth == width && newHeight == height && gBufferFBO != 0)
+		return;
+
+	// Released at the old size, so the resident memory they were counted with comes back off
+	destroyTargets();
+	width = newWidth;
+	height = newHeight;
+	createTargets();
+}
+
+void DeferredRenderer::beginGeometryPass() const
+{
+	GLState().bindFramebuffer(gBufferFBO);
+	GLState().viewport(0, 0, width, height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void DeferredRenderer::endGeometryPass() const
+{
+	GLState().bindFramebuffer(0);
+}
+
+void DeferredRenderer::lightingPass(const mat4& projection, const mat4& view, const vec3& viewPos,
+									const DeferredLightCounts& counts) const
+{
+	GLState().bindFramebuffer(lightFBO);
+	GLState().viewport(0, 0, width, height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Additive accumulation, every covered pixel is shaded once per light
+	GLState().disable(GL_DEPTH_TEST);
+	GLState().depthMask(GL_FALSE);
+	GLState().enable(GL_BLEND);
+	GLState().blendFunc(GL_ONE, GL_ONE);
+	// Back faces only, so volumes still shade when the camera is inside them
+	GLState().enable(GL_CULL_FACE);
+	GLState().cullFace(GL_FRONT);
+	// Keeps volumes that reach past the far plane from being clipped away
+	GLState().enable(GL_DEPTH_CLAMP);
+
+	cachedLightShader.use();
+	cachedLightShader.setMat4("projection", projection);
+	cachedLightShader.setMat4("view", view);
+	cachedLightShader.setMat4("invViewProj", inverse(projection * view));
+	cachedLightShader.setVec3("viewPos", viewPos);
+	cachedLightShader.setVec2("u_screenSize", vec2(static_cast<float>(width), static_cast<float>(height)));
+	bindGBufferTextures(cachedLightShader);
+
+	if(counts.dirLights > 0)
+	{
+		cachedLightShader.setInt("u_lightType", LIGHT_DIR);
+		GLState().bindVertexArray(emptyVAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 3, static_cast<GLsizei>(counts.dirLights));
+		RenderCounters().recordDraw(counts.dirLights, 1);
+	}
+	if(counts.pointLights > 0)
+	{
+		cachedLightShader.setInt("u_lightType", LIGHT_POINT);
+		GLState().bindVertexArray(sphereVAO);
+		glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, nullptr,
+								static_cast<GLsizei>(counts.pointLights));
+		RenderCounters().recordDraw(counts.pointLights, sphereIndexCount / 3);
+	}
+	if(counts.spotlights > 0)
+	{
+		cachedLightShader.setInt("u_lightType", LIGHT_SPOT);
+		GLState().bindVertexArray(coneVAO);
+		glDrawElementsInstanced(GL_TRIANGLES, coneIndexCount, GL_UNSIGNED_INT, nullptr,
+								static_cast<GLsizei>(counts.spotlights));
+		RenderCounters().recordDraw(counts.spotlights, coneIndexCount / 3);
+	}
+
+	GLState().disable(GL_DEPTH_CLAMP);
+	GLState().cullFace(GL_BACK);
+	GLState().disable(GL_CULL_FACE);
+	GLState().disable(GL_BLEND);
+	GLState().depthMask(GL_TRUE);
+	GLState().enable(GL_DEPTH_TEST);
+	GLState().bindFramebuffer(0);
+}
+
+void DeferredRenderer::composite() const
+{
+	// Depth is written through gl_FragDepth, so the test has to pass everywhere
+	GLState().depthFunc(GL_ALWAYS);
+
+	cachedCompositeShader.use();
+	glActiveTexture(GL_TEXTURE0 + LIGHT_UNIT);
+	glBindTexture(GL_TEXTURE_2D, lightTexture);
+	cachedCompositeShader.setInt("lightBuffer", LIGHT_UNIT);
+	glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	cachedCompositeShader.setInt("gDepth", DEPTH_UNIT);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLState().bindVertexArray(emptyVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	RenderCounters().recordDraw(1, 1);
+
+	GLState().depthFunc(GL_LESS);
+}
+
+void DeferredRenderer::createTargets()
+{
+	auto createTexture = [this](GLuint& texture, const GLenum internalFormat, const uint64_t bytesPerPixel)
+	{
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		GpuMemory().track(ResidentMemory::Texture, texture, GpuMemoryCategory::RenderTarget,
+						  static_cast<uint64_t>(width) * height * bytesPerPixel);
+	};
+
+	createTexture(albedoTexture, GL_RGBA8, 4);
+	createTexture(specularTexture, GL_RGBA8, 4);
+	createTexture(normalTexture, GL_RG16F, 4);
+	createTexture(depthTexture, GL_DEPTH_COMPONENT32F, 4);
+	createTexture(lightTexture, GL_RGBA16F, 8);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &gBufferFBO);
+	GLState().bindFramebuffer(gBufferFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, specularTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, normalTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	constexpr GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+	glDrawBuffers(3, drawBuffers);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "ERROR: G-buffer framebuffer is not complete!" << std::endl;
+
+	glGenFramebuffers(1, &lightFBO);
+	GLState().bindFramebuffer(lightFBO);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "ERROR: Light accumulation framebuffer is not complete!" << std::endl;
+
+	GLState().bindFramebuffer(0);
+}
+
+void DeferredRenderer::destroyTargets()
+{
+	for(const GLuint framebuffer : {gBufferFBO, lightFBO})
+	{
+		if(framebuffer)
+		{
+			GLState().forgetFramebuffer(framebuffer);
+			glDeleteFramebuffers(1, &framebuffer);
+		}
+	}
+
+	const GLuint textures[] = {albedoTexture, specularTexture, normalTexture, depthTexture, lightTexture};
+	for(const GLuint texture : textures)
+	{
+		if(texture)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, texture);
+			glDeleteTextures(1, &texture);
+		}
+	}
+	gBufferFBO = lightFBO = 0;
+	albedoTexture = specularTexture = normalTexture = depthTexture = lightTexture = 0;
+}
+
+void DeferredRenderer::createVolumes()
+{
+	constexpr int slices = 16;
+	constexpr int stacks = 12;
+	const float pi = glm::pi<float>();
+
+	// Scaled so the faceted volumes enclose the true sphere / cone instead of being inscribed in it
+	const float sliceScale = 1.0f / cos(pi / slices);
+	const float sphereScale = sliceScale / cos(pi / (2.0f * stacks));
+
+	// ========== Unit sphere ==========
+	vector<vec3> sphereVertices;
+	vector<GLuint> sphereIndices;
+	for(int i = 0; i <= stacks; ++i)
+	{
+		const float phi = pi * static_cast<float>(i) / stacks;
+		for(int j = 0; j <= slices; ++j)
+		{
+			const float theta = 2.0f * pi * static_cast<float>(j) / slices;
+			sphereVertices.emplace_back(vec3(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta)) * sphereScale);
+		}
+	}
+	for(int i = 0; i < stacks; ++i)
+	{
+		for(int j = 0; j < slices; ++j)
+		{
+			const GLuint a = i * (slices + 1) + j;
+			const GLuint b = a + slices + 1;
+			sphereIndices.insert(sphereIndices.end(), {a, b, a + 1, a + 1, b, b + 1});
+		}
+	}
+	orientOutward(sphereVertices, sphereIndices, vec3(0.0f));
+	uploadVolume(sphereVertices, sphereIndices, sphereVAO, sphereVBO, sphereEBO);
+	sphereIndexCount = static_cast<GLsizei>(sphereIndices.size());
+
+	// ========== Unit cone: apex at the origin, opening along +Z, radius 1 at z = 1 ==========
+	vector<vec3> coneVertices = {vec3(0.0f), vec3(0.0f, 0.0f, 1.0f)};
+	vector<GLuint> coneIndices;
+	for(int j = 0; j < slices; ++j)
+	{
+		const float theta = 2.0f * pi * static_cast<float>(j) / slices;
+		coneVertices.emplace_back(cos(theta) * sliceScale, sin(theta) * sliceScale, 1.0f);
+	}
+	for(int j = 0; j < slices; ++j)
+	{
+		const GLuint current = 2 + j;
+		const GLuint next = 2 + (j + 1) % slices;
+		coneIndices.insert(coneIndices.end(), {0, current, next}); // side
+		coneIndices.insert(coneIndices.end(), {1, next, current}); // cap
+	}
+	orientOutward(coneVertices, coneIndices, vec3(0.0f, 0.0f, 0.5f));
+	uploadVolume(coneVertices, coneIndices, coneVAO, coneVBO, coneEBO);
+	coneIndexCount = static_cast<GLsizei>(coneIndices.size());
+}
+
+void DeferredRenderer::bindGBufferTextures(const Shader& shader) const
+{
+	const GLuint textures[] = {albedoTexture, specularTexture, normalTexture, depthTexture};
+	const char* names[] = {"gAlbedo", "gSpecular", "gNormal", "gDepth"};
+	for(int unit = ALBEDO_UNIT; unit <= DEPTH_UNIT; ++unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, textures[unit]);
+		shader.setInt(names[unit], unit);
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include "Shader.hpp"
+
+using namespace glm;
+
+// Light counts of the scene, one light volume is drawn per light
+struct DeferredLightCounts
+{
+	uint32_t dirLights;
+	uint32_t pointLights;
+	uint32_t spotlights;
+};
+
+// Deferred shading path: a G-buffer pass writes albedo, specular, packed normal and depth,
+// then every light is drawn as a volume (fullscreen triangle, sphere or cone) that shades
+// only the pixels it covers, and a composite pass resolves the result into the default framebuffer.
+class DeferredRenderer
+{
+public:
+	DeferredRenderer(const Shader& lightShader, const Shader& compositeShader);
+	~DeferredRenderer();
+
+	// non-copyable, because of OpenGL resource management
+	DeferredRenderer(const DeferredRenderer&) = delete;
+	DeferredRenderer& operator=(const DeferredRenderer&) = delete;
+
+	// (Re)creates the render targets when the window size changed
+	void resize(int width, int height);
+
+	// Binds and clears the G-buffer, the caller then draws the geometry with the G-buffer shader
+	void beginGeometryPass() const;
+	void endGeometryPass() const;
+
+	// Accumulates all lights into the light buffer
+	void lightingPass(const mat4& projection, const mat4& view, const vec3& viewPos,
+					  const DeferredLightCounts& counts) const;
+
+	// Writes the gamma corrected lighting and the scene depth to the default framebuffer
+	void composite() const;
+
+private:
+	void createTargets();
+	void destroyTargets();
+	void createVolumes();
+	void bindGBufferTextures(const Shader& shader) const;
+
+	int width = 0;
+	int height = 0;
+
+	// G-buffer
+	GLuint gBufferFBO = 0;
+	GLuint albedoTexture = 0;   // RGB diffuse color
+	GLuint specularTexture = 0; // RGB specular color
+	GLuint normalTexture = 0;   // Octahedral packed normal
+	GLuint depthTexture = 0;
+
+	// Light accumulation (linear HDR)
+	GLuint lightFBO = 0;
+	GLuint lightTexture = 0;
+
+	// Light volumes
+	GLuint emptyVAO = 0;
+	GLuint sphereVAO = 0, sphereVBO = 0, sphereEBO = 0;
+	GLuint coneVAO = 0, coneVBO = 0, coneEBO = 0;
+	GLsizei sphereIndexCount = 0;
+	GLsizei coneIndexCount = 0;
+
+	const Shader& cachedLightShader;
+	const Shader& cachedCompositeShader;
+};
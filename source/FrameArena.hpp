@@ -0,0 +1,47 @@
+#pragma once
+#include <type_traits>
+#include <vector>
+#include "JobSystem.hpp"
+
+using namespace std;
+
+// std allocator over a ScratchArena, for containers whose memory is reclaimed all at once when the arena is reset.
+// deallocate does nothing: growing a container leaves its old storage behind until the reset.
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+	using propagate_on_container_copy_assignment = true_type;
+	using propagate_on_container_move_assignment = true_type;
+	using propagate_on_container_swap = true_type;
+
+	explicit ArenaAllocator(ScratchArena& arena) : arena(&arena) {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.getArena()) {}
+
+	T* allocate(const size_t count) { return arena->allocate<T>(count); }
+	void deallocate(T*, size_t) {}
+
+	[[nodiscard]] ScratchArena* getArena() const { return arena; }
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.getArena(); }
+
+private:
+	ScratchArena* arena;
+};
+
+template<typename T>
+using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+// Detaches the vector from its storage before the arena is reset, returns the capacity it had
+// so the same amount can be reserved again from the fresh arena
+template<typename T>
+size_t ReleaseArenaStorage(ArenaVector<T>& values)
+{
+	static_assert(is_trivially_destructible_v<T>, "arena storage is dropped without running destructors");
+	const size_t capacity = values.capacity();
+	values = ArenaVector<T>(values.get_allocator());
+	return capacity;
+}
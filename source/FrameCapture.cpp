@@ -0,0 +1,77 @@
+#include "FrameCapture.hpp"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+Image CaptureFramebuffer(const int width, const int height)
+{
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.rgb.resize(static_cast<size_t>(width) * height * 3);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, image.rgb.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	return image;
+}
+
+bool WritePPM(const string& path, const Image& image)
+{
+	ofstream file(path, ios::binary);
+	if(!file.is_open())
+	{
+		cerr << "Failed to open image for writing: " << path << endl;
+		return false;
+	}
+
+	file << "P6\n" << image.width << " " << image.height << "\n255\n";
+	const size_t rowBytes = static_cast<size_t>(image.width) * 3;
+	for(int y = image.height - 1; y >= 0; --y)
+		file.write(reinterpret_cast<const char*>(image.rgb.data() + y * rowBytes), static_cast<streamsize>(rowBytes));
+	return file.good();
+}
+
+ImageDiffResult DiffImages(const Image& a, const Image& b, const int threshold)
+{
+	ImageDiffResult result;
+	if(a.width != b.width || a.height != b.height || a.rgb.size() != b.rgb.size())
+	{
+		cerr << "Cannot diff images of different sizes" << endl;
+		result.mismatchPercent = 100.0;
+		return result;
+	}
+
+	result.diff.width = a.width;
+	result.diff.height = a.height;
+	result.diff.rgb.resize(a.rgb.size());
+
+	const size_t pixelCount = static_cast<size_t>(a.width) * a.height;
+	double squaredSum = 0.0;
+	size_t mismatches = 0;
+	for(size_t p = 0; p < pixelCount; ++p)
+	{
+		int pixelMax = 0;
+		for(size_t c = 0; c < 3; ++c)
+		{
+			const size_t i = p * 3 + c;
+			const int d = abs(static_cast<int>(a.rgb[i]) - static_cast<int>(b.rgb[i]));
+			squaredSum += static_cast<double>(d) * d;
+			pixelMax = max(pixelMax, d);
+			result.diff.rgb[i] = static_cast<uint8_t>(min(d * 4, 255));
+		}
+		result.maxChannelDiff = max(result.maxChannelDiff, pixelMax);
+		if(pixelMax > threshold)
+			++mismatches;
+	}
+
+	if(pixelCount > 0)
+	{
+		result.rmse = sqrt(squaredSum / static_cast<double>(pixelCount * 3));
+		result.mismatchPercent = 100.0 * static_cast<double>(mismatches) / static_cast<double>(pixelCount);
+	}
+	return result;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// 8-bit RGB image, rows stored bottom-up like glReadPixels returns them
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	vector<uint8_t> rgb;
+};
+
+struct ImageDiffResult
+{
+	double rmse = 0.0;            // Root mean square error over all channels, in 0-255 units
+	int maxChannelDiff = 0;       // Largest absolute difference of a single channel
+	double mismatchPercent = 0.0; // Pixels with any channel off by more than the threshold
+	Image diff;                   // Per-pixel absolute difference, amplified for visibility
+};
+
+// Reads back the currently bound read framebuffer (multisampled default framebuffers are resolved)
+Image CaptureFramebuffer(int width, int height);
+
+// Binary PPM (P6), written top-down so any image viewer shows it upright
+bool WritePPM(const string& path, const Image& image);
+
+ImageDiffResult DiffImages(const Image& a, const Image& b, int threshold = 8);
@@ -0,0 +1,32 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// Non-owning reference to a callable, for callbacks that are only invoked while the call they are passed to runs.
+// Never allocates, unlike std::function, but the callable must outlive every call through it.
+template<typename Signature>
+class FunctionRef;
+
+template<typename Result, typename... Args>
+class FunctionRef<Result(Args...)>
+{
+public:
+	template<typename Callable>
+		requires (!std::is_same_v<std::remove_cvref_t<Callable>, FunctionRef> && std::is_invocable_r_v<Result, Callable&, Args...>)
+	FunctionRef(Callable&& callable)
+	: object(const_cast<void*>(static_cast<const void*>(std::addressof(callable)))),
+	  invoker([](void* target, Args... args) -> Result
+	  {
+		  return std::invoke(*static_cast<std::remove_reference_t<Callable>*>(target), std::forward<Args>(args)...);
+	  })
+	{
+	}
+
+	Result operator()(Args... args) const { return invoker(object, std::forward<Args>(args)...); }
+
+private:
+	void* object;
+	Result (*invoker)(void*, Args...);
+};
@@ -0,0 +1,265 @@
+#include "GLStateCache.hpp"
+#include <iomanip>
+#include <limits>
+
+// Size recorded for glBindBufferBase, the whole buffer
+static constexpr GLsizeiptr WHOLE_BUFFER = -1;
+
+GLStateCache::GLStateCache()
+{
+	invalidate();
+}
+
+void GLStateCache::useProgram(const GLuint newProgram)
+{
+	if(filter(State::Program, program == newProgram))
+		return;
+	program = newProgram;
+	glUseProgram(newProgram);
+}
+
+void GLStateCache::bindVertexArray(const GLuint newVertexArray)
+{
+	if(filter(State::VertexArray, vertexArray == newVertexArray))
+		return;
+	vertexArray = newVertexArray;
+	glBindVertexArray(newVertexArray);
+}
+
+void GLStateCache::bindBufferBase(const GLuint index, const GLuint buffer)
+{
+	if(index >= BUFFER_BINDINGS)
+	{
+		filter(State::BufferBinding, false);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer);
+		return;
+	}
+
+	BufferRange& binding = bufferBindings[index];
+	if(filter(State::BufferBinding, binding.buffer == buffer && binding.size == WHOLE_BUFFER))
+		return;
+	binding = {buffer, 0, WHOLE_BUFFER};
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer);
+}
+
+void GLStateCache::bindBufferRange(const GLuint index, const GLuint buffer, const GLintptr offset, const GLsizeiptr size)
+{
+	if(index >= BUFFER_BINDINGS)
+	{
+		filter(State::BufferBinding, false);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, buffer, offset, size);
+		return;
+	}
+
+	BufferRange& binding = bufferBindings[index];
+	if(filter(State::BufferBinding, binding.buffer == buffer && binding.offset == offset && binding.size == size))
+		return;
+	binding = {buffer, offset, size};
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, buffer, offset, size);
+}
+
+void GLStateCache::bindFramebuffer(const GLuint newFramebuffer)
+{
+	if(filter(State::Framebuffer, framebuffer == newFramebuffer))
+		return;
+	framebuffer = newFramebuffer;
+	glBindFramebuffer(GL_FRAMEBUFFER, newFramebuffer);
+}
+
+void GLStateCache::viewport(const GLint x, const GLint y, const GLsizei width, const GLsizei height)
+{
+	const array<GLint, 4> rect{x, y, width, height};
+	if(filter(State::Viewport, viewportRect == rect))
+		return;
+	viewportRect = rect;
+	glViewport(x, y, width, height);
+}
+
+void GLStateCache::enable(const GLenum capability)
+{
+	setCapability(capability, true);
+}
+
+void GLStateCache::disable(const GLenum capability)
+{
+	setCapability(capability, false);
+}
+
+void GLStateCache::depthFunc(const GLenum func)
+{
+	if(filter(State::DepthFunc, depthFunction == func))
+		return;
+	depthFunction = func;
+	glDepthFunc(func);
+}
+
+void GLStateCache::depthMask(const GLboolean mask)
+{
+	const int8_t writes = mask ? 1 : 0;
+	if(filter(State::DepthMask, depthWrites == writes))
+		return;
+	depthWrites = writes;
+	glDepthMask(mask);
+}
+
+void GLStateCache::cullFace(const GLenum face)
+{
+	if(filter(State::CullFace, cullFaceMode == face))
+		return;
+	cullFaceMode = face;
+	glCullFace(face);
+}
+
+void GLStateCache::blendFunc(const GLenum source, const GLenum destination)
+{
+	const array<GLenum, 2> factors{source, destination};
+	if(filter(State::BlendFunc, blendFactors == factors))
+		return;
+	blendFactors = factors;
+	glBlendFunc(source, destination);
+}
+
+void GLStateCache::polygonOffset(const float factor, const float units)
+{
+	if(filter(State::PolygonOffset, polygonOffsets[0] == factor && polygonOffsets[1] == units))
+		return;
+	polygonOffsets = {factor, units};
+	glPolygonOffset(factor, units);
+}
+
+void GLStateCache::colorMask(const GLboolean red, const GLboolean green, const GLboolean blue, const GLboolean alpha)
+{
+	const auto writes = static_cast<int8_t>((red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0));
+	if(filter(State::ColorMask, colorWrites == writes))
+		return;
+	colorWrites = writes;
+	glColorMask(red, green, blue, alpha);
+}
+
+void GLStateCache::forgetProgram(const GLuint deleted)
+{
+	if(program == deleted)
+		program = UNKNOWN;
+}
+
+void GLStateCache::forgetVertexArray(const GLuint deleted)
+{
+	if(vertexArray == deleted)
+		vertexArray = UNKNOWN;
+}
+
+void GLStateCache::forgetBuffer(const GLuint deleted)
+{
+	for(BufferRange& binding : bufferBindings)
+	{
+		if(binding.buffer == deleted)
+			binding.buffer = UNKNOWN;
+	}
+}
+
+void GLStateCache::forgetFramebuffer(const GLuint deleted)
+{
+	if(framebuffer == deleted)
+		framebuffer = UNKNOWN;
+}
+
+void GLStateCache::invalidate()
+{
+	program = UNKNOWN;
+	vertexArray = UNKNOWN;
+	framebuffer = UNKNOWN;
+	bufferBindings.fill({UNKNOWN, 0, 0});
+	// A width of -1 is never set
+	viewportRect.fill(-1);
+	capabilities.fill(-1);
+	depthFunction = UNKNOWN;
+	depthWrites = -1;
+	cullFaceMode = UNKNOWN;
+	blendFactors.fill(UNKNOWN);
+	polygonOffsets.fill(numeric_limits<float>::quiet_NaN());
+	colorWrites = -1;
+}
+
+void GLStateCache::beginFrame()
+{
+	lastFrame = counters;
+	counters = {};
+}
+
+void GLStateCache::report(ostream& out) const
+{
+	out << "------------GL state calls (last frame)------------" << endl;
+	uint32_t issued = 0;
+	uint32_t filtered = 0;
+	for(size_t state = 0; state < STATE_COUNT; ++state)
+	{
+		const Counter& counter = lastFrame[state];
+		issued += counter.issued;
+		filtered += counter.filtered;
+		if(counter.issued + counter.filtered == 0)
+			continue;
+		out << "\t" << left << setw(16) << stateName(static_cast<State>(state)) << right
+			<< " issued " << setw(6) << counter.issued
+			<< "  filtered " << setw(6) << counter.filtered << endl;
+	}
+	const uint32_t total = issued + filtered;
+	out << "Issued " << issued << " of " << total << " calls";
+	if(total > 0)
+		out << " (" << fixed << setprecision(1) << 100.0 * filtered / total << defaultfloat << "% filtered)";
+	out << endl << "----------------------------------------" << endl;
+}
+
+const char* GLStateCache::stateName(const State state)
+{
+	static constexpr const char* NAMES[STATE_COUNT] = {
+		"program", "vertex_array", "buffer_binding", "framebuffer", "viewport", "capability",
+		"depth_func", "depth_mask", "cull_face", "blend_func", "polygon_offset", "color_mask"
+	};
+	return NAMES[static_cast<size_t>(state)];
+}
+
+bool GLStateCache::filter(const State state, const bool redundant)
+{
+	Counter& counter = counters[static_cast<size_t>(state)];
+	if(redundant)
+	{
+		++counter.filtered;
+		return true;
+	}
+	++counter.issued;
+	return false;
+}
+
+void GLStateCache::setCapability(const GLenum capability, const bool enabled)
+{
+	const int index = capabilityIndex(capability);
+	const int8_t value = enabled ? 1 : 0;
+	if(filter(State::Capability, index >= 0 && capabilities[index] == value))
+		return;
+	if(index >= 0)
+		capabilities[index] = value;
+	if(enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+int GLStateCache::capabilityIndex(const GLenum capability)
+{
+	switch(capability)
+	{
+		case GL_DEPTH_TEST: return 0;
+		case GL_CULL_FACE: return 1;
+		case GL_BLEND: return 2;
+		case GL_POLYGON_OFFSET_FILL: return 3;
+		case GL_DEPTH_CLAMP: return 4;
+		case GL_MULTISAMPLE: return 5;
+		default: return -1;
+	}
+}
+
+GLStateCache& GLState()
+{
+	static GLStateCache cache;
+	return cache;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <glad/glad.h>
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+// Shadow copy of the GL state the renderer changes per pass and per draw. A call setting what is already set
+// is dropped and counted, so the savings can be read per frame. Everything changing these states has to go
+// through here (or call invalidate() afterwards), otherwise the cache would drop a call that is needed.
+// GL thread only.
+class GLStateCache
+{
+public:
+	enum class State : uint8_t
+	{
+		Program,
+		VertexArray,
+		BufferBinding, // indexed shader storage bindings
+		Framebuffer,
+		Viewport,
+		Capability,    // glEnable / glDisable
+		DepthFunc,
+		DepthMask,
+		CullFace,
+		BlendFunc,
+		PolygonOffset,
+		ColorMask,
+		Count,
+	};
+
+	static constexpr size_t STATE_COUNT = static_cast<size_t>(State::Count);
+
+	struct Counter
+	{
+		uint32_t issued = 0;
+		uint32_t filtered = 0;
+	};
+	using Counters = array<Counter, STATE_COUNT>;
+
+	GLStateCache();
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vertexArray);
+	void bindBufferBase(GLuint index, GLuint buffer);
+	void bindBufferRange(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+	void bindFramebuffer(GLuint framebuffer);
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+	// Capabilities outside the cached set are passed through and counted as issued
+	void enable(GLenum capability);
+	void disable(GLenum capability);
+	void depthFunc(GLenum func);
+	void depthMask(GLboolean mask);
+	void cullFace(GLenum face);
+	void blendFunc(GLenum source, GLenum destination);
+	void polygonOffset(float factor, float units);
+	void colorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha);
+
+	// GL unbinds objects deleted while bound and reuses their names, so deleting has to be reported
+	void forgetProgram(GLuint program);
+	void forgetVertexArray(GLuint vertexArray);
+	void forgetBuffer(GLuint buffer);
+	void forgetFramebuffer(GLuint framebuffer);
+
+	// Everything unknown, the next call of every kind is issued
+	void invalidate();
+
+	// Moves the counters of the frame that just ended to getLastFrame()
+	void beginFrame();
+	[[nodiscard]] const Counters& getLastFrame() const { return lastFrame; }
+	[[nodiscard]] const Counters& getCurrentFrame() const { return counters; }
+	void report(ostream& out) const;
+
+	[[nodiscard]] static const char* stateName(State state);
+
+private:
+	struct BufferRange
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	static constexpr GLuint UNKNOWN = ~0u;
+	static constexpr size_t BUFFER_BINDINGS = 16;
+	// DEPTH_TEST, CULL_FACE, BLEND, POLYGON_OFFSET_FILL, DEPTH_CLAMP, MULTISAMPLE
+	static constexpr size_t CAPABILITY_COUNT = 6;
+
+	// Counts the call, true when it is redundant and must not be issued
+	bool filter(State state, bool redundant);
+	void setCapability(GLenum capability, bool enabled);
+	[[nodiscard]] static int capabilityIndex(GLenum capability);
+
+	GLuint program = UNKNOWN;
+	GLuint vertexArray = UNKNOWN;
+	GLuint framebuffer = UNKNOWN;
+	array<BufferRange, BUFFER_BINDINGS> bufferBindings{};
+	array<GLint, 4> viewportRect{};
+	array<int8_t, CAPABILITY_COUNT> capabilities{}; // -1 unknown, 0 disabled, 1 enabled
+	GLenum depthFunction = UNKNOWN;
+	int8_t depthWrites = -1;
+	GLenum cullFaceMode = UNKNOWN;
+	array<GLenum, 2> blendFactors{};
+	// NaN while unknown, it never compares equal
+	array<float, 2> polygonOffsets{};
+	int8_t colorWrites = -1; // four bits, one per channel
+
+	Counters counters{};
+	Counters lastFrame{};
+};
+
+// The cache of the GL context, every call has to be made on the thread owning it
+GLStateCache& GLState();
@@ -0,0 +1,122 @@
+#include "GpuMemory.hpp"
+#include <algorithm>
+#include <iomanip>
+
+GpuMemoryTracker::GpuMemoryTracker()
+{
+	registerOwner("renderer");
+}
+
+GpuMemoryOwner GpuMemoryTracker::registerOwner(const string& label)
+{
+	if(const auto it = ownerIds.find(label); it != ownerIds.end())
+		return it->second;
+
+	const auto owner = static_cast<GpuMemoryOwner>(owners.size());
+	owners.push_back({label});
+	ownerIds.emplace(label, owner);
+	return owner;
+}
+
+void GpuMemoryTracker::track(const ResidentMemory kind, const GLuint name, const GpuMemoryCategory category, const uint64_t bytes)
+{
+	track(kind, name, category, bytes, activeOwner);
+}
+
+void GpuMemoryTracker::track(const ResidentMemory kind, const GLuint name, const GpuMemoryCategory category,
+							 const uint64_t bytes, const GpuMemoryOwner owner)
+{
+	if(name == 0)
+		return;
+
+	untrack(kind, name);
+	allocations.emplace(key(kind, name), Allocation{category, owner, bytes});
+	categories[static_cast<size_t>(category)] += bytes;
+	owners[owner].bytes += bytes;
+	++owners[owner].allocations;
+	total += bytes;
+	RenderCounters().addResident(kind, bytes);
+}
+
+void GpuMemoryTracker::untrack(const ResidentMemory kind, const GLuint name)
+{
+	const auto it = allocations.find(key(kind, name));
+	if(it == allocations.end())
+		return;
+
+	const Allocation& allocation = it->second;
+	categories[static_cast<size_t>(allocation.category)] -= allocation.bytes;
+	owners[allocation.owner].bytes -= allocation.bytes;
+	--owners[allocation.owner].allocations;
+	total -= allocation.bytes;
+	RenderCounters().removeResident(kind, allocation.bytes);
+	allocations.erase(it);
+}
+
+void GpuMemoryTracker::report(ostream& out) const
+{
+	constexpr double MB = 1024.0 * 1024.0;
+	out << "------------GPU memory------------" << endl;
+	out << fixed << setprecision(2);
+	out << "Total: " << static_cast<double>(total) / MB << " MB of a " << static_cast<double>(budget) / MB
+		<< " MB budget in " << allocations.size() << " allocations" << endl;
+	for(size_t category = 0; category < categories.size(); ++category)
+	{
+		if(categories[category] == 0)
+			continue;
+		out << "\t" << left << setw(16) << categoryName(static_cast<GpuMemoryCategory>(category)) << right
+			<< setw(10) << static_cast<double>(categories[category]) / MB << " MB" << endl;
+	}
+
+	vector<GpuMemoryOwner> largest;
+	for(GpuMemoryOwner owner = 0; owner < owners.size(); ++owner)
+	{
+		if(owners[owner].allocations > 0)
+			largest.push_back(owner);
+	}
+	ranges::sort(largest, [this](const GpuMemoryOwner a, const GpuMemoryOwner b)
+	{
+		return owners[a].bytes > owners[b].bytes;
+	});
+	out << "Largest owners:" << endl;
+	for(size_t i = 0; i < std::min(largest.size(), REPORTED_OWNERS); ++i)
+	{
+		const OwnerUsage& usage = owners[largest[i]];
+		out << "\t" << setw(10) << static_cast<double>(usage.bytes) / MB << " MB in " << usage.allocations
+			<< " allocations: " << usage.label << endl;
+	}
+	out << defaultfloat << "----------------------------------------" << endl;
+}
+
+const char* GpuMemoryTracker::categoryName(const GpuMemoryCategory category)
+{
+	switch(category)
+	{
+		case GpuMemoryCategory::ModelTexture: return "model textures";
+		case GpuMemoryCategory::ModelBuffer: return "mesh buffers";
+		case GpuMemoryCategory::InstanceBuffer: return "instances";
+		case GpuMemoryCategory::ShadowMap: return "shadow maps";
+		case GpuMemoryCategory::RenderTarget: return "render targets";
+		case GpuMemoryCategory::LightBuffer: return "lights";
+		case GpuMemoryCategory::Skybox: return "skybox";
+		case GpuMemoryCategory::Culling: return "culling";
+		default: return "unknown";
+	}
+}
+
+GpuMemoryOwnerScope::GpuMemoryOwnerScope(const GpuMemoryOwner owner)
+: previous(GpuMemory().activeOwner)
+{
+	GpuMemory().activeOwner = owner;
+}
+
+GpuMemoryOwnerScope::~GpuMemoryOwnerScope()
+{
+	GpuMemory().activeOwner = previous;
+}
+
+GpuMemoryTracker& GpuMemory()
+{
+	static GpuMemoryTracker tracker;
+	return tracker;
+}
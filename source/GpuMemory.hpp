@@ -0,0 +1,109 @@
+#pragma once
+#include <glad/glad.h>
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "RenderStats.hpp"
+
+using namespace std;
+
+enum class GpuMemoryCategory : uint8_t
+{
+	ModelTexture,
+	ModelBuffer,    // mesh vertices, indices and bindless handle SSBOs
+	InstanceBuffer,
+	ShadowMap,
+	RenderTarget,   // G-buffer and Hi-Z targets
+	LightBuffer,    // light SSBOs and deferred light volumes
+	Skybox,
+	Culling,        // Hi-Z indirect commands and counts
+	Count,
+};
+
+// Interned label of whoever allocated, a model path or a renderer subsystem
+using GpuMemoryOwner = uint32_t;
+
+// Every GL buffer and texture the renderer allocates, keyed by name, with its category, owner and size.
+// Tracking an already tracked name replaces its entry, so a resize is a single track(). The resident totals of
+// RenderCounters() are kept from here. GL thread only, see GpuMemory().
+class GpuMemoryTracker
+{
+public:
+	struct OwnerUsage
+	{
+		string label;
+		uint64_t bytes = 0;
+		uint32_t allocations = 0;
+	};
+
+	GpuMemoryTracker();
+
+	// Same label, same owner
+	GpuMemoryOwner registerOwner(const string& label);
+	// Owner of allocations tracked without one, see GpuMemoryOwnerScope
+	[[nodiscard]] GpuMemoryOwner currentOwner() const { return activeOwner; }
+
+	void track(ResidentMemory kind, GLuint name, GpuMemoryCategory category, uint64_t bytes);
+	void track(ResidentMemory kind, GLuint name, GpuMemoryCategory category, uint64_t bytes, GpuMemoryOwner owner);
+	// Before the name is deleted, untracked names are ignored
+	void untrack(ResidentMemory kind, GLuint name);
+
+	[[nodiscard]] uint64_t totalBytes() const { return total; }
+	[[nodiscard]] uint64_t categoryBytes(GpuMemoryCategory category) const { return categories[static_cast<size_t>(category)]; }
+	[[nodiscard]] uint64_t ownerBytes(GpuMemoryOwner owner) const { return owner < owners.size() ? owners[owner].bytes : 0; }
+	[[nodiscard]] const vector<OwnerUsage>& getOwners() const { return owners; }
+
+	// Above it unused models are evicted, see AssetRegistry::evictLeastRecentlyUsed()
+	void setBudget(uint64_t bytes) { budget = bytes; }
+	[[nodiscard]] uint64_t getBudget() const { return budget; }
+	[[nodiscard]] bool overBudget() const { return total > budget; }
+
+	// Totals per category, then the largest owners
+	void report(ostream& out) const;
+
+	[[nodiscard]] static const char* categoryName(GpuMemoryCategory category);
+
+	static constexpr GpuMemoryOwner RENDERER = 0;
+	static constexpr uint64_t DEFAULT_BUDGET = 2ull << 30;
+	static constexpr size_t REPORTED_OWNERS = 16;
+
+private:
+	friend class GpuMemoryOwnerScope;
+
+	struct Allocation
+	{
+		GpuMemoryCategory category;
+		GpuMemoryOwner owner;
+		uint64_t bytes;
+	};
+
+	static uint64_t key(const ResidentMemory kind, const GLuint name) { return static_cast<uint64_t>(kind) << 32 | name; }
+
+	unordered_map<uint64_t, Allocation> allocations;
+	unordered_map<string, GpuMemoryOwner> ownerIds;
+	vector<OwnerUsage> owners; // indexed by GpuMemoryOwner
+	array<uint64_t, static_cast<size_t>(GpuMemoryCategory::Count)> categories{};
+	uint64_t total = 0;
+	uint64_t budget = DEFAULT_BUDGET;
+	GpuMemoryOwner activeOwner = RENDERER;
+};
+
+// Allocations tracked without an owner while it lives belong to the given one
+class GpuMemoryOwnerScope
+{
+public:
+	explicit GpuMemoryOwnerScope(GpuMemoryOwner owner);
+	~GpuMemoryOwnerScope();
+
+	GpuMemoryOwnerScope(const GpuMemoryOwnerScope&) = delete;
+	GpuMemoryOwnerScope& operator=(const GpuMemoryOwnerScope&) = delete;
+
+private:
+	GpuMemoryOwner previous;
+};
+
+// The GPU memory tracker of the GL context, used by the thread owning it
+GpuMemoryTracker& GpuMemory();
@@ -0,0 +1,270 @@
+#include "GpuProfiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include "Trace.hpp"
+
+static double secondsSinceEpoch()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+GpuProfiler::GpuProfiler()
+{
+	// Timer queries are core since 3.3, but some drivers still report a 0-bit counter
+	if(GLAD_GL_VERSION_3_3 || GLAD_GL_ARB_timer_query)
+	{
+		GLint counterBits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &counterBits);
+		isSupported = counterBits > 0;
+	}
+
+	if(!isSupported)
+		cout << "GPU profiler: timer queries not supported, GPU pass timings are disabled" << endl;
+
+	lastDump = secondsSinceEpoch();
+}
+
+GpuProfiler::~GpuProfiler()
+{
+	for(Frame& frame : frames)
+	{
+		for(const PendingScope& scope : frame.scopes)
+		{
+			frame.freeQueries.push_back(scope.beginQuery);
+			frame.freeQueries.push_back(scope.endQuery);
+		}
+		if(!frame.freeQueries.empty())
+			glDeleteQueries(static_cast<GLsizei>(frame.freeQueries.size()), frame.freeQueries.data());
+	}
+}
+
+void GpuProfiler::beginFrame()
+{
+	if(!enabled())
+		return;
+
+	frameIndex = (frameIndex + 1) % FRAMES_IN_FLIGHT;
+	Frame& frame = frames[frameIndex];
+	if(frame.recorded)
+		harvest(frame);
+
+	frame.scopes.clear();
+	frame.recorded = false;
+	openScopes.clear();
+
+	// Maps the frame's timestamps onto the trace clock, off by the submission latency of the queries at most
+	frame.traced = false;
+#if LEARNOPENGL_TRACING
+	if(Tracing().active())
+	{
+		GLint64 gpuNow = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		frame.traceClockOffsetNs = static_cast<int64_t>(Tracer::now()) - gpuNow;
+		frame.traced = true;
+	}
+#endif
+}
+
+void GpuProfiler::endFrame()
+{
+	if(!enabled())
+		return;
+
+	// Close anything left open so the frame's queries are always paired
+	while(!openScopes.empty())
+		endScope();
+
+	frames[frameIndex].recorded = true;
+
+	if(dumpInterval > 0.0)
+	{
+		const double now = secondsSinceEpoch();
+		if(now - lastDump >= dumpInterval)
+		{
+			dump(now);
+			lastDump = now;
+		}
+	}
+}
+
+void GpuProfiler::beginScope(const string_view name)
+{
+	if(!enabled())
+		return;
+
+	Frame& frame = frames[frameIndex];
+	PendingScope scope{internName(name), acquireQuery(frame), 0};
+	glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+
+	openScopes.push_back(frame.scopes.size());
+	frame.scopes.push_back(scope);
+}
+
+void GpuProfiler::endScope()
+{
+	if(!enabled() || openScopes.empty())
+		return;
+
+	Frame& frame = frames[frameIndex];
+	PendingScope& scope = frame.scopes[openScopes.back()];
+	openScopes.pop_back();
+
+	scope.endQuery = acquireQuery(frame);
+	glQueryCounter(scope.endQuery, GL_TIMESTAMP);
+}
+
+vector<GpuProfiler::ScopeStats> GpuProfiler::getStats() const
+{
+	vector<ScopeStats> result;
+	result.reserve(histories.size());
+	for(const History& history : histories)
+		if(!history.samplesMs.empty())
+			result.push_back(computeStats(history));
+
+	ranges::sort(result, [](const ScopeStats& a, const ScopeStats& b)
+	{
+		return a.avgMs > b.avgMs;
+	});
+	return result;
+}
+
+bool GpuProfiler::getStats(const string& name, ScopeStats& out) const
+{
+	const auto it = nameIndices.find(name);
+	if(it == nameIndices.end() || histories[it->second].samplesMs.empty())
+		return false;
+	out = computeStats(histories[it->second]);
+	return true;
+}
+
+void GpuProfiler::report(ostream& out) const
+{
+	out << "------------GPU pass timings (ms)------------" << endl;
+	if(!supported())
+	{
+		out << "Timer queries not supported by the driver" << endl;
+		return;
+	}
+	out << fixed << setprecision(3);
+	for(const ScopeStats& stats : getStats())
+		out << "\t" << left << setw(24) << stats.name << right
+			<< " min " << setw(7) << stats.minMs
+			<< "  avg " << setw(7) << stats.avgMs
+			<< "  p99 " << setw(7) << stats.p99Ms
+			<< "  (" << stats.samples << " frames)" << endl;
+	out << defaultfloat << "----------------------------------------" << endl;
+}
+
+void GpuProfiler::setCsvPath(const string& path)
+{
+	csv.close();
+	if(path.empty())
+		return;
+
+	csv.open(path, ios::out | ios::trunc);
+	if(!csv.is_open())
+	{
+		cerr << "GPU profiler: failed to open CSV file: " << path << endl;
+		return;
+	}
+	csv << "time_s,scope,min_ms,avg_ms,p99_ms,last_ms,samples\n";
+}
+
+GLuint GpuProfiler::acquireQuery(Frame& frame)
+{
+	if(frame.freeQueries.empty())
+	{
+		GLuint query = 0;
+		glGenQueries(1, &query);
+		return query;
+	}
+	const GLuint query = frame.freeQueries.back();
+	frame.freeQueries.pop_back();
+	return query;
+}
+
+bool GpuProfiler::harvest(Frame& frame)
+{
+	bool complete = true;
+	if(!frame.scopes.empty())
+	{
+		// Timestamps resolve in submission order, so the last one being ready means all are
+		GLint available = 0;
+		glGetQueryObjectiv(frame.scopes.back().endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		complete = available != 0;
+	}
+
+	for(const PendingScope& scope : frame.scopes)
+	{
+		if(complete)
+		{
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &end);
+
+			History& history = histories[scope.nameIndex];
+			const double ms = static_cast<double>(end - begin) / 1.0e6;
+			if(history.samplesMs.size() < HISTORY_SIZE)
+				history.samplesMs.push_back(ms);
+			else
+				history.samplesMs[history.next] = ms;
+			history.next = (history.next + 1) % HISTORY_SIZE;
+			history.lastMs = ms;
+
+			if(frame.traced)
+				Tracing().recordGpuZone(history.name, begin + frame.traceClockOffsetNs, end + frame.traceClockOffsetNs);
+		}
+
+		// The GPU fell more than FRAMES_IN_FLIGHT behind: the frame is dropped rather than waited for
+		frame.freeQueries.push_back(scope.beginQuery);
+		frame.freeQueries.push_back(scope.endQuery);
+	}
+	return complete;
+}
+
+uint32_t GpuProfiler::internName(const string_view name)
+{
+	if(const auto it = nameIndices.find(name); it != nameIndices.end())
+		return it->second;
+
+	const auto index = static_cast<uint32_t>(histories.size());
+	histories.push_back({string(name), {}, 0, 0.0});
+	nameIndices.emplace(name, index);
+	return index;
+}
+
+GpuProfiler::ScopeStats GpuProfiler::computeStats(const History& history)
+{
+	vector<double> sorted = history.samplesMs;
+	ranges::sort(sorted);
+
+	double sum = 0.0;
+	for(const double ms : sorted)
+		sum += ms;
+
+	const size_t p99Index = static_cast<size_t>(ceil(0.99 * static_cast<double>(sorted.size()))) - 1;
+	return {
+		history.name,
+		sorted.front(),
+		sum / static_cast<double>(sorted.size()),
+		sorted[min(p99Index, sorted.size() - 1)],
+		history.lastMs,
+		sorted.size()
+	};
+}
+
+void GpuProfiler::dump(const double nowSeconds)
+{
+	report(cout);
+
+	if(!csv.is_open())
+		return;
+	for(const ScopeStats& stats : getStats())
+		csv << nowSeconds << "," << stats.name << "," << stats.minMs << "," << stats.avgMs << ","
+			<< stats.p99Ms << "," << stats.lastMs << "," << stats.samples << "\n";
+	csv.flush();
+}
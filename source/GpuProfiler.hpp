@@ -0,0 +1,136 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// GPU pass timings from GL_TIMESTAMP queries.
+// Queries are kept in a ring of frames and read back several frames later, so it never stalls the pipeline.
+// On drivers without timer queries every call is a no-op and no stats are produced.
+class GpuProfiler
+{
+public:
+	struct ScopeStats
+	{
+		string name;
+		double minMs;
+		double avgMs;
+		double p99Ms;
+		double lastMs;
+		size_t samples;
+	};
+
+	GpuProfiler();
+	~GpuProfiler();
+
+	// non-copyable, owns OpenGL query objects
+	GpuProfiler(const GpuProfiler&) = delete;
+	GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+	[[nodiscard]] bool supported() const { return isSupported; }
+	void setEnabled(bool enabled) { isEnabled = enabled; }
+	[[nodiscard]] bool enabled() const { return isSupported && isEnabled; }
+
+	// Harvests the oldest frame of the ring and starts recording a new one
+	void beginFrame();
+	void endFrame();
+
+	// Scopes may nest, names are stored as given, e.g. "shadow/point[2]". Only new names allocate.
+	void beginScope(string_view name);
+	void endScope();
+
+	// Rolling statistics over the last HISTORY_SIZE frames, sorted by average time
+	[[nodiscard]] vector<ScopeStats> getStats() const;
+	[[nodiscard]] bool getStats(const string& name, ScopeStats& out) const;
+
+	void report(ostream& out) const;
+
+	// Appends one row per scope to a CSV file every interval seconds, 0 disables it
+	void setDumpInterval(double seconds) { dumpInterval = seconds; }
+	void setCsvPath(const string& path);
+
+	static constexpr size_t FRAMES_IN_FLIGHT = 4;
+	static constexpr size_t HISTORY_SIZE = 240;
+
+private:
+	struct PendingScope
+	{
+		uint32_t nameIndex;
+		GLuint beginQuery;
+		GLuint endQuery;
+	};
+
+	struct Frame
+	{
+		vector<PendingScope> scopes;
+		vector<GLuint> freeQueries;
+		bool recorded = false;
+		// now() minus the GPU clock when the frame began, set only while a trace is recorded
+		int64_t traceClockOffsetNs = 0;
+		bool traced = false;
+	};
+
+	struct History
+	{
+		string name;
+		vector<double> samplesMs; // ring of HISTORY_SIZE
+		size_t next = 0;
+		double lastMs = 0.0;
+	};
+
+	GLuint acquireQuery(Frame& frame);
+	bool harvest(Frame& frame);
+	uint32_t internName(string_view name);
+	static ScopeStats computeStats(const History& history);
+	void dump(double nowSeconds);
+
+	bool isSupported = false;
+	bool isEnabled = true;
+
+	Frame frames[FRAMES_IN_FLIGHT];
+	size_t frameIndex = 0;
+	vector<size_t> openScopes; // indices into the current frame's scopes
+
+	vector<History> histories;
+	// Transparent, so names are looked up without building a string
+	struct NameHash
+	{
+		using is_transparent = void;
+		size_t operator()(const string_view name) const { return hash<string_view>{}(name); }
+	};
+	unordered_map<string, uint32_t, NameHash, equal_to<>> nameIndices;
+
+	double dumpInterval = 0.0;
+	double lastDump = 0.0;
+	ofstream csv;
+};
+
+// Times the enclosing block on the GPU
+class GpuScope
+{
+public:
+	GpuScope(GpuProfiler* profiler, const string_view name)
+	: profiler(profiler)
+	{
+		if(profiler)
+			profiler->beginScope(name);
+	}
+
+	~GpuScope()
+	{
+		if(profiler)
+			profiler->endScope();
+	}
+
+	GpuScope(const GpuScope&) = delete;
+	GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+	GpuProfiler* profiler;
+};
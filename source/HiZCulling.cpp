@@ -0,0 +1,304 @@
+#include "HiZCulling.hpp"
+#include "Bounds.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "Primitives.hpp"
+#include "RenderStats.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iostream>
+
+// Texture units of the compute passes
+enum HiZUnit
+{
+	DEPTH_UNIT = 0,
+	PYRAMID_UNIT = 1,
+};
+
+// Image units of hiz_pyramid.glsl
+enum PyramidImage
+{
+	SOURCE_IMAGE = 0,
+	TARGET_IMAGE = 1,
+};
+
+// Matches local_size_x of hiz_cull.glsl and hiz_commands.glsl
+static constexpr GLuint CULL_GROUP_SIZE = 64;
+// Matches local_size_x/y of hiz_pyramid.glsl
+static constexpr GLuint PYRAMID_GROUP_SIZE = 8;
+
+// Visible, occluded and frustum culled instances, in that order
+static constexpr GLsizeiptr STATS_BYTES = 3 * sizeof(uint32_t);
+
+static void bindStorage(const SSBOBindingPoint point, const GLuint buffer)
+{
+	GLState().bindBufferBase(static_cast<GLuint>(point), buffer);
+}
+
+static void clearUints(const GLuint buffer)
+{
+	glClearNamedBufferData(buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+}
+
+HiZCulling::HiZCulling(const Shader& cullShader, const Shader& pyramidShader, const Shader& commandShader,
+					   const Shader& depthShader)
+: cachedCullShader(cullShader), cachedPyramidShader(pyramidShader), cachedCommandShader(commandShader),
+  cachedDepthShader(depthShader)
+{
+	glCreateBuffers(1, &commandBuffer);
+	glCreateBuffers(1, &commandModelBuffer);
+	glCreateBuffers(1, &countBuffer);
+	glCreateBuffers(FRAMES_IN_FLIGHT, statsBuffers);
+	for(const GLuint buffer : statsBuffers)
+		glNamedBufferData(buffer, STATS_BYTES, nullptr, GL_DYNAMIC_READ);
+}
+
+HiZCulling::~HiZCulling()
+{
+	destroyTargets();
+
+	for(const GLsync fence : statsFences)
+		if(fence)
+			glDeleteSync(fence);
+
+	for(const GLuint buffer : {commandBuffer, commandModelBuffer, countBuffer})
+	{
+		GpuMemory().untrack(ResidentMemory::Buffer, buffer);
+		GLState().forgetBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+	for(const GLuint buffer : statsBuffers)
+		GLState().forgetBuffer(buffer);
+	glDeleteBuffers(FRAMES_IN_FLIGHT, statsBuffers);
+}
+
+void HiZCulling::resize(const int newWidth, const int newHeight)
+{
+	if(newWidth == width && newHeight == height && depthFBO != 0)
+		return;
+
+	destroyTargets();
+	width = newWidth;
+	height = newHeight;
+	createTargets();
+}
+
+void HiZCulling::prepare(const span<const ModelDraw> models)
+{
+	firstCommands.clear();
+	commands.clear();
+	commandModels.clear();
+	for(size_t model = 0; model < models.size(); ++model)
+	{
+		firstCommands.push_back(static_cast<uint32_t>(commands.size()));
+		models[model].model->forEachMesh([this, model](const Mesh& mesh)
+		{
+			commands.push_back({mesh.indexCount(), 0, 0, 0, 0});
+			commandModels.push_back(static_cast<uint32_t>(model));
+		});
+	}
+
+	const auto commandCount = static_cast<uint32_t>(commands.size());
+	const auto modelCount = static_cast<uint32_t>(models.size());
+	if(commandCount > commandCapacity || modelCount > modelCapacity)
+	{
+		commandCapacity = std::max({commandCount, commandCapacity * 2, 64u});
+		modelCapacity = std::max({modelCount, modelCapacity * 2, 16u});
+		glNamedBufferData(commandBuffer, commandCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(commandModelBuffer, commandCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+		glNamedBufferData(countBuffer, modelCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+		GpuMemory().track(ResidentMemory::Buffer, commandBuffer, GpuMemoryCategory::Culling,
+						  commandCapacity * sizeof(DrawElementsIndirectCommand));
+		GpuMemory().track(ResidentMemory::Buffer, commandModelBuffer, GpuMemoryCategory::Culling, commandCapacity * sizeof(uint32_t));
+		GpuMemory().track(ResidentMemory::Buffer, countBuffer, GpuMemoryCategory::Culling, modelCapacity * sizeof(uint32_t));
+		// The new storage holds nothing
+		uploadedCommands.clear();
+		uploadedCommandModels.clear();
+	}
+
+	// Only the instance counts change from frame to frame, and the GPU writes those
+	const bool sameLayout = commandModels == uploadedCommandModels && commands.size() == uploadedCommands.size()
+		&& memcmp(commands.data(), uploadedCommands.data(), commands.size() * sizeof(DrawElementsIndirectCommand)) == 0;
+	if(sameLayout || commands.empty())
+		return;
+
+	glNamedBufferSubData(commandBuffer, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+	glNamedBufferSubData(commandModelBuffer, 0, commandModels.size() * sizeof(uint32_t), commandModels.data());
+	RenderCounters().recordBufferUpload(commands.size() * (sizeof(DrawElementsIndirectCommand) + sizeof(uint32_t)));
+	uploadedCommands = commands;
+	uploadedCommandModels = commandModels;
+}
+
+void HiZCulling::cull(const span<const ModelDraw> models, const CameraState& camera, const DrawModelsCallback& drawKept)
+{
+	harvestStats();
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if(commands.empty())
+		return;
+
+	const mat4 viewProj = camera.proj * camera.view;
+	clearUints(countBuffer);
+	clearUints(statsBuffers[statsIndex]);
+
+	// ========== Phase 1: what was visible last frame ==========
+	cullModels(models, viewProj, 1);
+	writeCommands();
+
+	GLState().bindFramebuffer(depthFBO);
+	GLState().viewport(0, 0, width, height);
+	GLState().depthMask(GL_TRUE);
+	GLState().depthFunc(GL_LESS);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	cachedDepthShader.use();
+	cachedDepthShader.setMat4("projection", camera.proj);
+	cachedDepthShader.setMat4("view", camera.view);
+	drawKept(cachedDepthShader);
+	GLState().bindFramebuffer(0);
+
+	// ========== Phase 2: everything against the pyramid of phase 1's depth ==========
+	buildPyramid();
+	cullModels(models, viewProj, 2);
+	writeCommands();
+
+	statsFences[statsIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	statsIndex = (statsIndex + 1) % FRAMES_IN_FLIGHT;
+}
+
+void HiZCulling::cullModels(const span<const ModelDraw> models, const mat4& viewProj, const int phase) const
+{
+	static constexpr const char* PLANE_NAMES[6] = {
+		"u_planes[0]", "u_planes[1]", "u_planes[2]", "u_planes[3]", "u_planes[4]", "u_planes[5]"
+	};
+
+	const Shader& shader = cachedCullShader;
+	shader.use();
+	shader.setInt("u_phase", phase);
+	shader.setMat4("u_viewProj", viewProj);
+	const Frustum frustum = Frustum::fromMatrix(viewProj);
+	for(int plane = 0; plane < 6; ++plane)
+		shader.setVec4(PLANE_NAMES[plane], frustum.planes[plane]);
+	glBindTextureUnit(PYRAMID_UNIT, pyramidTexture);
+	shader.setInt("u_pyramid", PYRAMID_UNIT);
+
+	bindStorage(SSBOBindingPoint::CullCounts, countBuffer);
+	bindStorage(SSBOBindingPoint::CullStats, statsBuffers[statsIndex]);
+	for(size_t model = 0; model < models.size(); ++model)
+	{
+		const ModelDraw& draw = models[model];
+		const AABB& bounds = draw.model->getBounds();
+		if(draw.instanceCount == 0 || bounds.empty())
+			continue;
+
+		bindStorage(SSBOBindingPoint::CullInstances, draw.model->getInstanceBuffer());
+		bindStorage(SSBOBindingPoint::CullOutput, draw.model->getCulledInstanceBuffer());
+		bindStorage(SSBOBindingPoint::CullVisibility, draw.model->getVisibilityBuffer());
+		shader.setInt("u_model", static_cast<int>(model));
+		shader.setInt("u_instanceCount", static_cast<int>(draw.instanceCount));
+		shader.setVec3("u_boundsMin", bounds.min);
+		shader.setVec3("u_boundsMax", bounds.max);
+		glDispatchCompute((draw.instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCulling::writeCommands() const
+{
+	const auto commandCount = static_cast<GLuint>(commands.size());
+	cachedCommandShader.use();
+	cachedCommandShader.setInt("u_commandCount", static_cast<int>(commandCount));
+	bindStorage(SSBOBindingPoint::CullCounts, countBuffer);
+	bindStorage(SSBOBindingPoint::CullCommands, commandBuffer);
+	bindStorage(SSBOBindingPoint::CullCommandModels, commandModelBuffer);
+	glDispatchCompute((commandCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+	// The draws read the commands and the culled instance matrices the dispatches wrote
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCulling::buildPyramid() const
+{
+	const Shader& shader = cachedPyramidShader;
+	shader.use();
+	glBindTextureUnit(DEPTH_UNIT, depthTexture);
+	shader.setInt("u_depth", DEPTH_UNIT);
+
+	// Level 0 copies the depth target, every other level reduces the one above it
+	for(int level = 0; level < pyramidLevels; ++level)
+	{
+		shader.setInt("u_level", level);
+		glBindImageTexture(SOURCE_IMAGE, pyramidTexture, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(TARGET_IMAGE, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		const GLuint levelWidth = std::max(width >> level, 1);
+		const GLuint levelHeight = std::max(height >> level, 1);
+		glDispatchCompute((levelWidth + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+						  (levelHeight + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void HiZCulling::harvestStats()
+{
+	// The slot about to be reused is the oldest one, skipped when the GPU is still that far behind
+	GLsync& fence = statsFences[statsIndex];
+	if(!fence)
+		return;
+
+	const GLenum status = glClientWaitSync(fence, 0, 0);
+	if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+	{
+		uint32_t values[3] = {};
+		glGetNamedBufferSubData(statsBuffers[statsIndex], 0, STATS_BYTES, values);
+		stats = {values[0], values[1], values[2]};
+		RenderCounters().recordOcclusion(stats.visible, stats.occluded, stats.frustumCulled);
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void HiZCulling::createTargets()
+{
+	pyramidLevels = std::bit_width(static_cast<uint32_t>(std::max(width, height)));
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &depthTexture);
+	glTextureStorage2D(depthTexture, 1, GL_DEPTH_COMPONENT32F, width, height);
+	glCreateTextures(GL_TEXTURE_2D, 1, &pyramidTexture);
+	glTextureStorage2D(pyramidTexture, pyramidLevels, GL_R32F, width, height);
+	for(const GLuint texture : {depthTexture, pyramidTexture})
+	{
+		glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	// The pyramid's mips add a third
+	const uint64_t pixels = static_cast<uint64_t>(width) * height;
+	GpuMemory().track(ResidentMemory::Texture, depthTexture, GpuMemoryCategory::RenderTarget, pixels * sizeof(float));
+	GpuMemory().track(ResidentMemory::Texture, pyramidTexture, GpuMemoryCategory::RenderTarget, pixels * sizeof(float) * 4 / 3);
+
+	glCreateFramebuffers(1, &depthFBO);
+	glNamedFramebufferTexture(depthFBO, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+	glNamedFramebufferDrawBuffer(depthFBO, GL_NONE);
+	if(glCheckNamedFramebufferStatus(depthFBO, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "ERROR: Hi-Z depth framebuffer is not complete!" << std::endl;
+}
+
+void HiZCulling::destroyTargets()
+{
+	if(depthFBO)
+	{
+		GLState().forgetFramebuffer(depthFBO);
+		glDeleteFramebuffers(1, &depthFBO);
+	}
+	for(const GLuint texture : {depthTexture, pyramidTexture})
+	{
+		if(texture)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, texture);
+			glDeleteTextures(1, &texture);
+		}
+	}
+	depthFBO = depthTexture = pyramidTexture = 0;
+	pyramidLevels = 0;
+}
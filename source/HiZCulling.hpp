@@ -0,0 +1,93 @@
+#pragma once
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "Camera.hpp"
+#include "RenderSnapshot.hpp"
+#include "Shader.hpp"
+
+using namespace std;
+using namespace glm;
+
+// GPU occlusion culling against a hierarchical depth (Hi-Z) pyramid, in two phases so nothing pops:
+//   1. instances visible last frame that are inside the frustum are kept and their depth is drawn,
+//   2. the pyramid is built from that depth and every instance inside the frustum is tested against it.
+//      Instances that pass and were not kept in phase 1 are appended, the result is next frame's visibility.
+// Kept instance matrices are compacted into each model's culled instance buffer, and one indirect draw command
+// per mesh receives its model's count, so the passes draw with Mesh::drawIndirect without any readback.
+class HiZCulling
+{
+public:
+	// Per frame counts, read back a few frames late so the CPU never waits for the GPU
+	struct Stats
+	{
+		uint32_t visible = 0;       // passed the pyramid test
+		uint32_t occluded = 0;
+		uint32_t frustumCulled = 0;
+	};
+
+	// depthShader draws phase 1's depth, the instance matrices come from the culled instance buffers
+	HiZCulling(const Shader& cullShader, const Shader& pyramidShader, const Shader& commandShader, const Shader& depthShader);
+	~HiZCulling();
+
+	// non-copyable, owns OpenGL objects
+	HiZCulling(const HiZCulling&) = delete;
+	HiZCulling& operator=(const HiZCulling&) = delete;
+
+	// (Re)creates the depth target and pyramid when the window size changed
+	void resize(int width, int height);
+
+	// Lays out the indirect commands of the frame's models, one per mesh in forEachMesh order.
+	// Must run before the render queue is built, which takes the commands from firstCommand().
+	void prepare(span<const ModelDraw> models);
+	[[nodiscard]] uint32_t firstCommand(size_t model) const { return firstCommands[model]; }
+
+	// Runs both phases, after it the commands hold every kept instance and stay bound for the frame's draws.
+	// drawKept draws the queue's culled packets with the depth shader, once, while the commands hold phase 1's counts.
+	void cull(span<const ModelDraw> models, const CameraState& camera, const DrawModelsCallback& drawKept);
+
+	[[nodiscard]] const Stats& getStats() const { return stats; }
+
+	static constexpr uint32_t FRAMES_IN_FLIGHT = 3;
+
+private:
+	void createTargets();
+	void destroyTargets();
+	void cullModels(span<const ModelDraw> models, const mat4& viewProj, int phase) const;
+	// Copies the per model counts into the commands, then makes them and the culled buffers visible to draws
+	void writeCommands() const;
+	void buildPyramid() const;
+	void harvestStats();
+
+	const Shader& cachedCullShader;
+	const Shader& cachedPyramidShader;
+	const Shader& cachedCommandShader;
+	const Shader& cachedDepthShader;
+
+	int width = 0;
+	int height = 0;
+	int pyramidLevels = 0;
+	GLuint depthFBO = 0;
+	GLuint depthTexture = 0;
+	GLuint pyramidTexture = 0; // R32F, farthest depth of the texels below, level 0 is the depth buffer
+
+	GLuint commandBuffer = 0;      // DrawElementsIndirectCommand per mesh
+	GLuint commandModelBuffer = 0; // model index of every command
+	GLuint countBuffer = 0;        // kept instances per model
+	uint32_t commandCapacity = 0;
+	uint32_t modelCapacity = 0;
+	vector<uint32_t> firstCommands;
+	// Layout of the last prepare(), only uploaded again when it changes
+	vector<DrawElementsIndirectCommand> commands;
+	vector<uint32_t> commandModels;
+	vector<DrawElementsIndirectCommand> uploadedCommands;
+	vector<uint32_t> uploadedCommandModels;
+
+	// Stats ring, written by the phase 2 dispatches and read back once its fence signaled
+	GLuint statsBuffers[FRAMES_IN_FLIGHT]{};
+	GLsync statsFences[FRAMES_IN_FLIGHT]{};
+	uint32_t statsIndex = 0;
+	Stats stats;
+};
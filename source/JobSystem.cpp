@@ -0,0 +1,237 @@
+#include "JobSystem.hpp"
+#include "Trace.hpp"
+
+static thread_local uint32_t workerIndex = UINT32_MAX;
+
+// ========== Scratch memory ==========
+
+ScratchArena::ScratchArena(const size_t blockSize)
+: blockSize(blockSize)
+{
+	blocks.push_back({make_unique<byte[]>(blockSize), blockSize});
+}
+
+void* ScratchArena::allocate(const size_t size, const size_t alignment)
+{
+	while(true)
+	{
+		Block& block = blocks[current];
+		const uintptr_t base = reinterpret_cast<uintptr_t>(block.memory.get());
+		const uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t{alignment} - 1);
+		if(aligned + size <= base + block.size)
+		{
+			offset = aligned - base + size;
+			return reinterpret_cast<void*>(aligned);
+		}
+
+		// Move on to the next block, adding one large enough when none is left
+		++current;
+		offset = 0;
+		if(current == blocks.size())
+		{
+			const size_t newSize = std::max(blockSize, size + alignment);
+			blocks.push_back({make_unique<byte[]>(newSize), newSize});
+		}
+		else if(blocks[current].size < size + alignment)
+		{
+			blocks.insert(blocks.begin() + static_cast<ptrdiff_t>(current), {make_unique<byte[]>(size + alignment), size + alignment});
+		}
+	}
+}
+
+size_t ScratchArena::used() const
+{
+	size_t bytes = offset;
+	for(size_t i = 0; i < current; ++i)
+		bytes += blocks[i].size;
+	return bytes;
+}
+
+size_t ScratchArena::capacity() const
+{
+	size_t bytes = 0;
+	for(const Block& block : blocks)
+		bytes += block.size;
+	return bytes;
+}
+
+ScratchArena& ThreadScratch()
+{
+	static thread_local ScratchArena arena;
+	return arena;
+}
+
+// ========== Scheduling ==========
+
+JobSystem::JobSystem(const uint32_t requestedWorkers)
+: workerCount(requestedWorkers == DEFAULT_WORKERS ? std::max(thread::hardware_concurrency(), 2u) - 1 : requestedWorkers)
+{
+	queues = make_unique<WorkQueue[]>(workerCount + 1);
+	workers.reserve(workerCount);
+	for(uint32_t i = 0; i < workerCount; ++i)
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		lock_guard lock(sleepMutex);
+		stopping.store(true);
+	}
+	wake.notify_all();
+	for(thread& worker : workers)
+		worker.join();
+}
+
+void JobSystem::run(Job job, JobCounter* counter)
+{
+	if(counter)
+		counter->pending.fetch_add(1, memory_order_relaxed);
+	push({std::move(job), counter});
+}
+
+void JobSystem::runAfter(JobCounter& dependency, Job job, JobCounter* counter)
+{
+	if(counter)
+		counter->pending.fetch_add(1, memory_order_relaxed);
+
+	{
+		lock_guard lock(dependency.continuationMutex);
+		if(!dependency.done())
+		{
+			dependency.continuations.push_back({std::move(job), counter});
+			return;
+		}
+	}
+	push({std::move(job), counter});
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	QueuedJob job;
+	while(!counter.done())
+	{
+		if(tryPop(job))
+			execute(job);
+		else
+			this_thread::yield();
+	}
+
+	// The last finish() may still hold the lock, the counter can only be destroyed once it let go
+	lock_guard lock(counter.continuationMutex);
+}
+
+JobSystem::Stats JobSystem::getStats() const
+{
+	return {executedJobs.load(memory_order_relaxed), stolenJobs.load(memory_order_relaxed)};
+}
+
+uint32_t JobSystem::currentWorker()
+{
+	return workerIndex;
+}
+
+void JobSystem::push(QueuedJob job)
+{
+	// Workers keep their own jobs local, everyone else goes through the shared queue
+	const uint32_t index = std::min(workerIndex, workerCount);
+	{
+		WorkQueue& queue = queues[index];
+		lock_guard lock(queue.queueMutex);
+		queue.jobs.push_back(std::move(job));
+	}
+	queuedJobs.fetch_add(1);
+
+	// Pairs with the sleepers increment in workerLoop, one of the two sides always sees the other
+	if(sleepers.load() > 0)
+	{
+		lock_guard lock(sleepMutex);
+		wake.notify_one();
+	}
+}
+
+bool JobSystem::tryPop(QueuedJob& out)
+{
+	const uint32_t self = workerIndex;
+
+	// Own queue first, newest job: it is the most likely to still be in cache
+	if(self < workerCount)
+	{
+		WorkQueue& queue = queues[self];
+		lock_guard lock(queue.queueMutex);
+		if(!queue.jobs.empty())
+		{
+			out = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+			queuedJobs.fetch_sub(1);
+			return true;
+		}
+	}
+
+	// Then the shared queue and the other workers, oldest job first
+	const uint32_t start = self < workerCount ? self + 1 : 0;
+	for(uint32_t i = 0; i <= workerCount; ++i)
+	{
+		const uint32_t victim = (start + workerCount - i) % (workerCount + 1);
+		if(victim == self)
+			continue;
+		WorkQueue& queue = queues[victim];
+		lock_guard lock(queue.queueMutex);
+		if(!queue.jobs.empty())
+		{
+			out = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			queuedJobs.fetch_sub(1);
+			if(victim != workerCount)
+				stolenJobs.fetch_add(1, memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobSystem::execute(QueuedJob& job)
+{
+	TRACE_ZONE("job");
+	job.job();
+	job.job = nullptr;
+	executedJobs.fetch_add(1, memory_order_relaxed);
+	if(job.counter)
+		finish(job.counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+	// Reaching zero under the lock lets wait() know when the counter is no longer touched
+	vector<JobCounter::Continuation> continuations;
+	{
+		lock_guard lock(counter->continuationMutex);
+		if(counter->pending.fetch_sub(1, memory_order_acq_rel) != 1)
+			return;
+		continuations.swap(counter->continuations);
+	}
+
+	for(JobCounter::Continuation& continuation : continuations)
+		push({std::move(continuation.job), continuation.counter});
+}
+
+void JobSystem::workerLoop(const uint32_t index)
+{
+	workerIndex = index;
+	TRACE_THREAD_NAME("worker " + to_string(index));
+
+	QueuedJob job;
+	while(!stopping.load(memory_order_relaxed))
+	{
+		if(tryPop(job))
+		{
+			execute(job);
+			continue;
+		}
+
+		unique_lock lock(sleepMutex);
+		sleepers.fetch_add(1);
+		wake.wait(lock, [this] { return queuedJobs.load() > 0 || stopping.load(); });
+		sleepers.fetch_sub(1);
+	}
+}
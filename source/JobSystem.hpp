@@ -0,0 +1,200 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+using Job = function<void()>;
+
+// Number of unfinished jobs started with it. Jobs started with JobSystem::runAfter() are held back until it
+// reaches zero. Must outlive the jobs it counts, JobSystem::wait() guarantees that for stack counters.
+class JobCounter
+{
+public:
+	[[nodiscard]] bool done() const { return pending.load(memory_order_acquire) == 0; }
+
+private:
+	friend class JobSystem;
+
+	struct Continuation
+	{
+		Job job;
+		JobCounter* counter;
+	};
+
+	atomic<uint32_t> pending{0};
+	mutex continuationMutex; // also guards the decrement to zero, see JobSystem::finish
+	vector<Continuation> continuations;
+};
+
+// Bump allocator for short-lived data, rewound by ScratchScope. Grows by chaining blocks, which are kept for reuse.
+class ScratchArena
+{
+public:
+	struct Marker
+	{
+		size_t block;
+		size_t offset;
+	};
+
+	explicit ScratchArena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+	// non-copyable, owns its blocks
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(max_align_t));
+	template<typename T>
+	T* allocate(const size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+
+	[[nodiscard]] Marker mark() const { return {current, offset}; }
+	void rewind(const Marker& marker) { current = marker.block; offset = marker.offset; }
+	// Frees everything at once, the blocks stay allocated for the next round
+	void reset() { current = 0; offset = 0; }
+
+	// Bytes handed out since the last reset, alignment padding and skipped block tails included
+	[[nodiscard]] size_t used() const;
+	[[nodiscard]] size_t capacity() const;
+
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+private:
+	struct Block
+	{
+		unique_ptr<byte[]> memory;
+		size_t size;
+	};
+
+	vector<Block> blocks;
+	size_t blockSize;
+	size_t current = 0;
+	size_t offset = 0;
+};
+
+// Scratch arena of the calling thread, every worker and the main/simulation threads get their own
+ScratchArena& ThreadScratch();
+
+// Rewinds the thread's scratch arena to where it was when the scope was entered
+class ScratchScope
+{
+public:
+	ScratchScope() : scratch(ThreadScratch()), marker(scratch.mark()) {}
+	~ScratchScope() { scratch.rewind(marker); }
+
+	ScratchScope(const ScratchScope&) = delete;
+	ScratchScope& operator=(const ScratchScope&) = delete;
+
+	template<typename T>
+	T* allocate(const size_t count) { return scratch.allocate<T>(count); }
+
+private:
+	ScratchArena& scratch;
+	ScratchArena::Marker marker;
+};
+
+// Work-stealing scheduler: every worker owns a deque, pops its own newest job and steals the oldest job of others.
+// Threads outside the pool submit through a shared queue, and wait() runs jobs instead of blocking, so it may be
+// called from inside jobs and from any thread.
+class JobSystem
+{
+public:
+	struct Stats
+	{
+		uint64_t executed = 0;
+		uint64_t stolen = 0;
+	};
+
+	// With 0 workers every job runs inside wait()/parallelFor on the calling thread
+	explicit JobSystem(uint32_t requestedWorkers = DEFAULT_WORKERS);
+	~JobSystem();
+
+	// non-copyable, owns threads
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	void run(Job job, JobCounter* counter = nullptr);
+	// Starts job once dependency reaches zero
+	void runAfter(JobCounter& dependency, Job job, JobCounter* counter = nullptr);
+	// Runs queued jobs until counter reaches zero
+	void wait(JobCounter& counter);
+
+	// Calls body(begin, end) for chunks of at least grainSize items covering [0, count), the calling thread
+	// takes part and it returns once every chunk is done
+	template<typename Body>
+	void parallelFor(size_t count, size_t grainSize, const Body& body);
+
+	[[nodiscard]] uint32_t getWorkerCount() const { return workerCount; }
+	[[nodiscard]] Stats getStats() const;
+	// Index of the calling worker, UINT32_MAX on threads outside the pool
+	[[nodiscard]] static uint32_t currentWorker();
+
+	// One worker per hardware thread, minus one for the thread that submits
+	static constexpr uint32_t DEFAULT_WORKERS = UINT32_MAX;
+	// More chunks than threads, so stealing can even out uneven chunks
+	static constexpr uint32_t CHUNKS_PER_THREAD = 4;
+
+private:
+	struct QueuedJob
+	{
+		Job job;
+		JobCounter* counter;
+	};
+
+	struct alignas(64) WorkQueue
+	{
+		mutex queueMutex;
+		deque<QueuedJob> jobs;
+	};
+
+	void push(QueuedJob job);
+	bool tryPop(QueuedJob& out);
+	void execute(QueuedJob& job);
+	void finish(JobCounter* counter);
+	void workerLoop(uint32_t index);
+
+	uint32_t workerCount; // fixed before the workers start, workers.size() is still growing while they run
+	vector<thread> workers;
+	unique_ptr<WorkQueue[]> queues; // one per worker, the last one is shared by outside threads
+	atomic<uint32_t> queuedJobs{0};
+	atomic<uint64_t> executedJobs{0};
+	atomic<uint64_t> stolenJobs{0};
+
+	mutex sleepMutex;
+	condition_variable wake;
+	atomic<uint32_t> sleepers{0};
+	atomic<bool> stopping{false};
+};
+
+template<typename Body>
+void JobSystem::parallelFor(const size_t count, const size_t grainSize, const Body& body)
+{
+	if(count == 0)
+		return;
+
+	const size_t maxChunks = static_cast<size_t>(getWorkerCount() + 1) * CHUNKS_PER_THREAD;
+	const size_t chunks = std::min(maxChunks, (count + std::max<size_t>(grainSize, 1) - 1) / std::max<size_t>(grainSize, 1));
+	if(chunks <= 1)
+	{
+		body(size_t{0}, count);
+		return;
+	}
+
+	const size_t chunkSize = (count + chunks - 1) / chunks;
+	JobCounter counter;
+	for(size_t begin = chunkSize; begin < count; begin += chunkSize)
+	{
+		const size_t end = std::min(begin + chunkSize, count);
+		run([&body, begin, end] { body(begin, end); }, &counter);
+	}
+	body(size_t{0}, std::min(chunkSize, count));
+	wait(counter);
+}
@@ -1,100 +1,237 @@
 #include "Light.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+#include <chrono>
+#include <cstdio>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
-LightManager::LightManager(const Shader& mainShader, const Shader& skyShader, const Shader& shadowMapShader, const Shader& shadowPointShader)
-: cachedMainShader(mainShader), cachedSkyShader(skyShader), cachedShadowMapShader(shadowMapShader), cachedShadowPointShader(shadowPointShader)
+// GL_DEPTH_COMPONENT24 texels are padded to four bytes
+static uint64_t DepthTextureBytes(const uint32_t width, const uint32_t height, const uint32_t faces = 1)
 {
-	// Create SSBOs for dynamic lights
-	glGenBuffers(1, &pointLightSSBO);
-	glGenBuffers(1, &spotLightSSBO);
-	glGenBuffers(1, &sunLightSSBO);
+	return static_cast<uint64_t>(width) * height * faces * 4;
 }
 
-LightManager::~LightManager()
+// Profiler scope of one light's shadow pass, e.g. "shadow/point[3]", formatted without a heap allocation
+static string_view ShadowScopeName(char (&buffer)[32], const char* type, const uint32_t slot)
+{
+	const int length = snprintf(buffer, sizeof(buffer), "shadow/%s[%u]", type, slot);
+	return {buffer, static_cast<size_t>(length)};
+}
+
+LightManager::LightManager(const Shader& mainShader, const Shader& skyShader, const Shader& shadowMapShader, const Shader& shadowPointShader)
+: pointSlots(emptyPointLight()), spotSlots(emptySpotlight()), dirSlots(emptyDirLight()),
+  pointLightBuffer(static_cast<GLuint>(SSBOBindingPoint::PointLights), sizeof(GpuPointLight)),
+  spotLightBuffer(static_cast<GLuint>(SSBOBindingPoint::Spotlights), sizeof(GpuSpotlight)),
+  dirLightBuffer(static_cast<GLuint>(SSBOBindingPoint::DirLights), sizeof(GpuDirLight)),
+  pointShadowViewBuffer(static_cast<GLuint>(SSBOBindingPoint::PointShadowViews), sizeof(PointShadowView)),
+  spotShadowViewBuffer(static_cast<GLuint>(SSBOBindingPoint::SpotShadowViews), sizeof(mat4)),
+  dirShadowViewBuffer(static_cast<GLuint>(SSBOBindingPoint::DirShadowViews), sizeof(mat4)),
+  cachedMainShader(mainShader), cachedSkyShader(skyShader), cachedShadowMapShader(shadowMapShader), cachedShadowPointShader(shadowPointShader)
 {
-	if(pointLightSSBO)
-		glDeleteBuffers(1, &pointLightSSBO);
-	if(spotLightSSBO)
-		glDeleteBuffers(1, &spotLightSSBO);
-	if(sunLightSSBO)
-		glDeleteBuffers(1, &sunLightSSBO);
 }
 
+LightManager::~LightManager() = default;
+
 entt::entity LightManager::createPointLight(const vec3& position, const vec3& color)
+{
+	PointLightDesc desc;
+	desc.position = position;
+	desc.ambient = color * 0.1f;
+	desc.diffuse = color;
+	desc.specular = color;
+
+	const entt::entity lightEnt = addPointLight(desc);
+	markChanged();
+	return lightEnt;
+}
+
+entt::entity LightManager::createSpotlight(const vec3& position, const vec3& direction, const vec3& color)
+{
+	SpotlightDesc desc;
+	desc.position = position;
+	desc.direction = direction;
+	desc.cutOff = cos(radians(12.5f));
+	desc.outerCutOff = cos(radians(17.5f));
+	desc.diffuse = color;
+	desc.specular = color;
+
+	const entt::entity lightEnt = addSpotlight(desc);
+	markChanged();
+	return lightEnt;
+}
+
+entt::entity LightManager::createDirLight(const vec3& direction, const vec3& color)
+{
+	DirLightDesc desc;
+	desc.direction = direction;
+	desc.ambient = color * 0.1f;
+	desc.diffuse = color;
+	desc.specular = color;
+
+	const entt::entity lightEnt = addDirLight(desc);
+	markChanged();
+	return lightEnt;
+}
+
+void LightManager::createPointLights(const span<const PointLightDesc> descs, vector<entt::entity>* outEntities)
+{
+	if(outEntities)
+		outEntities->reserve(outEntities->size() + descs.size());
+	for(const PointLightDesc& desc : descs)
+	{
+		const entt::entity lightEnt = addPointLight(desc);
+		if(outEntities)
+			outEntities->push_back(lightEnt);
+	}
+	markChanged();
+}
+
+void LightManager::createSpotlights(const span<const SpotlightDesc> descs, vector<entt::entity>* outEntities)
+{
+	if(outEntities)
+		outEntities->reserve(outEntities->size() + descs.size());
+	for(const SpotlightDesc& desc : descs)
+	{
+		const entt::entity lightEnt = addSpotlight(desc);
+		if(outEntities)
+			outEntities->push_back(lightEnt);
+	}
+	markChanged();
+}
+
+void LightManager::createDirLights(const span<const DirLightDesc> descs, vector<entt::entity>* outEntities)
+{
+	if(outEntities)
+		outEntities->reserve(outEntities->size() + descs.size());
+	for(const DirLightDesc& desc : descs)
+	{
+		const entt::entity lightEnt = addDirLight(desc);
+		if(outEntities)
+			outEntities->push_back(lightEnt);
+	}
+	markChanged();
+}
+
+vector<PointLightDesc> LightManager::getPointLightDescs() const
+{
+	vector<PointLightDesc> descs;
+	descs.reserve(pointLightCount);
+	lightRegistry.view<PointLightComponent>().each([this, &descs](const entt::entity entity, const PointLightComponent& light)
+	{
+		descs.push_back({
+			light.position, light.ambient, light.diffuse, light.specular,
+			light.constant, light.linear, light.quadratic,
+			lightRegistry.all_of<PointShadowMapComponent>(entity) ? 1u : 0u
+		});
+	});
+	return descs;
+}
+
+vector<SpotlightDesc> LightManager::getSpotlightDescs() const
+{
+	vector<SpotlightDesc> descs;
+	descs.reserve(spotlightCount);
+	lightRegistry.view<SpotlightComponent>().each([this, &descs](const entt::entity entity, const SpotlightComponent& light)
+	{
+		descs.push_back({
+			light.position, light.direction, light.ambient, light.diffuse, light.specular,
+			light.cutOff, light.outerCutOff, light.constant, light.linear, light.quadratic,
+			lightRegistry.all_of<SpotShadowMapComponent>(entity) ? 1u : 0u
+		});
+	});
+	return descs;
+}
+
+vector<DirLightDesc> LightManager::getDirLightDescs() const
+{
+	vector<DirLightDesc> descs;
+	descs.reserve(dirLightCount);
+	lightRegistry.view<DirLightComponent>().each([this, &descs](const entt::entity entity, const DirLightComponent& light)
+	{
+		descs.push_back({
+			light.direction, light.ambient, light.diffuse, light.specular,
+			lightRegistry.all_of<DirShadowMapComponent>(entity) ? 1u : 0u
+		});
+	});
+	return descs;
+}
+
+entt::entity LightManager::addPointLight(const PointLightDesc& desc)
 {
 	PointLightComponent lightComp{};
-	lightComp.position = position;
-	lightComp.constant = 1.0f;
-	lightComp.ambient = color * 0.1f;
-	lightComp.linear = 0.09f;
-	lightComp.diffuse = color;
-	lightComp.quadratic = 0.032f;
-	lightComp.specular = color;
+	lightComp.position = desc.position;
+	lightComp.constant = desc.constant;
+	lightComp.ambient = desc.ambient;
+	lightComp.linear = desc.linear;
+	lightComp.diffuse = desc.diffuse;
+	lightComp.quadratic = desc.quadratic;
+	lightComp.specular = desc.specular;
 	lightComp.farPlane = POINT_LIGHT_FAR_PLANE;
-	lightComp.cubeMapHandle = 0; // Will be set after shadow map creation
+	lightComp.cubeMapHandle = 0; // Will be set after shadow map creation, stays 0 without shadows
 
 	const entt::entity lightEnt = lightRegistry.create();
 	auto& comp = lightRegistry.emplace<PointLightComponent>(lightEnt, lightComp);
 
 	// Create shadow map for this light using ShadowManager
-	comp.cubeMapHandle = createPointShadowMap(lightEnt, 1024);
+	if(desc.castShadows)
+		comp.cubeMapHandle = createPointShadowMap(lightEnt, 1024);
 
-	// Calculate shadow matrices AFTER shadow map is created
-	recalcPointLightMatrices(lightEnt);
-	syncPointLights();
+	lightRegistry.emplace<LightSlotComponent>(lightEnt, pointSlots.allocate(packPointLight(comp), {comp.shadowMatrices}));
+	lightRegistry.emplace<DirtyLightTag>(lightEnt);
 
 	return lightEnt;
 }
 
-entt::entity LightManager::createSpotlight(const vec3& position, const vec3& direction, const vec3& color)
+entt::entity LightManager::addSpotlight(const SpotlightDesc& desc)
 {
 	SpotlightComponent lightComp{};
-	lightComp.position = position;
-	lightComp.cutOff = cos(radians(12.5f));
-	lightComp.direction = direction;
-	lightComp.outerCutOff = cos(radians(17.5f));
-	lightComp.ambient = vec3(0.0f);
-	lightComp.constant = 1.0f;
-	lightComp.diffuse = color;
-	lightComp.linear = 0.09f;
-	lightComp.specular = color;
-	lightComp.quadratic = 0.032f;
+	lightComp.position = desc.position;
+	lightComp.cutOff = desc.cutOff;
+	lightComp.direction = desc.direction;
+	lightComp.outerCutOff = desc.outerCutOff;
+	lightComp.ambient = desc.ambient;
+	lightComp.constant = desc.constant;
+	lightComp.diffuse = desc.diffuse;
+	lightComp.linear = desc.linear;
+	lightComp.specular = desc.specular;
+	lightComp.quadratic = desc.quadratic;
 	lightComp.lightSpaceMatrix = mat4(1.0f); // Will be updated below
-	lightComp.shadowMapHandle = 0; // Will be set after shadow map creation
+	lightComp.shadowMapHandle = 0; // Will be set after shadow map creation, stays 0 without shadows
 
 	const entt::entity lightEnt = lightRegistry.create();
 	auto& comp = lightRegistry.emplace<SpotlightComponent>(lightEnt, lightComp);
 
 	// Create shadow map for this light using ShadowManager
-	comp.shadowMapHandle = createSpotShadowMap(lightEnt, 1024, 1024);
+	if(desc.castShadows)
+		comp.shadowMapHandle = createSpotShadowMap(lightEnt, 1024, 1024);
 
-	// Calculate light space matrix AFTER shadow map is created
-	recalcSpotlightMatrix(lightEnt);
-	syncSpotlights();
+	lightRegistry.emplace<LightSlotComponent>(lightEnt, spotSlots.allocate(packSpotlight(comp), comp.lightSpaceMatrix));
+	lightRegistry.emplace<DirtyLightTag>(lightEnt);
 
 	return lightEnt;
 }
 
-entt::entity LightManager::createDirLight(const vec3& direction, const vec3& color)
+entt::entity LightManager::addDirLight(const DirLightDesc& desc)
 {
 	DirLightComponent lightComp{};
-	lightComp.direction = direction;
-	lightComp.ambient = color * 0.1f;
-	lightComp.diffuse = color;
-	lightComp.specular = color;
+	lightComp.direction = desc.direction;
+	lightComp.ambient = desc.ambient;
+	lightComp.diffuse = desc.diffuse;
+	lightComp.specular = desc.specular;
 	lightComp.lightSpaceMatrix = mat4(1.0f); // Will be updated below
 
 	const entt::entity lightEnt = lightRegistry.create();
 	auto& comp = lightRegistry.emplace<DirLightComponent>(lightEnt, lightComp);
 
 	// Create shadow map for this light using ShadowManager
-	comp.shadowMapHandle = createDirShadowMap(lightEnt, 4096, 4096);
+	if(desc.castShadows)
+		comp.shadowMapHandle = createDirShadowMap(lightEnt, 4096, 4096);
 
-	// Calculate light space matrix AFTER shadow map is created
-	recalcDirLightMatrix(lightEnt);
-	syncDirLights();
+	lightRegistry.emplace<LightSlotComponent>(lightEnt, dirSlots.allocate(packDirLight(comp), comp.lightSpaceMatrix));
+	lightRegistry.emplace<DirtyLightTag>(lightEnt);
 
 	return lightEnt;
 }
@@ -119,204 +256,262 @@ DirLightComponent& LightManager::getDirLight(const entt::entity lightEntity)
 
 void LightManager::updatePointLight(const entt::entity lightEntity)
 {
-	recalcPointLightMatrices(lightEntity);
-	syncPointLight(lightEntity);
+	assert(lightRegistry.all_of<PointLightComponent>(lightEntity) && "Entity does not have PointLightComponent");
+	lightRegistry.emplace_or_replace<DirtyLightTag>(lightEntity);
+	markChanged();
 }
 
 void LightManager::updateSpotlight(const entt::entity lightEntity)
 {
-	recalcSpotlightMatrix(lightEntity);
-	syncSpotlight(lightEntity);
+	assert(lightRegistry.all_of<SpotlightComponent>(lightEntity) && "Entity does not have SpotlightComponent");
+	lightRegistry.emplace_or_replace<DirtyLightTag>(lightEntity);
+	markChanged();
 }
 
 void LightManager::updateDirLight(const entt::entity lightEntity)
 {
-	recalcDirLightMatrix(lightEntity);
-	syncDirLight(lightEntity);
+	assert(lightRegistry.all_of<DirLightComponent>(lightEntity) && "Entity does not have DirLightComponent");
+	lightRegistry.emplace_or_replace<DirtyLightTag>(lightEntity);
+	markChanged();
 }
 
 void LightManager::deletePointLight(const entt::entity lightEntity)
 {
+	pointSlots.release(lightRegistry.get<LightSlotComponent>(lightEntity).slot);
 	destroyPointShadowMap(lightEntity);
 	lightRegistry.destroy(lightEntity);
-	syncPointLights();
+	markChanged();
 }
 
 void LightManager::deleteSpotlight(const entt::entity lightEntity)
 {
+	spotSlots.release(lightRegistry.get<LightSlotComponent>(lightEntity).slot);
 	destroySpotShadowMap(lightEntity);
 	lightRegistry.destroy(lightEntity);
-	syncSpotlights();
+	markChanged();
 }
 
 void LightManager::deleteDirLight(const entt::entity lightEntity)
 {
+	dirSlots.release(lightRegistry.get<LightSlotComponent>(lightEntity).slot);
 	destroyDirShadowMap(lightEntity);
 	lightRegistry.destroy(lightEntity);
-	syncDirLights();
+	markChanged();
 }
 
-void LightManager::renderShadows(const DrawModelsCallback& drawModels)
+void LightManager::renderShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels)
 {
-	renderDirLightShadows(drawModels);
-	renderPointLightShadows(drawModels);
-	renderSpotlightShadows(drawModels);
+	if(shadowSettings.dir)
+	{
+		GpuScope scope(profiler, "shadow/dir");
+		renderDirLightShadows(snapshot, drawModels);
+	}
+	if(shadowSettings.point)
+	{
+		GpuScope scope(profiler, "shadow/point");
+		renderPointLightShadows(snapshot, drawModels);
+	}
+	if(shadowSettings.spot)
+	{
+		GpuScope scope(profiler, "shadow/spot");
+		renderSpotlightShadows(snapshot, drawModels);
+	}
 }
 
-void LightManager::recalcPointLightMatrices(const entt::entity lightEntity)
+void LightManager::update()
 {
-	auto* pLight = lightRegistry.try_get<PointLightComponent>(lightEntity);
-	if(!pLight)
+	using namespace std::chrono;
+
+	if(lightRegistry.storage<DirtyLightTag>().empty())
 		return;
+	const auto start = steady_clock::now();
 
-	const float nearPlane = 0.1f;
-	const float farPlane = pLight->farPlane;
-	const mat4 projection = getPointLightProjection(nearPlane, farPlane);
-	const auto viewMatrices = getPointLightViewMatrices(pLight->position);
+	// ========== Gather ==========
+	pointBatch.clear();
+	const auto pointView = lightRegistry.view<DirtyLightTag, PointLightComponent>();
+	for(const entt::entity entity : pointView)
+	{
+		PointLightComponent& light = pointView.get<PointLightComponent>(entity);
+		pointBatch.push(light.position, light.farPlane, &light.shadowMatrices);
+	}
 
-	for(int face = 0; face < 6; ++face)
-		pLight->shadowMatrices[face] = projection * viewMatrices[face];
+	spotBatch.clear();
+	const auto spotView = lightRegistry.view<DirtyLightTag, SpotlightComponent>();
+	for(const entt::entity entity : spotView)
+	{
+		SpotlightComponent& light = spotView.get<SpotlightComponent>(entity);
+		spotBatch.push(light.position, light.direction, light.outerCutOff, &light.lightSpaceMatrix);
+	}
+
+	// ========== Recompute ==========
+	ComputePointLightMatrices(pointBatch, jobSystem);
+	ComputeSpotlightMatrices(spotBatch, jobSystem);
+
+	// Rarely more than a handful, not worth a batch
+	const auto dirView = lightRegistry.view<DirtyLightTag, DirLightComponent>();
+	for(const entt::entity entity : dirView)
+	{
+		DirLightComponent& light = dirView.get<DirLightComponent>(entity);
+		light.lightSpaceMatrix = DirLightSpaceMatrix(light.direction);
+	}
+
+	// ========== Write slots ==========
+	for(const entt::entity entity : pointView)
+	{
+		const PointLightComponent& light = pointView.get<PointLightComponent>(entity);
+		pointSlots.write(lightRegistry.get<LightSlotComponent>(entity).slot, packPointLight(light), {light.shadowMatrices});
+	}
+	for(const entt::entity entity : spotView)
+	{
+		const SpotlightComponent& light = spotView.get<SpotlightComponent>(entity);
+		spotSlots.write(lightRegistry.get<LightSlotComponent>(entity).slot, packSpotlight(light), light.lightSpaceMatrix);
+	}
+	uint32_t dirLights = 0;
+	for(const entt::entity entity : dirView)
+	{
+		const DirLightComponent& light = dirView.get<DirLightComponent>(entity);
+		dirSlots.write(lightRegistry.get<LightSlotComponent>(entity).slot, packDirLight(light), light.lightSpaceMatrix);
+		++dirLights;
+	}
+	lightRegistry.clear<DirtyLightTag>();
+
+	updateStats.pointLights = static_cast<uint32_t>(pointBatch.size());
+	updateStats.spotlights = static_cast<uint32_t>(spotBatch.size());
+	updateStats.dirLights = dirLights;
+	updateStats.matricesMs = duration<double, std::milli>(steady_clock::now() - start).count();
 }
 
-void LightManager::recalcSpotlightMatrix(const entt::entity lightEntity)
+void LightManager::extract(LightSnapshot& out)
 {
-	auto* sLight = lightRegistry.try_get<SpotlightComponent>(lightEntity);
-	if(!sLight)
+	update();
+
+	pointSlots.extract(out.pointLights);
+	spotSlots.extract(out.spotlights);
+	dirSlots.extract(out.dirLights);
+
+	if(out.version == version)
 		return;
+	out.version = version;
+
+	// Only shadow casters are copied, starting from the (smaller) shadow map storage
+	out.pointShadows.clear();
+	for(const auto [entity, shadowMap, light, slot] : lightRegistry.view<PointShadowMapComponent, PointLightComponent, LightSlotComponent>().each())
+		out.pointShadows.push_back({shadowMap, light, slot.slot});
 
-	sLight->lightSpaceMatrix = getSpotLightSpaceMatrix(
-		sLight->position,
-		normalize(sLight->direction),
-		sLight->outerCutOff, 0.1f, 50.0f
-	);
+	out.spotShadows.clear();
+	for(const auto [entity, shadowMap, light, slot] : lightRegistry.view<SpotShadowMapComponent, SpotlightComponent, LightSlotComponent>().each())
+		out.spotShadows.push_back({shadowMap, light, slot.slot});
+
+	out.dirShadows.clear();
+	for(const auto [entity, shadowMap, light, slot] : lightRegistry.view<DirShadowMapComponent, DirLightComponent, LightSlotComponent>().each())
+		out.dirShadows.push_back({shadowMap, light, slot.slot});
 }
 
-void LightManager::recalcDirLightMatrix(const entt::entity lightEntity)
+void LightManager::upload(LightSnapshot& snapshot)
 {
-	auto* dirLight = lightRegistry.try_get<DirLightComponent>(lightEntity);
-	if(!dirLight)
+	uploadLights(pointLightBuffer, pointShadowViewBuffer, snapshot.pointLights);
+	uploadLights(spotLightBuffer, spotShadowViewBuffer, snapshot.spotlights);
+	uploadLights(dirLightBuffer, dirShadowViewBuffer, snapshot.dirLights);
+
+	const uint32_t pointCount = pointLightBuffer.size();
+	const uint32_t spotCount = spotLightBuffer.size();
+	const uint32_t dirCount = dirLightBuffer.size();
+	if(pointCount == pointLightCount && spotCount == spotlightCount && dirCount == dirLightCount)
 		return;
 
-	dirLight->lightSpaceMatrix = getDirLightSpaceMatrix(
-		dirLight->direction,
-		50.0f, // ortho size - covers -50 to +50 on X/Y in light space
-		0.1f, // near plane
-		150.0f // far plane
-	);
+	pointLightCount = pointCount;
+	spotlightCount = spotCount;
+	dirLightCount = dirCount;
+
+	cachedMainShader.use();
+	cachedMainShader.setInt("u_numPointLights", pointLightCount);
+	cachedMainShader.setInt("u_numSpotLights", spotlightCount);
+	cachedMainShader.setInt("u_numDirLights", dirLightCount);
+
+	cachedSkyShader.use();
+	cachedSkyShader.setInt("u_numDirLights", dirLightCount);
 }
 
-void LightManager::syncPointLight(const entt::entity lightEntity)
+template<typename Light, typename ShadowView>
+void LightManager::uploadLights(LightBuffer& lightBuffer, LightBuffer& shadowViewBuffer, LightUpload<Light, ShadowView>& upload)
 {
-	const PointLightComponent& pointLight = getPointLight(lightEntity);
-	const GLuint index = static_cast<GLuint>(lightRegistry.view<PointLightComponent>()->index(lightEntity));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLightSSBO);
-	glBufferSubData(
-		GL_SHADER_STORAGE_BUFFER,
-		index * sizeof(PointLightComponent),
-		sizeof(PointLightComponent),
-		&pointLight
-	);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	const auto count = static_cast<uint32_t>(upload.lights.size());
+	lightBuffer.resize(upload.slotCount);
+	lightBuffer.write(upload.first, upload.lights.data(), count);
+	lightBuffer.flush();
+	shadowViewBuffer.resize(upload.slotCount);
+	shadowViewBuffer.write(upload.first, upload.shadowViews.data(), count);
+	shadowViewBuffer.flush();
+	upload.lights.clear();
+	upload.shadowViews.clear();
 }
 
-void LightManager::syncSpotlight(const entt::entity lightEntity)
+GpuPointLight LightManager::emptyPointLight()
 {
-	const SpotlightComponent& spotLight = getSpotlight(lightEntity);
-	const GLuint index = static_cast<GLuint>(lightRegistry.view<SpotlightComponent>()->index(lightEntity));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, spotLightSSBO);
-	glBufferSubData(
-		GL_SHADER_STORAGE_BUFFER,
-		index * sizeof(SpotlightComponent),
-		sizeof(SpotlightComponent),
-		&spotLight
-	);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GpuPointLight light{};
+	light.constant = 1.0f;
+	light.farPlane = POINT_LIGHT_FAR_PLANE;
+	return light;
 }
 
-void LightManager::syncDirLight(const entt::entity lightEntity)
+GpuSpotlight LightManager::emptySpotlight()
 {
-	const DirLightComponent& dirLight = getDirLight(lightEntity);
-	const GLuint index = static_cast<GLuint>(lightRegistry.view<DirLightComponent>()->index(lightEntity));
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sunLightSSBO);
-	glBufferSubData(
-		GL_SHADER_STORAGE_BUFFER,
-		index * sizeof(DirLightComponent),
-		sizeof(DirLightComponent),
-		&dirLight
-	);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GpuSpotlight light{};
+	light.direction = vec3(0.0f, -1.0f, 0.0f);
+	light.cutOff = 1.0f;
+	light.outerCutOff = 0.5f;
+	light.constant = 1.0f;
+	return light;
 }
 
-void LightManager::syncPointLights()
+GpuDirLight LightManager::emptyDirLight()
 {
-	const uint32_t pLightsCount = lightRegistry.view<PointLightComponent>().size();
-
-	cachedMainShader.use();
-	cachedMainShader.setInt("u_numPointLights", pLightsCount);
-
-	vector<PointLightComponent> pointLights;
-	pointLights.reserve(pLightsCount);
-	const auto& pLightView = lightRegistry.view<PointLightComponent>();
-	pLightView.each([&](const PointLightComponent& light) { pointLights.push_back(light); });
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, pointLightSSBO);
-	glBufferData(
-		GL_SHADER_STORAGE_BUFFER,
-		pLightsCount * sizeof(PointLightComponent),
-		pointLights.data(),
-		GL_DYNAMIC_DRAW
-	);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::PointLights), pointLightSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GpuDirLight light{};
+	light.direction = vec3(0.0f, -1.0f, 0.0f);
+	return light;
 }
 
-void LightManager::syncSpotlights()
+GpuPointLight LightManager::packPointLight(const PointLightComponent& light)
 {
-	const uint32_t sLightsCount = lightRegistry.view<SpotlightComponent>().size();
-
-	cachedMainShader.use();
-	cachedMainShader.setInt("u_numSpotLights", sLightsCount);
-
-	vector<SpotlightComponent> spotLights;
-	spotLights.reserve(sLightsCount);
-	const auto& sLightView = lightRegistry.view<SpotlightComponent>();
-	sLightView.each([&](const SpotlightComponent& light) { spotLights.push_back(light); });
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, spotLightSSBO);
-	glBufferData(
-		GL_SHADER_STORAGE_BUFFER,
-		sLightsCount * sizeof(SpotlightComponent),
-		spotLights.data(),
-		GL_DYNAMIC_DRAW
-	);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::Spotlights), spotLightSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GpuPointLight gpu{};
+	gpu.position = light.position;
+	gpu.constant = light.constant;
+	gpu.ambient = light.ambient;
+	gpu.linear = light.linear;
+	gpu.diffuse = light.diffuse;
+	gpu.quadratic = light.quadratic;
+	gpu.specular = light.specular;
+	gpu.farPlane = light.farPlane;
+	gpu.shadowMap = light.cubeMapHandle;
+	return gpu;
 }
 
-void LightManager::syncDirLights()
+GpuSpotlight LightManager::packSpotlight(const SpotlightComponent& light)
 {
-	const uint32_t dLightsCount = lightRegistry.view<DirLightComponent>().size();
-
-	cachedMainShader.use();
-	cachedMainShader.setInt("u_numDirLights", dLightsCount);
-
-	vector<DirLightComponent> dirLights;
-	dirLights.reserve(dLightsCount);
-	const auto& dLightView = lightRegistry.view<DirLightComponent>();
-	dLightView.each([&](const DirLightComponent& light) { dirLights.push_back(light); });
-
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sunLightSSBO);
-	glBufferData(
-		GL_SHADER_STORAGE_BUFFER,
-		dLightsCount * sizeof(DirLightComponent),
-		dirLights.data(),
-		GL_DYNAMIC_DRAW
-	);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::DirLights), sunLightSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	GpuSpotlight gpu{};
+	gpu.position = light.position;
+	gpu.cutOff = light.cutOff;
+	gpu.direction = light.direction;
+	gpu.outerCutOff = light.outerCutOff;
+	gpu.ambient = light.ambient;
+	gpu.constant = light.constant;
+	gpu.diffuse = light.diffuse;
+	gpu.linear = light.linear;
+	gpu.specular = light.specular;
+	gpu.quadratic = light.quadratic;
+	gpu.shadowMap = light.shadowMapHandle;
+	return gpu;
+}
 
-	cachedSkyShader.use();
-	cachedSkyShader.setInt("u_numDirLights", dLightsCount);
+GpuDirLight LightManager::packDirLight(const DirLightComponent& light)
+{
+	GpuDirLight gpu{};
+	gpu.direction = light.direction;
+	gpu.ambient = light.ambient;
+	gpu.diffuse = light.diffuse;
+	gpu.specular = light.specular;
+	gpu.shadowMap = light.shadowMapHandle;
+	return gpu;
 }
 
 GLuint64 LightManager::createPointShadowMap(entt::entity lightEntity, uint32_t size)
@@ -324,6 +519,7 @@ GLuint64 LightManager::createPointShadowMap(entt::entity lightEntity, uint32_t s
 	auto& comp = lightRegistry.emplace<PointShadowMapComponent>(lightEntity);
 	comp.shadowSize = size;
 	setupPointShadowTexture(comp);
+	GpuMemory().track(ResidentMemory::Texture, comp.depthCubeMap, GpuMemoryCategory::ShadowMap, DepthTextureBytes(size, size, 6));
 
 	// Create bindless handle
 	const GLuint64 handle = glGetTextureHandleARB(comp.depthCubeMap);
@@ -340,9 +536,15 @@ void LightManager::destroyPointShadowMap(entt::entity lightEntity)
 			glMakeTextureHandleNonResidentARB(handle);
 
 		if(comp->depthCubeMap)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, comp->depthCubeMap);
 			glDeleteTextures(1, &comp->depthCubeMap);
+		}
 		if(comp->frameBuffer)
+		{
+			GLState().forgetFramebuffer(comp->frameBuffer);
 			glDeleteFramebuffers(1, &comp->frameBuffer);
+		}
 
 		lightRegistry.remove<PointShadowMapComponent>(lightEntity);
 	}
@@ -354,6 +556,7 @@ GLuint64 LightManager::createSpotShadowMap(entt::entity lightEntity, uint32_t wi
 	comp.shadowWidth = width;
 	comp.shadowHeight = height;
 	setupSpotShadowTexture(comp);
+	GpuMemory().track(ResidentMemory::Texture, comp.depthTexture, GpuMemoryCategory::ShadowMap, DepthTextureBytes(width, height));
 
 	const GLuint64 handle = glGetTextureHandleARB(comp.depthTexture);
 	glMakeTextureHandleResidentARB(handle);
@@ -369,9 +572,15 @@ void LightManager::destroySpotShadowMap(entt::entity lightEntity)
 			glMakeTextureHandleNonResidentARB(handle);
 
 		if(comp->depthTexture)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, comp->depthTexture);
 			glDeleteTextures(1, &comp->depthTexture);
+		}
 		if(comp->frameBuffer)
+		{
+			GLState().forgetFramebuffer(comp->frameBuffer);
 			glDeleteFramebuffers(1, &comp->frameBuffer);
+		}
 
 		lightRegistry.remove<SpotShadowMapComponent>(lightEntity);
 	}
@@ -383,6 +592,7 @@ GLuint64 LightManager::createDirShadowMap(entt::entity lightEntity, uint32_t wid
 	comp.shadowWidth = width;
 	comp.shadowHeight = height;
 	setupDirShadowTexture(comp);
+	GpuMemory().track(ResidentMemory::Texture, comp.depthTexture, GpuMemoryCategory::ShadowMap, DepthTextureBytes(width, height));
 
 	const GLuint64 handle = glGetTextureHandleARB(comp.depthTexture);
 	glMakeTextureHandleResidentARB(handle);
@@ -398,59 +608,20 @@ void LightManager::destroyDirShadowMap(entt::entity lightEntity)
 			glMakeTextureHandleNonResidentARB(handle);
 
 		if(comp->depthTexture)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, comp->depthTexture);
 			glDeleteTextures(1, &comp->depthTexture);
+		}
 		if(comp->frameBuffer)
+		{
+			GLState().forgetFramebuffer(comp->frameBuffer);
 			glDeleteFramebuffers(1, &comp->frameBuffer);
+		}
 
 		lightRegistry.remove<DirShadowMapComponent>(lightEntity);
 	}
 }
 
-std::array<mat4, 6> LightManager::getPointLightViewMatrices(const vec3& lightPos)
-{
-	return {
-		lookAt(lightPos, lightPos + vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // +X
-		lookAt(lightPos, lightPos + vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // -X
-		lookAt(lightPos, lightPos + vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)), // +Y
-		lookAt(lightPos, lightPos + vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, -1.0f)), // -Y
-		lookAt(lightPos, lightPos + vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f)), // +Z
-		lookAt(lightPos, lightPos + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, -1.0f, 0.0f)) // -Z
-	};
-}
-
-mat4 LightManager::getPointLightProjection(const float nearPlane, const float farPlane)
-{
-	return perspective(radians(90.0f), 1.0f, nearPlane, farPlane);
-}
-
-mat4 LightManager::getSpotLightSpaceMatrix(const vec3& position, const vec3& direction, float outerCutOff,
-										   const float nearPlane, const float farPlane)
-{
-	float fov = acos(outerCutOff) * 2.0f;
-	fov = glm::clamp(fov, glm::radians(10.0f), glm::radians(170.0f));
-
-	const mat4 projection = perspective(fov, 1.0f, nearPlane, farPlane);
-
-	// Handle case where direction is parallel to the default up vector
-	const vec3 normalizedDir = normalize(direction);
-	vec3 up = vec3(0.0f, 1.0f, 0.0f);
-	if(abs(dot(normalizedDir, up)) > 0.99f)
-		up = vec3(1.0f, 0.0f, 0.0f);
-
-	// LookAt from position + small offset to avoid self-shadowing issues
-	// Ensure the camera is looking in the right direction
-	const mat4 view = lookAt(position, position + normalizedDir, up);
-
-	return projection * view;
-}
-
-mat4 LightManager::getDirLightSpaceMatrix(const vec3& lightDir, const float orthoSize, const float nearPlane, const float farPlane)
-{
-	const mat4 lightProjection = ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, nearPlane, farPlane);
-	const mat4 lightView = lookAt(-normalize(lightDir) * 25.0f, vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
-	return lightProjection * lightView;
-}
-
 void LightManager::setupPointShadowTexture(PointShadowMapComponent& comp)
 {
 	glGenFramebuffers(1, &comp.frameBuffer);
@@ -469,7 +640,7 @@ void LightManager::setupPointShadowTexture(PointShadowMapComponent& comp)
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, comp.frameBuffer);
+	GLState().bindFramebuffer(comp.frameBuffer);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, comp.depthCubeMap, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
@@ -477,7 +648,7 @@ void LightManager::setupPointShadowTexture(PointShadowMapComponent& comp)
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cerr << "ERROR: Point light shadow map framebuffer is not complete!" << std::endl;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().bindFramebuffer(0);
 }
 
 void LightManager::setupSpotShadowTexture(SpotShadowMapComponent& comp)
@@ -501,7 +672,7 @@ void LightManager::setupSpotShadowTexture(SpotShadowMapComponent& comp)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, comp.frameBuffer);
+	GLState().bindFramebuffer(comp.frameBuffer);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, comp.depthTexture, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
@@ -509,7 +680,7 @@ void LightManager::setupSpotShadowTexture(SpotShadowMapComponent& comp)
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cerr << "ERROR: Spotlight shadow map framebuffer is not complete!" << std::endl;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().bindFramebuffer(0);
 }
 
 void LightManager::setupDirShadowTexture(DirShadowMapComponent& comp)
@@ -538,7 +709,7 @@ void LightManager::setupDirShadowTexture(DirShadowMapComponent& comp)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, comp.frameBuffer);
+	GLState().bindFramebuffer(comp.frameBuffer);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, comp.depthTexture, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
@@ -546,97 +717,99 @@ void LightManager::setupDirShadowTexture(DirShadowMapComponent& comp)
 	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		std::cerr << "ERROR: Directional light shadow map framebuffer is not complete!" << std::endl;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().bindFramebuffer(0);
 }
 
-void LightManager::renderDirLightShadows(const DrawModelsCallback& drawModels)
+void LightManager::renderDirLightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels)
 {
-	if(lightRegistry.storage<DirShadowMapComponent>().empty())
+	if(snapshot.dirShadows.empty())
 		return;
 
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(2.0f, 4.0f);
+	GLState().enable(GL_CULL_FACE);
+	GLState().cullFace(GL_BACK);
+	GLState().enable(GL_POLYGON_OFFSET_FILL);
+	GLState().polygonOffset(2.0f, 4.0f);
 
 	cachedShadowMapShader.use();
 
-	auto view = lightRegistry.view<DirLightComponent, DirShadowMapComponent>();
-	for(auto [entity, light, shadowComp] : view.each())
+	for(const auto& [shadowComp, light, slot] : snapshot.dirShadows)
 	{
-		glViewport(0, 0, shadowComp.shadowWidth, shadowComp.shadowHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, shadowComp.frameBuffer);
+		char scopeName[32];
+		GpuScope scope(profiler, profiler ? ShadowScopeName(scopeName, "dir", slot) : string_view());
+		GLState().viewport(0, 0, shadowComp.shadowWidth, shadowComp.shadowHeight);
+		GLState().bindFramebuffer(shadowComp.frameBuffer);
 		glClear(GL_DEPTH_BUFFER_BIT);
+		RenderCounters().recordShadowMap();
 
 		cachedShadowMapShader.setMat4("lightSpaceMatrix", light.lightSpaceMatrix);
 		drawModels(cachedShadowMapShader);
 	}
 
-	glDisable(GL_POLYGON_OFFSET_FILL);
-	glDisable(GL_CULL_FACE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().disable(GL_POLYGON_OFFSET_FILL);
+	GLState().disable(GL_CULL_FACE);
+	GLState().bindFramebuffer(0);
 }
 
-void LightManager::renderPointLightShadows(const DrawModelsCallback& drawModels)
+void LightManager::renderPointLightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels)
 {
-	if(lightRegistry.storage<PointShadowMapComponent>().empty())
+	if(snapshot.pointShadows.empty())
 		return;
 
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_FRONT);
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(1.0f, 1.0f);
+	GLState().enable(GL_CULL_FACE);
+	GLState().cullFace(GL_FRONT);
+	GLState().enable(GL_POLYGON_OFFSET_FILL);
+	GLState().polygonOffset(1.0f, 1.0f);
 
 	cachedShadowPointShader.use();
 	cachedShadowPointShader.setFloat("farPlane", POINT_LIGHT_FAR_PLANE);
 
-	auto view = lightRegistry.view<PointLightComponent, PointShadowMapComponent>();
-	for(auto [entity, light, shadowComp] : view.each())
+	for(const auto& [shadowComp, light, slot] : snapshot.pointShadows)
 	{
-		glViewport(0, 0, shadowComp.shadowSize, shadowComp.shadowSize);
-		glBindFramebuffer(GL_FRAMEBUFFER, shadowComp.frameBuffer);
+		char scopeName[32];
+		GpuScope scope(profiler, profiler ? ShadowScopeName(scopeName, "point", slot) : string_view());
+		GLState().viewport(0, 0, shadowComp.shadowSize, shadowComp.shadowSize);
+		GLState().bindFramebuffer(shadowComp.frameBuffer);
 		glClear(GL_DEPTH_BUFFER_BIT);
+		RenderCounters().recordShadowMap();
 
+		// The cube face matrices are read from the shadow view SSBO at this slot
 		cachedShadowPointShader.setVec3("lightPos", light.position);
-
-		for(int face = 0; face < 6; ++face)
-		{
-			string uniformName = "shadowMatrices[" + std::to_string(face) + "]";
-			cachedShadowPointShader.setMat4(uniformName, light.shadowMatrices[face]);
-		}
+		cachedShadowPointShader.setInt("lightSlot", static_cast<int>(slot));
 
 		drawModels(cachedShadowPointShader);
 	}
 
-	glDisable(GL_POLYGON_OFFSET_FILL);
-	glDisable(GL_CULL_FACE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().disable(GL_POLYGON_OFFSET_FILL);
+	GLState().disable(GL_CULL_FACE);
+	GLState().bindFramebuffer(0);
 }
 
-void LightManager::renderSpotlightShadows(const DrawModelsCallback& drawModels)
+void LightManager::renderSpotlightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels)
 {
-	if(lightRegistry.storage<SpotShadowMapComponent>().empty())
+	if(snapshot.spotShadows.empty())
 		return;
 
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(1.1f, 4.0f);
+	GLState().enable(GL_CULL_FACE);
+	GLState().cullFace(GL_BACK);
+	GLState().enable(GL_POLYGON_OFFSET_FILL);
+	GLState().polygonOffset(1.1f, 4.0f);
 
 	cachedShadowMapShader.use();
 
-	auto view = lightRegistry.view<SpotlightComponent, SpotShadowMapComponent>();
-	for(auto [entity, light, shadowComp] : view.each())
+	for(const auto& [shadowComp, light, slot] : snapshot.spotShadows)
 	{
-		glViewport(0, 0, shadowComp.shadowWidth, shadowComp.shadowHeight);
-		glBindFramebuffer(GL_FRAMEBUFFER, shadowComp.frameBuffer);
+		char scopeName[32];
+		GpuScope scope(profiler, profiler ? ShadowScopeName(scopeName, "spot", slot) : string_view());
+		GLState().viewport(0, 0, shadowComp.shadowWidth, shadowComp.shadowHeight);
+		GLState().bindFramebuffer(shadowComp.frameBuffer);
 		glClear(GL_DEPTH_BUFFER_BIT);
+		RenderCounters().recordShadowMap();
 
 		cachedShadowMapShader.setMat4("lightSpaceMatrix", light.lightSpaceMatrix);
 		drawModels(cachedShadowMapShader);
 	}
 
-	glDisable(GL_POLYGON_OFFSET_FILL);
-	glDisable(GL_CULL_FACE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	GLState().disable(GL_POLYGON_OFFSET_FILL);
+	GLState().disable(GL_CULL_FACE);
+	GLState().bindFramebuffer(0);
 }
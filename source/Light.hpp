@@ -3,14 +3,267 @@
 #include <glad/glad.h>
 #include "Shader.hpp"
 #include <entt/entity/registry.hpp>
+#include <algorithm>
 #include <functional>
+#include <span>
 #include "Components.hpp"
+#include "FrameArena.hpp"
+#include "FunctionRef.hpp"
+#include "GpuProfiler.hpp"
+#include "LightBuffer.hpp"
+#include "LightMatrices.hpp"
 
 using namespace glm;
 
-// Callback type for drawing models during shadow passes
-using DrawModelsCallback = std::function<void(const Shader&)>;
+// Callback type for drawing models during shadow passes, only called while the pass runs
+using DrawModelsCallback = FunctionRef<void(const Shader&)>;
 
+// Which light types render shadow maps
+struct ShadowSettings
+{
+	bool dir = true;
+	bool point = true;
+	bool spot = true;
+};
+
+// Plain light descriptions, used for bulk creation and stored as-is in binary scene files
+struct PointLightDesc
+{
+	vec3 position{0.0f};
+	vec3 ambient{0.0f};
+	vec3 diffuse{1.0f};
+	vec3 specular{1.0f};
+	float constant = 1.0f;
+	float linear = 0.09f;
+	float quadratic = 0.032f;
+	uint32_t castShadows = 1;
+};
+
+struct SpotlightDesc
+{
+	vec3 position{0.0f};
+	vec3 direction{0.0f, -1.0f, 0.0f};
+	vec3 ambient{0.0f};
+	vec3 diffuse{1.0f};
+	vec3 specular{1.0f};
+	float cutOff = 0.976296f;      // cos(12.5 degrees)
+	float outerCutOff = 0.953717f; // cos(17.5 degrees)
+	float constant = 1.0f;
+	float linear = 0.09f;
+	float quadratic = 0.032f;
+	uint32_t castShadows = 1;
+};
+
+struct DirLightDesc
+{
+	vec3 direction{0.0f, -1.0f, 0.0f};
+	vec3 ambient{0.0f};
+	vec3 diffuse{1.0f};
+	vec3 specular{1.0f};
+	uint32_t castShadows = 1;
+};
+
+// ========== GPU light records ==========
+// std430 layouts of the light SSBOs, mirrored by include/lights.glsl. The shading records are what the light
+// loops read per fragment. Shadow views live in separate SSBOs with the same slots: the point light cube faces
+// are only read by the shadow pass, the spot/dir matrices only by lights that have a shadow map.
+
+struct GpuPointLight
+{
+	vec3 position;
+	float constant;
+	vec3 ambient;
+	float linear;
+	vec3 diffuse;
+	float quadratic;
+	vec3 specular;
+	float farPlane;
+	GLuint64 shadowMap; // samplerCube, 0 without shadows
+	float _pad[2];
+};
+
+struct GpuSpotlight
+{
+	vec3 position;
+	float cutOff;
+	vec3 direction;
+	float outerCutOff;
+	vec3 ambient;
+	float constant;
+	vec3 diffuse;
+	float linear;
+	vec3 specular;
+	float quadratic;
+	GLuint64 shadowMap; // sampler2DShadow, 0 without shadows
+	float _pad[2];
+};
+
+struct GpuDirLight
+{
+	vec3 direction;
+	float _pad0;
+	vec3 ambient;
+	float _pad1;
+	vec3 diffuse;
+	float _pad2;
+	vec3 specular;
+	float _pad3;
+	GLuint64 shadowMap; // sampler2DShadow, 0 without shadows
+	float _pad4[2];
+};
+
+struct PointShadowView
+{
+	array<mat4, 6> faces;
+};
+
+static_assert(sizeof(GpuPointLight) == 80 && sizeof(GpuSpotlight) == 96 && sizeof(GpuDirLight) == 80,
+			  "GPU light records must match the std430 layouts in lights.glsl");
+
+// Shadow map of one light with a copy of the light, slot is its index in the light SSBO
+template<typename ShadowMap, typename Light>
+struct ShadowPass
+{
+	ShadowMap shadowMap;
+	Light light;
+	uint32_t slot;
+};
+
+// Slots of one light type changed since the previous extract, lights[0] and shadowViews[0] go into slot first.
+// Staged in the frame arena of the snapshot it belongs to.
+template<typename Light, typename ShadowView>
+struct LightUpload
+{
+	explicit LightUpload(ScratchArena& arena) : lights(ArenaAllocator<Light>(arena)), shadowViews(ArenaAllocator<ShadowView>(arena)) {}
+
+	uint32_t slotCount = 0; // size of the SSBOs, holes included
+	uint32_t first = 0;
+	ArenaVector<Light> lights;
+	ArenaVector<ShadowView> shadowViews;
+};
+
+// Copy of everything the render thread needs from the lights: SSBO changes and shadow passes
+struct LightSnapshot
+{
+	explicit LightSnapshot(ScratchArena& arena) : pointLights(arena), spotlights(arena), dirLights(arena) {}
+
+	uint64_t version = 0; // LightManager version the shadow passes were captured at
+	LightUpload<GpuPointLight, PointShadowView> pointLights;
+	LightUpload<GpuSpotlight, mat4> spotlights;
+	LightUpload<GpuDirLight, mat4> dirLights;
+	vector<ShadowPass<PointShadowMapComponent, PointLightComponent>> pointShadows;
+	vector<ShadowPass<SpotShadowMapComponent, SpotlightComponent>> spotShadows;
+	vector<ShadowPass<DirShadowMapComponent, DirLightComponent>> dirShadows;
+};
+
+// SSBO slot of a light, stable for the light's lifetime
+struct LightSlotComponent
+{
+	uint32_t slot;
+};
+
+// Lights created or updated since the last LightManager::update, their matrices and slots are stale
+struct DirtyLightTag {};
+
+// Lights of one type by SSBO slot, a shading record and a shadow view per slot. A deleted light leaves a hole that
+// lights nothing, holes are refilled lowest first and trailing ones are trimmed, so the arrays stay dense.
+// Remembers the slot range changed since the last extract.
+template<typename Light, typename ShadowView>
+class LightSlots
+{
+public:
+	explicit LightSlots(const Light& hole) : hole(hole) {}
+
+	uint32_t allocate(const Light& light, const ShadowView& shadowView)
+	{
+		uint32_t slot = static_cast<uint32_t>(lights.size());
+		while(!freeSlots.empty())
+		{
+			pop_heap(freeSlots.begin(), freeSlots.end(), greater<>());
+			const uint32_t freeSlot = freeSlots.back();
+			freeSlots.pop_back();
+			// Trimmed or already reused slots leave stale entries behind
+			if(freeSlot < lights.size() && !used[freeSlot])
+			{
+				slot = freeSlot;
+				break;
+			}
+		}
+
+		if(slot == lights.size())
+		{
+			lights.emplace_back();
+			shadowViews.emplace_back();
+			used.push_back(0);
+		}
+		used[slot] = 1;
+		write(slot, light, shadowView);
+		return slot;
+	}
+
+	void write(const uint32_t slot, const Light& light, const ShadowView& shadowView)
+	{
+		lights[slot] = light;
+		shadowViews[slot] = shadowView;
+		dirtyBegin = std::min(dirtyBegin, slot);
+		dirtyEnd = std::max(dirtyEnd, slot + 1);
+	}
+
+	void release(const uint32_t slot)
+	{
+		used[slot] = 0;
+		write(slot, hole, ShadowView{});
+		freeSlots.push_back(slot);
+		push_heap(freeSlots.begin(), freeSlots.end(), greater<>());
+		while(!used.empty() && !used.back())
+		{
+			lights.pop_back();
+			shadowViews.pop_back();
+			used.pop_back();
+		}
+	}
+
+	// Copies the changed slots into upload, merged with a range it still holds from an earlier extract
+	void extract(LightUpload<Light, ShadowView>& upload)
+	{
+		const auto count = static_cast<uint32_t>(lights.size());
+		uint32_t begin = dirtyBegin;
+		uint32_t end = dirtyEnd;
+		if(!upload.lights.empty())
+		{
+			begin = std::min(begin, upload.first);
+			end = std::max(end, upload.first + static_cast<uint32_t>(upload.lights.size()));
+		}
+		end = std::min(end, count);
+
+		upload.slotCount = count;
+		upload.lights.clear();
+		upload.shadowViews.clear();
+		if(begin < end)
+		{
+			upload.first = begin;
+			upload.lights.assign(lights.begin() + begin, lights.begin() + end);
+			upload.shadowViews.assign(shadowViews.begin() + begin, shadowViews.begin() + end);
+		}
+		dirtyBegin = UINT32_MAX;
+		dirtyEnd = 0;
+	}
+
+	[[nodiscard]] uint32_t size() const { return static_cast<uint32_t>(lights.size()); }
+
+private:
+	Light hole;
+	vector<Light> lights;
+	vector<ShadowView> shadowViews;
+	vector<uint8_t> used;
+	vector<uint32_t> freeSlots; // min-heap
+	uint32_t dirtyBegin = UINT32_MAX;
+	uint32_t dirtyEnd = 0;
+};
+
+// Lights are created/deleted on the GL thread (shadow maps are GL objects). get*/update* don't touch GL,
+// so they also work from the simulation thread; every change reaches the GPU through extract + upload.
+// Every light keeps its SSBO slot for its lifetime, so an upload only carries the slot range that changed.
 class LightManager
 {
 public:
@@ -21,44 +274,120 @@ public:
 	entt::entity createSpotlight(const vec3& position, const vec3& direction, const vec3& color);
 	entt::entity createDirLight(const vec3& direction, const vec3& color);
 
+	// Bulk creation, the light buffer of each type is uploaded once for the whole batch
+	void createPointLights(span<const PointLightDesc> descs, vector<entt::entity>* outEntities = nullptr);
+	void createSpotlights(span<const SpotlightDesc> descs, vector<entt::entity>* outEntities = nullptr);
+	void createDirLights(span<const DirLightDesc> descs, vector<entt::entity>* outEntities = nullptr);
+
+	// Current lights as descriptions
+	[[nodiscard]] vector<PointLightDesc> getPointLightDescs() const;
+	[[nodiscard]] vector<SpotlightDesc> getSpotlightDescs() const;
+	[[nodiscard]] vector<DirLightDesc> getDirLightDescs() const;
+
 	PointLightComponent& getPointLight(entt::entity lightEntity);
 	SpotlightComponent& getSpotlight(entt::entity lightEntity);
 	DirLightComponent& getDirLight(entt::entity lightEntity);
 
+	// Queues the light after its component was edited, its matrices and slot are refreshed by update()
 	void updatePointLight(entt::entity lightEntity);
 	void updateSpotlight(entt::entity lightEntity);
 	void updateDirLight(entt::entity lightEntity);
 
+	// Of the last update() that had lights to recompute
+	struct UpdateStats
+	{
+		uint32_t pointLights = 0;
+		uint32_t spotlights = 0;
+		uint32_t dirLights = 0;
+		double matricesMs = 0.0;
+	};
+
+	// Recomputes the matrices of every created/updated light in SIMD batches and writes their slots.
+	// extract() runs it first, call it earlier only to read fresh matrices from the components.
+	void update();
+	[[nodiscard]] const UpdateStats& getUpdateStats() const { return updateStats; }
+
+	// Large batches of light matrices are split across it when set
+	void setJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+
 	void deletePointLight(entt::entity lightEntity);
 	void deleteSpotlight(entt::entity lightEntity);
 	void deleteDirLight(entt::entity lightEntity);
 
+	// Moves the slots changed since the last extract into a snapshot, shadow passes are refreshed when stale
+	void extract(LightSnapshot& out);
+	// GL thread: writes the snapshot's changed slots into the light and shadow view SSBOs, one flush per buffer
+	void upload(LightSnapshot& snapshot);
+	// Bumped by every create/update/delete
+	[[nodiscard]] uint64_t getVersion() const { return version; }
+
 	// Shadow rendering - takes a callback to draw models
-	void renderShadows(const DrawModelsCallback& drawModels);
+	void renderShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels);
+
+	void setShadowSettings(const ShadowSettings& settings) { shadowSettings = settings; }
+	[[nodiscard]] const ShadowSettings& getShadowSettings() const { return shadowSettings; }
+
+	// Optional, times every shadow pass per light when set
+	void setProfiler(GpuProfiler* gpuProfiler) { profiler = gpuProfiler; }
+
+	// SSBO sizes of the last upload, holes of deleted lights included
+	[[nodiscard]] uint32_t getPointLightCount() const { return pointLightCount; }
+	[[nodiscard]] uint32_t getSpotlightCount() const { return spotlightCount; }
+	[[nodiscard]] uint32_t getDirLightCount() const { return dirLightCount; }
 
 private:
 	entt::registry lightRegistry;
 
-	GLuint pointLightSSBO = 0;
-	GLuint spotLightSSBO = 0;
-	GLuint sunLightSSBO = 0;
+	LightSlots<GpuPointLight, PointShadowView> pointSlots;
+	LightSlots<GpuSpotlight, mat4> spotSlots;
+	LightSlots<GpuDirLight, mat4> dirSlots;
+
+	LightBuffer pointLightBuffer;
+	LightBuffer spotLightBuffer;
+	LightBuffer dirLightBuffer;
+	LightBuffer pointShadowViewBuffer;
+	LightBuffer spotShadowViewBuffer;
+	LightBuffer dirShadowViewBuffer;
+
+	uint32_t pointLightCount = 0;
+	uint32_t spotlightCount = 0;
+	uint32_t dirLightCount = 0;
+
+	uint64_t version = 1;
+	uint64_t uploadedVersion = 0;
+
+	ShadowSettings shadowSettings;
+	GpuProfiler* profiler = nullptr;
+	JobSystem* jobSystem = nullptr;
+
+	PointLightBatch pointBatch;
+	SpotlightBatch spotBatch;
+	UpdateStats updateStats;
 
 	const Shader& cachedMainShader;
 	const Shader& cachedSkyShader;
 	const Shader& cachedShadowMapShader;
 	const Shader& cachedShadowPointShader;
 
-	void recalcPointLightMatrices(entt::entity lightEntity);
-	void recalcSpotlightMatrix(entt::entity entityEntity);
-	void recalcDirLightMatrix(entt::entity entityEntity);
+	// Creates the entity, its shadow map and slot, matrices follow in the next update()
+	entt::entity addPointLight(const PointLightDesc& desc);
+	entt::entity addSpotlight(const SpotlightDesc& desc);
+	entt::entity addDirLight(const DirLightDesc& desc);
+
+	void markChanged() { ++version; }
 
-	void syncPointLight(entt::entity lightEntity);
-	void syncSpotlight(entt::entity lightEntity);
-	void syncDirLight(entt::entity lightEntity);
+	// Lights written into holes, they add nothing to the shading and keep the shader math finite
+	static GpuPointLight emptyPointLight();
+	static GpuSpotlight emptySpotlight();
+	static GpuDirLight emptyDirLight();
 
-	void syncPointLights();
-	void syncSpotlights();
-	void syncDirLights();
+	// Shading records of the components, the shadow views are copied from their matrices
+	static GpuPointLight packPointLight(const PointLightComponent& light);
+	static GpuSpotlight packSpotlight(const SpotlightComponent& light);
+	static GpuDirLight packDirLight(const DirLightComponent& light);
+
+	template<typename Light, typename ShadowView>
+	static void uploadLights(LightBuffer& lightBuffer, LightBuffer& shadowViewBuffer, LightUpload<Light, ShadowView>& upload);
 
 	// ============ Shadows ============ //
 
@@ -74,14 +403,6 @@ private:
 	GLuint64 createDirShadowMap(entt::entity lightEntity, uint32_t width = 4096, uint32_t height = 4096);
 	void destroyDirShadowMap(entt::entity lightEntity);
 
-	// Utility functions for light space matrices
-	static std::array<mat4, 6> getPointLightViewMatrices(const vec3& lightPos);
-	static mat4 getPointLightProjection(float nearPlane = 0.1f, float farPlane = 50.0f);
-	static mat4 getSpotLightSpaceMatrix(const vec3& position, const vec3& direction,
-										float outerCutOff, float nearPlane = 0.1f, float farPlane = 50.0f);
-	static mat4 getDirLightSpaceMatrix(const vec3& lightDir, float orthoSize = 20.0f,
-									   float nearPlane = 1.0f, float farPlane = 50.0f);
-
 	static constexpr float POINT_LIGHT_FAR_PLANE = 50.0f;
 
 	// Shadow texture setup helpers
@@ -90,9 +411,9 @@ private:
 	static void setupDirShadowTexture(DirShadowMapComponent& comp);
 
 	// Shadow rendering implementations
-	void renderDirLightShadows(const DrawModelsCallback& drawModels);
-	void renderPointLightShadows(const DrawModelsCallback& drawModels);
-	void renderSpotlightShadows(const DrawModelsCallback& drawModels);
+	void renderDirLightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels);
+	void renderPointLightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels);
+	void renderSpotlightShadows(const LightSnapshot& snapshot, const DrawModelsCallback& drawModels);
 };
 
 void setupLightTracking(LightManager& lManager, entt::registry& registry, const Shader& mainShader);
@@ -0,0 +1,160 @@
+#include "LightBuffer.hpp"
+#include <algorithm>
+#include <cstring>
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+
+LightBuffer::LightBuffer(const GLuint binding, const size_t stride)
+: binding(binding), stride(stride)
+{
+	GLint alignment = 1;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	offsetAlignment = static_cast<size_t>(std::max(alignment, 1));
+
+	// Bound from the start, so shaders always see a valid buffer even without lights
+	allocate(INITIAL_CAPACITY);
+	changed = false;
+	bindCurrent();
+}
+
+LightBuffer::~LightBuffer()
+{
+	for(Region& region : regions)
+	{
+		if(region.fence)
+			glDeleteSync(region.fence);
+	}
+	if(buffer)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		GLState().forgetBuffer(buffer);
+		GpuMemory().untrack(ResidentMemory::Buffer, buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+}
+
+void LightBuffer::resize(const uint32_t slots)
+{
+	if(slots == slotCount)
+		return;
+
+	lights.resize(static_cast<size_t>(slots) * stride);
+	slotCount = slots;
+	if(slots > capacity)
+		allocate(std::max(slots, capacity * 2));
+}
+
+void LightBuffer::write(const uint32_t first, const void* data, const uint32_t count)
+{
+	if(count == 0)
+		return;
+
+	memcpy(lights.data() + first * stride, data, count * stride);
+	for(Region& region : regions)
+	{
+		if(region.dirtyBegin == region.dirtyEnd)
+		{
+			region.dirtyBegin = first;
+			region.dirtyEnd = first + count;
+		}
+		else
+		{
+			region.dirtyBegin = std::min(region.dirtyBegin, first);
+			region.dirtyEnd = std::max(region.dirtyEnd, first + count);
+		}
+	}
+	changed = true;
+}
+
+void LightBuffer::flush()
+{
+	if(!changed)
+		return;
+	changed = false;
+
+	// Commands reading the current region are all submitted, fence them and move on to the oldest region
+	if(regions[current].fence)
+		glDeleteSync(regions[current].fence);
+	regions[current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % REGIONS;
+
+	Region& region = regions[current];
+	if(region.fence)
+		waitAndDelete(region.fence);
+
+	const uint32_t end = std::min(region.dirtyEnd, slotCount);
+	lastFlushBytes = 0;
+	if(region.dirtyBegin < end)
+	{
+		const size_t offset = current * regionSize + region.dirtyBegin * stride;
+		lastFlushBytes = (end - region.dirtyBegin) * stride;
+		memcpy(mapped + offset, lights.data() + region.dirtyBegin * stride, lastFlushBytes);
+		RenderCounters().recordBufferUpload(lastFlushBytes);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glFlushMappedBufferRange(GL_SHADER_STORAGE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(lastFlushBytes));
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		// The mapping is not coherent, make the flushed writes visible to the shaders
+		glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	}
+	region.dirtyBegin = region.dirtyEnd = 0;
+
+	bindCurrent();
+}
+
+void LightBuffer::allocate(const uint32_t slots)
+{
+	// Immutable storage can't grow, the old buffer is released (the driver keeps it alive while the GPU uses it)
+	for(Region& region : regions)
+	{
+		if(region.fence)
+		{
+			glDeleteSync(region.fence);
+			region.fence = nullptr;
+		}
+		region.dirtyBegin = 0;
+		region.dirtyEnd = slotCount;
+	}
+	if(buffer)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+		GLState().forgetBuffer(buffer);
+		GpuMemory().untrack(ResidentMemory::Buffer, buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+
+	capacity = slots;
+	regionSize = (capacity * stride + offsetAlignment - 1) / offsetAlignment * offsetAlignment;
+	const auto totalSize = static_cast<GLsizeiptr>(regionSize * REGIONS);
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, totalSize, nullptr, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT);
+	GpuMemory().track(ResidentMemory::Buffer, buffer, GpuMemoryCategory::LightBuffer, static_cast<uint64_t>(totalSize));
+	mapped = static_cast<byte*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, totalSize,
+												  GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	current = 0;
+	changed = true;
+}
+
+void LightBuffer::bindCurrent() const
+{
+	GLState().bindBufferRange(binding, buffer, static_cast<GLintptr>(current * regionSize),
+							  static_cast<GLsizeiptr>(regionSize));
+}
+
+void LightBuffer::waitAndDelete(GLsync& fence)
+{
+	// Normally signaled long ago, the GPU would have to be REGIONS frames behind to block here
+	while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000) == GL_TIMEOUT_EXPIRED)
+	{
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
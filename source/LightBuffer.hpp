@@ -0,0 +1,63 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Light SSBO in persistently mapped storage, holding REGIONS copies of the light array. Writes go to a CPU copy,
+// flush() then brings the copy the GPU used longest ago up to date (guarded by a fence), flushes it once and binds it.
+// Every copy catches up on all slots changed since it was last current, so a frame only writes what changed.
+class LightBuffer
+{
+public:
+	LightBuffer(GLuint binding, size_t stride);
+	~LightBuffer();
+
+	// non-copyable, owns the buffer and its mapping
+	LightBuffer(const LightBuffer&) = delete;
+	LightBuffer& operator=(const LightBuffer&) = delete;
+
+	// Slots past the old size are undefined until written
+	void resize(uint32_t slots);
+	// Copies count lights of stride bytes into slots [first, first + count)
+	void write(uint32_t first, const void* lights, uint32_t count);
+	// One memcpy and one flush into the next region, then binds it. A no-op when nothing changed.
+	void flush();
+
+	[[nodiscard]] uint32_t size() const { return slotCount; }
+	// Bytes copied into mapped memory by the last flush that had changes
+	[[nodiscard]] size_t getLastFlushBytes() const { return lastFlushBytes; }
+
+	static constexpr uint32_t REGIONS = 3;
+	static constexpr uint32_t INITIAL_CAPACITY = 16;
+
+private:
+	struct Region
+	{
+		uint32_t dirtyBegin = 0;
+		uint32_t dirtyEnd = 0;
+		GLsync fence = nullptr; // signaled once the GPU no longer reads the region
+	};
+
+	void allocate(uint32_t slots);
+	void bindCurrent() const;
+	static void waitAndDelete(GLsync& fence);
+
+	GLuint binding;
+	size_t stride;
+	size_t offsetAlignment = 1;
+
+	GLuint buffer = 0;
+	byte* mapped = nullptr;
+	size_t regionSize = 0; // bytes, padded to the SSBO offset alignment
+	uint32_t capacity = 0;
+	uint32_t slotCount = 0;
+	uint32_t current = 0;
+	bool changed = false;
+	size_t lastFlushBytes = 0;
+
+	vector<byte> lights; // CPU copy, every region is updated from it
+	Region regions[REGIONS];
+};
@@ -0,0 +1,304 @@
+#include "LightMatrices.hpp"
+#include "Simd.hpp"
+#include <glm/ext.hpp>
+#include <algorithm>
+
+static constexpr float POINT_NEAR_PLANE = 0.1f;
+static constexpr float SPOT_NEAR_PLANE = 0.1f;
+static constexpr float SPOT_FAR_PLANE = 50.0f;
+
+// Eye at the origin looking down each cube face, the batched path only adds the translation
+static const array<mat4, 6>& faceRotations()
+{
+	static const array<mat4, 6> rotations = {
+		lookAt(vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // +X
+		lookAt(vec3(0.0f), vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // -X
+		lookAt(vec3(0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)), // +Y
+		lookAt(vec3(0.0f), vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, -1.0f)), // -Y
+		lookAt(vec3(0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f)), // +Z
+		lookAt(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, -1.0f, 0.0f)) // -Z
+	};
+	return rotations;
+}
+
+// ========== Single light ==========
+
+array<mat4, 6> PointLightShadowMatrices(const vec3& position, const float farPlane)
+{
+	const mat4 projection = perspective(radians(90.0f), 1.0f, POINT_NEAR_PLANE, farPlane);
+	const array<mat4, 6> views = {
+		lookAt(position, position + vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // +X
+		lookAt(position, position + vec3(-1.0f, 0.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f)), // -X
+		lookAt(position, position + vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)), // +Y
+		lookAt(position, position + vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, 0.0f, -1.0f)), // -Y
+		lookAt(position, position + vec3(0.0f, 0.0f, 1.0f), vec3(0.0f, -1.0f, 0.0f)), // +Z
+		lookAt(position, position + vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, -1.0f, 0.0f)) // -Z
+	};
+
+	array<mat4, 6> matrices;
+	for(int face = 0; face < 6; ++face)
+		matrices[face] = projection * views[face];
+	return matrices;
+}
+
+mat4 SpotLightSpaceMatrix(const vec3& position, const vec3& direction, const float outerCutOff)
+{
+	float fov = acos(outerCutOff) * 2.0f;
+	fov = glm::clamp(fov, glm::radians(10.0f), glm::radians(170.0f));
+
+	const mat4 projection = perspective(fov, 1.0f, SPOT_NEAR_PLANE, SPOT_FAR_PLANE);
+
+	// Handle case where direction is parallel to the default up vector
+	const vec3 normalizedDir = normalize(direction);
+	vec3 up = vec3(0.0f, 1.0f, 0.0f);
+	if(abs(dot(normalizedDir, up)) > 0.99f)
+		up = vec3(1.0f, 0.0f, 0.0f);
+
+	const mat4 view = lookAt(position, position + normalizedDir, up);
+	return projection * view;
+}
+
+mat4 DirLightSpaceMatrix(const vec3& direction)
+{
+	// Covers -50 to +50 on X/Y in light space
+	const mat4 lightProjection = ortho(-50.0f, 50.0f, -50.0f, 50.0f, 0.1f, 150.0f);
+	const mat4 lightView = lookAt(-normalize(direction) * 25.0f, vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+	return lightProjection * lightView;
+}
+
+// ========== Batches ==========
+
+void PointLightBatch::clear()
+{
+	px.clear(); py.clear(); pz.clear();
+	farPlane.clear();
+	destinations.clear();
+}
+
+void PointLightBatch::reserve(const size_t count)
+{
+	px.reserve(count); py.reserve(count); pz.reserve(count);
+	farPlane.reserve(count);
+	destinations.reserve(count);
+}
+
+void PointLightBatch::push(const vec3& position, const float far, array<mat4, 6>* destination)
+{
+	px.push_back(position.x);
+	py.push_back(position.y);
+	pz.push_back(position.z);
+	farPlane.push_back(far);
+	destinations.push_back(destination);
+}
+
+void SpotlightBatch::clear()
+{
+	px.clear(); py.clear(); pz.clear();
+	dx.clear(); dy.clear(); dz.clear();
+	outerCutOff.clear();
+	destinations.clear();
+}
+
+void SpotlightBatch::reserve(const size_t count)
+{
+	px.reserve(count); py.reserve(count); pz.reserve(count);
+	dx.reserve(count); dy.reserve(count); dz.reserve(count);
+	outerCutOff.reserve(count);
+	destinations.reserve(count);
+}
+
+void SpotlightBatch::push(const vec3& position, const vec3& direction, const float cutOff, mat4* destination)
+{
+	px.push_back(position.x);
+	py.push_back(position.y);
+	pz.push_back(position.z);
+	dx.push_back(direction.x);
+	dy.push_back(direction.y);
+	dz.push_back(direction.z);
+	outerCutOff.push_back(cutOff);
+	destinations.push_back(destination);
+}
+
+#if defined(LEARNOPENGL_SIMD)
+
+// perspective(90 degrees, aspect 1) * lookAt per face is the constant face rotation R scaled row-wise,
+// so per light only the third row (depends on the far plane) and the translation -R * position vary
+static void pointLightLanes(const PointLightBatch& batch, const size_t first)
+{
+	constexpr size_t W = SimdFloat::WIDTH;
+	const array<mat4, 6>& rotations = faceRotations();
+	const float a = 1.0f / tan(radians(90.0f) / 2.0f);
+
+	const SimdFloat px = SimdFloat::load(batch.px.data() + first);
+	const SimdFloat py = SimdFloat::load(batch.py.data() + first);
+	const SimdFloat pz = SimdFloat::load(batch.pz.data() + first);
+	const SimdFloat far = SimdFloat::load(batch.farPlane.data() + first);
+	const SimdFloat nearPlane = SimdFloat::set(POINT_NEAR_PLANE);
+	const SimdFloat c = (far + nearPlane) / (nearPlane - far);
+	const SimdFloat d = SimdFloat::set(2.0f) * far * nearPlane / (nearPlane - far);
+
+	for(int face = 0; face < 6; ++face)
+	{
+		const mat4& r = rotations[face];
+		const SimdFloat t0 = SimdFloat::set(0.0f) - (SimdFloat::set(r[0][0]) * px + SimdFloat::set(r[1][0]) * py + SimdFloat::set(r[2][0]) * pz);
+		const SimdFloat t1 = SimdFloat::set(0.0f) - (SimdFloat::set(r[0][1]) * px + SimdFloat::set(r[1][1]) * py + SimdFloat::set(r[2][1]) * pz);
+		const SimdFloat t2 = SimdFloat::set(0.0f) - (SimdFloat::set(r[0][2]) * px + SimdFloat::set(r[1][2]) * py + SimdFloat::set(r[2][2]) * pz);
+
+		// Third row of the rotation columns, then the translation column
+		alignas(32) float m[7][W];
+		(c * SimdFloat::set(r[0][2])).store(m[0]);
+		(c * SimdFloat::set(r[1][2])).store(m[1]);
+		(c * SimdFloat::set(r[2][2])).store(m[2]);
+		(SimdFloat::set(a) * t0).store(m[3]);
+		(SimdFloat::set(a) * t1).store(m[4]);
+		(c * t2 + d).store(m[5]);
+		(SimdFloat::set(0.0f) - t2).store(m[6]);
+
+		for(size_t lane = 0; lane < W; ++lane)
+		{
+			mat4& out = (*batch.destinations[first + lane])[face];
+			for(int col = 0; col < 3; ++col)
+				out[col] = vec4(a * r[col][0], a * r[col][1], m[col][lane], -r[col][2]);
+			out[3] = vec4(m[3][lane], m[4][lane], m[5][lane], m[6][lane]);
+		}
+	}
+}
+
+// lookAt basis from the normalized direction, projection scale from the cone: 1 / tan(acos(cutOff)) is
+// cutOff / sqrt(1 - cutOff^2), with the cut-off clamped to the 10..170 degree field of view of the scalar path
+static void spotlightLanes(const SpotlightBatch& batch, const size_t first)
+{
+	constexpr size_t W = SimdFloat::WIDTH;
+	const SimdFloat zero = SimdFloat::set(0.0f);
+	const SimdFloat one = SimdFloat::set(1.0f);
+
+	const SimdFloat px = SimdFloat::load(batch.px.data() + first);
+	const SimdFloat py = SimdFloat::load(batch.py.data() + first);
+	const SimdFloat pz = SimdFloat::load(batch.pz.data() + first);
+	SimdFloat fx = SimdFloat::load(batch.dx.data() + first);
+	SimdFloat fy = SimdFloat::load(batch.dy.data() + first);
+	SimdFloat fz = SimdFloat::load(batch.dz.data() + first);
+	const SimdFloat inverseLength = one / SimdFloat::sqrt(fx * fx + fy * fy + fz * fz);
+	fx = fx * inverseLength;
+	fy = fy * inverseLength;
+	fz = fz * inverseLength;
+
+	// cross(f, up) for up = +Y, or up = +X when the direction is nearly vertical
+	const SimdFloat vertical = SimdFloat::abs(fy) > SimdFloat::set(0.99f);
+	SimdFloat sx = SimdFloat::select(vertical, zero, zero - fz);
+	SimdFloat sy = SimdFloat::select(vertical, fz, zero);
+	SimdFloat sz = SimdFloat::select(vertical, zero - fy, fx);
+	const SimdFloat inverseSideLength = one / SimdFloat::sqrt(sx * sx + sy * sy + sz * sz);
+	sx = sx * inverseSideLength;
+	sy = sy * inverseSideLength;
+	sz = sz * inverseSideLength;
+
+	const SimdFloat ux = sy * fz - sz * fy;
+	const SimdFloat uy = sz * fx - sx * fz;
+	const SimdFloat uz = sx * fy - sy * fx;
+
+	const SimdFloat cutOff = SimdFloat::min(SimdFloat::max(SimdFloat::load(batch.outerCutOff.data() + first),
+														   SimdFloat::set(cos(radians(85.0f)))),
+											SimdFloat::set(cos(radians(5.0f))));
+	const SimdFloat a = cutOff / SimdFloat::sqrt(one - cutOff * cutOff);
+	const SimdFloat c = SimdFloat::set((SPOT_FAR_PLANE + SPOT_NEAR_PLANE) / (SPOT_NEAR_PLANE - SPOT_FAR_PLANE));
+	const SimdFloat d = SimdFloat::set(2.0f * SPOT_FAR_PLANE * SPOT_NEAR_PLANE / (SPOT_NEAR_PLANE - SPOT_FAR_PLANE));
+
+	const SimdFloat sDotP = sx * px + sy * py + sz * pz;
+	const SimdFloat uDotP = ux * px + uy * py + uz * pz;
+	const SimdFloat fDotP = fx * px + fy * py + fz * pz;
+
+	// projection * view, column major
+	alignas(32) float m[16][W];
+	(a * sx).store(m[0]);
+	(a * ux).store(m[1]);
+	(zero - c * fx).store(m[2]);
+	fx.store(m[3]);
+	(a * sy).store(m[4]);
+	(a * uy).store(m[5]);
+	(zero - c * fy).store(m[6]);
+	fy.store(m[7]);
+	(a * sz).store(m[8]);
+	(a * uz).store(m[9]);
+	(zero - c * fz).store(m[10]);
+	fz.store(m[11]);
+	(zero - a * sDotP).store(m[12]);
+	(zero - a * uDotP).store(m[13]);
+	(c * fDotP + d).store(m[14]);
+	(zero - fDotP).store(m[15]);
+
+	for(size_t lane = 0; lane < W; ++lane)
+	{
+		mat4& out = *batch.destinations[first + lane];
+		for(int col = 0; col < 4; ++col)
+			out[col] = vec4(m[col * 4][lane], m[col * 4 + 1][lane], m[col * 4 + 2][lane], m[col * 4 + 3][lane]);
+	}
+}
+
+#endif
+
+// Whole lane groups through lanes(first), the remainder (or everything without SIMD) through single(i)
+template<typename Lanes, typename Single>
+static void computeBatch(const size_t count, JobSystem* jobs, const Lanes& lanes, const Single& single)
+{
+	const auto computeRange = [&lanes, &single](const size_t begin, const size_t end)
+	{
+		size_t i = begin;
+#if defined(LEARNOPENGL_SIMD)
+		for(; i + SimdFloat::WIDTH <= end; i += SimdFloat::WIDTH)
+			lanes(i);
+#endif
+		for(; i < end; ++i)
+			single(i);
+	};
+
+	if(!jobs || count < PARALLEL_LIGHT_MATRICES_THRESHOLD)
+	{
+		computeRange(0, count);
+		return;
+	}
+
+	// Split on whole lane groups so only the last chunk has a scalar remainder
+#if defined(LEARNOPENGL_SIMD)
+	constexpr size_t GROUP = SimdFloat::WIDTH;
+#else
+	constexpr size_t GROUP = 1;
+#endif
+	const size_t groups = (count + GROUP - 1) / GROUP;
+	jobs->parallelFor(groups, 256 / GROUP, [&computeRange, count](const size_t begin, const size_t end)
+	{
+		computeRange(begin * GROUP, std::min(end * GROUP, count));
+	});
+}
+
+void ComputePointLightMatrices(const PointLightBatch& batch, JobSystem* jobs)
+{
+	computeBatch(batch.size(), jobs,
+		[&batch](const size_t first)
+		{
+#if defined(LEARNOPENGL_SIMD)
+			pointLightLanes(batch, first);
+#endif
+		},
+		[&batch](const size_t i)
+		{
+			*batch.destinations[i] = PointLightShadowMatrices(vec3(batch.px[i], batch.py[i], batch.pz[i]), batch.farPlane[i]);
+		});
+}
+
+void ComputeSpotlightMatrices(const SpotlightBatch& batch, JobSystem* jobs)
+{
+	computeBatch(batch.size(), jobs,
+		[&batch](const size_t first)
+		{
+#if defined(LEARNOPENGL_SIMD)
+			spotlightLanes(batch, first);
+#endif
+		},
+		[&batch](const size_t i)
+		{
+			*batch.destinations[i] = SpotLightSpaceMatrix(vec3(batch.px[i], batch.py[i], batch.pz[i]),
+														  vec3(batch.dx[i], batch.dy[i], batch.dz[i]),
+														  batch.outerCutOff[i]);
+		});
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include "JobSystem.hpp"
+
+using namespace std;
+using namespace glm;
+
+// Light-space matrices of one light at a time, also the reference the batched versions are checked against
+array<mat4, 6> PointLightShadowMatrices(const vec3& position, float farPlane);
+mat4 SpotLightSpaceMatrix(const vec3& position, const vec3& direction, float outerCutOff);
+mat4 DirLightSpaceMatrix(const vec3& direction);
+
+// Structure-of-arrays inputs of point lights whose six cube face matrices are recomputed together
+struct PointLightBatch
+{
+	vector<float> px, py, pz;
+	vector<float> farPlane;
+	vector<array<mat4, 6>*> destinations;
+
+	[[nodiscard]] size_t size() const { return destinations.size(); }
+	void clear();
+	void reserve(size_t count);
+	void push(const vec3& position, float far, array<mat4, 6>* destination);
+};
+
+// Structure-of-arrays inputs of spotlights whose light-space matrix is recomputed together
+struct SpotlightBatch
+{
+	vector<float> px, py, pz;
+	vector<float> dx, dy, dz;
+	vector<float> outerCutOff;
+	vector<mat4*> destinations;
+
+	[[nodiscard]] size_t size() const { return destinations.size(); }
+	void clear();
+	void reserve(size_t count);
+	void push(const vec3& position, const vec3& direction, float cutOff, mat4* destination);
+};
+
+// Same results as the single-light functions, several lights per SIMD lane group.
+// Large batches are split across the job system when one is given.
+void ComputePointLightMatrices(const PointLightBatch& batch, JobSystem* jobs = nullptr);
+void ComputeSpotlightMatrices(const SpotlightBatch& batch, JobSystem* jobs = nullptr);
+
+// Below this many lights a batch stays on the calling thread
+constexpr size_t PARALLEL_LIGHT_MATRICES_THRESHOLD = 4096;
@@ -3,6 +3,12 @@
 #include <assimp/postprocess.h>
 #include <stb_image.h>
 #include "Components.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+#include "TextureStreamer.hpp"
+#include "Trace.hpp"
+#include <algorithm>
 
 Mesh::~Mesh()
 {
@@ -16,7 +22,7 @@ Mesh::Mesh(Mesh&& other) noexcept
   VAO(other.VAO),
   VBO(other.VBO),
   EBO(other.EBO),
-  instanceVBO(other.instanceVBO),
+  culledVAO(other.culledVAO),
   diffuseHandlesSSBO(other.diffuseHandlesSSBO),
   specularHandlesSSBO(other.specularHandlesSSBO),
   normalHandlesSSBO(other.normalHandlesSSBO),
@@ -26,9 +32,9 @@ Mesh::Mesh(Mesh&& other) noexcept
 {
 	// Nullify the source so it doesn't delete our resources
 	other.VAO = 0;
+	other.culledVAO = 0;
 	other.VBO = 0;
 	other.EBO = 0;
-	other.instanceVBO = 0;
 	other.diffuseHandlesSSBO = 0;
 	other.specularHandlesSSBO = 0;
 	other.normalHandlesSSBO = 0;
@@ -46,9 +52,9 @@ Mesh& Mesh::operator=(Mesh&& other) noexcept
 		indices = std::move(other.indices);
 		textures = std::move(other.textures);
 		VAO = other.VAO;
+		culledVAO = other.culledVAO;
 		VBO = other.VBO;
 		EBO = other.EBO;
-		instanceVBO = other.instanceVBO;
 		diffuseHandlesSSBO = other.diffuseHandlesSSBO;
 		specularHandlesSSBO = other.specularHandlesSSBO;
 		normalHandlesSSBO = other.normalHandlesSSBO;
@@ -58,9 +64,9 @@ Mesh& Mesh::operator=(Mesh&& other) noexcept
 
 		// Nullify the source
 		other.VAO = 0;
+		other.culledVAO = 0;
 		other.VBO = 0;
 		other.EBO = 0;
-		other.instanceVBO = 0;
 		other.diffuseHandlesSSBO = 0;
 		other.specularHandlesSSBO = 0;
 		other.normalHandlesSSBO = 0;
@@ -69,45 +75,30 @@ Mesh& Mesh::operator=(Mesh&& other) noexcept
 }
 
 void Mesh::setup(const vector<Vertex>& vertices, const vector<Index>& indices,
-				 const vector<TextureComponent>& textures)
+				 const vector<TextureComponent>& textures, const GLuint instanceBuffer, const GLuint culledInstanceBuffer)
 {
 	this->vertices = vertices;
 	this->indices = indices;
 	this->textures = textures;
 
-	glGenVertexArrays(1, &VAO);
 	glGenBuffers(1, &VBO);
 	glGenBuffers(1, &EBO);
 
-	glBindVertexArray(VAO);
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
 	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Same vertices, instances read from every slot or from the ones occlusion culling kept
+	VAO = createVertexArray(instanceBuffer);
+	culledVAO = createVertexArray(culledInstanceBuffer);
 
+	GLState().bindVertexArray(VAO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
 				 indices.data(), GL_STATIC_DRAW);
-
-	GLuint next = Vertex::vertexAttributes();
-
-	glBindVertexArray(0);
-
-	// 1. Generate the Instance VBO
-	glGenBuffers(1, &instanceVBO);
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-
-	// We bind the VAO to attach the new attributes to it
-	glBindVertexArray(VAO);
-
-	for(unsigned int i = 0; i < 4; i++)
-	{
-		glEnableVertexAttribArray(next + i);
-		glVertexAttribPointer(next + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
-		// Tell OpenGL this attribute advances per instance, not per vertex
-		glVertexAttribDivisor(next + i, 1);
-	}
-
-	glBindVertexArray(0);
+	GLState().bindVertexArray(culledVAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	GLState().bindVertexArray(0);
 
 	// === BINDLESS TEXTURE SSBO SETUP ===
 	// Collect handles by texture type
@@ -127,23 +118,116 @@ void Mesh::setup(const vector<Vertex>& vertices, const vector<Index>& indices,
 	normalHandlesSSBO = CreateTextureHandleSSBO(normalHandles);
 
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Streamed textures rewrite their slot whenever their handle changes, the handle vectors above go stale
+	uint32_t diffuseSlot = 0, specularSlot = 0, normalSlot = 0;
+	for(const auto& tex : textures)
+	{
+		if(tex.type == "diffuse")
+			TextureStreaming().addHandleReference(tex.streamId, diffuseHandlesSSBO, diffuseSlot++);
+		else if(tex.type == "specular")
+			TextureStreaming().addHandleReference(tex.streamId, specularHandlesSSBO, specularSlot++);
+		else if(tex.type == "normal")
+			TextureStreaming().addHandleReference(tex.streamId, normalHandlesSSBO, normalSlot++);
+	}
+
+	RenderCounters().recordBufferUpload(memoryUsage().gpuBytes);
+	GpuMemory().track(ResidentMemory::Buffer, VBO, GpuMemoryCategory::ModelBuffer, vertices.size() * sizeof(Vertex));
+	GpuMemory().track(ResidentMemory::Buffer, EBO, GpuMemoryCategory::ModelBuffer, indices.size() * sizeof(Index));
+	GpuMemory().track(ResidentMemory::Buffer, diffuseHandlesSSBO, GpuMemoryCategory::ModelBuffer, diffuseHandles.size() * sizeof(GLuint64));
+	GpuMemory().track(ResidentMemory::Buffer, specularHandlesSSBO, GpuMemoryCategory::ModelBuffer, specularHandles.size() * sizeof(GLuint64));
+	GpuMemory().track(ResidentMemory::Buffer, normalHandlesSSBO, GpuMemoryCategory::ModelBuffer, normalHandles.size() * sizeof(GLuint64));
 }
 
-void Mesh::drawInstanced(const Shader& shader, const vector<mat4>& instanceMatrices) const
+void Mesh::drawInstanced(const Shader& shader, const uint32_t instanceCount) const
 {
-	const int instanceCount = static_cast<int>(instanceMatrices.size());
 	const int indexCount = static_cast<int>(indices.size());
 
-	// Upload the gathered matrices to the instanceVBO
-	glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-	glBufferData(GL_ARRAY_BUFFER, instanceCount * sizeof(mat4), instanceMatrices.data(), GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	bind(shader);
+
+	// Left bound, consecutive draws of the same mesh skip the rebind
+	GLState().bindVertexArray(VAO);
+	glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(instanceCount));
+	RenderCounters().recordDraw(instanceCount, indexCount / 3);
+}
+
+void Mesh::drawIndirect(const Shader& shader, const uint32_t command, const uint32_t instanceCount) const
+{
+	bind(shader);
+
+	// The command was filled by the culling pass, the bound GL_DRAW_INDIRECT_BUFFER holds it
+	GLState().bindVertexArray(culledVAO);
+	glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+						   reinterpret_cast<const void*>(static_cast<uintptr_t>(command) * sizeof(DrawElementsIndirectCommand)));
+	// Upper bound, the visible count only exists on the GPU, see RenderStats occlusion counters
+	RenderCounters().recordDraw(instanceCount, indices.size() / 3);
+}
+
+void Mesh::drawCulled(const Shader& shader, const uint32_t instanceCount) const
+{
+	const int indexCount = static_cast<int>(indices.size());
 
 	bind(shader);
 
-	glBindVertexArray(VAO);
-	glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, instanceCount);
-	glBindVertexArray(0);
+	GLState().bindVertexArray(culledVAO);
+	glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, static_cast<GLsizei>(instanceCount));
+	RenderCounters().recordDraw(instanceCount, indexCount / 3);
+}
+
+void Mesh::appendTriangles(vector<vec3>& outPositions, vector<uint32_t>& outIndices) const
+{
+	const auto base = static_cast<uint32_t>(outPositions.size());
+	outPositions.reserve(outPositions.size() + vertices.size());
+	for(const Vertex& vertex : vertices)
+		outPositions.push_back(vertex.Position);
+	outIndices.reserve(outIndices.size() + indices.size());
+	for(const Index index : indices)
+		outIndices.push_back(base + index);
+}
+
+GLuint Mesh::createVertexArray(const GLuint instanceBuffer) const
+{
+	GLuint vertexArray = 0;
+	glGenVertexArrays(1, &vertexArray);
+	GLState().bindVertexArray(vertexArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	const GLuint next = Vertex::vertexAttributes();
+
+	// The instance buffer keeps its name when it grows, so the attributes stay valid
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+	for(unsigned int i = 0; i < 4; i++)
+	{
+		glEnableVertexAttribArray(next + i);
+		glVertexAttribPointer(next + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void*)(sizeof(vec4) * i));
+		// Tell OpenGL this attribute advances per instance, not per vertex
+		glVertexAttribDivisor(next + i, 1);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GLState().bindVertexArray(0);
+	return vertexArray;
+}
+
+MaterialFeatures Mesh::materialFeatures() const
+{
+	return {
+		static_cast<uint32_t>(diffuseHandles.size()),
+		static_cast<uint32_t>(specularHandles.size()),
+		static_cast<uint32_t>(normalHandles.size())
+	};
+}
+
+MemoryUsage Mesh::memoryUsage() const
+{
+	const size_t vertexBytes = vertices.size() * sizeof(Vertex);
+	const size_t indexBytes = indices.size() * sizeof(Index);
+	const size_t handleBytes = (diffuseHandles.size() + specularHandles.size() + normalHandles.size()) * sizeof(GLuint64);
+	return {
+		vertexBytes + indexBytes + handleBytes + textures.size() * sizeof(TextureComponent),
+		vertexBytes + indexBytes + handleBytes
+	};
 }
 
 void Mesh::cleanup()
@@ -154,41 +238,51 @@ void Mesh::cleanup()
 	// Delete SSBOs (these are per-mesh, so we delete them here)
 	if(diffuseHandlesSSBO != 0)
 	{
+		GLState().forgetBuffer(diffuseHandlesSSBO);
+		TextureStreaming().forgetHandleBuffer(diffuseHandlesSSBO);
+		GpuMemory().untrack(ResidentMemory::Buffer, diffuseHandlesSSBO);
 		glDeleteBuffers(1, &diffuseHandlesSSBO);
 		diffuseHandlesSSBO = 0;
 	}
 	if(specularHandlesSSBO != 0)
 	{
+		GLState().forgetBuffer(specularHandlesSSBO);
+		TextureStreaming().forgetHandleBuffer(specularHandlesSSBO);
+		GpuMemory().untrack(ResidentMemory::Buffer, specularHandlesSSBO);
 		glDeleteBuffers(1, &specularHandlesSSBO);
 		specularHandlesSSBO = 0;
 	}
 	if(normalHandlesSSBO != 0)
 	{
+		GLState().forgetBuffer(normalHandlesSSBO);
+		TextureStreaming().forgetHandleBuffer(normalHandlesSSBO);
+		GpuMemory().untrack(ResidentMemory::Buffer, normalHandlesSSBO);
 		glDeleteBuffers(1, &normalHandlesSSBO);
 		normalHandlesSSBO = 0;
 	}
 
-	// Delete VAO, VBO, EBO
-	if(VAO != 0)
+	// Delete VAOs, VBO, EBO
+	for(GLuint* vertexArray : {&VAO, &culledVAO})
 	{
-		glDeleteVertexArrays(1, &VAO);
-		VAO = 0;
+		if(*vertexArray != 0)
+		{
+			GLState().forgetVertexArray(*vertexArray);
+			glDeleteVertexArrays(1, vertexArray);
+			*vertexArray = 0;
+		}
 	}
 	if(VBO != 0)
 	{
+		GpuMemory().untrack(ResidentMemory::Buffer, VBO);
 		glDeleteBuffers(1, &VBO);
 		VBO = 0;
 	}
 	if(EBO != 0)
 	{
+		GpuMemory().untrack(ResidentMemory::Buffer, EBO);
 		glDeleteBuffers(1, &EBO);
 		EBO = 0;
 	}
-	if(instanceVBO != 0)
-	{
-		glDeleteBuffers(1, &instanceVBO);
-		instanceVBO = 0;
-	}
 
 	diffuseHandles.clear();
 	specularHandles.clear();
@@ -200,15 +294,15 @@ void Mesh::bind(const Shader& shader) const
 {
 	// Bind Diffuse Handles SSBO
 	if(diffuseHandlesSSBO != 0)
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::DiffuseTextures), diffuseHandlesSSBO);
+		GLState().bindBufferBase(static_cast<GLuint>(SSBOBindingPoint::DiffuseTextures), diffuseHandlesSSBO);
 
 	// Bind Specular Handles SSBO
 	if(specularHandlesSSBO != 0)
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::SpecularTextures), specularHandlesSSBO);
+		GLState().bindBufferBase(static_cast<GLuint>(SSBOBindingPoint::SpecularTextures), specularHandlesSSBO);
 
 	// Bind Normal Handles SSBO
 	if(normalHandlesSSBO != 0)
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, static_cast<GLuint>(SSBOBindingPoint::NormalTextures), normalHandlesSSBO);
+		GLState().bindBufferBase(static_cast<GLuint>(SSBOBindingPoint::NormalTextures), normalHandlesSSBO);
 
 	// Set counts
 	shader.setInt("u_numDiffuse", static_cast<int>(diffuseHandles.size()));
@@ -216,6 +310,49 @@ void Mesh::bind(const Shader& shader) const
 	shader.setInt("u_numNormal", static_cast<int>(normalHandles.size()));
 }
 
+// Instance matrix, its copy in the culled buffer and the visibility flag
+static constexpr uint64_t INSTANCE_SLOT_BYTES = 2 * sizeof(mat4) + sizeof(uint32_t);
+
+// Base level size from the driver's internal format, the full mip chain adds a third of it
+static size_t TextureBytes(const GLuint texture)
+{
+	GLint width = 0, height = 0;
+	GLint bits[4] = {};
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_RED_SIZE, &bits[0]);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_GREEN_SIZE, &bits[1]);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_BLUE_SIZE, &bits[2]);
+	glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_ALPHA_SIZE, &bits[3]);
+	const size_t texelBytes = static_cast<size_t>(bits[0] + bits[1] + bits[2] + bits[3] + 7) / 8;
+	return static_cast<size_t>(width) * height * texelBytes * 4 / 3;
+}
+
+// Textures of a model going away, before their names are deleted
+static void ReleaseTextures(entt::registry& registry)
+{
+	for(auto [ent, tex] : registry.view<TextureComponent>().each())
+	{
+		// Streamed textures are retired once the GPU is done with them
+		if(tex.streamId != TextureStreamer::NO_STREAM)
+		{
+			TextureStreaming().release(tex.streamId);
+			continue;
+		}
+
+		// Make bindless handle non-resident before deleting
+		if(tex.handle != 0)
+			glMakeTextureHandleNonResidentARB(tex.handle);
+
+		// Delete the OpenGL texture
+		if(tex.id != 0)
+		{
+			GpuMemory().untrack(ResidentMemory::Texture, tex.id);
+			glDeleteTextures(1, &tex.id);
+		}
+	}
+}
+
 bool ProcessTexture(unsigned char* data, int width, int height, int nrComponents, GLuint& textureID)
 {
 	// Choose proper internal format and data format based on number of components
@@ -242,6 +379,11 @@ bool ProcessTexture(unsigned char* data, int width, int height, int nrComponents
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 
 	glGenerateMipmap(GL_TEXTURE_2D);
+	if(format != -1)
+	{
+		RenderCounters().recordTextureUpload(static_cast<uint64_t>(width) * height * nrComponents);
+		GpuMemory().track(ResidentMemory::Texture, textureID, GpuMemoryCategory::ModelTexture, TextureBytes(textureID));
+	}
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -251,97 +393,54 @@ bool ProcessTexture(unsigned char* data, int width, int height, int nrComponents
 	return format != -1;
 }
 
-GLuint TextureFromFile(const string& fullPath, GLuint64& outHandle)
+GLuint TextureFromFile(const string& fullPath, GLuint64& outHandle, uint32_t& outStream)
 {
-	unsigned int textureID = 0;
-	glGenTextures(1, &textureID);
+	TRACE_ZONE_DETAIL("TextureFromFile", fullPath);
+	TextureSource source;
+	source.path = fullPath;
 
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(fullPath.c_str(), &width, &height, &nrComponents, 0);
-	if(data)
-	{
-		if(!ProcessTexture(data, width, height, nrComponents, textureID))
-			cout << "Failed to process texture at path: " << fullPath << endl;
-		stbi_image_free(data);
-	}
-	else
-	{
+	GLuint textureID = 0;
+	outStream = TextureStreaming().registerTexture(std::move(source), textureID, outHandle);
+	if(outStream == TextureStreamer::NO_STREAM)
 		cout << "TextureComponent failed to load at path: " << fullPath << endl;
-		stbi_image_free(data);
-	}
-
-	// Get bindless texture handle and make it resident
-	outHandle = glGetTextureHandleARB(textureID);
-	glMakeTextureHandleResidentARB(outHandle);
 
 	return textureID;
 }
 
-bool LoadEmbeddedTextureData(const aiTexture* atex, GLuint& textureID, GLuint64& outHandle)
+bool LoadEmbeddedTextureData(const aiTexture* atex, GLuint& textureID, GLuint64& outHandle, uint32_t& outStream)
 {
 	if(!atex)
 		return false;
 
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_2D, textureID);
-
-	int width = 0, height = 0, nrComponents = 0;
-	unsigned char* data = nullptr;
-	bool dataAllocated = false;
-
+	// Copied, the scene is freed after loading and the streamer decodes it again for more detail
+	TextureSource source;
 	if(atex->mHeight == 0)
 	{
 		// Compressed image format (PNG/JPEG) inside memory
 		// atex->mWidth stores size in bytes and pcData points to that memory
-		const unsigned int size = atex->mWidth;
-		data = stbi_load_from_memory(
-			reinterpret_cast<const unsigned char*>(atex->pcData),
-			static_cast<int>(size), &width, &height, &nrComponents, 0);
+		const auto* bytes = reinterpret_cast<const unsigned char*>(atex->pcData);
+		source.encoded.assign(bytes, bytes + atex->mWidth);
 	}
 	else
 	{
 		// Uncompressed RGBA32 image stored as aiTexel array
-		width = static_cast<int>(atex->mWidth);
-		height = static_cast<int>(atex->mHeight);
-		nrComponents = 4; // aiTexel has r,g,b,a
-		const size_t bufSize = static_cast<size_t>(width) * static_cast<size_t>(height) * 4;
-		data = static_cast<unsigned char*>(malloc(bufSize));
-		dataAllocated = true;
+		source.width = static_cast<int>(atex->mWidth);
+		source.height = static_cast<int>(atex->mHeight);
+		source.components = 4; // aiTexel has r,g,b,a
+		const size_t texelCount = static_cast<size_t>(source.width) * static_cast<size_t>(source.height);
+		source.pixels.resize(texelCount * 4);
 		const auto* texels = reinterpret_cast<const aiTexel*>(atex->pcData);
-		for(size_t p = 0; p < static_cast<size_t>(width) * static_cast<size_t>(height); ++p)
+		for(size_t p = 0; p < texelCount; ++p)
 		{
-			data[p * 4 + 0] = texels[p].r;
-			data[p * 4 + 1] = texels[p].g;
-			data[p * 4 + 2] = texels[p].b;
-			data[p * 4 + 3] = texels[p].a;
+			source.pixels[p * 4 + 0] = texels[p].r;
+			source.pixels[p * 4 + 1] = texels[p].g;
+			source.pixels[p * 4 + 2] = texels[p].b;
+			source.pixels[p * 4 + 3] = texels[p].a;
 		}
 	}
 
-	bool success = false;
-	if(data)
-	{
-		success = ProcessTexture(data, width, height, nrComponents, textureID);
-		if(dataAllocated)
-			free(data);
-		else
-			stbi_image_free(data);
-
-		if(success)
-		{
-			// Get bindless texture handle and make it resident
-			outHandle = glGetTextureHandleARB(textureID);
-			glMakeTextureHandleResidentARB(outHandle);
-		}
-	}
-
-	if(!success)
-	{
-		glDeleteTextures(1, &textureID);
-		textureID = 0;
-		outHandle = 0;
-	}
-
-	return success;
+	outStream = TextureStreaming().registerTexture(std::move(source), textureID, outHandle);
+	return outStream != TextureStreamer::NO_STREAM;
 }
 
 GLuint CreateTextureHandleSSBO(const vector<GLuint64>& handles)
@@ -355,13 +454,23 @@ GLuint CreateTextureHandleSSBO(const vector<GLuint64>& handles)
 	glBufferData(GL_SHADER_STORAGE_BUFFER,
 				 handles.size() * sizeof(GLuint64),
 				 handles.data(),
-				 GL_STATIC_DRAW);
+				 GL_DYNAMIC_DRAW); // streamed textures rewrite their handles
 	return ssbo;
 }
 
 Model::Model(const string& modelPath)
+: memoryOwner(GpuMemory().registerOwner(modelPath))
 {
 	cout << "------------------Model-------------------" << endl;
+	// Meshes and textures are tracked under the model's path
+	const GpuMemoryOwnerScope ownerScope(memoryOwner);
+	// Created before the meshes so their VAOs can reference them
+	for(GLuint* buffer : {&instanceBuffer, &culledInstanceBuffer, &visibilityBuffer})
+	{
+		glGenBuffers(1, buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, *buffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	loadModel(modelPath);
 	cout << "Number of meshes: " << registry.view<Mesh>().storage()->size() << endl;
 	const auto texturesView = registry.view<TextureComponent>();
@@ -373,23 +482,15 @@ Model::Model(const string& modelPath)
 
 Model::~Model()
 {
+	releaseInstanceBuffers();
+
 	// Check if this Model was moved-from (registry is empty/invalid after move)
 	// We check by seeing if there's any storage at all
 	if(registry.storage<entt::entity>().empty())
 		return;
 
 	// First, clean up all textures (they are shared across meshes)
-	auto texturesView = registry.view<TextureComponent>();
-	for(auto [ent, tex] : texturesView.each())
-	{
-		// Make bindless handle non-resident before deleting
-		if(tex.handle != 0)
-			glMakeTextureHandleNonResidentARB(tex.handle);
-
-		// Delete the OpenGL texture
-		if(tex.id != 0)
-			glDeleteTextures(1, &tex.id);
-	}
+	ReleaseTextures(registry);
 
 	// Clear the registry - this will destroy Mesh components which clean up their own VAO/VBO/EBO/SSBOs
 	registry.clear();
@@ -397,10 +498,18 @@ Model::~Model()
 
 Model::Model(Model&& other) noexcept
 : directory(std::move(other.directory)),
-  registry(std::move(other.registry))
+  registry(std::move(other.registry)),
+  bounds(other.bounds),
+  instanceBuffer(other.instanceBuffer),
+  culledInstanceBuffer(other.culledInstanceBuffer),
+  visibilityBuffer(other.visibilityBuffer),
+  instanceCapacity(other.instanceCapacity),
+  memoryOwner(other.memoryOwner)
 {
 	// Mark the source as moved-from by clearing its directory
 	other.directory.clear();
+	other.instanceBuffer = other.culledInstanceBuffer = other.visibilityBuffer = 0;
+	other.instanceCapacity = 0;
 }
 
 Model& Model::operator=(Model&& other) noexcept
@@ -410,38 +519,133 @@ Model& Model::operator=(Model&& other) noexcept
 		// Clean up our current resources first (same logic as destructor)
 		if(!registry.storage<entt::entity>().empty())
 		{
-			auto texturesView = registry.view<TextureComponent>();
-			for(auto [ent, tex] : texturesView.each())
-			{
-				if(tex.handle != 0)
-					glMakeTextureHandleNonResidentARB(tex.handle);
-				if(tex.id != 0)
-					glDeleteTextures(1, &tex.id);
-			}
+			ReleaseTextures(registry);
 			registry.clear();
 		}
 
+		releaseInstanceBuffers();
+
 		// Move from other
 		directory = std::move(other.directory);
 		registry = std::move(other.registry);
+		bounds = other.bounds;
+		instanceBuffer = other.instanceBuffer;
+		culledInstanceBuffer = other.culledInstanceBuffer;
+		visibilityBuffer = other.visibilityBuffer;
+		instanceCapacity = other.instanceCapacity;
+		memoryOwner = other.memoryOwner;
 
 		// Mark the source as moved-from
 		other.directory.clear();
+		other.instanceBuffer = other.culledInstanceBuffer = other.visibilityBuffer = 0;
+		other.instanceCapacity = 0;
 	}
 	return *this;
 }
 
-void Model::drawInstanced(const Shader& shader, const vector<mat4>& instanceMatrices) const
+void Model::updateInstances(const span<const mat4> matrices, const uint32_t first, const uint32_t instanceCount)
+{
+	if(matrices.empty())
+		return;
+
+	if(instanceCount > instanceCapacity)
+	{
+		// Grow geometrically, the caller passed every slot since the old contents are gone
+		instanceCapacity = std::max({instanceCount, instanceCapacity * 2, 16u});
+		glBindBuffer(GL_ARRAY_BUFFER, culledInstanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(mat4), nullptr, GL_DYNAMIC_COPY);
+		// Nothing was visible last frame, the culling pass tests every slot against the pyramid
+		glBindBuffer(GL_ARRAY_BUFFER, visibilityBuffer);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+		glClearBufferData(GL_ARRAY_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(mat4), nullptr, GL_DYNAMIC_DRAW);
+		GpuMemory().track(ResidentMemory::Buffer, instanceBuffer, GpuMemoryCategory::InstanceBuffer, instanceCapacity * sizeof(mat4), memoryOwner);
+		GpuMemory().track(ResidentMemory::Buffer, culledInstanceBuffer, GpuMemoryCategory::InstanceBuffer, instanceCapacity * sizeof(mat4), memoryOwner);
+		GpuMemory().track(ResidentMemory::Buffer, visibilityBuffer, GpuMemoryCategory::InstanceBuffer, instanceCapacity * sizeof(uint32_t), memoryOwner);
+	}
+	else
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	const auto count = std::min(static_cast<uint32_t>(matrices.size()), instanceCapacity - std::min(first, instanceCapacity));
+	if(count > 0)
+	{
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(mat4), count * sizeof(mat4), matrices.data());
+		RenderCounters().recordBufferUpload(count * sizeof(mat4));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Model::updateCulledInstances(const span<const mat4> matrices)
+{
+	const auto count = std::min(static_cast<uint32_t>(matrices.size()), instanceCapacity);
+	if(count == 0)
+		return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, culledInstanceBuffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(mat4), matrices.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	RenderCounters().recordBufferUpload(count * sizeof(mat4));
+}
+
+void Model::requestTextureDetail(const float pixels) const
+{
+	registry.view<TextureComponent>().each([pixels](const TextureComponent& tex)
+	{
+		if(tex.streamId != TextureStreamer::NO_STREAM)
+			TextureStreaming().request(tex.streamId, pixels);
+	});
+}
+
+void Model::collectTriangles(vector<vec3>& positions, vector<uint32_t>& indices) const
+{
+	positions.clear();
+	indices.clear();
+	forEachMesh([&positions, &indices](const Mesh& mesh)
+	{
+		mesh.appendTriangles(positions, indices);
+	});
+}
+
+MemoryUsage Model::memoryUsage() const
 {
-	const auto view = registry.view<Mesh>();
-	view.each([&shader, &instanceMatrices](const Mesh& mesh)
+	MemoryUsage usage;
+	registry.view<Mesh>().each([&usage](const Mesh& mesh)
+	{
+		const MemoryUsage meshUsage = mesh.memoryUsage();
+		usage.cpuBytes += meshUsage.cpuBytes;
+		usage.gpuBytes += meshUsage.gpuBytes;
+	});
+
+	registry.view<TextureComponent>().each([&usage](const TextureComponent& tex)
 	{
-		mesh.drawInstanced(shader, instanceMatrices);
+		if(tex.streamId != TextureStreamer::NO_STREAM)
+			usage.gpuBytes += TextureStreaming().residentBytes(tex.streamId);
+		else if(tex.id != 0)
+			usage.gpuBytes += TextureBytes(tex.id);
 	});
+
+	usage.gpuBytes += static_cast<size_t>(instanceCapacity) * INSTANCE_SLOT_BYTES;
+	return usage;
+}
+
+void Model::releaseInstanceBuffers()
+{
+	if(instanceBuffer == 0)
+		return;
+
+	for(const GLuint buffer : {instanceBuffer, culledInstanceBuffer, visibilityBuffer})
+	{
+		// Bound as storage buffers by the culling pass
+		GLState().forgetBuffer(buffer);
+		GpuMemory().untrack(ResidentMemory::Buffer, buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+	instanceBuffer = culledInstanceBuffer = visibilityBuffer = 0;
 }
 
 void Model::loadModel(const string& modelPath)
 {
+	TRACE_ZONE_DETAIL("Model::loadModel", modelPath);
 	// read file via ASSIMP
 	Assimp::Importer importer;
 	const aiScene* scene = importer.ReadFile(
@@ -488,6 +692,7 @@ void Model::processNode(const aiNode* node, const aiScene* scene, const aiMatrix
 
 void Model::processMesh(aiMesh* mesh, const aiScene* scene, const aiMatrix4x4& transform)
 {
+	TRACE_ZONE_DETAIL("Model::processMesh", string_view(mesh->mName.data, mesh->mName.length));
 	// Apply the transformation to the vertices
 	vector<Vertex> vertices;
 	vector<Index> indices;
@@ -534,6 +739,7 @@ void Model::processMesh(aiMesh* mesh, const aiScene* scene, const aiMatrix4x4& t
 			vertex.Tangent = normalize(vec3(transformedTangent.x, transformedTangent.y, transformedTangent.z));
 		}
 
+		bounds.expand(vertex.Position);
 		vertices.push_back(vertex);
 	}
 
@@ -566,7 +772,7 @@ void Model::processMesh(aiMesh* mesh, const aiScene* scene, const aiMatrix4x4& t
 	textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
 
 	Mesh& meshComp = registry.emplace<Mesh>(registry.create());
-	meshComp.setup(vertices, indices, textures);
+	meshComp.setup(vertices, indices, textures, instanceBuffer, culledInstanceBuffer);
 }
 
 vector<TextureComponent> Model::loadMaterialTextures(const aiMaterial* mat, aiTextureType type, const string& typeName,
@@ -610,7 +816,7 @@ vector<TextureComponent> Model::loadMaterialTextures(const aiMaterial* mat, aiTe
 					GLuint textureID = 0;
 					GLuint64 handle = 0;
 
-					if(LoadEmbeddedTextureData(atex, textureID, handle))
+					if(LoadEmbeddedTextureData(atex, textureID, handle, texture.streamId))
 					{
 						texture.id = textureID;
 						texture.handle = handle;
@@ -634,7 +840,7 @@ vector<TextureComponent> Model::loadMaterialTextures(const aiMaterial* mat, aiTe
 				GLuint textureID = 0;
 				GLuint64 handle = 0;
 
-				if(LoadEmbeddedTextureData(embeddedTex, textureID, handle))
+				if(LoadEmbeddedTextureData(embeddedTex, textureID, handle, texture.streamId))
 				{
 					texture.id = textureID;
 					texture.handle = handle;
@@ -652,7 +858,7 @@ vector<TextureComponent> Model::loadMaterialTextures(const aiMaterial* mat, aiTe
 			{
 				// fallback: try loading texture from file on disk
 				fs::path fullPath = directory / str.C_Str();
-				texture.id = TextureFromFile(fullPath.string(), texture.handle);
+				texture.id = TextureFromFile(fullPath.string(), texture.handle, texture.streamId);
 				texture.type = typeName;
 				texture.path = str.C_Str();
 				textures.push_back(texture);
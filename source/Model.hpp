@@ -2,17 +2,27 @@
 #include <glad/glad.h>
 #include <assimp/scene.h>
 #include <string>
+#include <span>
 #include <vector>
 #include <filesystem>
 #include "Shader.hpp"
+#include "ShaderVariants.hpp"
 #include <iostream>
 #include "Primitives.hpp"
+#include "Bounds.hpp"
+#include "GpuMemory.hpp"
 #include <entt/entity/registry.hpp>
 
 struct TextureComponent;
 
 namespace fs = std::filesystem;
 
+struct MemoryUsage
+{
+	size_t cpuBytes = 0;
+	size_t gpuBytes = 0;
+};
+
 class Mesh
 {
 public:
@@ -27,18 +37,36 @@ public:
 	Mesh(Mesh&& other) noexcept;
 	Mesh& operator=(Mesh&& other) noexcept;
 
-	void setup(const vector<Vertex>& vertices, const vector<Index>& indices, const vector<TextureComponent>& textures);
-	void drawInstanced(const Shader& shader, const vector<mat4>& instanceMatrices) const;
+	// The instance buffers are owned by the Model and shared by all of its meshes
+	void setup(const vector<Vertex>& vertices, const vector<Index>& indices, const vector<TextureComponent>& textures,
+			   GLuint instanceBuffer, GLuint culledInstanceBuffer);
+	void drawInstanced(const Shader& shader, uint32_t instanceCount) const;
+	// Instances kept by occlusion culling, command indexes the bound GL_DRAW_INDIRECT_BUFFER.
+	// instanceCount is only what the stats record, the command holds the real count.
+	void drawIndirect(const Shader& shader, uint32_t command, uint32_t instanceCount) const;
+	// The first instanceCount matrices of the culled instance buffer, written by the CPU occlusion culling
+	void drawCulled(const Shader& shader, uint32_t instanceCount) const;
+	[[nodiscard]] uint32_t indexCount() const { return static_cast<uint32_t>(indices.size()); }
+	// Positions and triangle indices of the CPU copy, indices offset by the positions already in the list
+	void appendTriangles(vector<vec3>& outPositions, vector<uint32_t>& outIndices) const;
+
+	[[nodiscard]] MaterialFeatures materialFeatures() const;
+	// GL names of what a draw binds, draws are sorted by them
+	[[nodiscard]] GLuint vertexArray() const { return VAO; }
+	[[nodiscard]] GLuint materialId() const { return diffuseHandlesSSBO ? diffuseHandlesSSBO : specularHandlesSSBO ? specularHandlesSSBO : normalHandlesSSBO; }
+	// Vertex/index copies kept on the CPU, and the vertex, index and texture handle buffers
+	[[nodiscard]] MemoryUsage memoryUsage() const;
 
 private:
 	void cleanup();
 	void bind(const Shader& shader) const;
+	[[nodiscard]] GLuint createVertexArray(GLuint instanceBuffer) const;
 
 	vector<Vertex> vertices;
 	vector<Index> indices;
 	vector<TextureComponent> textures;
 	GLuint VAO{}, VBO{}, EBO{};
-	GLuint instanceVBO{};
+	GLuint culledVAO{};
 
 	// Bindless texture SSBOs
 	GLuint diffuseHandlesSSBO{};
@@ -50,10 +78,11 @@ private:
 };
 
 bool ProcessTexture(unsigned char* data, int width, int height, int nrComponents, GLuint& textureID);
-GLuint TextureFromFile(const string& fullPath, GLuint64& outHandle);
+// Registered with the texture streamer, which owns the texture from then on
+GLuint TextureFromFile(const string& fullPath, GLuint64& outHandle, uint32_t& outStream);
 
 // Helper to load embedded texture from aiTexture* (eliminates code duplication)
-bool LoadEmbeddedTextureData(const aiTexture* atex, GLuint& textureID, GLuint64& outHandle);
+bool LoadEmbeddedTextureData(const aiTexture* atex, GLuint& textureID, GLuint64& outHandle, uint32_t& outStream);
 
 // Helper to create SSBO from texture handles
 GLuint CreateTextureHandleSSBO(const vector<GLuint64>& handles);
@@ -72,10 +101,45 @@ public:
 	Model(Model&& other) noexcept;
 	Model& operator=(Model&& other) noexcept;
 
-	void drawInstanced(const Shader& shader, const vector<mat4>& instanceMatrices) const;
+	// Copies matrices into slots [first, first + matrices.size()) of the instance buffer and grows it to hold
+	// instanceCount slots. Growing drops the old contents, so every slot must be passed when
+	// instanceCount > getInstanceCapacity().
+	void updateInstances(span<const mat4> matrices, uint32_t first, uint32_t instanceCount);
+	[[nodiscard]] uint32_t getInstanceCapacity() const { return instanceCapacity; }
+
+	// Read by the occlusion culling pass, which writes the surviving matrices to the culled buffer and keeps a
+	// visibility flag per slot across frames. All three hold getInstanceCapacity() slots.
+	[[nodiscard]] GLuint getInstanceBuffer() const { return instanceBuffer; }
+	[[nodiscard]] GLuint getCulledInstanceBuffer() const { return culledInstanceBuffer; }
+	[[nodiscard]] GLuint getVisibilityBuffer() const { return visibilityBuffer; }
+	// Instances that passed the CPU occlusion test, compacted to the front of the culled instance buffer
+	void updateCulledInstances(span<const mat4> matrices);
+
+	template<typename Function>
+	void forEachMesh(Function&& function) const
+	{
+		for(const entt::entity entity : registry.view<Mesh>())
+			function(registry.get<Mesh>(entity));
+	}
+
+	// Meshes, textures (queried from the driver, mips included, or the streamer's resident mips) and the instance buffer
+	[[nodiscard]] MemoryUsage memoryUsage() const;
+
+	// On-screen size in pixels of an instance this frame, requested for every streamed texture
+	void requestTextureDetail(float pixels) const;
+
+	// Model space triangles of every mesh, for the CPU occlusion rasterizer
+	void collectTriangles(vector<vec3>& positions, vector<uint32_t>& indices) const;
+
+	// Model space bounds of all meshes, node transforms included
+	[[nodiscard]] const AABB& getBounds() const { return bounds; }
+
+	// Owner of the model's GPU allocations, labeled with its path
+	[[nodiscard]] GpuMemoryOwner getMemoryOwner() const { return memoryOwner; }
 
 private:
 	void loadModel(const string& modelPath);
+	void releaseInstanceBuffers();
 	void processNode(const aiNode* node, const aiScene* scene, const aiMatrix4x4& parentTransform = aiMatrix4x4());
 	void processMesh(aiMesh* mesh, const aiScene* scene, const aiMatrix4x4& transform);
 	vector<TextureComponent> loadMaterialTextures(const aiMaterial* mat, aiTextureType type,
@@ -86,4 +150,12 @@ private:
 
 	fs::path directory;
 	entt::registry registry;
+	AABB bounds;
+
+	// Per instance model matrices, read by every mesh through its VAO
+	GLuint instanceBuffer = 0;
+	GLuint culledInstanceBuffer = 0;
+	GLuint visibilityBuffer = 0;
+	uint32_t instanceCapacity = 0;
+	GpuMemoryOwner memoryOwner = GpuMemoryTracker::RENDERER;
 };
@@ -0,0 +1,277 @@
+#include "OcclusionRasterizer.hpp"
+#include "Simd.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Vertices closer than this in clip w are treated as behind the eye
+static constexpr float NEAR_W = 1e-4f;
+
+// In front of the near plane or behind the eye, where the GPU would clip
+static bool nearClipped(const vec4& clip)
+{
+	return clip.w < NEAR_W || clip.z < -clip.w;
+}
+
+static uint32_t roundUp(const uint32_t value, const uint32_t multiple)
+{
+	return (std::max(value, 1u) + multiple - 1) / multiple * multiple;
+}
+
+// A box only counts as occluded this far in window depth behind the buffer, so an occluder coplanar with the box,
+// including the box's own instance, never hides it through interpolation error
+static constexpr float DEPTH_BIAS = 1e-5f;
+
+// Edges are pushed out by this many pixels, so centers on an edge two triangles share are covered by at least one
+static constexpr float EDGE_BIAS = 1.0f / 256.0f;
+
+// Twice the signed area of abp, positive when p is left of a->b
+static float edge(const vec3& a, const vec3& b, const float px, const float py)
+{
+	return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+OcclusionRasterizer::OcclusionRasterizer(const uint32_t width, const uint32_t height)
+{
+	resize(width, height);
+}
+
+void OcclusionRasterizer::resize(const uint32_t newWidth, const uint32_t newHeight)
+{
+	width = roundUp(newWidth, TILE_WIDTH);
+	height = roundUp(newHeight, TILE_HEIGHT);
+	tilesX = width / TILE_WIDTH;
+	tilesY = height / TILE_HEIGHT;
+	depth.assign(static_cast<size_t>(width) * height, 1.0f);
+	tileMaxDepth.assign(static_cast<size_t>(tilesX) * tilesY, 1.0f);
+	bins.resize(static_cast<size_t>(tilesX) * tilesY);
+}
+
+void OcclusionRasterizer::begin(const mat4& frameViewProj)
+{
+	beginTime = chrono::steady_clock::now();
+	viewProj = frameViewProj;
+	triangles.clear();
+	for(vector<uint32_t>& bin : bins)
+		bin.clear();
+	stats = {};
+}
+
+void OcclusionRasterizer::addOccluder(const span<const vec3> positions, const span<const uint32_t> indices, const mat4& model)
+{
+	++stats.occluders;
+	stats.triangles += static_cast<uint32_t>(indices.size() / 3);
+
+	const mat4 modelViewProj = viewProj * model;
+	clipPositions.resize(positions.size());
+	for(size_t i = 0; i < positions.size(); ++i)
+		clipPositions[i] = modelViewProj * vec4(positions[i], 1.0f);
+
+	const float screenWidth = static_cast<float>(width);
+	const float screenHeight = static_cast<float>(height);
+	for(size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		ScreenTriangle triangle;
+		bool clipped = false;
+		for(int corner = 0; corner < 3; ++corner)
+		{
+			const vec4& clip = clipPositions[indices[i + corner]];
+			if(nearClipped(clip))
+			{
+				clipped = true;
+				break;
+			}
+			const vec3 ndc = vec3(clip) / clip.w;
+			triangle.v[corner] = vec3((ndc.x * 0.5f + 0.5f) * screenWidth, (ndc.y * 0.5f + 0.5f) * screenHeight,
+									  ndc.z * 0.5f + 0.5f);
+		}
+		if(clipped)
+			continue;
+
+		// Both windings occlude, walls and floor tiles are often single sided
+		const float area = edge(triangle.v[0], triangle.v[1], triangle.v[2].x, triangle.v[2].y);
+		if(area == 0.0f)
+			continue;
+		if(area < 0.0f)
+			std::swap(triangle.v[1], triangle.v[2]);
+
+		const vec3 lower = min(min(triangle.v[0], triangle.v[1]), triangle.v[2]);
+		const vec3 upper = max(max(triangle.v[0], triangle.v[1]), triangle.v[2]);
+		if(upper.x < 0.0f || upper.y < 0.0f || lower.x >= screenWidth || lower.y >= screenHeight || lower.z > 1.0f)
+			continue;
+
+		const auto index = static_cast<uint32_t>(triangles.size());
+		triangles.push_back(triangle);
+		const uint32_t firstX = static_cast<uint32_t>(std::max(lower.x, 0.0f)) / TILE_WIDTH;
+		const uint32_t firstY = static_cast<uint32_t>(std::max(lower.y, 0.0f)) / TILE_HEIGHT;
+		const uint32_t lastX = std::min(static_cast<uint32_t>(upper.x) / TILE_WIDTH, tilesX - 1);
+		const uint32_t lastY = std::min(static_cast<uint32_t>(upper.y) / TILE_HEIGHT, tilesY - 1);
+		for(uint32_t ty = firstY; ty <= lastY; ++ty)
+			for(uint32_t tx = firstX; tx <= lastX; ++tx)
+				bins[ty * tilesX + tx].push_back(index);
+	}
+}
+
+void OcclusionRasterizer::rasterize()
+{
+	const uint32_t tileCount = tilesX * tilesY;
+	auto rasterizeTiles = [this](const size_t begin, const size_t end)
+	{
+		for(size_t tile = begin; tile < end; ++tile)
+			rasterizeTile(static_cast<uint32_t>(tile));
+	};
+	if(jobSystem)
+		jobSystem->parallelFor(tileCount, 1, rasterizeTiles);
+	else
+		rasterizeTiles(0, tileCount);
+
+	stats.rasterizedTriangles = static_cast<uint32_t>(triangles.size());
+	stats.rasterMs = chrono::duration<double, std::milli>(chrono::steady_clock::now() - beginTime).count();
+}
+
+void OcclusionRasterizer::rasterizeTile(const uint32_t tile)
+{
+	const uint32_t tileX = tile % tilesX * TILE_WIDTH;
+	const uint32_t tileY = tile / tilesX * TILE_HEIGHT;
+	for(uint32_t y = tileY; y < tileY + TILE_HEIGHT; ++y)
+		std::fill_n(depth.data() + static_cast<size_t>(y) * width + tileX, TILE_WIDTH, 1.0f);
+
+#if defined(LEARNOPENGL_SIMD)
+	constexpr uint32_t W = SimdFloat::WIDTH;
+	// Pixel center offsets of the lanes
+	alignas(32) float laneOffsets[W];
+	for(uint32_t lane = 0; lane < W; ++lane)
+		laneOffsets[lane] = static_cast<float>(lane) + 0.5f;
+	const SimdFloat laneCenters = SimdFloat::load(laneOffsets);
+#else
+	constexpr uint32_t W = 1;
+#endif
+
+	for(const uint32_t index : bins[tile])
+	{
+		const ScreenTriangle& triangle = triangles[index];
+		const vec3& v0 = triangle.v[0];
+		const vec3& v1 = triangle.v[1];
+		const vec3& v2 = triangle.v[2];
+
+		// Edge functions and depth as planes a * x + b * y + c over the pixel centers
+		const float area = edge(v0, v1, v2.x, v2.y);
+		const vec3 a(v1.y - v2.y, v2.y - v0.y, v0.y - v1.y);
+		const vec3 b(v2.x - v1.x, v0.x - v2.x, v1.x - v0.x);
+		vec3 c(edge(v1, v2, 0.0f, 0.0f), edge(v2, v0, 0.0f, 0.0f), edge(v0, v1, 0.0f, 0.0f));
+		const float depthA = (a.y * (v1.z - v0.z) + a.z * (v2.z - v0.z)) / area;
+		const float depthB = (b.y * (v1.z - v0.z) + b.z * (v2.z - v0.z)) / area;
+		const float depthC = v0.z + (c.y * (v1.z - v0.z) + c.z * (v2.z - v0.z)) / area;
+		// The edge function grows by the edge's length per pixel of distance
+		for(int i = 0; i < 3; ++i)
+			c[i] += std::sqrt(a[i] * a[i] + b[i] * b[i]) * EDGE_BIAS;
+
+		const float minX = std::min({v0.x, v1.x, v2.x});
+		const float maxX = std::max({v0.x, v1.x, v2.x});
+		const float minY = std::min({v0.y, v1.y, v2.y});
+		const float maxY = std::max({v0.y, v1.y, v2.y});
+		// Whole SIMD groups, the edge functions mask the pixels outside
+		const uint32_t firstX = std::max(tileX, static_cast<uint32_t>(std::max(minX, 0.0f)) / W * W);
+		const uint32_t lastX = std::min(tileX + TILE_WIDTH, static_cast<uint32_t>(std::max(maxX + 1.0f, 0.0f)));
+		const uint32_t firstY = std::max(tileY, static_cast<uint32_t>(std::max(minY, 0.0f)));
+		const uint32_t lastY = std::min(tileY + TILE_HEIGHT, static_cast<uint32_t>(std::max(maxY + 1.0f, 0.0f)));
+
+		for(uint32_t y = firstY; y < lastY; ++y)
+		{
+			const float py = static_cast<float>(y) + 0.5f;
+			float* row = depth.data() + static_cast<size_t>(y) * width;
+#if defined(LEARNOPENGL_SIMD)
+			const SimdFloat a0 = SimdFloat::set(a.x), a1 = SimdFloat::set(a.y), a2 = SimdFloat::set(a.z);
+			const SimdFloat row0 = SimdFloat::set(b.x * py + c.x);
+			const SimdFloat row1 = SimdFloat::set(b.y * py + c.y);
+			const SimdFloat row2 = SimdFloat::set(b.z * py + c.z);
+			const SimdFloat rowDepth = SimdFloat::set(depthB * py + depthC);
+			const SimdFloat depthStep = SimdFloat::set(depthA);
+			for(uint32_t x = firstX; x < lastX; x += W)
+			{
+				const SimdFloat px = laneCenters + SimdFloat::set(static_cast<float>(x));
+				const SimdFloat e0 = a0 * px + row0;
+				const SimdFloat e1 = a1 * px + row1;
+				const SimdFloat e2 = a2 * px + row2;
+				const SimdFloat inside = SimdFloat::min(e0, SimdFloat::min(e1, e2)) > SimdFloat::set(0.0f);
+				const SimdFloat z = depthStep * px + rowDepth;
+				const SimdFloat old = SimdFloat::load(row + x);
+				SimdFloat::select(inside, SimdFloat::min(old, z), old).storeUnaligned(row + x);
+			}
+#else
+			for(uint32_t x = firstX; x < lastX; ++x)
+			{
+				const float px = static_cast<float>(x) + 0.5f;
+				const float e0 = a.x * px + b.x * py + c.x;
+				const float e1 = a.y * px + b.y * py + c.y;
+				const float e2 = a.z * px + b.z * py + c.z;
+				if(std::min({e0, e1, e2}) > 0.0f)
+					row[x] = std::min(row[x], depthA * px + depthB * py + depthC);
+			}
+#endif
+		}
+	}
+
+	float farthest = 0.0f;
+	for(uint32_t y = tileY; y < tileY + TILE_HEIGHT; ++y)
+	{
+		const float* row = depth.data() + static_cast<size_t>(y) * width + tileX;
+		farthest = std::max(farthest, *std::max_element(row, row + TILE_WIDTH));
+	}
+	tileMaxDepth[tile] = farthest;
+}
+
+bool OcclusionRasterizer::isOccluded(const AABB& worldBounds) const
+{
+	if(worldBounds.empty() || triangles.empty())
+		return false;
+
+	vec2 lower(FLT_MAX);
+	vec2 upper(-FLT_MAX);
+	float nearest = FLT_MAX;
+	for(int corner = 0; corner < 8; ++corner)
+	{
+		const vec3 position((corner & 1) ? worldBounds.max.x : worldBounds.min.x,
+							(corner & 2) ? worldBounds.max.y : worldBounds.min.y,
+							(corner & 4) ? worldBounds.max.z : worldBounds.min.z);
+		const vec4 clip = viewProj * vec4(position, 1.0f);
+		if(nearClipped(clip))
+			return false;
+		const vec3 ndc = vec3(clip) / clip.w;
+		lower = min(lower, vec2(ndc));
+		upper = max(upper, vec2(ndc));
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+	nearest -= DEPTH_BIAS;
+
+	const float screenWidth = static_cast<float>(width);
+	const float screenHeight = static_cast<float>(height);
+	lower = (lower * 0.5f + 0.5f) * vec2(screenWidth, screenHeight);
+	upper = (upper * 0.5f + 0.5f) * vec2(screenWidth, screenHeight);
+	if(upper.x < 0.0f || upper.y < 0.0f || lower.x >= screenWidth || lower.y >= screenHeight)
+		return false;
+
+	// Every pixel the rectangle touches, not only those whose center it covers
+	const uint32_t firstX = static_cast<uint32_t>(std::max(lower.x, 0.0f));
+	const uint32_t firstY = static_cast<uint32_t>(std::max(lower.y, 0.0f));
+	const uint32_t lastX = std::min(static_cast<uint32_t>(upper.x), width - 1);
+	const uint32_t lastY = std::min(static_cast<uint32_t>(upper.y), height - 1);
+	for(uint32_t ty = firstY / TILE_HEIGHT; ty <= lastY / TILE_HEIGHT; ++ty)
+	{
+		for(uint32_t tx = firstX / TILE_WIDTH; tx <= lastX / TILE_WIDTH; ++tx)
+		{
+			// The whole tile is in front of the box
+			if(tileMaxDepth[ty * tilesX + tx] < nearest)
+				continue;
+
+			const uint32_t x0 = std::max(firstX, tx * TILE_WIDTH);
+			const uint32_t x1 = std::min(lastX, tx * TILE_WIDTH + TILE_WIDTH - 1);
+			const uint32_t y0 = std::max(firstY, ty * TILE_HEIGHT);
+			const uint32_t y1 = std::min(lastY, ty * TILE_HEIGHT + TILE_HEIGHT - 1);
+			for(uint32_t y = y0; y <= y1; ++y)
+				for(uint32_t x = x0; x <= x1; ++x)
+					if(depth[static_cast<size_t>(y) * width + x] >= nearest)
+						return false;
+		}
+	}
+	return true;
+}
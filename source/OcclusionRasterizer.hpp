@@ -0,0 +1,81 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "Bounds.hpp"
+#include "JobSystem.hpp"
+
+using namespace std;
+using namespace glm;
+
+// Coarse software depth buffer for occlusion culling on the CPU, no GL involved.
+// A few designated low-poly occluders are rasterized into a small depth buffer split into tiles, every tile is
+// rasterized by one job with SimdFloat::WIDTH pixels at a time. Instance bounds are then tested against it.
+// Depth is window z in [0, 1] as OpenGL maps it, the nearest occluder wins.
+class OcclusionRasterizer
+{
+public:
+	struct Stats
+	{
+		uint32_t occluders = 0;
+		uint32_t triangles = 0;           // submitted
+		uint32_t rasterizedTriangles = 0; // in front of the near plane and on screen
+		double rasterMs = 0.0;            // transform, binning and rasterization
+	};
+
+	// Sizes are rounded up to whole tiles
+	explicit OcclusionRasterizer(uint32_t width = DEFAULT_WIDTH, uint32_t height = DEFAULT_HEIGHT);
+
+	// Tiles are rasterized in parallel when set, on the calling thread otherwise
+	void setJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+	void resize(uint32_t width, uint32_t height);
+
+	// Clears the buffer and the occluders of the previous frame
+	void begin(const mat4& viewProj);
+	// Model space triangles, three indices each. Triangles crossing the near plane are dropped, which only
+	// makes the buffer occlude less.
+	void addOccluder(span<const vec3> positions, span<const uint32_t> indices, const mat4& model);
+	void rasterize();
+
+	// True only when every pixel the box covers holds an occluder in front of the box's nearest point, by a small
+	// depth bias so coplanar occluders don't count. Boxes crossing the near plane or off screen are never occluded.
+	// Safe to call from several threads.
+	[[nodiscard]] bool isOccluded(const AABB& worldBounds) const;
+
+	// Row 0 is the bottom of the screen, like window coordinates
+	[[nodiscard]] float depthAt(uint32_t x, uint32_t y) const { return depth[static_cast<size_t>(y) * width + x]; }
+	[[nodiscard]] uint32_t getWidth() const { return width; }
+	[[nodiscard]] uint32_t getHeight() const { return height; }
+	[[nodiscard]] const Stats& getStats() const { return stats; }
+
+	static constexpr uint32_t TILE_WIDTH = 32; // a multiple of every SimdFloat::WIDTH
+	static constexpr uint32_t TILE_HEIGHT = 16;
+	static constexpr uint32_t DEFAULT_WIDTH = 256;
+	static constexpr uint32_t DEFAULT_HEIGHT = 128;
+
+private:
+	// Window space: x and y in pixels, z in [0, 1], counter-clockwise
+	struct ScreenTriangle
+	{
+		vec3 v[3];
+	};
+
+	void rasterizeTile(uint32_t tile);
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t tilesX = 0;
+	uint32_t tilesY = 0;
+	mat4 viewProj{1.0f};
+	vector<float> depth;          // row major, cleared to 1 (far plane)
+	vector<float> tileMaxDepth;   // farthest depth per tile, lets most tests skip the pixels
+	vector<vec4> clipPositions;   // of the occluder being added
+	vector<ScreenTriangle> triangles;
+	vector<vector<uint32_t>> bins; // triangles overlapping each tile, in submission order
+
+	JobSystem* jobSystem = nullptr;
+	chrono::steady_clock::time_point beginTime;
+	Stats stats;
+};
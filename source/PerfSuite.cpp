@@ -0,0 +1,388 @@
+#include "PerfSuite.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+
+// Nearest rank percentile of sorted samples, the same definition as GpuProfiler's p99
+static double percentile(const vector<double>& sorted, const double fraction)
+{
+	if(sorted.empty())
+		return 0.0;
+	const auto rank = static_cast<size_t>(ceil(fraction * static_cast<double>(sorted.size())));
+	return sorted[std::min(rank > 0 ? rank - 1 : 0, sorted.size() - 1)];
+}
+
+static const char* movementName(const MovementPattern movement)
+{
+	switch(movement)
+	{
+		case MovementPattern::Static: return "static";
+		case MovementPattern::Orbit: return "orbit";
+		case MovementPattern::Drift: return "drift";
+		case MovementPattern::Spin: return "spin";
+	}
+	return "unknown";
+}
+
+PerfSuite::PerfSuite(vector<PerfCase> perfCases)
+: cases(std::move(perfCases))
+{
+}
+
+vector<PerfCase> PerfSuite::defaultMatrix()
+{
+	const vector<GeneratedModel> models = {
+		{"backpack/backpack.obj", 1.0f, 0.2f},
+		{"Cardboard_Box.fbx", 2.0f, 0.015f}
+	};
+
+	struct LightLoad
+	{
+		const char* name;
+		uint32_t pointLights, spotlights, dirLights;
+		float shadowCasterFraction;
+	};
+	constexpr LightLoad LIGHT_LOADS[] = {
+		{"few_lights", 4, 2, 1, 1.0f},
+		{"many_lights", 64, 16, 1, 0.125f},
+	};
+	constexpr uint32_t INSTANCE_COUNTS[] = {1000, 10000};
+	constexpr MovementPattern MOVEMENTS[] = {MovementPattern::Static, MovementPattern::Orbit};
+	constexpr RenderPath PATHS[] = {RenderPath::Forward, RenderPath::Deferred};
+
+	vector<PerfCase> matrix;
+	for(const uint32_t instanceCount : INSTANCE_COUNTS)
+	{
+		for(const MovementPattern movement : MOVEMENTS)
+		{
+			for(const LightLoad& lights : LIGHT_LOADS)
+			{
+				for(const RenderPath path : PATHS)
+				{
+					PerfCase perfCase;
+					perfCase.path = path;
+					SceneGeneratorConfig& scene = perfCase.scene;
+					scene.seed = 1;
+					scene.instanceCount = instanceCount;
+					scene.models = models;
+					scene.pointLights = lights.pointLights;
+					scene.spotlights = lights.spotlights;
+					scene.dirLights = lights.dirLights;
+					scene.shadowCasterFraction = lights.shadowCasterFraction;
+					scene.movement = movement;
+					scene.movingLights = movement != MovementPattern::Static;
+					scene.name = string(path == RenderPath::Forward ? "forward" : "deferred") + "_"
+								 + to_string(instanceCount) + "_" + movementName(movement) + "_" + lights.name;
+					matrix.push_back(std::move(perfCase));
+				}
+			}
+		}
+	}
+	return matrix;
+}
+
+const vector<PerfResult>& PerfSuite::run(Renderer& renderer)
+{
+	results.clear();
+	results.reserve(cases.size());
+	const RenderPath previousPath = renderer.getRenderPath();
+
+	vector<double> frameMs, simulationMs, submitMs;
+	for(const PerfCase& perfCase : cases)
+	{
+		cout << "Perf suite: " << perfCase.scene.name << "..." << flush;
+		SceneGenerator generator(perfCase.scene);
+		generator.build(renderer);
+		renderer.setRenderPath(perfCase.path);
+		renderer.setSimulationCallback([&generator, &renderer](const float deltaTime)
+		{
+			generator.animate(renderer, deltaTime);
+		});
+
+		frameMs.clear();
+		simulationMs.clear();
+		submitMs.clear();
+		PerfResult result;
+		result.name = perfCase.scene.name;
+		for(uint32_t frame = 0; frame < perfCase.warmupFrames + perfCase.frames; ++frame)
+		{
+			// Keeps the hidden window responsive, nothing reads the events
+			SDL_PumpEvents();
+			const Uint64 start = SDL_GetTicksNS();
+			renderer.update(FIXED_DELTA_TIME);
+			const double elapsedMs = static_cast<double>(SDL_GetTicksNS() - start) / 1e6;
+			if(frame < perfCase.warmupFrames)
+				continue;
+
+			const Renderer::FrameTimings& timings = renderer.getFrameTimings();
+			frameMs.push_back(elapsedMs);
+			simulationMs.push_back(timings.simulationMs);
+			submitMs.push_back(timings.submitMs);
+			for(const PassStats& pass : renderer.getRenderStats().getLastFrame().passes)
+			{
+				result.drawCalls += static_cast<double>(pass.drawCalls);
+				result.triangles += static_cast<double>(pass.triangles);
+			}
+		}
+
+		renderer.setSimulationCallback(nullptr);
+		generator.destroy(renderer);
+
+		ranges::sort(frameMs);
+		ranges::sort(simulationMs);
+		ranges::sort(submitMs);
+		result.frameP50Ms = percentile(frameMs, 0.50);
+		result.frameP95Ms = percentile(frameMs, 0.95);
+		result.frameP99Ms = percentile(frameMs, 0.99);
+		result.frameMaxMs = frameMs.empty() ? 0.0 : frameMs.back();
+		result.simulationP95Ms = percentile(simulationMs, 0.95);
+		result.submitP95Ms = percentile(submitMs, 0.95);
+		if(!frameMs.empty())
+		{
+			result.drawCalls /= static_cast<double>(frameMs.size());
+			result.triangles /= static_cast<double>(frameMs.size());
+		}
+		cout << " p50 " << fixed << setprecision(2) << result.frameP50Ms << " ms, p95 " << result.frameP95Ms
+			 << " ms" << defaultfloat << endl;
+		results.push_back(std::move(result));
+	}
+
+	renderer.setRenderPath(previousPath);
+	return results;
+}
+
+vector<PerfRegression> PerfSuite::compare(const PerfBaseline& baseline) const
+{
+	vector<PerfRegression> regressions;
+	for(const PerfResult& result : results)
+	{
+		const auto entry = baseline.configurations.find(result.name);
+		if(entry == baseline.configurations.end())
+			continue;
+
+		const PerfBaseline::Entry& expected = entry->second;
+		const double tolerance = expected.tolerance >= 0.0 ? expected.tolerance : baseline.tolerance;
+		auto check = [&](const char* metric, const double baselineMs, const double measuredMs)
+		{
+			const double limitMs = baselineMs * (1.0 + tolerance) + baseline.minSlackMs;
+			if(baselineMs > 0.0 && measuredMs > limitMs)
+				regressions.push_back({result.name, metric, baselineMs, measuredMs, limitMs});
+		};
+		check("p50", expected.p50Ms, result.frameP50Ms);
+		check("p95", expected.p95Ms, result.frameP95Ms);
+		check("p99", expected.p99Ms, result.frameP99Ms);
+	}
+	return regressions;
+}
+
+vector<string> PerfSuite::missingBaselines(const PerfBaseline& baseline) const
+{
+	vector<string> missing;
+	for(const PerfResult& result : results)
+		if(!baseline.configurations.contains(result.name))
+			missing.push_back(result.name);
+	return missing;
+}
+
+void PerfSuite::report(ostream& out, const PerfBaseline& baseline, const vector<PerfRegression>& regressions) const
+{
+	out << "------------Perf suite (" << results.size() << " configurations)------------" << endl;
+	out << fixed << setprecision(2);
+	for(const PerfResult& result : results)
+	{
+		const bool known = baseline.configurations.contains(result.name);
+		const bool regressed = ranges::any_of(regressions, [&](const PerfRegression& regression)
+		{
+			return regression.name == result.name;
+		});
+		out << "\t" << left << setw(40) << result.name << right
+			<< " p50 " << setw(7) << result.frameP50Ms
+			<< "  p95 " << setw(7) << result.frameP95Ms
+			<< "  p99 " << setw(7) << result.frameP99Ms
+			<< "  max " << setw(7) << result.frameMaxMs
+			<< "  draws " << setw(8) << setprecision(0) << result.drawCalls << setprecision(2)
+			<< "  " << (!known ? "NO BASELINE" : regressed ? "REGRESSED" : "ok") << endl;
+	}
+	for(const PerfRegression& regression : regressions)
+	{
+		out << regression.name << ": " << regression.metric << " " << regression.measuredMs << " ms, baseline "
+			<< regression.baselineMs << " ms, limit " << regression.limitMs << " ms" << endl;
+	}
+	out << defaultfloat << "----------------------------------------" << endl;
+}
+
+// ========== Baseline file ==========
+
+// Just enough JSON for the baseline: nested objects, strings and numbers. Every number is handed to the
+// callback with the keys leading to it, e.g. "configurations/forward_1000_static_few_lights/p95_ms".
+class BaselineParser
+{
+public:
+	using NumberCallback = function<void(const string& path, double value)>;
+
+	BaselineParser(const string_view json, NumberCallback callback)
+	: text(json), onNumber(std::move(callback))
+	{
+	}
+
+	bool parse()
+	{
+		if(!parseValue(""))
+			return false;
+		skipSpace();
+		return position == text.size();
+	}
+
+private:
+	void skipSpace()
+	{
+		while(position < text.size() && isspace(static_cast<unsigned char>(text[position])))
+			++position;
+	}
+
+	bool consume(const char c)
+	{
+		skipSpace();
+		if(position >= text.size() || text[position] != c)
+			return false;
+		++position;
+		return true;
+	}
+
+	bool parseString(string& out)
+	{
+		if(!consume('"'))
+			return false;
+		out.clear();
+		while(position < text.size() && text[position] != '"')
+		{
+			// Escapes are kept as the escaped character, configuration names never need more
+			if(text[position] == '\\' && position + 1 < text.size())
+				++position;
+			out += text[position++];
+		}
+		return consume('"');
+	}
+
+	bool parseValue(const string& path)
+	{
+		skipSpace();
+		if(position >= text.size())
+			return false;
+		if(text[position] == '{')
+			return parseObject(path);
+		if(text[position] == '"')
+		{
+			string ignored;
+			return parseString(ignored);
+		}
+
+		double value = 0.0;
+		const auto [end, error] = from_chars(text.data() + position, text.data() + text.size(), value);
+		if(error != errc())
+			return false;
+		position = static_cast<size_t>(end - text.data());
+		onNumber(path, value);
+		return true;
+	}
+
+	bool parseObject(const string& path)
+	{
+		consume('{');
+		if(consume('}'))
+			return true;
+		do
+		{
+			string key;
+			if(!parseString(key) || !consume(':') || !parseValue(path.empty() ? key : path + "/" + key))
+				return false;
+		}
+		while(consume(','));
+		return consume('}');
+	}
+
+	string_view text;
+	size_t position = 0;
+	NumberCallback onNumber;
+};
+
+bool ReadPerfBaseline(const string& path, PerfBaseline& baseline)
+{
+	ifstream file(path);
+	if(!file.is_open())
+	{
+		cerr << "Perf baseline: failed to open " << path << endl;
+		return false;
+	}
+	stringstream contents;
+	contents << file.rdbuf();
+	const string json = contents.str();
+
+	baseline = {};
+	constexpr string_view CONFIGURATIONS = "configurations/";
+	BaselineParser parser(json, [&baseline, CONFIGURATIONS](const string& key, const double value)
+	{
+		if(key == "tolerance")
+			baseline.tolerance = value;
+		else if(key == "min_slack_ms")
+			baseline.minSlackMs = value;
+		else if(key.starts_with(CONFIGURATIONS))
+		{
+			const size_t nameEnd = key.rfind('/');
+			if(nameEnd < CONFIGURATIONS.size())
+				return;
+			PerfBaseline::Entry& entry = baseline.configurations[key.substr(CONFIGURATIONS.size(), nameEnd - CONFIGURATIONS.size())];
+			const string_view field = string_view(key).substr(nameEnd + 1);
+			if(field == "p50_ms")
+				entry.p50Ms = value;
+			else if(field == "p95_ms")
+				entry.p95Ms = value;
+			else if(field == "p99_ms")
+				entry.p99Ms = value;
+			else if(field == "tolerance")
+				entry.tolerance = value;
+		}
+	});
+	if(!parser.parse())
+	{
+		cerr << "Perf baseline: malformed JSON in " << path << endl;
+		return false;
+	}
+	return true;
+}
+
+bool WritePerfBaseline(const string& path, const PerfBaseline& previous, const vector<PerfResult>& results)
+{
+	ofstream file(path);
+	if(!file.is_open())
+	{
+		cerr << "Perf baseline: failed to write " << path << endl;
+		return false;
+	}
+
+	file << fixed << setprecision(3);
+	file << "{\n\t\"tolerance\": " << previous.tolerance << ",\n\t\"min_slack_ms\": " << previous.minSlackMs
+		 << ",\n\t\"configurations\": {";
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const PerfResult& result = results[i];
+		file << (i == 0 ? "\n" : ",\n") << "\t\t\"" << result.name << "\": {"
+			 << "\"p50_ms\": " << result.frameP50Ms
+			 << ", \"p95_ms\": " << result.frameP95Ms
+			 << ", \"p99_ms\": " << result.frameP99Ms;
+		const auto entry = previous.configurations.find(result.name);
+		if(entry != previous.configurations.end() && entry->second.tolerance >= 0.0)
+			file << ", \"tolerance\": " << entry->second.tolerance;
+		// Context for whoever reads a regression, not compared
+		file << ", \"draw_calls\": " << setprecision(0) << result.drawCalls
+			 << ", \"triangles\": " << result.triangles << setprecision(3) << "}";
+	}
+	file << (results.empty() ? "}\n}\n" : "\n\t}\n}\n");
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Renderer.hpp"
+#include "SceneGenerator.hpp"
+
+using namespace std;
+
+// One configuration of the regression matrix: a generated scene rendered with one path
+struct PerfCase
+{
+	SceneGeneratorConfig scene; // scene.name names the configuration in the baseline
+	RenderPath path = RenderPath::Forward;
+	uint32_t warmupFrames = 60;  // not measured, lets uploads, shadow maps and the pipeline settle
+	uint32_t frames = 300;
+};
+
+struct PerfResult
+{
+	string name;
+	double frameP50Ms = 0.0;
+	double frameP95Ms = 0.0;
+	double frameP99Ms = 0.0;
+	double frameMaxMs = 0.0;
+	double simulationP95Ms = 0.0;
+	double submitP95Ms = 0.0;
+	// Averages per measured frame, from RenderStats
+	double drawCalls = 0.0;
+	double triangles = 0.0;
+};
+
+// Checked in frame time percentiles. A configuration regresses when a percentile exceeds
+// baseline * (1 + tolerance) + minSlackMs, the slack keeps tiny scenes from flagging on timer noise.
+struct PerfBaseline
+{
+	struct Entry
+	{
+		double p50Ms = 0.0;
+		double p95Ms = 0.0;
+		double p99Ms = 0.0;
+		double tolerance = -1.0; // negative uses the file wide tolerance
+	};
+
+	double tolerance = 0.15;
+	double minSlackMs = 0.5;
+	unordered_map<string, Entry> configurations;
+};
+
+struct PerfRegression
+{
+	string name;
+	const char* metric;
+	double baselineMs;
+	double measuredMs;
+	double limitMs;
+};
+
+// Runs the matrix headlessly through the normal Renderer::update path with a fixed time step,
+// so every run simulates the same frames
+class PerfSuite
+{
+public:
+	explicit PerfSuite(vector<PerfCase> perfCases);
+
+	// Instance counts x movement x light load x render path
+	[[nodiscard]] static vector<PerfCase> defaultMatrix();
+
+	// Builds, measures and destroys every case in order, on the main thread
+	const vector<PerfResult>& run(Renderer& renderer);
+	[[nodiscard]] const vector<PerfResult>& getResults() const { return results; }
+
+	[[nodiscard]] vector<PerfRegression> compare(const PerfBaseline& baseline) const;
+	// Configurations compare() had nothing to check against
+	[[nodiscard]] vector<string> missingBaselines(const PerfBaseline& baseline) const;
+	void report(ostream& out, const PerfBaseline& baseline, const vector<PerfRegression>& regressions) const;
+
+	static constexpr float FIXED_DELTA_TIME = 1.0f / 60.0f;
+
+private:
+	vector<PerfCase> cases;
+	vector<PerfResult> results;
+};
+
+// Reads the subset of JSON WritePerfBaseline produces, logs and returns false on a missing or malformed file
+bool ReadPerfBaseline(const string& path, PerfBaseline& baseline);
+// Writes the results as the new baseline, keeping the tolerances and per configuration overrides of the old one
+bool WritePerfBaseline(const string& path, const PerfBaseline& previous, const vector<PerfResult>& results);
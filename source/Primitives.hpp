@@ -30,6 +30,16 @@ struct Vertex
 
 using Index = uint32_t;
 
+// Layout glDrawElementsIndirect reads, written by the culling pass
+struct DrawElementsIndirectCommand
+{
+	uint32_t count;
+	uint32_t instanceCount;
+	uint32_t firstIndex;
+	int32_t baseVertex;
+	uint32_t baseInstance;
+};
+
 enum class SSBOBindingPoint : GLuint
 {
 	DiffuseTextures,
@@ -38,4 +48,15 @@ enum class SSBOBindingPoint : GLuint
 	PointLights,
 	Spotlights,
 	DirLights,
+	PointShadowViews,
+	SpotShadowViews,
+	DirShadowViews,
+	// Occlusion culling compute passes, see hiz_cull.glsl
+	CullInstances,
+	CullOutput,
+	CullVisibility,
+	CullCounts,
+	CullStats,
+	CullCommands,
+	CullCommandModels,
 };
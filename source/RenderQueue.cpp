@@ -0,0 +1,181 @@
+#include "RenderQueue.hpp"
+#include <bit>
+#include <chrono>
+
+RenderQueue::RenderQueue()
+: arena(64 * 1024)
+{
+}
+
+void RenderQueue::begin()
+{
+	const size_t capacity = ReleaseArenaStorage(packetList);
+	ReleaseArenaStorage(sortBuffer);
+	arena.reset();
+	packetList.reserve(capacity);
+
+	passBegin.fill(0);
+	stats.fill({});
+	lastEmitted.fill({});
+}
+
+void RenderQueue::push(const RenderPass pass, const uint32_t program, const float depth, const Mesh& mesh, const uint32_t instanceCount,
+					   const uint32_t command)
+{
+	const DrawPacket packet{
+		makeKey(pass, program, depthBucket(depth), mesh.materialId(), mesh.vertexArray()),
+		&mesh,
+		instanceCount,
+		command
+	};
+
+	// Emission order changes are counted against the previous packet of the same pass
+	DrawPacket& previous = lastEmitted[static_cast<size_t>(pass)];
+	countChange(stats[static_cast<size_t>(pass)].emitted, previous, packet);
+	previous = packet;
+
+	packetList.push_back(packet);
+}
+
+void RenderQueue::sort()
+{
+	using namespace std::chrono;
+	const auto start = steady_clock::now();
+
+	// LSD radix sort on bytes, all histograms in one read, bytes every key shares are skipped
+	const size_t count = packetList.size();
+	array<array<uint32_t, 256>, 8> histograms{};
+	for(const DrawPacket& packet : packetList)
+	{
+		for(size_t digit = 0; digit < 8; ++digit)
+			++histograms[digit][packet.key >> (digit * 8) & 0xFF];
+	}
+
+	sortBuffer.resize(count);
+	for(size_t digit = 0; digit < 8 && count > 0; ++digit)
+	{
+		array<uint32_t, 256>& histogram = histograms[digit];
+		const size_t shift = digit * 8;
+		if(histogram[packetList.front().key >> shift & 0xFF] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for(uint32_t& bucket : histogram)
+		{
+			const uint32_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+		for(const DrawPacket& packet : packetList)
+			sortBuffer[histogram[packet.key >> shift & 0xFF]++] = packet;
+		packetList.swap(sortBuffer);
+	}
+
+	// Passes are the top bits, so each one is now a contiguous range
+	size_t packet = 0;
+	for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+	{
+		passBegin[pass] = static_cast<uint32_t>(packet);
+		while(packet < count && packetList[packet].key >> 60 == pass)
+			++packet;
+	}
+	passBegin[PASS_COUNT] = static_cast<uint32_t>(count);
+
+	for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+		stats[pass].sorted = countChanges(packets(static_cast<RenderPass>(pass)));
+
+	lastSortMs = duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+span<const DrawPacket> RenderQueue::packets(const RenderPass pass) const
+{
+	const auto index = static_cast<size_t>(pass);
+	return {packetList.data() + passBegin[index], passBegin[index + 1] - passBegin[index]};
+}
+
+void RenderQueue::draw(const RenderPass pass, const Shader& shader) const
+{
+	for(const DrawPacket& packet : packets(pass))
+		drawPacket(packet, shader);
+}
+
+void RenderQueue::draw(const RenderPass pass, ShaderVariantCache& variants, const SceneFeatures& scene) const
+{
+	for(const DrawPacket& packet : packets(pass))
+	{
+		const Shader& shader = variants.bindForDraw({packet.mesh->materialFeatures(), scene});
+		drawPacket(packet, shader);
+	}
+}
+
+void RenderQueue::drawPacket(const DrawPacket& packet, const Shader& shader)
+{
+	if(packet.command == CULLED_INSTANCES)
+		packet.mesh->drawCulled(shader, packet.instanceCount);
+	else if(packet.command != NO_COMMAND)
+		packet.mesh->drawIndirect(shader, packet.command, packet.instanceCount);
+	else
+		packet.mesh->drawInstanced(shader, packet.instanceCount);
+}
+
+void RenderQueue::report(ostream& out) const
+{
+	static constexpr const char* PASS_NAMES[PASS_COUNT] = {"shadow", "depth_prepass", "opaque"};
+
+	out << "------------Render queue------------" << endl;
+	out << "Packets: " << packetList.size() << ", sorted in " << lastSortMs << " ms" << endl;
+	for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+	{
+		const PassStats& passStats = stats[pass];
+		if(passStats.emitted.draws == 0)
+			continue;
+		out << "\t" << PASS_NAMES[pass] << ": " << passStats.emitted.draws << " draws, programs "
+			<< passStats.emitted.programs << " -> " << passStats.sorted.programs << ", materials "
+			<< passStats.emitted.materials << " -> " << passStats.sorted.materials << ", meshes "
+			<< passStats.emitted.meshes << " -> " << passStats.sorted.meshes << endl;
+	}
+	out << "----------------------------------------" << endl;
+}
+
+uint16_t RenderQueue::depthBucket(const float depth)
+{
+	// Behind the eye (or NaN) goes first, like depth 0
+	if(!(depth > 0.0f))
+		return 0;
+	return static_cast<uint16_t>(std::bit_cast<uint32_t>(depth) >> 16);
+}
+
+uint64_t RenderQueue::makeKey(const RenderPass pass, const uint32_t program, const uint16_t bucket, const uint32_t material,
+							  const uint32_t mesh)
+{
+	return static_cast<uint64_t>(pass) << 60
+		   | static_cast<uint64_t>(program & 0xFFFF) << 44
+		   | static_cast<uint64_t>(bucket) << 28
+		   | static_cast<uint64_t>(material & 0x3FFF) << 14
+		   | static_cast<uint64_t>(mesh & 0x3FFF);
+}
+
+RenderQueue::StateChanges RenderQueue::countChanges(const span<const DrawPacket> passPackets)
+{
+	StateChanges changes;
+	DrawPacket previous{};
+	for(const DrawPacket& packet : passPackets)
+	{
+		countChange(changes, previous, packet);
+		previous = packet;
+	}
+	return changes;
+}
+
+void RenderQueue::countChange(StateChanges& changes, const DrawPacket& previous, const DrawPacket& packet)
+{
+	// A null mesh marks the first draw of the pass, everything is bound for it
+	const bool first = previous.mesh == nullptr;
+	++changes.draws;
+	if(first || (previous.key >> 44 & 0xFFFF) != (packet.key >> 44 & 0xFFFF))
+		++changes.programs;
+	if(first || previous.mesh->materialId() != packet.mesh->materialId())
+		++changes.materials;
+	if(first || previous.mesh != packet.mesh)
+		++changes.meshes;
+}
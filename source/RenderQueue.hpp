@@ -0,0 +1,97 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include "FrameArena.hpp"
+#include "Model.hpp"
+#include "ShaderVariants.hpp"
+
+using namespace std;
+
+// Geometry passes fed by the render queue, in submission order
+enum class RenderPass : uint8_t
+{
+	Shadow,       // replayed once per shadow casting light
+	DepthPrepass,
+	Opaque,       // forward main pass or deferred G-buffer pass
+	Count,
+};
+
+// One instanced draw of a mesh. Sort key, high to low bits:
+// pass (4) | program (16) | depth bucket (16) | material (14) | mesh (14)
+// Every mesh owns its VAO and texture handle SSBOs, so only program changes can be shared between meshes,
+// which is why depth goes before material and mesh: draws of one program run front-to-back.
+struct DrawPacket
+{
+	uint64_t key;
+	const Mesh* mesh;
+	uint32_t instanceCount;
+	uint32_t command; // indirect command written by occlusion culling, NO_COMMAND draws every instance
+};
+
+static constexpr uint32_t NO_COMMAND = UINT32_MAX;
+// Instead of a command: instanceCount instances from the culled instance buffer, filled on the CPU
+static constexpr uint32_t CULLED_INSTANCES = UINT32_MAX - 1;
+
+// Draw packets of one frame, emitted in scene order, radix sorted once and replayed per pass.
+// Lives in its own arena, rebuilt every frame by begin() / push() / sort().
+class RenderQueue
+{
+public:
+	// Binds that a pass would make when replayed in some order, a draw whose value differs from the previous one counts
+	struct StateChanges
+	{
+		uint32_t draws = 0;
+		uint32_t programs = 0;
+		uint32_t materials = 0;
+		uint32_t meshes = 0;
+	};
+
+	struct PassStats
+	{
+		StateChanges emitted; // scene order, what the per-model traversal used to submit
+		StateChanges sorted;
+	};
+
+	RenderQueue();
+
+	void begin();
+	// program identifies the shader the pass binds for the draw (e.g. a variant key), 0 when the pass has one program.
+	// depth is the view depth of the nearest instance, 0 for passes that don't sort by depth.
+	// command is the mesh's indirect command when the pass draws occlusion culled instances.
+	void push(RenderPass pass, uint32_t program, float depth, const Mesh& mesh, uint32_t instanceCount,
+			  uint32_t command = NO_COMMAND);
+	void sort();
+
+	// Packets of one pass, sorted once sort() ran
+	[[nodiscard]] span<const DrawPacket> packets(RenderPass pass) const;
+
+	// Same program for every draw
+	void draw(RenderPass pass, const Shader& shader) const;
+	// Program from the variant cache per draw, the cache skips binds of the program already bound
+	void draw(RenderPass pass, ShaderVariantCache& variants, const SceneFeatures& scene) const;
+
+	[[nodiscard]] const PassStats& getStats(const RenderPass pass) const { return stats[static_cast<size_t>(pass)]; }
+	[[nodiscard]] double getLastSortMs() const { return lastSortMs; }
+	void report(ostream& out) const;
+
+	// Positive floats order like their bits, the top 16 bits give a logarithmic bucket
+	[[nodiscard]] static uint16_t depthBucket(float depth);
+	[[nodiscard]] static uint64_t makeKey(RenderPass pass, uint32_t program, uint16_t bucket, uint32_t material, uint32_t mesh);
+
+private:
+	static constexpr size_t PASS_COUNT = static_cast<size_t>(RenderPass::Count);
+
+	static void drawPacket(const DrawPacket& packet, const Shader& shader);
+	static StateChanges countChanges(span<const DrawPacket> passPackets);
+	static void countChange(StateChanges& changes, const DrawPacket& previous, const DrawPacket& packet);
+
+	ScratchArena arena;
+	ArenaVector<DrawPacket> packetList{ArenaAllocator<DrawPacket>(arena)};
+	ArenaVector<DrawPacket> sortBuffer{ArenaAllocator<DrawPacket>(arena)};
+	array<uint32_t, PASS_COUNT + 1> passBegin{};
+	array<PassStats, PASS_COUNT> stats{};
+	array<DrawPacket, PASS_COUNT> lastEmitted{};
+	double lastSortMs = 0.0;
+};
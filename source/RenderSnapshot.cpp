@@ -0,0 +1,61 @@
+#include "RenderSnapshot.hpp"
+#include "Components.hpp"
+#include <cassert>
+
+void RenderSnapshot::resetArena()
+{
+	assert(instanceUploads.empty() && lights.pointLights.lights.empty() && "snapshot captured again before its uploads");
+
+	const size_t modelCapacity = ReleaseArenaStorage(models);
+	const size_t uploadCapacity = ReleaseArenaStorage(instanceUploads);
+	const size_t matrixCapacity = ReleaseArenaStorage(uploadMatrices);
+	const size_t visibleCapacity = ReleaseArenaStorage(visibleMatrices);
+	const size_t pointCapacity = ReleaseArenaStorage(lights.pointLights.lights);
+	const size_t pointViewCapacity = ReleaseArenaStorage(lights.pointLights.shadowViews);
+	const size_t spotCapacity = ReleaseArenaStorage(lights.spotlights.lights);
+	const size_t spotViewCapacity = ReleaseArenaStorage(lights.spotlights.shadowViews);
+	const size_t dirCapacity = ReleaseArenaStorage(lights.dirLights.lights);
+	const size_t dirViewCapacity = ReleaseArenaStorage(lights.dirLights.shadowViews);
+
+	arena.reset();
+
+	models.reserve(modelCapacity);
+	instanceUploads.reserve(uploadCapacity);
+	uploadMatrices.reserve(matrixCapacity);
+	visibleMatrices.reserve(visibleCapacity);
+	lights.pointLights.lights.reserve(pointCapacity);
+	lights.pointLights.shadowViews.reserve(pointViewCapacity);
+	lights.spotlights.lights.reserve(spotCapacity);
+	lights.spotlights.shadowViews.reserve(spotViewCapacity);
+	lights.dirLights.lights.reserve(dirCapacity);
+	lights.dirLights.shadowViews.reserve(dirViewCapacity);
+}
+
+void RenderSnapshot::uploadInstances(entt::registry& registry)
+{
+	for(const InstanceUpload& upload : instanceUploads)
+	{
+		auto* modelComp = registry.valid(upload.modelEntity) ? registry.try_get<ModelComponent>(upload.modelEntity) : nullptr;
+		if(!modelComp)
+			continue;
+		const span<const mat4> matrices(uploadMatrices.data() + upload.matrixOffset, upload.count);
+		modelComp->model.updateInstances(matrices, upload.first, upload.instanceCount);
+	}
+	instanceUploads.clear();
+	uploadMatrices.clear();
+}
+
+void RenderSnapshot::uploadVisibleInstances(entt::registry& registry) const
+{
+	if(!softwareOcclusion.culled)
+		return;
+
+	for(const ModelDraw& draw : models)
+	{
+		auto* modelComp = registry.valid(draw.modelEntity) ? registry.try_get<ModelComponent>(draw.modelEntity) : nullptr;
+		if(!modelComp)
+			continue;
+		const span<const mat4> matrices(visibleMatrices.data() + draw.visibleFirst, draw.visibleCount);
+		modelComp->model.updateCulledInstances(matrices);
+	}
+}
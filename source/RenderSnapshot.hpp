@@ -0,0 +1,78 @@
+#pragma once
+#include <entt/entity/registry.hpp>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+#include "Camera.hpp"
+#include "FrameArena.hpp"
+#include "Light.hpp"
+#include "Model.hpp"
+
+using namespace std;
+using namespace glm;
+
+// Instance slots of one model that changed, copied out of the registry for the render thread
+struct InstanceUpload
+{
+	entt::entity modelEntity; // resolved at upload time, the model may have been unloaded since
+	uint32_t first;         // first slot
+	uint32_t count;         // matrices start at matrixOffset in RenderSnapshot::uploadMatrices
+	uint32_t instanceCount; // pool size when captured, the instance buffer grows to hold it
+	uint32_t matrixOffset;
+};
+
+struct ModelDraw
+{
+	const Model* model;
+	entt::entity modelEntity;
+	uint32_t instanceCount;
+	float nearestDepth; // view depth of the closest instance origin, orders the draws front-to-back
+	float detailDepth;  // same over the instances in the view frustum only, FLT_MAX when none is
+	// Instances that passed the CPU occlusion test, in RenderSnapshot::visibleMatrices
+	uint32_t visibleFirst = 0;
+	uint32_t visibleCount = 0;
+};
+
+// CPU occlusion culling of one snapshot, recorded into the render stats when the snapshot is submitted
+struct SoftwareOcclusionResult
+{
+	bool culled = false; // visibleFirst / visibleCount are only valid when set
+	uint32_t occluderTriangles = 0;
+	uint32_t tested = 0;
+	uint32_t occluded = 0;
+	double rasterMs = 0.0;
+	double testMs = 0.0;
+};
+
+// Everything the render thread reads for one frame. The simulation thread fills one snapshot while the
+// render thread submits the other, so during the overlap neither touches the other's data.
+// Transient lists live in the snapshot's own arena, reset when the snapshot is captured again.
+struct RenderSnapshot
+{
+	ScratchArena arena; // declared first, the containers below allocate from it
+
+	uint64_t frame = 0;
+	CameraState camera;
+
+	ArenaVector<ModelDraw> models{ArenaAllocator<ModelDraw>(arena)};
+	uint64_t modelsVersion = 0; // InstanceStructureVersion models was captured at
+
+	// Accumulate until uploaded, so ranges captured again after an edit go out after the older ones
+	ArenaVector<InstanceUpload> instanceUploads{ArenaAllocator<InstanceUpload>(arena)};
+	ArenaVector<mat4> uploadMatrices{ArenaAllocator<mat4>(arena)};
+
+	LightSnapshot lights{arena};
+
+	// Matrices of the instances kept by the CPU occlusion culling, grouped by model
+	ArenaVector<mat4> visibleMatrices{ArenaAllocator<mat4>(arena)};
+	SoftwareOcclusionResult softwareOcclusion;
+
+	// Start of a capture: drops the previous frame's lists and reserves as much as they held, so a steady scene
+	// needs one bump allocation per list and no heap allocation. Everything staged must have been uploaded.
+	void resetArena();
+
+	// GL thread: copies every captured instance range into its model's instance buffer
+	void uploadInstances(entt::registry& registry);
+	// GL thread: copies the kept instances into each model's culled instance buffer
+	void uploadVisibleInstances(entt::registry& registry) const;
+};
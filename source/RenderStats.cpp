@@ -0,0 +1,251 @@
+#include "RenderStats.hpp"
+#include "GLStateCache.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+static double secondsSinceEpoch()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+RenderStats::RenderStats()
+{
+	lastDump = secondsSinceEpoch();
+}
+
+void RenderStats::endFrame()
+{
+	endPass();
+
+	// Switches made outside every pass (uploads, setup between passes) are left for Other
+	const SwitchMarks total = currentSwitches();
+	uint64_t programs = 0, vertexArrays = 0;
+	for(const PassStats& pass : current.passes)
+	{
+		programs += pass.programSwitches;
+		vertexArrays += pass.vertexArraySwitches;
+	}
+	PassStats& other = current.passes[static_cast<size_t>(StatsPass::Other)];
+	if(total.programs > programs)
+		other.programSwitches += total.programs - programs;
+	if(total.vertexArrays > vertexArrays)
+		other.vertexArraySwitches += total.vertexArrays - vertexArrays;
+
+	lastFrame = current;
+	history[next] = current;
+	next = (next + 1) % HISTORY_SIZE;
+	++frameCount;
+
+	// Resident memory carries over, everything else starts from zero
+	const uint64_t residentTextureBytes = current.residentTextureBytes;
+	const uint64_t residentBufferBytes = current.residentBufferBytes;
+	current = {};
+	current.residentTextureBytes = residentTextureBytes;
+	current.residentBufferBytes = residentBufferBytes;
+
+	if(dumpInterval > 0.0)
+	{
+		const double now = secondsSinceEpoch();
+		if(now - lastDump >= dumpInterval)
+		{
+			if(json.is_open())
+			{
+				writeJson(json);
+				json.flush();
+			}
+			else
+				report(cout);
+			lastDump = now;
+		}
+	}
+}
+
+void RenderStats::beginPass(const StatsPass pass)
+{
+	endPass();
+	activePass = pass;
+	passStart = currentSwitches();
+}
+
+void RenderStats::endPass()
+{
+	if(activePass == StatsPass::Other)
+		return;
+	chargeSwitches();
+	activePass = StatsPass::Other;
+}
+
+void RenderStats::recordDraw(const uint64_t instances, const uint64_t triangles)
+{
+	PassStats& pass = current.passes[static_cast<size_t>(activePass)];
+	++pass.drawCalls;
+	pass.instances += instances;
+	pass.triangles += triangles * instances;
+}
+
+void RenderStats::recordOcclusion(const uint64_t visible, const uint64_t occluded, const uint64_t frustumCulled)
+{
+	current.occlusionVisible += visible;
+	current.occlusionOccluded += occluded;
+	current.occlusionFrustumCulled += frustumCulled;
+}
+
+void RenderStats::recordSoftwareOcclusion(const uint64_t tested, const uint64_t culled, const uint64_t triangles,
+										  const double rasterMs, const double testMs)
+{
+	current.softwareOcclusionTested += tested;
+	current.softwareOcclusionCulled += culled;
+	current.softwareOcclusionTriangles += triangles;
+	current.softwareOcclusionRasterUs += static_cast<uint64_t>(rasterMs * 1000.0);
+	current.softwareOcclusionTestUs += static_cast<uint64_t>(testMs * 1000.0);
+}
+
+void RenderStats::addResident(const ResidentMemory memory, const uint64_t bytes)
+{
+	if(memory == ResidentMemory::Texture)
+		current.residentTextureBytes += bytes;
+	else
+		current.residentBufferBytes += bytes;
+}
+
+void RenderStats::removeResident(const ResidentMemory memory, const uint64_t bytes)
+{
+	uint64_t& total = memory == ResidentMemory::Texture ? current.residentTextureBytes : current.residentBufferBytes;
+	total -= std::min(total, bytes);
+}
+
+FrameStatsAverages RenderStats::getAverages() const
+{
+	FrameStatsAverages averages;
+	const size_t samples = std::min(frameCount, HISTORY_SIZE);
+	if(samples == 0)
+		return averages;
+
+	const double scale = 1.0 / static_cast<double>(samples);
+	auto accumulate = [scale](const char*, double& average, const uint64_t value)
+	{
+		average += static_cast<double>(value) * scale;
+	};
+	for(size_t i = 0; i < samples; ++i)
+	{
+		const FrameStats& frame = history[i];
+		for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+			PassStats::fields(accumulate, averages.passes[pass], frame.passes[pass]);
+		FrameStats::fields(accumulate, averages, frame);
+	}
+	return averages;
+}
+
+void RenderStats::report(ostream& out) const
+{
+	const FrameStatsAverages averages = getAverages();
+	constexpr double MB = 1024.0 * 1024.0;
+
+	out << "------------Render stats (average of " << std::min(frameCount, HISTORY_SIZE) << " frames)------------" << endl;
+	out << fixed << setprecision(1);
+	for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+	{
+		const BasicPassStats<double>& stats = averages.passes[pass];
+		if(stats.drawCalls == 0.0 && stats.programSwitches == 0.0 && stats.vertexArraySwitches == 0.0)
+			continue;
+		out << "\t" << left << setw(14) << passName(static_cast<StatsPass>(pass)) << right
+			<< " draws " << setw(8) << stats.drawCalls
+			<< "  instances " << setw(9) << stats.instances
+			<< "  triangles " << setw(11) << stats.triangles
+			<< "  programs " << setw(6) << stats.programSwitches
+			<< "  VAOs " << setw(6) << stats.vertexArraySwitches << endl;
+	}
+	out << "Uploads: buffers " << averages.bufferUploadBytes / 1024.0 << " KB, textures "
+		<< averages.textureUploadBytes / 1024.0 << " KB per frame" << endl;
+	out << "Shadow maps: " << averages.shadowMapsRendered << ", lights shaded: " << averages.lightsShaded << endl;
+	if(averages.occlusionVisible + averages.occlusionOccluded + averages.occlusionFrustumCulled > 0.0)
+	{
+		out << "Occlusion culling: visible " << averages.occlusionVisible << ", occluded " << averages.occlusionOccluded
+			<< ", outside the frustum " << averages.occlusionFrustumCulled << endl;
+	}
+	if(averages.softwareOcclusionTested > 0.0)
+	{
+		out << "Software occlusion: culled " << averages.softwareOcclusionCulled << " of " << averages.softwareOcclusionTested
+			<< " instances, " << averages.softwareOcclusionTriangles << " occluder triangles rasterized in "
+			<< averages.softwareOcclusionRasterUs / 1000.0 << " ms, tested in " << averages.softwareOcclusionTestUs / 1000.0
+			<< " ms" << endl;
+	}
+	out << setprecision(2) << "Resident: textures " << static_cast<double>(lastFrame.residentTextureBytes) / MB
+		<< " MB, buffers " << static_cast<double>(lastFrame.residentBufferBytes) / MB << " MB" << endl;
+	out << defaultfloat << "----------------------------------------" << endl;
+}
+
+void RenderStats::setJsonPath(const string& path)
+{
+	json.close();
+	if(path.empty())
+		return;
+
+	json.open(path, ios::out | ios::app);
+	if(!json.is_open())
+		cerr << "Render stats: failed to open JSON lines file: " << path << endl;
+}
+
+void RenderStats::writeJson(ostream& out) const
+{
+	const FrameStatsAverages averages = getAverages();
+	// A fresh writer per object, the comma state must not leak from one object into the next
+	auto fieldWriter = [&out]
+	{
+		return [&out, first = true](const char* name, const double value) mutable
+		{
+			out << (first ? "" : ",") << "\"" << name << "\":" << value;
+			first = false;
+		};
+	};
+
+	const streamsize precision = out.precision();
+	out << "{\"time_s\":" << fixed << setprecision(3) << secondsSinceEpoch() << defaultfloat << setprecision(JSON_PRECISION)
+		<< ",\"frames\":" << frameCount << ",\"window\":" << std::min(frameCount, HISTORY_SIZE) << ",\"passes\":{";
+	bool firstPass = true;
+	for(size_t pass = 0; pass < PASS_COUNT; ++pass)
+	{
+		out << (firstPass ? "" : ",") << "\"" << passName(static_cast<StatsPass>(pass)) << "\":{";
+		BasicPassStats<double>::fields(fieldWriter(), averages.passes[pass]);
+		out << "}";
+		firstPass = false;
+	}
+	out << "},";
+	FrameStatsAverages::fields(fieldWriter(), averages);
+	out << "}\n" << setprecision(precision);
+}
+
+const char* RenderStats::passName(const StatsPass pass)
+{
+	static constexpr const char* NAMES[PASS_COUNT] = {
+		"shadow", "depth_prepass", "main", "gbuffer", "lighting", "composite", "skybox", "occlusion", "other"
+	};
+	return NAMES[static_cast<size_t>(pass)];
+}
+
+RenderStats::SwitchMarks RenderStats::currentSwitches()
+{
+	const GLStateCache::Counters& counters = GLState().getCurrentFrame();
+	return {
+		counters[static_cast<size_t>(GLStateCache::State::Program)].issued,
+		counters[static_cast<size_t>(GLStateCache::State::VertexArray)].issued
+	};
+}
+
+void RenderStats::chargeSwitches()
+{
+	const SwitchMarks now = currentSwitches();
+	PassStats& pass = current.passes[static_cast<size_t>(activePass)];
+	// The cache counters restart every frame, a pass spanning that point is charged from zero
+	pass.programSwitches += now.programs >= passStart.programs ? now.programs - passStart.programs : now.programs;
+	pass.vertexArraySwitches += now.vertexArrays >= passStart.vertexArrays ? now.vertexArrays - passStart.vertexArrays : now.vertexArrays;
+}
+
+RenderStats& RenderCounters()
+{
+	static RenderStats stats;
+	return stats;
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+// Passes the counters are split into, a draw outside any pass is counted under Other
+enum class StatsPass : uint8_t
+{
+	Shadow,
+	DepthPrepass,
+	Main,      // forward main pass
+	GBuffer,
+	Lighting,  // deferred light volumes
+	Composite,
+	Skybox,
+	Occlusion, // Hi-Z culling dispatches and the depth they test against
+	Other,
+	Count,
+};
+
+enum class ResidentMemory : uint8_t
+{
+	Texture,
+	Buffer,
+};
+
+template<typename T>
+struct BasicPassStats
+{
+	T drawCalls{};
+	T instances{};
+	T triangles{};
+	T programSwitches{};
+	T vertexArraySwitches{};
+
+	// Visits every field with its name, the same field of each struct together. The single list the averaging
+	// and the JSON output are built from.
+	template<typename Function, typename... Structs>
+	static void fields(Function&& function, Structs&... structs)
+	{
+		function("draw_calls", structs.drawCalls...);
+		function("instances", structs.instances...);
+		function("triangles", structs.triangles...);
+		function("program_switches", structs.programSwitches...);
+		function("vao_switches", structs.vertexArraySwitches...);
+	}
+};
+
+template<typename T>
+struct BasicFrameStats
+{
+	array<BasicPassStats<T>, static_cast<size_t>(StatsPass::Count)> passes{};
+	T bufferUploadBytes{};
+	T textureUploadBytes{};
+	T shadowMapsRendered{};
+	T lightsShaded{};
+	// Occlusion culling results, read back a few frames late
+	T occlusionVisible{};
+	T occlusionOccluded{};
+	T occlusionFrustumCulled{};
+	// CPU occlusion culling of the submitted snapshot, times in microseconds
+	T softwareOcclusionTested{};
+	T softwareOcclusionCulled{};
+	T softwareOcclusionTriangles{};
+	T softwareOcclusionRasterUs{};
+	T softwareOcclusionTestUs{};
+	// Totals at the end of the frame, not per frame amounts
+	T residentTextureBytes{};
+	T residentBufferBytes{};
+
+	[[nodiscard]] const BasicPassStats<T>& pass(const StatsPass statsPass) const { return passes[static_cast<size_t>(statsPass)]; }
+
+	// Frame wide fields only, the passes are visited through BasicPassStats::fields
+	template<typename Function, typename... Structs>
+	static void fields(Function&& function, Structs&... structs)
+	{
+		function("buffer_upload_bytes", structs.bufferUploadBytes...);
+		function("texture_upload_bytes", structs.textureUploadBytes...);
+		function("shadow_maps", structs.shadowMapsRendered...);
+		function("lights_shaded", structs.lightsShaded...);
+		function("occlusion_visible", structs.occlusionVisible...);
+		function("occlusion_occluded", structs.occlusionOccluded...);
+		function("occlusion_frustum_culled", structs.occlusionFrustumCulled...);
+		function("software_occlusion_tested", structs.softwareOcclusionTested...);
+		function("software_occlusion_culled", structs.softwareOcclusionCulled...);
+		function("software_occlusion_triangles", structs.softwareOcclusionTriangles...);
+		function("software_occlusion_raster_us", structs.softwareOcclusionRasterUs...);
+		function("software_occlusion_test_us", structs.softwareOcclusionTestUs...);
+		function("resident_texture_bytes", structs.residentTextureBytes...);
+		function("resident_buffer_bytes", structs.residentBufferBytes...);
+	}
+};
+
+using PassStats = BasicPassStats<uint64_t>;
+using FrameStats = BasicFrameStats<uint64_t>;
+// Rolling averages over the last HISTORY_SIZE frames
+using FrameStatsAverages = BasicFrameStats<double>;
+
+// Per frame counters of the GL thread. Draws, uploads and the rest are recorded where they are issued,
+// program and VAO switches are read from the GL state cache when a pass begins and ends.
+// GL thread only, see RenderCounters().
+class RenderStats
+{
+public:
+	RenderStats();
+
+	// Closes the frame that was being recorded: it becomes getLastFrame() and enters the rolling averages
+	void endFrame();
+
+	void beginPass(StatsPass pass);
+	void endPass();
+
+	void recordDraw(uint64_t instances, uint64_t triangles);
+	void recordBufferUpload(uint64_t bytes) { current.bufferUploadBytes += bytes; }
+	void recordTextureUpload(uint64_t bytes) { current.textureUploadBytes += bytes; }
+	void recordShadowMap() { ++current.shadowMapsRendered; }
+	void recordLightsShaded(uint64_t lights) { current.lightsShaded += lights; }
+	void recordOcclusion(uint64_t visible, uint64_t occluded, uint64_t frustumCulled);
+	void recordSoftwareOcclusion(uint64_t tested, uint64_t culled, uint64_t triangles, double rasterMs, double testMs);
+
+	// Resident totals, kept by GpuMemory() as allocations are tracked and untracked
+	void addResident(ResidentMemory memory, uint64_t bytes);
+	void removeResident(ResidentMemory memory, uint64_t bytes);
+
+	[[nodiscard]] const FrameStats& getLastFrame() const { return lastFrame; }
+	[[nodiscard]] FrameStatsAverages getAverages() const;
+	[[nodiscard]] size_t getFrameCount() const { return frameCount; }
+	void report(ostream& out) const;
+
+	// Appends the averages as one JSON object per line every interval seconds, 0 disables it
+	void setDumpInterval(double seconds) { dumpInterval = seconds; }
+	void setJsonPath(const string& path);
+	void writeJson(ostream& out) const;
+
+	[[nodiscard]] static const char* passName(StatsPass pass);
+
+	static constexpr size_t PASS_COUNT = static_cast<size_t>(StatsPass::Count);
+	static constexpr size_t HISTORY_SIZE = 240;
+	// Significant digits of the JSON values, byte counts stay exact
+	static constexpr int JSON_PRECISION = 12;
+
+private:
+	// Switches issued by the state cache so far this frame, the difference over a pass is charged to it
+	struct SwitchMarks
+	{
+		uint32_t programs = 0;
+		uint32_t vertexArrays = 0;
+	};
+
+	static SwitchMarks currentSwitches();
+	void chargeSwitches();
+
+	FrameStats current;
+	FrameStats lastFrame;
+	StatsPass activePass = StatsPass::Other;
+	SwitchMarks passStart;
+
+	array<FrameStats, HISTORY_SIZE> history{};
+	size_t next = 0;
+	size_t frameCount = 0;
+
+	double dumpInterval = 0.0;
+	double lastDump = 0.0;
+	ofstream json;
+};
+
+// The stats of the GL context, recorded by the thread owning it
+RenderStats& RenderCounters();
@@ -4,13 +4,30 @@
 #include "Camera.hpp"
 #include <stb_image.h>
 #include <iostream>
+#include <algorithm>
+#include "FrameCapture.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+#include "TextureStreamer.hpp"
+#include "Trace.hpp"
 
 Renderer::~Renderer()
 {
 	// destroy these first, because they use OpenGL context
+	// models go before their instances, so the instance tracking skips the swap-and-pop work
+	modelRegistry.clear<ModelComponent>();
 	modelRegistry.clear();
+	TextureStreaming().shutdown();
+	delete hiZCulling;
+	delete deferredRenderer;
+	delete gBufferVariants;
+	delete mainVariants;
 	shaders.clear();
+	if(samplesQueries[0])
+		glDeleteQueries(NUM_SAMPLE_QUERIES, samplesQueries);
 	delete lightManager;
+	delete gpuProfiler;
 	delete camera;
 	delete skybox;
 	if(glContext)
@@ -20,13 +37,23 @@ Renderer::~Renderer()
 
 void Renderer::init(SDL_Window* sdlWindow)
 {
+	TRACE_THREAD_NAME("main");
+	TRACE_ZONE("Renderer::init");
 	window = sdlWindow;
+	transformSystem.setJobSystem(&jobSystem);
+	sceneBVH.setJobSystem(&jobSystem);
+	occlusionRasterizer.setJobSystem(&jobSystem);
+	TextureStreaming().setJobSystem(&jobSystem);
 
 	initOpenGL();
+	gpuProfiler = new GpuProfiler();
 	initShaders();
 	loadSkybox();
 	initCamera();
 	initLightManager();
+	initQueries();
+	initDeferredRenderer();
+	initOcclusionCulling();
 
 	setupInstanceTracking(modelRegistry);
 	stbi_set_flip_vertically_on_load(true);
@@ -40,7 +67,7 @@ void Renderer::event(const SDL_Event& event)
 		case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
 			windowWidth = event.window.data1;
 			windowHeight = event.window.data2;
-			glViewport(0, 0, windowWidth, windowHeight);
+			GLState().viewport(0, 0, windowWidth, windowHeight);
 			if(camera)
 				camera->setAspect(static_cast<float>(windowWidth), static_cast<float>(windowHeight));
 			break;
@@ -82,6 +109,54 @@ void Renderer::event(const SDL_Event& event)
 					case SDL_SCANCODE_D:
 						if(isFocused) if(camera) camera->speed.x += 1.0f;
 						break;
+					case SDL_SCANCODE_F1:
+						useShaderVariants = !useShaderVariants;
+						cout << "Shader variants: " << (useShaderVariants ? "on" : "off") << endl;
+						break;
+					case SDL_SCANCODE_F2:
+						reportShaderVariants();
+						break;
+					case SDL_SCANCODE_F3:
+						useDepthPrepass = !useDepthPrepass;
+						cout << "Depth pre-pass: " << (useDepthPrepass ? "on" : "off")
+							<< " (shaded samples per pixel: " << shadedSamplesPerPixel << ")" << endl;
+						break;
+					case SDL_SCANCODE_F4:
+						renderPath = renderPath == RenderPath::Forward ? RenderPath::Deferred : RenderPath::Forward;
+						cout << "Render path: " << (renderPath == RenderPath::Forward ? "forward" : "deferred") << endl;
+						break;
+					case SDL_SCANCODE_F5:
+						// Deferred to the next update so it runs at a well defined point of the frame
+						pendingRenderPathComparison = true;
+						break;
+					case SDL_SCANCODE_F6:
+						gpuProfiler->report(cout);
+						break;
+					case SDL_SCANCODE_F7:
+						assets.report(cout);
+						TextureStreaming().report(cout);
+						GpuMemory().report(cout);
+						break;
+					case SDL_SCANCODE_F8:
+						if(saveScene("scene_export.txt") && saveScene("scene_export.scene"))
+							cout << "Scene exported to scene_export.txt and scene_export.scene" << endl;
+						break;
+					case SDL_SCANCODE_F9:
+						renderQueue.report(cout);
+						break;
+					case SDL_SCANCODE_F10:
+						GLState().report(cout);
+						break;
+					case SDL_SCANCODE_F11:
+						RenderCounters().report(cout);
+						break;
+					case SDL_SCANCODE_F12:
+						// Off -> Hi-Z -> software -> off
+						occlusionCulling = occlusionCulling == OcclusionCulling::Off ? OcclusionCulling::HiZ
+							: occlusionCulling == OcclusionCulling::HiZ ? OcclusionCulling::Software : OcclusionCulling::Off;
+						cout << "Occlusion culling: " << (occlusionCulling == OcclusionCulling::Off ? "off"
+							: occlusionCulling == OcclusionCulling::HiZ ? "Hi-Z (GPU)" : "software (CPU)") << endl;
+						break;
 					default: break;
 				}
 			}
@@ -120,71 +195,457 @@ void Renderer::event(const SDL_Event& event)
 
 void Renderer::update(const float deltaTime)
 {
-	camera->update(deltaTime);
+	TRACE_ZONE("frame");
 
-	auto drawModels = [this](const Shader& shader)
+	// ========== Sync point, the simulation thread is idle ==========
+	if(!hasSnapshot)
 	{
-		const auto modelView = modelRegistry.view<ModelComponent>();
-		modelView.each([&shader](const ModelComponent& modelComp)
+		// First frame, nothing was simulated ahead yet
+		simulate(deltaTime, snapshots[renderIndex]);
+		hasSnapshot = true;
+	}
+	RenderSnapshot& frame = snapshots[renderIndex];
+
+	// One unused model per frame, the memory its streamed textures held comes back once their fences signal
+	assets.markUsed(frame.frame);
+	if(GpuMemory().overBudget())
+		assets.evictLeastRecentlyUsed();
+
+	refreshSnapshot(frame);
+	{
+		TRACE_ZONE("upload");
+		frame.uploadInstances(modelRegistry);
+		frame.uploadVisibleInstances(modelRegistry);
+		if(frame.softwareOcclusion.culled)
 		{
-			modelComp.drawInstanced(shader);
-		});
-	};
+			const SoftwareOcclusionResult& occlusion = frame.softwareOcclusion;
+			RenderCounters().recordSoftwareOcclusion(occlusion.tested, occlusion.occluded, occlusion.occluderTriangles,
+													 occlusion.rasterMs, occlusion.testMs);
+		}
+		lightManager->upload(frame.lights);
+	}
+	{
+		TRACE_ZONE("textureStreaming");
+		requestTextureDetail(frame);
+		TextureStreaming().update();
+	}
 
-	// ========== PASS 1: Shadow Maps ==========
-	lightManager->renderShadows(drawModels);
+	if(pendingRenderPathComparison)
+	{
+		pendingRenderPathComparison = false;
+		compareRenderPaths();
+	}
 
-	// ========== PASS 2: Main Scene ==========
-	renderScene(drawModels);
+	// ========== Simulate the next frame while this one is submitted ==========
+	const Uint64 submitStart = SDL_GetTicksNS();
+	// Captures only this, small enough for std::function's inline storage, so the kick doesn't allocate
+	simulationDeltaTime = deltaTime;
+	simulation.kick([this]
+	{
+		simulate(simulationDeltaTime, snapshots[renderIndex ^ 1]);
+	});
 
-	SDL_GL_SwapWindow(window);
+	renderProfiledFrame(frame);
+
+	{
+		TRACE_ZONE("swap");
+		SDL_GL_SwapWindow(window);
+	}
+
+	const Uint64 waitStart = SDL_GetTicksNS();
+	{
+		TRACE_ZONE("waitSimulation");
+		simulation.wait();
+	}
+	const Uint64 end = SDL_GetTicksNS();
+
+	frameTimings.submitMs = static_cast<double>(waitStart - submitStart) / 1e6;
+	frameTimings.waitMs = static_cast<double>(end - waitStart) / 1e6;
+	renderIndex ^= 1;
 }
 
-entt::entity Renderer::loadModel(const string& modelPath, const TransformComponent& transform)
+void Renderer::simulate(const float deltaTime, RenderSnapshot& out)
 {
-	// TODO: some models need glCullFace(GL_FRONT), others GL_BACK or disabled culling
-	entt::entity modelEntity = entt::null;
+	TRACE_ZONE("simulate");
+	const Uint64 start = SDL_GetTicksNS();
+
+	if(simulationCallback)
+		simulationCallback(deltaTime);
+	camera->update(deltaTime);
+	updateSystems();
+	extractSnapshot(out);
+
+	frameTimings.simulationMs = static_cast<double>(SDL_GetTicksNS() - start) / 1e6;
+}
+
+void Renderer::updateSystems()
+{
+	TRACE_ZONE("updateSystems");
+	transformSystem.update(modelRegistry);
+	sceneBVH.update(modelRegistry, transformSystem.getBakedInstances());
+}
+
+void Renderer::extractSnapshot(RenderSnapshot& out)
+{
+	TRACE_ZONE("extractSnapshot");
+	out.resetArena();
+	out.frame = ++simulatedFrames;
+	out.camera = camera->getState();
+	extractModels(out);
+	transformSystem.extract(modelRegistry, out);
+	cullOccludedInstances(out);
+	lightManager->extract(out.lights);
+}
 
-	// 1. Find or create the model resource entity
-	auto modelView = modelRegistry.view<ModelComponent>();
-	for(auto e : modelView)
+void Renderer::extractModels(RenderSnapshot& out) const
+{
+	out.models.clear();
+	const mat4& view = out.camera.view;
+	const Frustum frustum = Frustum::fromMatrix(out.camera.proj * view);
+	const auto modelView = modelRegistry.view<ModelComponent>();
+	modelView.each([&out, &view, &frustum](const entt::entity modelEntity, const ModelComponent& modelComp)
 	{
-		if(modelView.get<ModelComponent>(e).path == modelPath)
+		if(modelComp.instances.empty())
+			return;
+
+		// Depth is -z in view space, only the z row of the view matrix is needed
+		const AABB& bounds = modelComp.model.getBounds();
+		float nearestDepth = FLT_MAX;
+		float detailDepth = FLT_MAX;
+		for(const mat4& instance : modelComp.instanceMatrices)
 		{
-			modelEntity = e;
-			break;
+			const vec3 position(instance[3]);
+			const float depth = -(view[0][2] * position.x + view[1][2] * position.y + view[2][2] * position.z + view[3][2]);
+			nearestDepth = std::min(nearestDepth, depth);
+			// Instances behind the camera or off screen don't need texture detail
+			if(depth < detailDepth && !bounds.empty() && frustum.intersects(bounds.transformed(instance)))
+				detailDepth = depth;
 		}
+		out.models.push_back({&modelComp.model, modelEntity, static_cast<uint32_t>(modelComp.instanceMatrices.size()),
+							  nearestDepth, detailDepth});
+	});
+	out.modelsVersion = InstanceStructureVersion(modelRegistry);
+}
+
+void Renderer::refreshSnapshot(RenderSnapshot& frame)
+{
+	TRACE_ZONE("refreshSnapshot");
+	// Catches edits made on the main thread after the snapshot was captured: loads, spawns, deletions and moves
+	const bool structureChanged = InstanceStructureVersion(modelRegistry) != frame.modelsVersion;
+	const bool instancesChanged = structureChanged || !modelRegistry.storage<DirtyTransformTag>().empty();
+	if(instancesChanged)
+	{
+		updateSystems();
+		transformSystem.extract(modelRegistry, frame);
+		if(structureChanged)
+			extractModels(frame);
 	}
+	// Kept instances are copies, so they go stale with any edit, and a mode switch takes effect right away
+	if(instancesChanged || frame.softwareOcclusion.culled != (occlusionCulling == OcclusionCulling::Software))
+		cullOccludedInstances(frame);
+	lightManager->extract(frame.lights);
+}
 
-	if(modelEntity == entt::null)
+void Renderer::cullOccludedInstances(RenderSnapshot& out)
+{
+	out.visibleMatrices.clear();
+	out.softwareOcclusion = {};
+	if(occlusionCulling != OcclusionCulling::Software)
+		return;
+
+	TRACE_ZONE("cullOccludedInstances");
+	occlusionRasterizer.begin(out.camera.proj * out.camera.view);
+	modelRegistry.view<ModelComponent, OccluderComponent>().each(
+		[this](const ModelComponent& modelComp, const OccluderComponent& occluder)
+	{
+		for(const mat4& instance : modelComp.instanceMatrices)
+			occlusionRasterizer.addOccluder(occluder.positions, occluder.indices, instance);
+	});
+	occlusionRasterizer.rasterize();
+
+	const Uint64 testStart = SDL_GetTicksNS();
+	SoftwareOcclusionResult& result = out.softwareOcclusion;
+	for(ModelDraw& draw : out.models)
+	{
+		const auto& matrices = modelRegistry.get<ModelComponent>(draw.modelEntity).instanceMatrices;
+		const AABB& bounds = draw.model->getBounds();
+		const auto count = static_cast<uint32_t>(std::min<size_t>(draw.instanceCount, matrices.size()));
+		// Occluders would be tested against their own depth, they are drawn as they are
+		const bool occluder = modelRegistry.all_of<OccluderComponent>(draw.modelEntity);
+		occludedFlags.assign(count, 0);
+		if(!occluder)
+		{
+			jobSystem.parallelFor(count, OCCLUSION_TEST_GRAIN, [this, &matrices, &bounds](const size_t begin, const size_t end)
+			{
+				for(size_t i = begin; i < end; ++i)
+					occludedFlags[i] = occlusionRasterizer.isOccluded(bounds.transformed(matrices[i]));
+			});
+		}
+
+		draw.visibleFirst = static_cast<uint32_t>(out.visibleMatrices.size());
+		for(uint32_t i = 0; i < count; ++i)
+			if(!occludedFlags[i])
+				out.visibleMatrices.push_back(matrices[i]);
+		draw.visibleCount = static_cast<uint32_t>(out.visibleMatrices.size()) - draw.visibleFirst;
+		if(!occluder)
+			result.tested += count;
+		result.occluded += count - draw.visibleCount;
+	}
+
+	const OcclusionRasterizer::Stats& rasterStats = occlusionRasterizer.getStats();
+	result.culled = true;
+	result.occluderTriangles = rasterStats.rasterizedTriangles;
+	result.rasterMs = rasterStats.rasterMs;
+	result.testMs = static_cast<double>(SDL_GetTicksNS() - testStart) / 1e6;
+}
+
+void Renderer::compareRenderPaths()
+{
+	TRACE_ZONE("compareRenderPaths");
+	const RenderPath savedPath = renderPath;
+
+	const RenderSnapshot& frame = snapshots[renderIndex];
+
+	// Each render is a frame of its own, the profiler's scopes and the stats' passes can't span two of them
+	renderPath = RenderPath::Forward;
+	renderProfiledFrame(frame);
+	const Image forwardImage = CaptureFramebuffer(windowWidth, windowHeight);
+
+	renderPath = RenderPath::Deferred;
+	renderProfiledFrame(frame);
+	const Image deferredImage = CaptureFramebuffer(windowWidth, windowHeight);
+
+	renderPath = savedPath;
+
+	const ImageDiffResult diff = DiffImages(forwardImage, deferredImage);
+	WritePPM("render_forward.ppm", forwardImage);
+	WritePPM("render_deferred.ppm", deferredImage);
+	WritePPM("render_diff.ppm", diff.diff);
+
+	cout << "------------Forward vs deferred------------" << endl;
+	cout << "RMSE: " << diff.rmse << " (0-255)" << endl;
+	cout << "Max channel difference: " << diff.maxChannelDiff << endl;
+	cout << "Mismatching pixels: " << diff.mismatchPercent << "%" << endl;
+	cout << "Images written to render_forward.ppm, render_deferred.ppm and render_diff.ppm" << endl;
+	cout << "----------------------------------------" << endl;
+}
+
+void Renderer::renderProfiledFrame(const RenderSnapshot& frame)
+{
+	gpuProfiler->beginFrame();
+	GLState().beginFrame();
+	renderFrame(frame);
+	gpuProfiler->endFrame();
+	RenderCounters().endFrame();
+}
+
+void Renderer::renderFrame(const RenderSnapshot& frame)
+{
+	TRACE_ZONE("renderFrame");
+	// Only the snapshot is read here, the registries belong to the simulation thread until it is waited for
+	buildRenderQueue(frame);
+	auto drawShadowCasters = [this](const Shader& shader)
 	{
-		const string base(DATA_DIR);
-		const string fullPath = base + "/models/" + modelPath;
-
-		modelEntity = modelRegistry.create();
-		modelRegistry.emplace<ModelComponent>(
-			modelEntity,
-			modelPath,
-			Model(fullPath)
-		);
+		shader.use();
+		renderQueue.draw(RenderPass::Shadow, shader);
+	};
+
+	// The uber shader and the deferred lighting pass always sample every shadow map
+	const bool specialized = useShaderVariants && renderPath == RenderPath::Forward;
+
+	// ========== PASS 1: Shadow Maps ==========
+	lightManager->setShadowSettings(specialized ? shadowSettings : ShadowSettings{});
+	{
+		GpuScope scope(gpuProfiler, "shadows");
+		RenderCounters().beginPass(StatsPass::Shadow);
+		lightManager->renderShadows(frame.lights, drawShadowCasters);
+		RenderCounters().endPass();
+	}
+
+	// ========== Occlusion culling, fills the indirect commands the geometry passes draw with ==========
+	if(occlusionCulling == OcclusionCulling::HiZ)
+	{
+		GpuScope scope(gpuProfiler, "occlusion");
+		RenderCounters().beginPass(StatsPass::Occlusion);
+		hiZCulling->resize(windowWidth, windowHeight);
+		hiZCulling->cull(frame.models, frame.camera, [this](const Shader& shader)
+		{
+			renderQueue.draw(RenderPass::Opaque, shader);
+		});
+		RenderCounters().endPass();
 	}
 
-	// 2. Create an instance entity
+	// ========== PASS 2: Main Scene ==========
+	if(renderPath == RenderPath::Deferred)
+		renderSceneDeferred(frame);
+	else
+		renderScene(frame);
+}
+
+entt::entity Renderer::loadModel(const string& modelPath, const TransformComponent& transform)
+{
+	const entt::entity instance = createInstance(assets.intern(modelPath), transform);
+	cout << "Instance created for model: " << modelPath << endl;
+	return instance;
+}
+
+entt::entity Renderer::createInstance(const AssetId model, const TransformComponent& transform)
+{
+	// TODO: some models need glCullFace(GL_FRONT), others GL_BACK or disabled culling
+
+	// 1. Find or load the model resource entity
+	const entt::entity modelEntity = assets.load(model);
+	if(modelEntity == entt::null)
+		return entt::null;
+
+	// 2. Create an instance entity, the instance tracking gives it a slot in the model's pool
+	// and its matrix is baked with the other dirty transforms
 	const entt::entity instance = modelRegistry.create();
-	modelRegistry.emplace<InstanceComponent>(instance, modelEntity);
+	modelRegistry.emplace<InstanceComponent>(instance, modelEntity, 0u);
 	modelRegistry.emplace<TransformComponent>(instance, transform);
-	cout << "Instance created for model: " << modelPath << endl;
+	modelRegistry.emplace<DirtyTransformTag>(instance);
 	// TODO: when scale is different than (1,1,1), position and rotation may need adjustment
 
-	// 3. Bake the transform and add it to the ModelComponent's instanceMatrices
+	return instance;
+}
+
+void Renderer::createInstances(const AssetId model, const TransformArraysView& transforms,
+							   vector<entt::entity>* outInstances)
+{
+	const entt::entity modelEntity = assets.load(model);
+	if(modelEntity == entt::null || transforms.count == 0)
+		return;
+
 	auto& modelComp = modelRegistry.get<ModelComponent>(modelEntity);
-	modelComp.instanceMatrices.emplace_back(transform.bake());
+	modelComp.instances.reserve(modelComp.instances.size() + transforms.count);
+	modelComp.instanceMatrices.reserve(modelComp.instanceMatrices.size() + transforms.count);
 
-	return instance;
+	vector<entt::entity> instances(transforms.count);
+	modelRegistry.create(instances.begin(), instances.end());
+
+	vector<TransformComponent> transformComps;
+	transformComps.reserve(transforms.count);
+	for(size_t i = 0; i < transforms.count; ++i)
+		transformComps.push_back(transforms[i]);
+
+	modelRegistry.insert<InstanceComponent>(instances.begin(), instances.end(), InstanceComponent{modelEntity, 0u});
+	modelRegistry.insert<TransformComponent>(instances.begin(), instances.end(), transformComps.begin());
+	modelRegistry.insert<DirtyTransformTag>(instances.begin(), instances.end());
+
+	if(outInstances)
+		outInstances->insert(outInstances->end(), instances.begin(), instances.end());
+}
+
+static bool IsBinaryScenePath(const string& path)
+{
+	return path.size() >= 6 && path.compare(path.size() - 6, 6, ".scene") == 0;
+}
+
+bool Renderer::loadScene(const string& path)
+{
+	const Uint64 start = SDL_GetTicksNS();
+	size_t instanceCount = 0, lightCount = 0;
+
+	if(IsBinaryScenePath(path))
+	{
+		MappedScene scene;
+		if(!scene.open(path))
+			return false;
+
+		for(uint32_t model = 0; model < scene.modelCount(); ++model)
+			createInstances(assets.intern(string(scene.modelPath(model))), scene.transforms(model));
+		lightManager->createPointLights(scene.pointLights());
+		lightManager->createSpotlights(scene.spotlights());
+		lightManager->createDirLights(scene.dirLights());
+
+		instanceCount = scene.instanceCount();
+		lightCount = scene.pointLights().size() + scene.spotlights().size() + scene.dirLights().size();
+	}
+	else
+	{
+		SceneDescription scene;
+		if(!ReadSceneText(path, scene))
+			return false;
+
+		size_t first = 0;
+		for(size_t model = 0; model < scene.modelPaths.size(); ++model)
+		{
+			createInstances(assets.intern(scene.modelPaths[model]), scene.transforms(first, scene.instanceCounts[model]));
+			first += scene.instanceCounts[model];
+		}
+		lightManager->createPointLights(scene.pointLights);
+		lightManager->createSpotlights(scene.spotlights);
+		lightManager->createDirLights(scene.dirLights);
+
+		instanceCount = scene.instanceCount();
+		lightCount = scene.pointLights.size() + scene.spotlights.size() + scene.dirLights.size();
+	}
+
+	const double ms = static_cast<double>(SDL_GetTicksNS() - start) / 1.0e6;
+	cout << "Scene loaded from " << path << ": " << instanceCount << " instances, " << lightCount
+		<< " lights in " << ms << " ms" << endl;
+	return true;
+}
+
+bool Renderer::saveScene(const string& path) const
+{
+	const SceneDescription scene = captureScene();
+	return IsBinaryScenePath(path) ? WriteSceneBinary(path, scene) : WriteSceneText(path, scene);
+}
+
+SceneDescription Renderer::captureScene() const
+{
+	SceneDescription scene;
+	const auto modelView = modelRegistry.view<ModelComponent>();
+	modelView.each([this, &scene](const ModelComponent& modelComp)
+	{
+		if(modelComp.instances.empty())
+			return;
+		scene.modelPaths.push_back(modelComp.path);
+		scene.instanceCounts.push_back(0);
+		for(const entt::entity instance : modelComp.instances)
+			scene.addInstance(modelRegistry.get<TransformComponent>(instance));
+	});
+
+	scene.pointLights = lightManager->getPointLightDescs();
+	scene.spotlights = lightManager->getSpotlightDescs();
+	scene.dirLights = lightManager->getDirLightDescs();
+	return scene;
+}
+
+void Renderer::setTransform(const entt::entity instance, const TransformComponent& transform)
+{
+	modelRegistry.replace<TransformComponent>(instance, transform);
+	modelRegistry.emplace_or_replace<DirtyTransformTag>(instance);
+}
+
+const TransformComponent& Renderer::getTransform(const entt::entity instance) const
+{
+	return modelRegistry.get<TransformComponent>(instance);
+}
+
+void Renderer::destroyInstance(const entt::entity instance)
+{
+	if(modelRegistry.valid(instance))
+		modelRegistry.destroy(instance);
+}
+
+entt::entity Renderer::pickInstance(const float x, const float y) const
+{
+	// Window position to NDC, y points up in NDC
+	const vec2 ndc(2.0f * x / static_cast<float>(windowWidth) - 1.0f, 1.0f - 2.0f * y / static_cast<float>(windowHeight));
+	const mat4 inverseViewProj = inverse(camera->getProj() * camera->getView());
+	vec4 nearPoint = inverseViewProj * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProj * vec4(ndc, 1.0f, 1.0f);
+	nearPoint /= nearPoint.w;
+	farPoint /= farPoint.w;
+
+	return sceneBVH.raycast(vec3(nearPoint), vec3(farPoint - nearPoint)).instance;
 }
 
 void Renderer::initOpenGL()
 {
+	TRACE_ZONE("initOpenGL");
 	// Set OpenGL attributes before creating context
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 6);
@@ -216,15 +677,18 @@ void Renderer::initOpenGL()
 
 	SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
-	glViewport(0, 0, windowWidth, windowHeight);
+	// Whatever SDL or the driver left bound is unknown to the cache
+	GLState().invalidate();
+	GLState().viewport(0, 0, windowWidth, windowHeight);
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_MULTISAMPLE);
+	GLState().enable(GL_DEPTH_TEST);
+	GLState().enable(GL_CULL_FACE);
+	GLState().enable(GL_MULTISAMPLE);
 }
 
 void Renderer::initShaders()
 {
+	TRACE_ZONE("initShaders");
 	shaders.clear();
 	shaders.reserve(NUM_SHADERS);
 	for(int type = 0; type < NUM_SHADERS; ++type)
@@ -234,10 +698,14 @@ void Renderer::initShaders()
 		if(!shaders[type].ok())
 			throw std::runtime_error("Failed to load shader: " + shaderFiles[type]);
 	}
+
+	// Variants are compiled lazily, the uber shader above is their fallback
+	mainVariants = new ShaderVariantCache(shaderFiles[MAIN_SHADER], shaders[MAIN_SHADER]);
 }
 
 void Renderer::loadSkybox()
 {
+	TRACE_ZONE("loadSkybox");
 	skybox = new Skybox(shaders[SKYBOX_SHADER]);
 
 	const string faces[6] = {
@@ -250,40 +718,313 @@ void Renderer::loadSkybox()
 	};
 
 	const string skyboxDir = string(DATA_DIR) + "/textures/skybox";
-	skybox->loadFaces(skyboxDir, faces);
+	skybox->loadFaces(skyboxDir, faces, &jobSystem);
 	skybox->scale(1000.0f);
 }
 
 void Renderer::initCamera()
 {
+	TRACE_ZONE("initCamera");
 	camera = new Camera(shaders[MAIN_SHADER], shaders[SKYBOX_SHADER]);
 	camera->setAspect(windowWidth, windowHeight);
 }
 
 void Renderer::initLightManager()
 {
+	TRACE_ZONE("initLightManager");
 	lightManager = new LightManager(
 		shaders[MAIN_SHADER],
 		shaders[SKYBOX_SHADER],
 		shaders[SHADOW_MAP_SHADER],
 		shaders[SHADOW_POINT_SHADER]
 	);
+	lightManager->setProfiler(gpuProfiler);
+	lightManager->setJobSystem(&jobSystem);
+}
+
+void Renderer::initQueries()
+{
+	TRACE_ZONE("initQueries");
+	glGenQueries(NUM_SAMPLE_QUERIES, samplesQueries);
+
+	// Default framebuffer is multisampled, so the samples counter counts covered samples, not pixels
+	glGetIntegerv(GL_SAMPLES, &framebufferSamples);
+	framebufferSamples = std::max(framebufferSamples, 1);
+}
+
+void Renderer::initDeferredRenderer()
+{
+	TRACE_ZONE("initDeferredRenderer");
+	deferredRenderer = new DeferredRenderer(shaders[DEFERRED_LIGHT_SHADER], shaders[DEFERRED_COMPOSITE_SHADER]);
+	deferredRenderer->resize(windowWidth, windowHeight);
+	gBufferVariants = new ShaderVariantCache(shaderFiles[GBUFFER_SHADER], shaders[GBUFFER_SHADER]);
+}
+
+void Renderer::initOcclusionCulling()
+{
+	TRACE_ZONE("initOcclusionCulling");
+	hiZCulling = new HiZCulling(shaders[HIZ_CULL_SHADER], shaders[HIZ_PYRAMID_SHADER], shaders[HIZ_COMMANDS_SHADER],
+								shaders[DEPTH_PREPASS_SHADER]);
+}
+
+void Renderer::setOccluder(const AssetId model, const bool occluder)
+{
+	const entt::entity modelEntity = assets.load(model);
+	if(modelEntity == entt::null)
+		return;
+	if(!occluder)
+	{
+		modelRegistry.remove<OccluderComponent>(modelEntity);
+		return;
+	}
+
+	auto& component = modelRegistry.emplace_or_replace<OccluderComponent>(modelEntity);
+	const ModelComponent& modelComp = modelRegistry.get<ModelComponent>(modelEntity);
+	modelComp.model.collectTriangles(component.positions, component.indices);
+	if(component.indices.size() / 3 > MAX_OCCLUDER_TRIANGLES)
+		cerr << "WARNING: occluder " << modelComp.path << " has " << component.indices.size() / 3
+			 << " triangles, a simplified stand-in would rasterize faster" << endl;
+}
+
+void Renderer::reportShaderVariants() const
+{
+	mainVariants->report(cout);
+}
+
+SceneFeatures Renderer::getSceneFeatures() const
+{
+	const ShadowSettings& shadows = lightManager->getShadowSettings();
+	SceneFeatures scene;
+	scene.dirLights = lightManager->getDirLightCount() > 0;
+	scene.pointLights = lightManager->getPointLightCount() > 0;
+	scene.spotLights = lightManager->getSpotlightCount() > 0;
+	scene.dirShadows = shadows.dir;
+	scene.pointShadows = shadows.point;
+	scene.spotShadows = shadows.spot;
+	return scene;
+}
+
+ShaderVariantCache::FrameUniforms Renderer::getFrameUniforms(const CameraState& cameraState) const
+{
+	return {
+		cameraState.proj,
+		cameraState.view,
+		cameraState.eye,
+		static_cast<int>(lightManager->getPointLightCount()),
+		static_cast<int>(lightManager->getSpotlightCount()),
+		static_cast<int>(lightManager->getDirLightCount())
+	};
 }
 
-void Renderer::renderScene(const DrawModelsCallback& drawModels) const
+void Renderer::requestTextureDetail(const RenderSnapshot& frame) const
 {
-	glDisable(GL_CULL_FACE);
-	glViewport(0, 0, windowWidth, windowHeight);
+	// Projected diameter of the model's bounds at its nearest instance in view, instance scale is not accounted for.
+	// Models with no instance in view ask for nothing, so their textures are the first the budget trims.
+	const float pixelsPerUnit = frame.camera.proj[1][1] * 0.5f * static_cast<float>(windowHeight);
+	for(const ModelDraw& draw : frame.models)
+	{
+		const AABB& bounds = draw.model->getBounds();
+		if(bounds.empty() || draw.detailDepth == FLT_MAX)
+			continue;
+		const float radius = length(bounds.extent()) * 0.5f;
+		const float depth = std::max(draw.detailDepth - radius, TEXTURE_DETAIL_MIN_DEPTH);
+		draw.model->requestTextureDetail(2.0f * radius * pixelsPerUnit / depth);
+	}
+}
+
+void Renderer::buildRenderQueue(const RenderSnapshot& frame)
+{
+	TRACE_ZONE("buildRenderQueue");
+	// Programs only differ between draws when the pass picks shader variants per material
+	const bool deferred = renderPath == RenderPath::Deferred;
+	const SceneFeatures scene = deferred ? SceneFeatures{} : getSceneFeatures();
+	const bool prepass = useDepthPrepass && !deferred;
+
+	// Hi-Z culled geometry draws one indirect command per mesh, software culled geometry only the kept instances.
+	// Shadows still draw every instance.
+	const bool hiZ = occlusionCulling == OcclusionCulling::HiZ;
+	const bool softwareCulled = frame.softwareOcclusion.culled;
+	if(hiZ)
+		hiZCulling->prepare(frame.models);
+
+	renderQueue.begin();
+	for(size_t model = 0; model < frame.models.size(); ++model)
+	{
+		const ModelDraw& draw = frame.models[model];
+		const uint32_t drawnInstances = softwareCulled ? draw.visibleCount : draw.instanceCount;
+		uint32_t command = hiZ ? hiZCulling->firstCommand(model) : softwareCulled ? CULLED_INSTANCES : NO_COMMAND;
+		draw.model->forEachMesh([&](const Mesh& mesh)
+		{
+			renderQueue.push(RenderPass::Shadow, 0, 0.0f, mesh, draw.instanceCount);
+			if(drawnInstances == 0)
+				return;
+			if(prepass)
+				renderQueue.push(RenderPass::DepthPrepass, 0, draw.nearestDepth, mesh, drawnInstances, command);
+			const uint32_t program = useShaderVariants ? ShaderVariantKey{mesh.materialFeatures(), scene}.value() : 0;
+			renderQueue.push(RenderPass::Opaque, program, draw.nearestDepth, mesh, drawnInstances, command);
+			if(hiZ)
+				++command;
+		});
+	}
+	renderQueue.sort();
+}
+
+void Renderer::renderScene(const RenderSnapshot& frame)
+{
+	GLState().disable(GL_CULL_FACE);
+	GLState().viewport(0, 0, windowWidth, windowHeight);
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	camera->sync();
+	camera->sync(frame.camera);
 
-	const Shader& mainShader = shaders[MAIN_SHADER];
+	if(useDepthPrepass)
+	{
+		GpuScope scope(gpuProfiler, "depth_prepass");
+		RenderCounters().beginPass(StatsPass::DepthPrepass);
+		renderDepthPrepass(frame.camera);
+		RenderCounters().endPass();
+		// Only the nearest surface passes, and it is already in the depth buffer
+		GLState().depthFunc(GL_EQUAL);
+		GLState().depthMask(GL_FALSE);
+	}
 
-	mainShader.use();
-	drawModels(mainShader);
+	gpuProfiler->beginScope("main");
+	RenderCounters().beginPass(StatsPass::Main);
+	RenderCounters().recordLightsShaded(lightManager->getDirLightCount() + lightManager->getPointLightCount()
+										+ lightManager->getSpotlightCount());
+	beginShadedSamplesQuery();
+
+	if(useShaderVariants)
+	{
+		mainVariants->beginFrame(getFrameUniforms(frame.camera));
+		renderQueue.draw(RenderPass::Opaque, *mainVariants, getSceneFeatures());
+	}
+	else
+	{
+		const Shader& mainShader = shaders[MAIN_SHADER];
+
+		mainShader.use();
+		renderQueue.draw(RenderPass::Opaque, mainShader);
+	}
+
+	endShadedSamplesQuery();
+	RenderCounters().endPass();
+	gpuProfiler->endScope();
+
+	if(useDepthPrepass)
+	{
+		GLState().depthMask(GL_TRUE);
+		GLState().depthFunc(GL_LESS);
+	}
+
+	{
+		GpuScope scope(gpuProfiler, "skybox");
+		RenderCounters().beginPass(StatsPass::Skybox);
+		skybox->draw();
+		RenderCounters().endPass();
+	}
+
+	GLState().enable(GL_CULL_FACE);
+}
+
+void Renderer::renderSceneDeferred(const RenderSnapshot& frame)
+{
+	GLState().disable(GL_CULL_FACE);
+	deferredRenderer->resize(windowWidth, windowHeight);
+
+	camera->sync(frame.camera);
+
+	// ========== G-buffer ==========
+	gpuProfiler->beginScope("gbuffer");
+	RenderCounters().beginPass(StatsPass::GBuffer);
+	deferredRenderer->beginGeometryPass();
+	if(useShaderVariants)
+	{
+		// Only the material part of the key matters, the G-buffer pass does no lighting
+		gBufferVariants->beginFrame(getFrameUniforms(frame.camera));
+		renderQueue.draw(RenderPass::Opaque, *gBufferVariants, SceneFeatures{});
+	}
+	else
+	{
+		const Shader& gBufferShader = shaders[GBUFFER_SHADER];
+		gBufferShader.use();
+		gBufferShader.setMat4("projection", frame.camera.proj);
+		gBufferShader.setMat4("view", frame.camera.view);
+		renderQueue.draw(RenderPass::Opaque, gBufferShader);
+	}
+	deferredRenderer->endGeometryPass();
+	RenderCounters().endPass();
+	gpuProfiler->endScope();
+
+	// ========== Light volumes ==========
+	gpuProfiler->beginScope("lighting");
+	RenderCounters().beginPass(StatsPass::Lighting);
+	const DeferredLightCounts lightCounts{
+		lightManager->getDirLightCount(),
+		lightManager->getPointLightCount(),
+		lightManager->getSpotlightCount()
+	};
+	RenderCounters().recordLightsShaded(lightCounts.dirLights + lightCounts.pointLights + lightCounts.spotlights);
+	deferredRenderer->lightingPass(frame.camera.proj, frame.camera.view, frame.camera.eye, lightCounts);
+	RenderCounters().endPass();
+	gpuProfiler->endScope();
+
+	// ========== Composite + skybox ==========
+	GLState().viewport(0, 0, windowWidth, windowHeight);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gpuProfiler->beginScope("composite");
+	RenderCounters().beginPass(StatsPass::Composite);
+	deferredRenderer->composite();
+	RenderCounters().endPass();
+	gpuProfiler->endScope();
+	gpuProfiler->beginScope("skybox");
+	RenderCounters().beginPass(StatsPass::Skybox);
 	skybox->draw();
+	RenderCounters().endPass();
+	gpuProfiler->endScope();
+
+	GLState().enable(GL_CULL_FACE);
+}
 
-	glEnable(GL_CULL_FACE);
+void Renderer::renderDepthPrepass(const CameraState& cameraState) const
+{
+	const Shader& depthShader = shaders[DEPTH_PREPASS_SHADER];
+
+	GLState().colorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	depthShader.use();
+	depthShader.setMat4("projection", cameraState.proj);
+	depthShader.setMat4("view", cameraState.view);
+	renderQueue.draw(RenderPass::DepthPrepass, depthShader);
+
+	GLState().colorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void Renderer::beginShadedSamplesQuery()
+{
+	// The oldest query in the ring is reused this frame, harvest it first if the GPU is done with it
+	const GLuint query = samplesQueries[samplesQueryIndex];
+	if(samplesQueryIssued[samplesQueryIndex])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if(available)
+		{
+			GLuint64 samplesPassed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samplesPassed);
+			const double totalSamples = static_cast<double>(windowWidth) * windowHeight * framebufferSamples;
+			shadedSamplesPerPixel = totalSamples > 0.0 ? static_cast<double>(samplesPassed) / totalSamples : 0.0;
+		}
+	}
+
+	glBeginQuery(GL_SAMPLES_PASSED, query);
+}
+
+void Renderer::endShadedSamplesQuery()
+{
+	glEndQuery(GL_SAMPLES_PASSED);
+	samplesQueryIssued[samplesQueryIndex] = true;
+	samplesQueryIndex = (samplesQueryIndex + 1) % NUM_SAMPLE_QUERIES;
 }
@@ -5,10 +5,51 @@
 #include "Components.hpp"
 #include "Light.hpp"
 #include "Skybox.hpp"
+#include "ShaderVariants.hpp"
+#include "DeferredRenderer.hpp"
+#include "GpuProfiler.hpp"
+#include "TransformSystem.hpp"
+#include "AssetRegistry.hpp"
+#include "SceneFile.hpp"
+#include "SceneBVH.hpp"
+#include "RenderSnapshot.hpp"
+#include "SimulationThread.hpp"
+#include "JobSystem.hpp"
+#include "RenderQueue.hpp"
+#include "GLStateCache.hpp"
+#include "RenderStats.hpp"
+#include "HiZCulling.hpp"
+#include "OcclusionRasterizer.hpp"
 
+enum class RenderPath
+{
+	Forward,
+	Deferred,
+};
+
+enum class OcclusionCulling
+{
+	Off,
+	HiZ,      // GPU, two phases against a depth pyramid, every instance occludes
+	Software, // CPU, only designated occluders, see Renderer::setOccluder
+};
+
+// Game logic run on the simulation thread, see Renderer::setSimulationCallback
+using SimulationCallback = function<void(float deltaTime)>;
+
+// Each update() submits the frame captured by the previous one while the simulation thread (camera, transforms,
+// BVH and the SimulationCallback) prepares the next, so the image lags input by one frame.
+// Every other method runs on the main thread between updates, when the simulation thread is idle.
 class Renderer
 {
 public:
+	struct FrameTimings
+	{
+		double simulationMs = 0.0; // simulation stage, including the snapshot extraction
+		double submitMs = 0.0;     // GL submission and swap on the render thread
+		double waitMs = 0.0;       // render thread blocked on the simulation stage afterwards
+	};
+
 	Renderer() = default;
 	~Renderer();
 
@@ -16,9 +57,81 @@ public:
 	void event(const SDL_Event& event);
 	void update(float deltaTime);
 
+	// Runs at the start of every simulation stage, off the GL thread. It may move instances (setTransform) and
+	// edit lights through LightManager::get* / update*, but must not create or destroy anything.
+	void setSimulationCallback(SimulationCallback callback) { simulationCallback = std::move(callback); }
+	[[nodiscard]] const FrameTimings& getFrameTimings() const { return frameTimings; }
+
 	entt::entity loadModel(const string& modelPath, const TransformComponent& transform);
+	// Same as loadModel without any path handling, for spawning many instances of a known model
+	entt::entity createInstance(AssetId model, const TransformComponent& transform);
+	// Bulk version: entities and components are created in batches, matrices are baked on the next frame
+	void createInstances(AssetId model, const TransformArraysView& transforms, vector<entt::entity>* outInstances = nullptr);
+
+	// Binary scenes (.scene) are memory mapped and bulk created, any other extension is read as the text format
+	bool loadScene(const string& path);
+	// Format picked by extension like loadScene
+	bool saveScene(const string& path) const;
+	[[nodiscard]] SceneDescription captureScene() const;
+
+	// Models are loaded once per canonical path, references keep them alive through AssetRegistry::unloadUnused
+	AssetRegistry& getAssets() { return assets; }
+
+	// Moves an instance, the matrix is re-baked and uploaded once at the start of the next frame
+	void setTransform(entt::entity instance, const TransformComponent& transform);
+	[[nodiscard]] const TransformComponent& getTransform(entt::entity instance) const;
+	// O(1), the last instance of the model moves into the freed slot
+	void destroyInstance(entt::entity instance);
+	[[nodiscard]] const TransformSystem::Stats& getTransformStats() const { return transformSystem.getStats(); }
+
+	// Instance bounds hierarchy, current as of the start of the frame, for culling and spatial queries
+	[[nodiscard]] const SceneBVH& getSceneBVH() const { return sceneBVH; }
+	// Closest instance under a window position in pixels, entt::null when nothing is hit
+	[[nodiscard]] entt::entity pickInstance(float x, float y) const;
 
 	LightManager& getLightManager() const { return *lightManager; }
+	// Shared worker pool for CPU work of the engine and the application
+	JobSystem& getJobSystem() { return jobSystem; }
+
+	// Specialized main pass programs per material and scene configuration
+	void setShaderVariantsEnabled(bool enabled) { useShaderVariants = enabled; }
+	[[nodiscard]] bool shaderVariantsEnabled() const { return useShaderVariants; }
+	// Shadow maps are only skipped when shader variants are enabled, the uber shader always samples them
+	void setShadowSettings(const ShadowSettings& settings) { shadowSettings = settings; }
+	void reportShaderVariants() const;
+
+	// Depth-only pre-pass so the main pass shades roughly one fragment per pixel
+	void setDepthPrepassEnabled(bool enabled) { useDepthPrepass = enabled; }
+	[[nodiscard]] bool depthPrepassEnabled() const { return useDepthPrepass; }
+	// Samples that passed the depth test in the main pass, per framebuffer sample (1.0 = no overdraw)
+	[[nodiscard]] double getShadedSamplesPerPixel() const { return shadedSamplesPerPixel; }
+
+	void setRenderPath(RenderPath path) { renderPath = path; }
+	[[nodiscard]] RenderPath getRenderPath() const { return renderPath; }
+	// Renders the same frame with both paths, writes both images and their difference, logs the diff
+	void compareRenderPaths();
+
+	// The geometry passes draw only the instances occlusion culling kept. Shadow passes are never culled,
+	// occluders of the camera are not occluders of the lights.
+	void setOcclusionCulling(OcclusionCulling mode) { occlusionCulling = mode; }
+	[[nodiscard]] OcclusionCulling getOcclusionCulling() const { return occlusionCulling; }
+	// Hi-Z counts of the newest frame the GPU has finished, a few frames behind
+	[[nodiscard]] const HiZCulling::Stats& getOcclusionStats() const { return hiZCulling->getStats(); }
+	// Instances of the model occlude in the software culling and are never culled by it. Keeps a CPU copy of the
+	// model's triangles, meant for low-poly models such as walls and floor tiles.
+	void setOccluder(AssetId model, bool occluder);
+	// Depth buffer and timings of the snapshot simulated last
+	[[nodiscard]] const OcclusionRasterizer& getOcclusionRasterizer() const { return occlusionRasterizer; }
+
+	// Per pass GPU timings, see GpuProfiler::report / setDumpInterval / setCsvPath
+	GpuProfiler& getGpuProfiler() const { return *gpuProfiler; }
+	// Draws of the last rendered frame, with state changes per pass before and after sorting
+	[[nodiscard]] const RenderQueue& getRenderQueue() const { return renderQueue; }
+	// GL state calls issued and filtered as redundant during the last frame, per kind of state
+	[[nodiscard]] const GLStateCache::Counters& getGLStateCounters() const { return GLState().getLastFrame(); }
+	// Per pass draws, triangles and switches, uploads, shadow maps, lights and resident memory, for the last frame
+	// and as rolling averages. See RenderStats::setJsonPath / setDumpInterval for the JSON lines output.
+	RenderStats& getRenderStats() const { return RenderCounters(); }
 
 private:
 	void initOpenGL();
@@ -26,8 +139,34 @@ private:
 	void loadSkybox();
 	void initCamera();
 	void initLightManager();
+	void initQueries();
+	void initDeferredRenderer();
+	void initOcclusionCulling();
+
+	// ========== Simulation stage ==========
+	void simulate(float deltaTime, RenderSnapshot& out);
+	void updateSystems();
+	void extractSnapshot(RenderSnapshot& out);
+	void extractModels(RenderSnapshot& out) const;
+	void refreshSnapshot(RenderSnapshot& frame);
+	// Rasterizes the occluders and keeps the instances they don't hide, only in OcclusionCulling::Software
+	void cullOccludedInstances(RenderSnapshot& out);
 
-	void renderScene(const DrawModelsCallback& drawModels) const;
+	// ========== Render stage, reads only the snapshot ==========
+	void renderFrame(const RenderSnapshot& frame);
+	// renderFrame bracketed as one frame of the GPU profiler, the GL state cache and the render stats
+	void renderProfiledFrame(const RenderSnapshot& frame);
+	// Asks the texture streamer for the detail each model needs at its nearest instance
+	void requestTextureDetail(const RenderSnapshot& frame) const;
+	// Draw packets of every geometry pass this frame runs, sorted once and replayed by each pass
+	void buildRenderQueue(const RenderSnapshot& frame);
+	void renderScene(const RenderSnapshot& frame);
+	void renderSceneDeferred(const RenderSnapshot& frame);
+	void renderDepthPrepass(const CameraState& cameraState) const;
+	void beginShadedSamplesQuery();
+	void endShadedSamplesQuery();
+	[[nodiscard]] SceneFeatures getSceneFeatures() const;
+	[[nodiscard]] ShaderVariantCache::FrameUniforms getFrameUniforms(const CameraState& cameraState) const;
 
 	SDL_Window* window = nullptr;
 	SDL_GLContext glContext = nullptr;
@@ -40,6 +179,13 @@ private:
 		SKYBOX_SHADER,
 		SHADOW_MAP_SHADER,
 		SHADOW_POINT_SHADER,
+		DEPTH_PREPASS_SHADER,
+		GBUFFER_SHADER,
+		DEFERRED_LIGHT_SHADER,
+		DEFERRED_COMPOSITE_SHADER,
+		HIZ_CULL_SHADER,
+		HIZ_PYRAMID_SHADER,
+		HIZ_COMMANDS_SHADER,
 		NUM_SHADERS,
 	};
 
@@ -48,15 +194,68 @@ private:
 		"shaders/skybox.glsl",
 		"shaders/shadow_map.glsl",
 		"shaders/shadow_point.glsl",
+		"shaders/depth_prepass.glsl",
+		"shaders/gbuffer.glsl",
+		"shaders/deferred_light.glsl",
+		"shaders/deferred_composite.glsl",
+		"shaders/hiz_cull.glsl",
+		"shaders/hiz_pyramid.glsl",
+		"shaders/hiz_commands.glsl",
 	};
 
 	vector<Shader> shaders;
+	JobSystem jobSystem; // declared before its users, so it is destroyed after them
 	entt::registry modelRegistry;
+	AssetRegistry assets{modelRegistry};
+	TransformSystem transformSystem;
+	SceneBVH sceneBVH;
 
 	Camera* camera = nullptr;
 	Skybox* skybox = nullptr;
 
 	LightManager* lightManager = nullptr;
 
+	RenderQueue renderQueue;
+	ShaderVariantCache* mainVariants = nullptr;
+	bool useShaderVariants = true;
+	ShadowSettings shadowSettings;
+
+	bool useDepthPrepass = false;
+
+	// GL_SAMPLES_PASSED ring, read back a few frames late so it never stalls
+	static constexpr uint32_t NUM_SAMPLE_QUERIES = 3;
+	GLuint samplesQueries[NUM_SAMPLE_QUERIES]{};
+	bool samplesQueryIssued[NUM_SAMPLE_QUERIES]{};
+	uint32_t samplesQueryIndex = 0;
+	int framebufferSamples = 1;
+	double shadedSamplesPerPixel = 0.0;
+
+	DeferredRenderer* deferredRenderer = nullptr;
+	ShaderVariantCache* gBufferVariants = nullptr;
+	RenderPath renderPath = RenderPath::Forward;
+	bool pendingRenderPathComparison = false;
+
+	OcclusionCulling occlusionCulling = OcclusionCulling::Off;
+	HiZCulling* hiZCulling = nullptr;
+	OcclusionRasterizer occlusionRasterizer;
+	vector<uint8_t> occludedFlags; // per instance of the model being tested
+	static constexpr size_t OCCLUSION_TEST_GRAIN = 256;
+	// Occluders above this many triangles are accepted with a warning, they cost more to rasterize than they save
+	static constexpr size_t MAX_OCCLUDER_TRIANGLES = 2000;
+	// Closer than this a model counts as this close, a camera inside its bounds doesn't ask for infinite detail
+	static constexpr float TEXTURE_DETAIL_MIN_DEPTH = 0.1f;
+
+	GpuProfiler* gpuProfiler = nullptr;
+
+	// Double-buffered: renderIndex is submitted while the other one is filled by the simulation thread
+	SimulationThread simulation;
+	SimulationCallback simulationCallback;
+	RenderSnapshot snapshots[2];
+	uint32_t renderIndex = 0;
+	float simulationDeltaTime = 0.0f; // of the frame being simulated ahead
+	bool hasSnapshot = false;
+	uint64_t simulatedFrames = 0;
+	FrameTimings frameTimings;
+
 	bool isFocused = false;
 };
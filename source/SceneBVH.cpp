@@ -0,0 +1,427 @@
+#include "SceneBVH.hpp"
+#include "Components.hpp"
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <iostream>
+
+// Ray against box, returns the entry distance or FLT_MAX on a miss
+static float IntersectRay(const AABB& box, const vec3& origin, const vec3& inverseDirection, const float maxDistance)
+{
+	const vec3 t0 = (box.min - origin) * inverseDirection;
+	const vec3 t1 = (box.max - origin) * inverseDirection;
+	const vec3 tNear = glm::min(t0, t1);
+	const vec3 tFar = glm::max(t0, t1);
+	const float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	const float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+	return entry <= exit ? entry : FLT_MAX;
+}
+
+// ========== Building ==========
+
+void SceneBVH::update(const entt::registry& registry, const span<const entt::entity> movedInstances)
+{
+	// Added/removed instances or models change the primitive set, which a refit can't handle
+	if(nodes.empty() || InstanceStructureVersion(registry) != builtVersion)
+	{
+		build(registry);
+		return;
+	}
+
+	if(!movedInstances.empty())
+		refit(registry, movedInstances);
+
+	if(++framesSinceQualityCheck >= QUALITY_CHECK_INTERVAL)
+	{
+		framesSinceQualityCheck = 0;
+		stats.sahCost = computeSahCost();
+		if(stats.sahCost > stats.builtSahCost * REBUILD_THRESHOLD)
+		{
+			cout << "SceneBVH: SAH cost " << stats.sahCost << " degraded past " << REBUILD_THRESHOLD
+				 << "x of " << stats.builtSahCost << ", rebuilding" << endl;
+			build(registry);
+		}
+	}
+}
+
+void SceneBVH::build(const entt::registry& registry)
+{
+	const Uint64 start = SDL_GetTicksNS();
+
+	primitives.clear();
+	primitiveIndices.clear();
+	for(const auto instance : registry.view<InstanceComponent>())
+	{
+		const AABB bounds = instanceBounds(registry, instance);
+		if(bounds.empty())
+			continue;
+		primitives.push_back({bounds, bounds.center(), instance});
+	}
+
+	const auto count = static_cast<uint32_t>(primitives.size());
+	// A binary tree with leaves of at least one primitive never has more than 2n - 1 nodes
+	nodes.assign(std::max(2 * count, 2u) - 1, Node{{}, 0, 0});
+	parents.assign(nodes.size(), UINT32_MAX);
+	nodeCount.store(1, memory_order_relaxed);
+
+	if(count > 0)
+		buildNode(0, 0, count);
+
+	nodes.resize(nodeCount.load(memory_order_relaxed));
+	parents.resize(nodes.size());
+
+	// Primitives were reordered by the partitioning, index them once they are final
+	primitiveLeaves.assign(count, 0);
+	primitiveIndices.reserve(count);
+	for(uint32_t i = 0; i < count; ++i)
+		primitiveIndices.emplace(primitives[i].instance, i);
+	for(uint32_t nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+	{
+		const Node& node = nodes[nodeIndex];
+		for(uint32_t i = 0; i < node.count; ++i)
+			primitiveLeaves[node.first + i] = nodeIndex;
+	}
+
+	builtVersion = InstanceStructureVersion(registry);
+	framesSinceQualityCheck = 0;
+	stats.primitives = count;
+	stats.nodes = static_cast<uint32_t>(nodes.size());
+	stats.sahCost = stats.builtSahCost = computeSahCost();
+	++stats.builds;
+	stats.lastBuildMs = static_cast<double>(SDL_GetTicksNS() - start) / 1e6;
+}
+
+void SceneBVH::buildNode(const uint32_t nodeIndex, const uint32_t first, const uint32_t count)
+{
+	// nodes is preallocated, so references stay valid while other threads allocate children
+	Node& node = nodes[nodeIndex];
+	node.bounds = {};
+	AABB centroidBounds;
+	for(uint32_t i = first; i < first + count; ++i)
+	{
+		node.bounds.expand(primitives[i].bounds);
+		centroidBounds.expand(primitives[i].centroid);
+	}
+
+	node.first = first;
+	node.count = count;
+	if(count <= MAX_LEAF_SIZE)
+		return;
+
+	uint32_t leftCount = 0;
+	int axis;
+	float position;
+	if(findSplit(first, count, centroidBounds, node.bounds.surfaceArea(), axis, position))
+	{
+		const auto begin = primitives.begin() + first;
+		const auto middle = partition(begin, begin + count, [axis, position](const Primitive& primitive)
+		{
+			return primitive.centroid[axis] < position;
+		});
+		leftCount = static_cast<uint32_t>(middle - begin);
+	}
+	else if(count <= MAX_LEAF_SIZE * 4)
+	{
+		// SAH prefers a leaf over any split
+		return;
+	}
+
+	if(leftCount == 0 || leftCount == count)
+	{
+		// Coincident centroids or a leaf that would be too large, fall back to a median split
+		const vec3 extent = centroidBounds.extent();
+		axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		leftCount = count / 2;
+		const auto begin = primitives.begin() + first;
+		nth_element(begin, begin + leftCount, begin + count, [axis](const Primitive& a, const Primitive& b)
+		{
+			return a.centroid[axis] < b.centroid[axis];
+		});
+	}
+
+	const uint32_t left = nodeCount.fetch_add(2, memory_order_relaxed);
+	node.first = left;
+	node.count = 0;
+	parents[left] = parents[left + 1] = nodeIndex;
+
+	if(jobSystem && count >= PARALLEL_BUILD_THRESHOLD)
+	{
+		// The left subtree goes to the job system, waiting runs other jobs (often its own subtrees) meanwhile
+		JobCounter leftBuild;
+		jobSystem->run([this, left, first, leftCount]
+		{
+			buildNode(left, first, leftCount);
+		}, &leftBuild);
+		buildNode(left + 1, first + leftCount, count - leftCount);
+		jobSystem->wait(leftBuild);
+	}
+	else
+	{
+		buildNode(left, first, leftCount);
+		buildNode(left + 1, first + leftCount, count - leftCount);
+	}
+}
+
+bool SceneBVH::findSplit(const uint32_t first, const uint32_t count, const AABB& centroidBounds, const float parentArea,
+						 int& axis, float& position) const
+{
+	struct Bin
+	{
+		AABB bounds;
+		uint32_t count = 0;
+	};
+
+	// Traversal and intersection costs are both 1, so a leaf costs its primitive count
+	float bestCost = static_cast<float>(count) * parentArea;
+	bool found = false;
+
+	for(int candidateAxis = 0; candidateAxis < 3; ++candidateAxis)
+	{
+		const float minCentroid = centroidBounds.min[candidateAxis];
+		const float extent = centroidBounds.max[candidateAxis] - minCentroid;
+		if(extent <= 0.0f)
+			continue;
+
+		Bin bins[NUM_BINS];
+		const float scale = static_cast<float>(NUM_BINS) / extent;
+		for(uint32_t i = first; i < first + count; ++i)
+		{
+			const Primitive& primitive = primitives[i];
+			const auto bin = std::min(NUM_BINS - 1, static_cast<uint32_t>((primitive.centroid[candidateAxis] - minCentroid) * scale));
+			bins[bin].bounds.expand(primitive.bounds);
+			++bins[bin].count;
+		}
+
+		// Sweep from both sides, plane i lies between bin i and bin i + 1
+		float leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
+		uint32_t leftCount[NUM_BINS - 1], rightCount[NUM_BINS - 1];
+		AABB leftBox, rightBox;
+		uint32_t leftSum = 0, rightSum = 0;
+		for(uint32_t i = 0; i < NUM_BINS - 1; ++i)
+		{
+			leftBox.expand(bins[i].bounds);
+			leftSum += bins[i].count;
+			leftArea[i] = leftBox.surfaceArea();
+			leftCount[i] = leftSum;
+
+			rightBox.expand(bins[NUM_BINS - 1 - i].bounds);
+			rightSum += bins[NUM_BINS - 1 - i].count;
+			rightArea[NUM_BINS - 2 - i] = rightBox.surfaceArea();
+			rightCount[NUM_BINS - 2 - i] = rightSum;
+		}
+
+		for(uint32_t i = 0; i < NUM_BINS - 1; ++i)
+		{
+			if(leftCount[i] == 0 || rightCount[i] == 0)
+				continue;
+			const float cost = parentArea + leftArea[i] * static_cast<float>(leftCount[i])
+							 + rightArea[i] * static_cast<float>(rightCount[i]);
+			if(cost < bestCost)
+			{
+				bestCost = cost;
+				axis = candidateAxis;
+				position = minCentroid + static_cast<float>(i + 1) / scale;
+				found = true;
+			}
+		}
+	}
+	return found;
+}
+
+// ========== Refitting ==========
+
+void SceneBVH::refit(const entt::registry& registry, const span<const entt::entity> movedInstances)
+{
+	const Uint64 start = SDL_GetTicksNS();
+
+	const auto refitNode = [this](const uint32_t nodeIndex)
+	{
+		Node& node = nodes[nodeIndex];
+		node.bounds = {};
+		if(node.count > 0)
+		{
+			for(uint32_t i = node.first; i < node.first + node.count; ++i)
+				node.bounds.expand(primitives[i].bounds);
+		}
+		else
+		{
+			node.bounds.expand(nodes[node.first].bounds);
+			node.bounds.expand(nodes[node.first + 1].bounds);
+		}
+	};
+
+	vector<uint32_t> movedLeaves;
+	movedLeaves.reserve(movedInstances.size());
+	for(const auto instance : movedInstances)
+	{
+		const auto it = primitiveIndices.find(instance);
+		if(it == primitiveIndices.end())
+			continue;
+		Primitive& primitive = primitives[it->second];
+		primitive.bounds = instanceBounds(registry, instance);
+		primitive.centroid = primitive.bounds.center();
+		movedLeaves.push_back(primitiveLeaves[it->second]);
+	}
+
+	if(movedLeaves.size() * 4 > primitives.size())
+	{
+		// Most of the scene moved, one bottom-up pass is cheaper than walking every path to the root.
+		// Children are always allocated after their parent, so reverse order visits children first.
+		for(uint32_t nodeIndex = static_cast<uint32_t>(nodes.size()); nodeIndex-- > 0;)
+			refitNode(nodeIndex);
+	}
+	else
+	{
+		for(uint32_t nodeIndex : movedLeaves)
+		{
+			while(nodeIndex != UINT32_MAX)
+			{
+				refitNode(nodeIndex);
+				nodeIndex = parents[nodeIndex];
+			}
+		}
+	}
+
+	++stats.refits;
+	stats.lastRefitMs = static_cast<double>(SDL_GetTicksNS() - start) / 1e6;
+}
+
+float SceneBVH::computeSahCost() const
+{
+	if(nodes.empty() || nodes[0].bounds.empty())
+		return 0.0f;
+
+	float cost = 0.0f;
+	for(const Node& node : nodes)
+		cost += node.bounds.surfaceArea() * (node.count > 0 ? static_cast<float>(node.count) : 1.0f);
+	return cost / nodes[0].bounds.surfaceArea();
+}
+
+AABB SceneBVH::instanceBounds(const entt::registry& registry, const entt::entity instance)
+{
+	const auto& instanceComp = registry.get<InstanceComponent>(instance);
+	const auto* modelComp = registry.try_get<ModelComponent>(instanceComp.modelEntity);
+	if(!modelComp || instanceComp.slot >= modelComp->instanceMatrices.size())
+		return {};
+	return modelComp->model.getBounds().transformed(modelComp->instanceMatrices[instanceComp.slot]);
+}
+
+// ========== Queries ==========
+
+template<typename Test>
+void SceneBVH::collect(const Test& test, vector<entt::entity>& out) const
+{
+	if(nodes.empty() || nodes[0].bounds.empty())
+		return;
+
+	vector<uint32_t> stack;
+	stack.reserve(64);
+	stack.push_back(0);
+	while(!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if(!test(node.bounds))
+			continue;
+
+		if(node.count > 0)
+		{
+			for(uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				if(test(primitives[i].bounds))
+					out.push_back(primitives[i].instance);
+			}
+		}
+		else
+		{
+			stack.push_back(node.first + 1);
+			stack.push_back(node.first);
+		}
+	}
+}
+
+void SceneBVH::queryFrustum(const Frustum& frustum, vector<entt::entity>& out) const
+{
+	collect([&frustum](const AABB& box) { return frustum.intersects(box); }, out);
+}
+
+void SceneBVH::querySphere(const vec3& center, const float radius, vector<entt::entity>& out) const
+{
+	const float radiusSquared = radius * radius;
+	collect([&center, radiusSquared](const AABB& box)
+	{
+		const vec3 closest = clamp(center, box.min, box.max);
+		const vec3 offset = closest - center;
+		return dot(offset, offset) <= radiusSquared;
+	}, out);
+}
+
+void SceneBVH::queryCone(const vec3& apex, const vec3& direction, const float halfAngle, const float range,
+						 vector<entt::entity>& out) const
+{
+	const float cosAngle = cos(halfAngle);
+	const float sinAngle = sin(halfAngle);
+	collect([&apex, &direction, cosAngle, sinAngle, range](const AABB& box)
+	{
+		// Bounding sphere of the box against the cone
+		const vec3 toCenter = box.center() - apex;
+		const float radius = length(box.extent()) * 0.5f;
+		const float along = dot(toCenter, direction);
+		if(along > range + radius || along < -radius)
+			return false;
+		const float across = sqrt(std::max(dot(toCenter, toCenter) - along * along, 0.0f));
+		return cosAngle * across - along * sinAngle <= radius;
+	}, out);
+}
+
+RayHit SceneBVH::raycast(const vec3& origin, const vec3& direction, const float maxDistance) const
+{
+	RayHit hit;
+	const float directionLength = length(direction);
+	if(nodes.empty() || nodes[0].bounds.empty() || directionLength == 0.0f)
+		return hit;
+
+	const vec3 unitDirection = direction / directionLength;
+	const vec3 inverseDirection = 1.0f / unitDirection;
+	float closest = maxDistance;
+
+	if(IntersectRay(nodes[0].bounds, origin, inverseDirection, closest) == FLT_MAX)
+		return hit;
+
+	vector<uint32_t> stack;
+	stack.reserve(64);
+	stack.push_back(0);
+	while(!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+		if(node.count > 0)
+		{
+			for(uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				const float distance = IntersectRay(primitives[i].bounds, origin, inverseDirection, closest);
+				if(distance != FLT_MAX && (distance < closest || hit.instance == entt::null))
+				{
+					closest = distance;
+					hit = {primitives[i].instance, distance};
+				}
+			}
+			continue;
+		}
+
+		// Push the nearer child last so it is visited first and the farther one is more likely to be pruned
+		uint32_t nearChild = node.first;
+		uint32_t farChild = node.first + 1;
+		float nearDistance = IntersectRay(nodes[nearChild].bounds, origin, inverseDirection, closest);
+		float farDistance = IntersectRay(nodes[farChild].bounds, origin, inverseDirection, closest);
+		if(farDistance < nearDistance)
+		{
+			swap(nearChild, farChild);
+			swap(nearDistance, farDistance);
+		}
+		if(farDistance != FLT_MAX)
+			stack.push_back(farChild);
+		if(nearDistance != FLT_MAX)
+			stack.push_back(nearChild);
+	}
+	return hit;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <entt/entity/registry.hpp>
+#include <atomic>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "Bounds.hpp"
+#include "JobSystem.hpp"
+
+using namespace std;
+using namespace glm;
+
+struct RayHit
+{
+	entt::entity instance = entt::null;
+	float distance = 0.0f; // along the ray, to the instance's world AABB
+};
+
+// Bounding volume hierarchy over the world AABBs of every instance in a model registry.
+// Built with binned SAH (large subtrees as jobs), refitted when instances move,
+// and rebuilt when instances are added/removed or the refitted tree degrades.
+class SceneBVH
+{
+public:
+	struct Stats
+	{
+		uint32_t primitives = 0;
+		uint32_t nodes = 0;
+		float sahCost = 0.0f;      // current
+		float builtSahCost = 0.0f; // right after the last build
+		uint32_t builds = 0;
+		uint32_t refits = 0;
+		double lastBuildMs = 0.0;
+		double lastRefitMs = 0.0;
+	};
+
+	void setJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+
+	// Call once per frame after the transform system, movedInstances are the instances it re-baked
+	void update(const entt::registry& registry, span<const entt::entity> movedInstances);
+	void build(const entt::registry& registry);
+
+	// Queries append every instance whose world AABB may overlap the volume
+	void queryFrustum(const Frustum& frustum, vector<entt::entity>& out) const;
+	void querySphere(const vec3& center, float radius, vector<entt::entity>& out) const;
+	// Cone from apex along a normalized direction, half angle in radians, cut at range
+	void queryCone(const vec3& apex, const vec3& direction, float halfAngle, float range,
+				   vector<entt::entity>& out) const;
+	// Closest instance AABB hit within maxDistance, direction does not need to be normalized
+	[[nodiscard]] RayHit raycast(const vec3& origin, const vec3& direction, float maxDistance = FLT_MAX) const;
+
+	[[nodiscard]] const Stats& getStats() const { return stats; }
+
+	// Refitted trees are checked every QUALITY_CHECK_INTERVAL frames and rebuilt past REBUILD_THRESHOLD x built cost
+	static constexpr uint32_t QUALITY_CHECK_INTERVAL = 60;
+	static constexpr float REBUILD_THRESHOLD = 1.5f;
+
+private:
+	struct Node
+	{
+		AABB bounds;
+		uint32_t first; // first child for inner nodes (children are first and first + 1), first primitive for leaves
+		uint32_t count; // primitives in a leaf, 0 for inner nodes
+	};
+
+	struct Primitive
+	{
+		AABB bounds;
+		vec3 centroid;
+		entt::entity instance;
+	};
+
+	static constexpr uint32_t MAX_LEAF_SIZE = 4;
+	static constexpr uint32_t NUM_BINS = 16;
+	// Subtrees larger than this split their left half off as a job
+	static constexpr uint32_t PARALLEL_BUILD_THRESHOLD = 8192;
+
+	void buildNode(uint32_t nodeIndex, uint32_t first, uint32_t count);
+	bool findSplit(uint32_t first, uint32_t count, const AABB& centroidBounds, float parentArea,
+				   int& axis, float& position) const;
+	void refit(const entt::registry& registry, span<const entt::entity> movedInstances);
+	[[nodiscard]] float computeSahCost() const;
+	[[nodiscard]] static AABB instanceBounds(const entt::registry& registry, entt::entity instance);
+
+	template<typename Test>
+	void collect(const Test& test, vector<entt::entity>& out) const;
+
+	JobSystem* jobSystem = nullptr;
+	vector<Node> nodes;
+	atomic<uint32_t> nodeCount{0};
+	vector<Primitive> primitives;
+	vector<uint32_t> parents;                                 // per node, UINT32_MAX for the root
+	vector<uint32_t> primitiveLeaves;                         // per primitive, the leaf holding it
+	unordered_map<entt::entity, uint32_t> primitiveIndices;   // instance -> primitive
+	uint64_t builtVersion = 0;
+	uint32_t framesSinceQualityCheck = 0;
+	Stats stats;
+};
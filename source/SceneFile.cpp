@@ -0,0 +1,419 @@
+#include "SceneFile.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+
+#if defined(_WIN32)
+#define SCENE_FILE_NO_MMAP 1
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Light descriptions are written as raw bytes
+static_assert(is_trivially_copyable_v<PointLightDesc> && sizeof(PointLightDesc) == 64);
+static_assert(is_trivially_copyable_v<SpotlightDesc> && sizeof(SpotlightDesc) == 84);
+static_assert(is_trivially_copyable_v<DirLightDesc> && sizeof(DirLightDesc) == 52);
+
+static constexpr size_t SECTION_ALIGNMENT = 16;
+
+static size_t alignSection(const size_t offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~(SECTION_ALIGNMENT - 1);
+}
+
+void SceneDescription::addInstance(const TransformComponent& transform)
+{
+	px.push_back(transform.position.x);
+	py.push_back(transform.position.y);
+	pz.push_back(transform.position.z);
+	rx.push_back(transform.rotation.x);
+	ry.push_back(transform.rotation.y);
+	rz.push_back(transform.rotation.z);
+	sx.push_back(transform.scale.x);
+	sy.push_back(transform.scale.y);
+	sz.push_back(transform.scale.z);
+	++instanceCounts.back();
+}
+
+TransformArraysView SceneDescription::transforms(const size_t first, const size_t count) const
+{
+	return {
+		px.data() + first, py.data() + first, pz.data() + first,
+		rx.data() + first, ry.data() + first, rz.data() + first,
+		sx.data() + first, sy.data() + first, sz.data() + first,
+		count
+	};
+}
+
+// ============ Text format ============ //
+
+static bool readVec3(istringstream& in, vec3& v)
+{
+	return static_cast<bool>(in >> v.x >> v.y >> v.z);
+}
+
+bool ReadSceneText(const string& path, SceneDescription& scene)
+{
+	ifstream file(path);
+	if(!file.is_open())
+	{
+		cerr << "Failed to open scene file: " << path << endl;
+		return false;
+	}
+
+	scene = {};
+	string line;
+	uint32_t lineNumber = 0;
+	while(getline(file, line))
+	{
+		++lineNumber;
+		istringstream in(line);
+		string record;
+		if(!(in >> record) || record[0] == '#')
+			continue;
+
+		bool ok = true;
+		if(record == "model")
+		{
+			string modelPath;
+			getline(in >> ws, modelPath);
+			ok = !modelPath.empty();
+			if(ok)
+			{
+				scene.modelPaths.push_back(modelPath);
+				scene.instanceCounts.push_back(0);
+			}
+		}
+		else if(record == "instance")
+		{
+			TransformComponent transform{};
+			ok = !scene.modelPaths.empty()
+				 && readVec3(in, transform.position) && readVec3(in, transform.rotation) && readVec3(in, transform.scale);
+			if(ok)
+				scene.addInstance(transform);
+		}
+		else if(record == "point")
+		{
+			PointLightDesc light;
+			ok = readVec3(in, light.position) && readVec3(in, light.ambient) && readVec3(in, light.diffuse)
+				 && readVec3(in, light.specular) && (in >> light.constant >> light.linear >> light.quadratic >> light.castShadows);
+			if(ok)
+				scene.pointLights.push_back(light);
+		}
+		else if(record == "spot")
+		{
+			SpotlightDesc light;
+			ok = readVec3(in, light.position) && readVec3(in, light.direction) && readVec3(in, light.ambient)
+				 && readVec3(in, light.diffuse) && readVec3(in, light.specular)
+				 && (in >> light.cutOff >> light.outerCutOff >> light.constant >> light.linear >> light.quadratic
+					 >> light.castShadows);
+			if(ok)
+				scene.spotlights.push_back(light);
+		}
+		else if(record == "dir")
+		{
+			DirLightDesc light;
+			ok = readVec3(in, light.direction) && readVec3(in, light.ambient) && readVec3(in, light.diffuse)
+				 && readVec3(in, light.specular) && (in >> light.castShadows);
+			if(ok)
+				scene.dirLights.push_back(light);
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if(!ok)
+		{
+			cerr << "Invalid scene record at " << path << ":" << lineNumber << ": " << line << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool WriteSceneText(const string& path, const SceneDescription& scene)
+{
+	ofstream file(path);
+	if(!file.is_open())
+	{
+		cerr << "Failed to create scene file: " << path << endl;
+		return false;
+	}
+
+	auto vec = [&file](const vec3& v) -> ofstream&
+	{
+		file << " " << v.x << " " << v.y << " " << v.z;
+		return file;
+	};
+
+	file << "# LearnOpenGL scene" << "\n";
+	size_t instance = 0;
+	for(size_t model = 0; model < scene.modelPaths.size(); ++model)
+	{
+		file << "model " << scene.modelPaths[model] << "\n";
+		for(uint32_t i = 0; i < scene.instanceCounts[model]; ++i, ++instance)
+		{
+			const TransformComponent transform = scene.transforms(instance, 1)[0];
+			file << "instance";
+			vec(transform.position);
+			vec(transform.rotation);
+			vec(transform.scale) << "\n";
+		}
+	}
+	for(const PointLightDesc& light : scene.pointLights)
+	{
+		file << "point";
+		vec(light.position);
+		vec(light.ambient);
+		vec(light.diffuse);
+		vec(light.specular) << " " << light.constant << " " << light.linear << " " << light.quadratic
+			<< " " << light.castShadows << "\n";
+	}
+	for(const SpotlightDesc& light : scene.spotlights)
+	{
+		file << "spot";
+		vec(light.position);
+		vec(light.direction);
+		vec(light.ambient);
+		vec(light.diffuse);
+		vec(light.specular) << " " << light.cutOff << " " << light.outerCutOff << " " << light.constant
+			<< " " << light.linear << " " << light.quadratic << " " << light.castShadows << "\n";
+	}
+	for(const DirLightDesc& light : scene.dirLights)
+	{
+		file << "dir";
+		vec(light.direction);
+		vec(light.ambient);
+		vec(light.diffuse);
+		vec(light.specular) << " " << light.castShadows << "\n";
+	}
+	return file.good();
+}
+
+// ============ Binary format ============ //
+
+bool WriteSceneBinary(const string& path, const SceneDescription& scene)
+{
+	const auto instanceCount = static_cast<uint32_t>(scene.instanceCount());
+
+	vector<SceneModelRecord> models;
+	string strings;
+	uint32_t firstInstance = 0;
+	for(size_t model = 0; model < scene.modelPaths.size(); ++model)
+	{
+		const string& modelPath = scene.modelPaths[model];
+		models.push_back({
+			static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(modelPath.size()),
+			firstInstance, scene.instanceCounts[model]
+		});
+		strings += modelPath;
+		firstInstance += scene.instanceCounts[model];
+	}
+
+	SceneFileHeader header{};
+	memcpy(header.magic, SceneFileHeader::MAGIC, sizeof(header.magic));
+	header.version = SceneFileHeader::VERSION;
+	header.modelCount = static_cast<uint32_t>(models.size());
+	header.instanceCount = instanceCount;
+	header.pointLightCount = static_cast<uint32_t>(scene.pointLights.size());
+	header.spotlightCount = static_cast<uint32_t>(scene.spotlights.size());
+	header.dirLightCount = static_cast<uint32_t>(scene.dirLights.size());
+	header.stringBytes = static_cast<uint32_t>(strings.size());
+
+	size_t offset = alignSection(sizeof(SceneFileHeader));
+	header.modelsOffset = offset;
+	offset = alignSection(offset + models.size() * sizeof(SceneModelRecord));
+	header.stringsOffset = offset;
+	offset = alignSection(offset + strings.size());
+	header.transformsOffset = offset;
+	offset = alignSection(offset + 9 * static_cast<size_t>(instanceCount) * sizeof(float));
+	header.pointLightsOffset = offset;
+	offset = alignSection(offset + scene.pointLights.size() * sizeof(PointLightDesc));
+	header.spotlightsOffset = offset;
+	offset = alignSection(offset + scene.spotlights.size() * sizeof(SpotlightDesc));
+	header.dirLightsOffset = offset;
+
+	ofstream file(path, ios::binary | ios::trunc);
+	if(!file.is_open())
+	{
+		cerr << "Failed to create scene file: " << path << endl;
+		return false;
+	}
+
+	auto writeSection = [&file](const uint64_t sectionOffset, const void* bytes, const size_t count)
+	{
+		// Zero padding up to the section start
+		static constexpr char ZEROS[SECTION_ALIGNMENT] = {};
+		const auto position = static_cast<uint64_t>(file.tellp());
+		file.write(ZEROS, static_cast<streamsize>(sectionOffset - position));
+		file.write(static_cast<const char*>(bytes), static_cast<streamsize>(count));
+	};
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writeSection(header.modelsOffset, models.data(), models.size() * sizeof(SceneModelRecord));
+	writeSection(header.stringsOffset, strings.data(), strings.size());
+
+	const vector<float>* arrays[9] = {
+		&scene.px, &scene.py, &scene.pz, &scene.rx, &scene.ry, &scene.rz, &scene.sx, &scene.sy, &scene.sz
+	};
+	writeSection(header.transformsOffset, nullptr, 0);
+	for(const vector<float>* array : arrays)
+		file.write(reinterpret_cast<const char*>(array->data()), static_cast<streamsize>(array->size() * sizeof(float)));
+
+	writeSection(header.pointLightsOffset, scene.pointLights.data(), scene.pointLights.size() * sizeof(PointLightDesc));
+	writeSection(header.spotlightsOffset, scene.spotlights.data(), scene.spotlights.size() * sizeof(SpotlightDesc));
+	writeSection(header.dirLightsOffset, scene.dirLights.data(), scene.dirLights.size() * sizeof(DirLightDesc));
+	return file.good();
+}
+
+MappedScene::~MappedScene()
+{
+	close();
+}
+
+bool MappedScene::open(const string& path)
+{
+	close();
+
+#if defined(SCENE_FILE_NO_MMAP)
+	ifstream file(path, ios::binary | ios::ate);
+	if(!file.is_open())
+	{
+		cerr << "Failed to open scene file: " << path << endl;
+		return false;
+	}
+	fallbackBuffer.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(fallbackBuffer.data()), static_cast<streamsize>(fallbackBuffer.size()));
+	data = fallbackBuffer.data();
+	size = fallbackBuffer.size();
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		cerr << "Failed to open scene file: " << path << endl;
+		return false;
+	}
+	struct stat fileStat{};
+	if(fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+	{
+		::close(fd);
+		cerr << "Failed to read scene file size: " << path << endl;
+		return false;
+	}
+	size = static_cast<size_t>(fileStat.st_size);
+	void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps the file referenced
+	if(mapping == MAP_FAILED)
+	{
+		size = 0;
+		cerr << "Failed to map scene file: " << path << endl;
+		return false;
+	}
+	// The loader walks every section once, front to back
+	// Advice values are not flags, each hint is its own call
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	madvise(mapping, size, MADV_WILLNEED);
+	data = static_cast<const uint8_t*>(mapping);
+#endif
+
+	header = reinterpret_cast<const SceneFileHeader*>(data);
+	if(!validate(path))
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedScene::close()
+{
+#if !defined(SCENE_FILE_NO_MMAP)
+	if(data)
+		munmap(const_cast<uint8_t*>(data), size);
+#endif
+	fallbackBuffer.clear();
+	data = nullptr;
+	size = 0;
+	header = nullptr;
+}
+
+bool MappedScene::validate(const string& path) const
+{
+	auto fail = [&path](const char* reason)
+	{
+		cerr << "Invalid scene file " << path << ": " << reason << endl;
+		return false;
+	};
+	auto fits = [this](const uint64_t offset, const uint64_t bytes)
+	{
+		return offset % alignof(float) == 0 && offset <= size && bytes <= size - offset;
+	};
+
+	if(size < sizeof(SceneFileHeader))
+		return fail("file too small");
+	if(memcmp(header->magic, SceneFileHeader::MAGIC, sizeof(header->magic)) != 0)
+		return fail("bad magic");
+	if(header->version != SceneFileHeader::VERSION)
+		return fail("unsupported version");
+
+	if(!fits(header->modelsOffset, static_cast<uint64_t>(header->modelCount) * sizeof(SceneModelRecord))
+	   || !fits(header->stringsOffset, header->stringBytes)
+	   || !fits(header->transformsOffset, 9ull * header->instanceCount * sizeof(float))
+	   || !fits(header->pointLightsOffset, static_cast<uint64_t>(header->pointLightCount) * sizeof(PointLightDesc))
+	   || !fits(header->spotlightsOffset, static_cast<uint64_t>(header->spotlightCount) * sizeof(SpotlightDesc))
+	   || !fits(header->dirLightsOffset, static_cast<uint64_t>(header->dirLightCount) * sizeof(DirLightDesc)))
+		return fail("section out of bounds");
+
+	const auto* models = reinterpret_cast<const SceneModelRecord*>(data + header->modelsOffset);
+	for(uint32_t i = 0; i < header->modelCount; ++i)
+	{
+		const SceneModelRecord& model = models[i];
+		if(static_cast<uint64_t>(model.pathOffset) + model.pathLength > header->stringBytes
+		   || static_cast<uint64_t>(model.firstInstance) + model.instanceCount > header->instanceCount)
+			return fail("model record out of bounds");
+	}
+	return true;
+}
+
+string_view MappedScene::modelPath(const uint32_t model) const
+{
+	const auto* models = reinterpret_cast<const SceneModelRecord*>(data + header->modelsOffset);
+	const auto* strings = reinterpret_cast<const char*>(data + header->stringsOffset);
+	return {strings + models[model].pathOffset, models[model].pathLength};
+}
+
+TransformArraysView MappedScene::transforms(const uint32_t model) const
+{
+	const auto* models = reinterpret_cast<const SceneModelRecord*>(data + header->modelsOffset);
+	const auto* arrays = reinterpret_cast<const float*>(data + header->transformsOffset);
+	const size_t stride = header->instanceCount;
+	const float* first = arrays + models[model].firstInstance;
+	return {
+		first, first + stride, first + 2 * stride,
+		first + 3 * stride, first + 4 * stride, first + 5 * stride,
+		first + 6 * stride, first + 7 * stride, first + 8 * stride,
+		models[model].instanceCount
+	};
+}
+
+span<const PointLightDesc> MappedScene::pointLights() const
+{
+	return {reinterpret_cast<const PointLightDesc*>(data + header->pointLightsOffset), header->pointLightCount};
+}
+
+span<const SpotlightDesc> MappedScene::spotlights() const
+{
+	return {reinterpret_cast<const SpotlightDesc*>(data + header->spotlightsOffset), header->spotlightCount};
+}
+
+span<const DirLightDesc> MappedScene::dirLights() const
+{
+	return {reinterpret_cast<const DirLightDesc*>(data + header->dirLightsOffset), header->dirLightCount};
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Light.hpp"
+#include "TransformSystem.hpp"
+
+using namespace std;
+
+// In-memory scene: instances are grouped by model in modelPaths order, transforms are stored as structure of arrays
+struct SceneDescription
+{
+	vector<string> modelPaths; // relative to DATA_DIR/models
+	vector<uint32_t> instanceCounts; // per model
+	vector<float> px, py, pz;
+	vector<float> rx, ry, rz;
+	vector<float> sx, sy, sz;
+	vector<PointLightDesc> pointLights;
+	vector<SpotlightDesc> spotlights;
+	vector<DirLightDesc> dirLights;
+
+	[[nodiscard]] size_t instanceCount() const { return px.size(); }
+	// Appends to the last added model
+	void addInstance(const TransformComponent& transform);
+	[[nodiscard]] TransformArraysView transforms(size_t first, size_t count) const;
+};
+
+// Text format, one record per line:
+//   model <path>
+//   instance px py pz  rx ry rz  sx sy sz
+//   point px py pz  ambient(3) diffuse(3) specular(3)  constant linear quadratic shadows
+//   spot px py pz  dx dy dz  ambient(3) diffuse(3) specular(3)  cutOff outerCutOff constant linear quadratic shadows
+//   dir dx dy dz  ambient(3) diffuse(3) specular(3)  shadows
+// Instances belong to the model line above them, '#' starts a comment.
+bool ReadSceneText(const string& path, SceneDescription& scene);
+bool WriteSceneText(const string& path, const SceneDescription& scene);
+
+bool WriteSceneBinary(const string& path, const SceneDescription& scene);
+
+// Binary layout: header, model table, path strings, 9 transform arrays of instanceCount floats
+// (px, py, pz, rx, ry, rz, sx, sy, sz), then the light description arrays. Sections are 16 byte aligned.
+struct SceneFileHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t modelCount;
+	uint32_t instanceCount;
+	uint32_t pointLightCount;
+	uint32_t spotlightCount;
+	uint32_t dirLightCount;
+	uint32_t stringBytes;
+	uint64_t modelsOffset;
+	uint64_t stringsOffset;
+	uint64_t transformsOffset;
+	uint64_t pointLightsOffset;
+	uint64_t spotlightsOffset;
+	uint64_t dirLightsOffset;
+
+	static constexpr char MAGIC[4] = {'L', 'O', 'S', 'C'};
+	static constexpr uint32_t VERSION = 1;
+};
+
+struct SceneModelRecord
+{
+	uint32_t pathOffset; // into the string section
+	uint32_t pathLength;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+// Read-only memory mapping of a binary scene file, every view points straight into the mapping
+class MappedScene
+{
+public:
+	MappedScene() = default;
+	~MappedScene();
+
+	// non-copyable, owns the mapping
+	MappedScene(const MappedScene&) = delete;
+	MappedScene& operator=(const MappedScene&) = delete;
+
+	// Maps and validates the file, logs and returns false when it is not a valid scene
+	bool open(const string& path);
+	void close();
+
+	[[nodiscard]] uint32_t modelCount() const { return header ? header->modelCount : 0; }
+	[[nodiscard]] uint32_t instanceCount() const { return header ? header->instanceCount : 0; }
+	[[nodiscard]] string_view modelPath(uint32_t model) const;
+	[[nodiscard]] TransformArraysView transforms(uint32_t model) const;
+	[[nodiscard]] span<const PointLightDesc> pointLights() const;
+	[[nodiscard]] span<const SpotlightDesc> spotlights() const;
+	[[nodiscard]] span<const DirLightDesc> dirLights() const;
+
+private:
+	bool validate(const string& path) const;
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	vector<uint8_t> fallbackBuffer; // used where mmap is not available
+	const SceneFileHeader* header = nullptr;
+};
@@ -0,0 +1,219 @@
+#include "SceneGenerator.hpp"
+#include <cmath>
+#include <random>
+
+// Radius of MovementPattern::Orbit and of moving point lights
+static constexpr float ORBIT_RADIUS = 2.0f;
+
+SceneGenerator::SceneGenerator(SceneGeneratorConfig sceneConfig)
+: config(std::move(sceneConfig))
+{
+	generate();
+}
+
+void SceneGenerator::generate()
+{
+	mt19937 rng(config.seed);
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+	const vec3 center(0.0f, 0.0f, -config.extent);
+	auto areaPoint = [&](const float minY, const float maxY)
+	{
+		return center + vec3((unit(rng) * 2.0f - 1.0f) * config.extent, minY + unit(rng) * (maxY - minY),
+							 (unit(rng) * 2.0f - 1.0f) * config.extent);
+	};
+	auto randomColor = [&]
+	{
+		// Bright enough to light something, never black
+		return vec3(0.3f + 0.7f * unit(rng), 0.3f + 0.7f * unit(rng), 0.3f + 0.7f * unit(rng));
+	};
+
+	// Model of every instance first, then the instances grouped by model as SceneDescription wants them
+	description = {};
+	vector<uint32_t> counts(config.models.size(), 0);
+	if(!config.models.empty())
+	{
+		vector<float> weights;
+		weights.reserve(config.models.size());
+		for(const GeneratedModel& model : config.models)
+			weights.push_back(std::max(model.weight, 0.0f));
+		discrete_distribution<uint32_t> pick(weights.begin(), weights.end());
+		for(uint32_t i = 0; i < config.instanceCount; ++i)
+			++counts[pick(rng)];
+	}
+
+	for(size_t model = 0; model < config.models.size(); ++model)
+	{
+		if(counts[model] == 0)
+			continue;
+		description.modelPaths.push_back(config.models[model].path);
+		description.instanceCounts.push_back(0);
+		for(uint32_t i = 0; i < counts[model]; ++i)
+		{
+			const float scale = config.models[model].scale * (0.8f + 0.4f * unit(rng));
+			description.addInstance({
+				areaPoint(-1.0f, 3.0f),
+				vec3(0.0f, unit(rng) * two_pi<float>(), 0.0f),
+				vec3(scale)
+			});
+		}
+	}
+
+	const auto movingCount = static_cast<uint32_t>(config.movement == MovementPattern::Static ? 0.0f
+		: std::clamp(config.movingFraction, 0.0f, 1.0f) * static_cast<float>(description.instanceCount()));
+	moving.clear();
+	phases.clear();
+	velocities.clear();
+	if(movingCount > 0)
+	{
+		// Every n-th instance, so each model keeps its share of the moving ones
+		const double stride = static_cast<double>(description.instanceCount()) / movingCount;
+		for(uint32_t i = 0; i < movingCount; ++i)
+		{
+			moving.push_back(static_cast<uint32_t>(i * stride));
+			phases.push_back(unit(rng) * two_pi<float>());
+			velocities.push_back(vec3(unit(rng) * 2.0f - 1.0f, 0.0f, unit(rng) * 2.0f - 1.0f) * 4.0f);
+		}
+	}
+
+	auto castsShadows = [this](const uint32_t index, const uint32_t count)
+	{
+		return static_cast<float>(index) < std::clamp(config.shadowCasterFraction, 0.0f, 1.0f) * static_cast<float>(count) ? 1u : 0u;
+	};
+
+	description.pointLights.reserve(config.pointLights);
+	for(uint32_t i = 0; i < config.pointLights; ++i)
+	{
+		PointLightDesc light;
+		light.position = areaPoint(1.0f, 6.0f);
+		light.diffuse = randomColor();
+		light.specular = light.diffuse;
+		light.castShadows = castsShadows(i, config.pointLights);
+		description.pointLights.push_back(light);
+	}
+
+	description.spotlights.reserve(config.spotlights);
+	for(uint32_t i = 0; i < config.spotlights; ++i)
+	{
+		SpotlightDesc light;
+		light.position = areaPoint(4.0f, 8.0f);
+		light.direction = normalize(vec3(unit(rng) * 0.6f - 0.3f, -1.0f, unit(rng) * 0.6f - 0.3f));
+		light.diffuse = randomColor();
+		light.specular = light.diffuse;
+		light.castShadows = castsShadows(i, config.spotlights);
+		description.spotlights.push_back(light);
+	}
+
+	description.dirLights.reserve(config.dirLights);
+	for(uint32_t i = 0; i < config.dirLights; ++i)
+	{
+		DirLightDesc light;
+		light.direction = normalize(vec3(unit(rng) * 2.0f - 1.0f, -1.0f, unit(rng) * 2.0f - 1.0f));
+		light.diffuse = randomColor() * 0.5f;
+		light.specular = light.diffuse;
+		light.castShadows = castsShadows(i, config.dirLights);
+		description.dirLights.push_back(light);
+	}
+}
+
+void SceneGenerator::build(Renderer& renderer)
+{
+	instances.clear();
+	instances.reserve(description.instanceCount());
+	size_t first = 0;
+	for(size_t model = 0; model < description.modelPaths.size(); ++model)
+	{
+		const size_t count = description.instanceCounts[model];
+		renderer.createInstances(renderer.getAssets().intern(description.modelPaths[model]),
+								 description.transforms(first, count), &instances);
+		first += count;
+	}
+
+	LightManager& lightManager = renderer.getLightManager();
+	pointLights.clear();
+	spotlights.clear();
+	dirLights.clear();
+	lightManager.createPointLights(description.pointLights, &pointLights);
+	lightManager.createSpotlights(description.spotlights, &spotlights);
+	lightManager.createDirLights(description.dirLights, &dirLights);
+	time = 0.0f;
+}
+
+void SceneGenerator::animate(Renderer& renderer, const float deltaTime)
+{
+	time += deltaTime;
+
+	// A model that failed to load created no instances
+	if(instances.size() == description.instanceCount())
+	{
+		const vec3 center(0.0f, 0.0f, -config.extent);
+		for(size_t i = 0; i < moving.size(); ++i)
+		{
+			const uint32_t index = moving[i];
+			TransformComponent transform{
+				vec3(description.px[index], description.py[index], description.pz[index]),
+				vec3(description.rx[index], description.ry[index], description.rz[index]),
+				vec3(description.sx[index], description.sy[index], description.sz[index])
+			};
+			const float angle = time + phases[i];
+			switch(config.movement)
+			{
+				case MovementPattern::Orbit:
+					transform.position += vec3(cos(angle), 0.0f, sin(angle)) * ORBIT_RADIUS;
+					break;
+				case MovementPattern::Drift:
+				{
+					// Wrapped back into the area on x and z
+					const vec3 offset = transform.position - center + velocities[i] * time + config.extent;
+					const float size = 2.0f * config.extent;
+					transform.position.x = center.x + offset.x - floor(offset.x / size) * size - config.extent;
+					transform.position.z = center.z + offset.z - floor(offset.z / size) * size - config.extent;
+					break;
+				}
+				case MovementPattern::Spin:
+					transform.rotation.y += angle;
+					break;
+				case MovementPattern::Static:
+					break;
+			}
+			renderer.setTransform(instances[index], transform);
+		}
+	}
+
+	if(!config.movingLights)
+		return;
+
+	LightManager& lightManager = renderer.getLightManager();
+	for(size_t i = 0; i < pointLights.size(); ++i)
+	{
+		const float angle = time + static_cast<float>(i);
+		lightManager.getPointLight(pointLights[i]).position = description.pointLights[i].position
+															 + vec3(cos(angle), 0.0f, sin(angle)) * ORBIT_RADIUS;
+		lightManager.updatePointLight(pointLights[i]);
+	}
+	for(size_t i = 0; i < spotlights.size(); ++i)
+	{
+		// Sweeps the cone around its starting direction
+		const float angle = time + static_cast<float>(i);
+		const vec3 sweep = vec3(cos(angle), 0.0f, sin(angle)) * 0.3f;
+		lightManager.getSpotlight(spotlights[i]).direction = normalize(description.spotlights[i].direction + sweep);
+		lightManager.updateSpotlight(spotlights[i]);
+	}
+}
+
+void SceneGenerator::destroy(Renderer& renderer)
+{
+	for(const entt::entity instance : instances)
+		renderer.destroyInstance(instance);
+	instances.clear();
+
+	LightManager& lightManager = renderer.getLightManager();
+	for(const entt::entity light : pointLights)
+		lightManager.deletePointLight(light);
+	for(const entt::entity light : spotlights)
+		lightManager.deleteSpotlight(light);
+	for(const entt::entity light : dirLights)
+		lightManager.deleteDirLight(light);
+	pointLights.clear();
+	spotlights.clear();
+	dirLights.clear();
+}
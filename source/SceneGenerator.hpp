@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Renderer.hpp"
+#include "SceneFile.hpp"
+
+using namespace std;
+
+enum class MovementPattern : uint8_t
+{
+	Static,
+	Orbit, // circles around its starting point
+	Drift, // straight line across the area, wrapping at its edges
+	Spin,  // rotates in place, only the matrices change
+};
+
+struct GeneratedModel
+{
+	string path;         // relative to DATA_DIR/models
+	float weight = 1.0f; // share of the instances, relative to the other models
+	float scale = 1.0f;
+};
+
+struct SceneGeneratorConfig
+{
+	string name;
+	uint32_t seed = 1;
+	uint32_t instanceCount = 1000;
+	vector<GeneratedModel> models;
+	uint32_t pointLights = 0;
+	uint32_t spotlights = 0;
+	uint32_t dirLights = 0;
+	float shadowCasterFraction = 1.0f; // of the lights of each type
+	MovementPattern movement = MovementPattern::Static;
+	float movingFraction = 0.25f; // of the instances
+	bool movingLights = false;
+	float extent = 40.0f; // half size of the square the scene covers, centered in front of the default camera
+};
+
+// Deterministic stress scenes: the same config always gives the same description, every random value is drawn
+// from one generator seeded by the config, in a fixed order
+class SceneGenerator
+{
+public:
+	explicit SceneGenerator(SceneGeneratorConfig sceneConfig);
+
+	[[nodiscard]] const SceneGeneratorConfig& getConfig() const { return config; }
+	// What build() creates, can also be written out with WriteSceneText / WriteSceneBinary
+	[[nodiscard]] const SceneDescription& getDescription() const { return description; }
+
+	// Creates the instances and lights through Renderer / LightManager, on the main thread between updates
+	void build(Renderer& renderer);
+	// Moves what the movement pattern moves, from the simulation callback
+	void animate(Renderer& renderer, float deltaTime);
+	// Deletes everything build() created
+	void destroy(Renderer& renderer);
+
+private:
+	void generate();
+
+	SceneGeneratorConfig config;
+	SceneDescription description;
+
+	// Indices into the description of the instances that move, with a per instance phase and velocity
+	vector<uint32_t> moving;
+	vector<float> phases;
+	vector<vec3> velocities;
+
+	vector<entt::entity> instances; // in description order
+	vector<entt::entity> pointLights;
+	vector<entt::entity> spotlights;
+	vector<entt::entity> dirLights;
+	float time = 0.0f;
+};
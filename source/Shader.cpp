@@ -1,18 +1,20 @@
 #include "Shader.hpp"
 #include "error_macro.hpp"
+#include "GLStateCache.hpp"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
-bool Shader::load(const string& filepath)
+bool Shader::load(const string& filepath, const vector<string>& defines)
 {
-	source = read(filepath);
-	if(source.vertex.empty() || source.fragment.empty())
+	source = read(filepath, defines);
+	const bool isCompute = !source.compute.empty();
+	if(!isCompute && (source.vertex.empty() || source.fragment.empty()))
 	{
 		cerr << "Failed to read shader from file: " << filepath << "\n";
 		return false;
 	}
-	program = create(source);
+	program = isCompute ? createCompute(source.compute) : create(source);
 	if(program == 0)
 	{
 		cerr << "Failed to create shader program from file: " << filepath << "\n";
@@ -21,14 +23,14 @@ bool Shader::load(const string& filepath)
 	return true;
 }
 
-Shader::ShaderSource Shader::read(const string& filepath)
+Shader::ShaderSource Shader::read(const string& filepath, const vector<string>& defines)
 {
 	string data_dir = DATA_DIR;
 	string full_path = data_dir + "/" + filepath;
 
 	string line;
 	ifstream file(full_path);
-	stringstream ss[3]; // 0=vertex, 1=geometry, 2=fragment
+	stringstream ss[4]; // 0=vertex, 1=geometry, 2=fragment, 3=compute
 
 	if(!file.is_open())
 	{
@@ -46,11 +48,65 @@ Shader::ShaderSource Shader::read(const string& filepath)
 				i = 1;
 			else if(line.find("fragment") != string::npos)
 				i = 2;
+			else if(line.find("compute") != string::npos)
+				i = 3;
+		}
+		else if(i != -1 && line.rfind("#include", 0) == 0)
+		{
+			// #include "path" is resolved relative to the shaders directory
+			const size_t open = line.find('"');
+			const size_t close = line.rfind('"');
+			string included;
+			if(open == string::npos || close <= open || !readInclude(line.substr(open + 1, close - open - 1), included, 0))
+			{
+				cerr << "Failed to resolve " << line << " in " << full_path << "\n";
+				return {};
+			}
+			ss[i] << included;
 		}
 		else if(i != -1)
+		{
 			ss[i] << line << '\n';
+			// Variant defines must follow #version, which has to stay the first statement
+			if(line.rfind("#version", 0) == 0)
+				for(const string& define : defines)
+					ss[i] << "#define " << define << '\n';
+		}
 	}
-	return {ss[0].str(), ss[1].str(), ss[2].str()};
+	return {ss[0].str(), ss[1].str(), ss[2].str(), ss[3].str()};
+}
+
+bool Shader::readInclude(const string& filepath, string& out, const int depth)
+{
+	// Guards against include cycles
+	if(depth > 16)
+	{
+		cerr << "Shader include depth exceeded at: " << filepath << "\n";
+		return false;
+	}
+
+	const string full_path = string(DATA_DIR) + "/shaders/" + filepath;
+	ifstream file(full_path);
+	if(!file.is_open())
+	{
+		cerr << "Failed to open shader include: " << full_path << "\n";
+		return false;
+	}
+
+	string line;
+	while(getline(file, line))
+	{
+		if(line.rfind("#include", 0) == 0)
+		{
+			const size_t open = line.find('"');
+			const size_t close = line.rfind('"');
+			if(open == string::npos || close <= open || !readInclude(line.substr(open + 1, close - open - 1), out, depth + 1))
+				return false;
+		}
+		else
+			out += line + '\n';
+	}
+	return true;
 }
 
 static bool compile(GLuint shader, const char* shader_source)
@@ -71,15 +127,18 @@ static bool compile(GLuint shader, const char* shader_source)
 	return true;
 }
 
-Shader::Shader(const string& filepath)
+Shader::Shader(const string& filepath, const vector<string>& defines)
 {
-	load(filepath);
+	load(filepath, defines);
 }
 
 Shader::~Shader()
 {
 	if(program != 0)
+	{
+		GLState().forgetProgram(program);
 		glDeleteProgram(program);
+	}
 }
 
 Shader::Shader(Shader&& other) noexcept
@@ -93,7 +152,10 @@ Shader& Shader::operator=(Shader&& other) noexcept
 	if(this != &other)
 	{
 		if(program)
+		{
+			GLState().forgetProgram(program);
 			glDeleteProgram(program);
+		}
 		source = std::move(other.source);
 		program = other.program;
 		other.program = 0;
@@ -108,36 +170,48 @@ bool Shader::ok() const
 
 void Shader::use() const
 {
-	GL_CHECK(glUseProgram(program));
+	GLState().useProgram(program);
 }
 
-void Shader::setMat4(const string& name, const mat4& matrix) const
+void Shader::setMat4(const char* name, const mat4& matrix) const
 {
-	const GLint loc = glGetUniformLocation(program, name.c_str());
+	const GLint loc = glGetUniformLocation(program, name);
 	GL_CHECK(glUniformMatrix4fv(loc, 1, GL_FALSE, &matrix[0][0]));
 }
 
-void Shader::setVec3(const string& name, const vec3& vec) const
+void Shader::setVec2(const char* name, const vec2& vec) const
+{
+	const GLint loc = glGetUniformLocation(program, name);
+	GL_CHECK(glUniform2fv(loc, 1, &vec[0]));
+}
+
+void Shader::setVec3(const char* name, const vec3& vec) const
 {
-	const GLint loc = glGetUniformLocation(program, name.c_str());
+	const GLint loc = glGetUniformLocation(program, name);
 	GL_CHECK(glUniform3fv(loc, 1, &vec[0]));
 }
 
-void Shader::setFloat(const string& name, const float value) const
+void Shader::setVec4(const char* name, const vec4& vec) const
+{
+	const GLint loc = glGetUniformLocation(program, name);
+	GL_CHECK(glUniform4fv(loc, 1, &vec[0]));
+}
+
+void Shader::setFloat(const char* name, const float value) const
 {
-	const GLint loc = glGetUniformLocation(program, name.c_str());
+	const GLint loc = glGetUniformLocation(program, name);
 	GL_CHECK(glUniform1f(loc, value));
 }
 
-void Shader::setInt(const string& name, const int value) const
+void Shader::setInt(const char* name, const int value) const
 {
-	const GLint loc = glGetUniformLocation(program, name.c_str());
+	const GLint loc = glGetUniformLocation(program, name);
 	GL_CHECK(glUniform1i(loc, value));
 }
 
-void Shader::setBool(const string& name, const int value) const
+void Shader::setBool(const char* name, const int value) const
 {
-	const GLint loc = glGetUniformLocation(program, name.c_str());
+	const GLint loc = glGetUniformLocation(program, name);
 	GL_CHECK(glUniform1i(loc, value));
 }
 
@@ -219,3 +293,35 @@ GLuint Shader::create(const ShaderSource& shaderCode)
 
 	return shaderProgram;
 }
+
+GLuint Shader::createCompute(const string& computeCode)
+{
+	const GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
+	if(computeShader == 0)
+	{
+		cerr << "Failed to create compute shader" << endl;
+		return 0;
+	}
+	if(!compile(computeShader, computeCode.c_str()))
+	{
+		glDeleteShader(computeShader);
+		return 0;
+	}
+
+	const GLuint shaderProgram = glCreateProgram();
+	glAttachShader(shaderProgram, computeShader);
+	glLinkProgram(shaderProgram);
+	glDeleteShader(computeShader);
+
+	int success;
+	glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+	if(!success)
+	{
+		char infoLog[512];
+		glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
+		cerr << "Compute program linking failed\n" << infoLog << endl;
+		glDeleteProgram(shaderProgram);
+		return 0;
+	}
+	return shaderProgram;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
@@ -9,7 +10,10 @@ using namespace glm;
 class Shader
 {
 public:
-	explicit Shader(const string& filepath);
+	// A file with a "#shader compute" stage is linked as a compute program, the other stages are then ignored.
+	// defines are injected as "#define <entry>" right after the #version line of every stage,
+	// e.g. {"NUM_DIFFUSE_MAPS 1", "HAS_DIR_LIGHTS 0"}
+	explicit Shader(const string& filepath, const vector<string>& defines = {});
 	~Shader();
 
 	// non-copyable, because of OpenGL resource management
@@ -24,11 +28,14 @@ public:
 	bool ok() const;
 	void use() const;
 
-	void setMat4(const string& name, const mat4& matrix) const;
-	void setVec3(const string& name, const vec3& vec) const;
-	void setFloat(const string& name, float value) const;
-	void setInt(const string& name, int value) const;
-	void setBool(const string& name, int value) const;
+	// Names are C strings, so setting a uniform by a literal name never builds a std::string
+	void setMat4(const char* name, const mat4& matrix) const;
+	void setVec2(const char* name, const vec2& vec) const;
+	void setVec3(const char* name, const vec3& vec) const;
+	void setVec4(const char* name, const vec4& vec) const;
+	void setFloat(const char* name, float value) const;
+	void setInt(const char* name, int value) const;
+	void setBool(const char* name, int value) const;
 
 private:
 	struct ShaderSource
@@ -36,11 +43,14 @@ private:
 		string vertex;
 		string geometry;
 		string fragment;
+		string compute;
 	};
 
-	bool load(const string& filepath);
-	static ShaderSource read(const string& filepath);
+	bool load(const string& filepath, const vector<string>& defines);
+	static ShaderSource read(const string& filepath, const vector<string>& defines);
+	static bool readInclude(const string& filepath, string& out, int depth);
 	static GLuint create(const ShaderSource& shaderCode);
+	static GLuint createCompute(const string& computeCode);
 
 	ShaderSource source;
 	GLuint program = 0;
@@ -0,0 +1,162 @@
+#include "ShaderVariants.hpp"
+#include <algorithm>
+#include <iostream>
+
+// Material counts are stored in 3 bits each, this value marks a count that is left to the runtime uniforms
+static constexpr uint32_t RUNTIME_COUNT = 7;
+
+static uint32_t encodeCount(const uint32_t count)
+{
+	return count <= ShaderVariantKey::MAX_SPECIALIZED_MAPS ? count : RUNTIME_COUNT;
+}
+
+uint32_t ShaderVariantKey::value() const
+{
+	// Shadow switches only matter when the light type is present
+	uint32_t key = 0;
+	key |= encodeCount(material.numDiffuse);
+	key |= encodeCount(material.numSpecular) << 3;
+	key |= encodeCount(material.numNormal) << 6;
+	key |= static_cast<uint32_t>(scene.dirLights) << 9;
+	key |= static_cast<uint32_t>(scene.pointLights) << 10;
+	key |= static_cast<uint32_t>(scene.spotLights) << 11;
+	key |= static_cast<uint32_t>(scene.dirLights && scene.dirShadows) << 12;
+	key |= static_cast<uint32_t>(scene.pointLights && scene.pointShadows) << 13;
+	key |= static_cast<uint32_t>(scene.spotLights && scene.spotShadows) << 14;
+	return key;
+}
+
+vector<string> ShaderVariantKey::defines() const
+{
+	vector<string> result;
+	result.reserve(9);
+
+	if(encodeCount(material.numDiffuse) != RUNTIME_COUNT)
+		result.push_back("NUM_DIFFUSE_MAPS " + to_string(material.numDiffuse));
+	if(encodeCount(material.numSpecular) != RUNTIME_COUNT)
+		result.push_back("NUM_SPECULAR_MAPS " + to_string(material.numSpecular));
+	if(encodeCount(material.numNormal) != RUNTIME_COUNT)
+		result.push_back("NUM_NORMAL_MAPS " + to_string(material.numNormal));
+
+	result.push_back(string("HAS_DIR_LIGHTS ") + (scene.dirLights ? "1" : "0"));
+	result.push_back(string("HAS_POINT_LIGHTS ") + (scene.pointLights ? "1" : "0"));
+	result.push_back(string("HAS_SPOT_LIGHTS ") + (scene.spotLights ? "1" : "0"));
+	result.push_back(string("DIR_SHADOWS ") + (scene.dirShadows ? "1" : "0"));
+	result.push_back(string("POINT_SHADOWS ") + (scene.pointShadows ? "1" : "0"));
+	result.push_back(string("SPOT_SHADOWS ") + (scene.spotShadows ? "1" : "0"));
+	return result;
+}
+
+string ShaderVariantKey::name() const
+{
+	auto count = [](const uint32_t n)
+	{
+		return encodeCount(n) == RUNTIME_COUNT ? string("*") : to_string(n);
+	};
+	auto light = [](const bool present, const bool shadows, const char* tag)
+	{
+		if(!present)
+			return string();
+		return string(" ") + tag + (shadows ? "+shadow" : "");
+	};
+
+	string result = "diffuse=" + count(material.numDiffuse)
+					+ " specular=" + count(material.numSpecular)
+					+ " normal=" + count(material.numNormal) + " |";
+	result += light(scene.dirLights, scene.dirShadows, "dir");
+	result += light(scene.pointLights, scene.pointShadows, "point");
+	result += light(scene.spotLights, scene.spotShadows, "spot");
+	return result;
+}
+
+ShaderVariantCache::ShaderVariantCache(string filepath, const Shader& fallback)
+: filepath(std::move(filepath)), cachedFallbackShader(fallback)
+{}
+
+void ShaderVariantCache::beginFrame(const FrameUniforms& uniforms)
+{
+	frameUniforms = uniforms;
+	++frameIndex;
+	// Other passes may have bound their own programs since the last frame
+	boundKey = UINT32_MAX;
+
+	for(auto& [key, variant] : variants)
+	{
+		variant.drawsLastFrame = variant.drawsThisFrame;
+		variant.drawsThisFrame = 0;
+	}
+}
+
+const Shader& ShaderVariantCache::bindForDraw(const ShaderVariantKey& key)
+{
+	Variant& variant = getOrCompile(key);
+	++variant.drawsThisFrame;
+	++variant.totalDraws;
+
+	const Shader& shader = variant.ok ? variant.shader : cachedFallbackShader;
+	const uint32_t value = key.value();
+	if(boundKey != value)
+	{
+		shader.use();
+		boundKey = value;
+	}
+
+	if(variant.syncedFrame != frameIndex)
+	{
+		applyFrameUniforms(shader);
+		variant.syncedFrame = frameIndex;
+	}
+	return shader;
+}
+
+vector<ShaderVariantCache::VariantStats> ShaderVariantCache::stats() const
+{
+	vector<VariantStats> result;
+	result.reserve(variants.size());
+	for(const auto& [key, variant] : variants)
+		result.push_back({variant.name, variant.drawsLastFrame, variant.totalDraws});
+
+	ranges::sort(result, [](const VariantStats& a, const VariantStats& b)
+	{
+		return a.totalDraws > b.totalDraws;
+	});
+	return result;
+}
+
+void ShaderVariantCache::report(ostream& out) const
+{
+	out << "------------Shader variants: " << filepath << "------------" << endl;
+	out << "Compiled variants: " << variants.size() << endl;
+	for(const VariantStats& variant : stats())
+		out << "\t[" << variant.name << "] draws last frame: " << variant.drawsLastFrame
+			<< ", total draws: " << variant.totalDraws << endl;
+	out << "----------------------------------------" << endl;
+}
+
+ShaderVariantCache::Variant& ShaderVariantCache::getOrCompile(const ShaderVariantKey& key)
+{
+	const uint32_t value = key.value();
+	if(const auto it = variants.find(value); it != variants.end())
+		return it->second;
+
+	const string name = key.name();
+	cout << "Compiling shader variant: " << filepath << " [" << name << "]" << endl;
+
+	Shader shader(filepath, key.defines());
+	const bool ok = shader.ok();
+	if(!ok)
+		cerr << "Shader variant failed to compile, falling back to the uber shader: [" << name << "]" << endl;
+
+	auto [it, inserted] = variants.emplace(value, Variant{name, std::move(shader), ok, 0, 0, 0, 0});
+	return it->second;
+}
+
+void ShaderVariantCache::applyFrameUniforms(const Shader& shader) const
+{
+	shader.setMat4("projection", frameUniforms.projection);
+	shader.setMat4("view", frameUniforms.view);
+	shader.setVec3("viewPos", frameUniforms.viewPos);
+	shader.setInt("u_numPointLights", frameUniforms.numPointLights);
+	shader.setInt("u_numSpotLights", frameUniforms.numSpotLights);
+	shader.setInt("u_numDirLights", frameUniforms.numDirLights);
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Shader.hpp"
+
+using namespace std;
+using namespace glm;
+
+// Texture counts of a single mesh, selects the material part of a shader variant
+struct MaterialFeatures
+{
+	uint32_t numDiffuse = 0;
+	uint32_t numSpecular = 0;
+	uint32_t numNormal = 0;
+};
+
+// Light types present in the scene and whether they cast shadows
+struct SceneFeatures
+{
+	bool dirLights = true;
+	bool pointLights = true;
+	bool spotLights = true;
+	bool dirShadows = true;
+	bool pointShadows = true;
+	bool spotShadows = true;
+};
+
+// Identifies one compiled permutation of an uber shader, e.g.
+// "one diffuse + one normal map, no dir lights, spot shadows on"
+struct ShaderVariantKey
+{
+	MaterialFeatures material;
+	SceneFeatures scene;
+
+	// Texture counts above this are not specialized and fall back to the runtime u_num* uniforms
+	static constexpr uint32_t MAX_SPECIALIZED_MAPS = 3;
+
+	[[nodiscard]] uint32_t value() const;
+	[[nodiscard]] vector<string> defines() const;
+	[[nodiscard]] string name() const;
+};
+
+// Lazily compiles and caches the permutations of one shader file
+class ShaderVariantCache
+{
+public:
+	// Uniforms every main pass variant needs, uploaded once per frame per variant
+	struct FrameUniforms
+	{
+		mat4 projection{1.0f};
+		mat4 view{1.0f};
+		vec3 viewPos{0.0f};
+		int numPointLights = 0;
+		int numSpotLights = 0;
+		int numDirLights = 0;
+	};
+
+	struct VariantStats
+	{
+		string name;
+		uint64_t drawsLastFrame;
+		uint64_t totalDraws;
+	};
+
+	// fallback is used for variants that fail to compile
+	ShaderVariantCache(string filepath, const Shader& fallback);
+
+	// non-copyable, variants own OpenGL programs
+	ShaderVariantCache(const ShaderVariantCache&) = delete;
+	ShaderVariantCache& operator=(const ShaderVariantCache&) = delete;
+
+	void beginFrame(const FrameUniforms& uniforms);
+
+	// Compiles the variant on first use, binds it and counts one draw against it
+	const Shader& bindForDraw(const ShaderVariantKey& key);
+
+	[[nodiscard]] size_t size() const { return variants.size(); }
+	[[nodiscard]] vector<VariantStats> stats() const;
+	void report(ostream& out) const;
+
+private:
+	struct Variant
+	{
+		string name;
+		Shader shader;
+		bool ok;
+		uint64_t syncedFrame;
+		uint64_t drawsThisFrame;
+		uint64_t drawsLastFrame;
+		uint64_t totalDraws;
+	};
+
+	Variant& getOrCompile(const ShaderVariantKey& key);
+	void applyFrameUniforms(const Shader& shader) const;
+
+	string filepath;
+	const Shader& cachedFallbackShader;
+
+	unordered_map<uint32_t, Variant> variants;
+	FrameUniforms frameUniforms;
+	uint64_t frameIndex = 0;
+	uint32_t boundKey = UINT32_MAX;
+};
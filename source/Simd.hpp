@@ -0,0 +1,95 @@
+#pragma once
+// Thin wrapper over the widest float SIMD the target was compiled for, so batch code is written once.
+// LEARNOPENGL_SIMD is defined when SimdFloat exists, other targets fall back to scalar loops.
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define LEARNOPENGL_SIMD_AVX 1
+#define LEARNOPENGL_SIMD 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEARNOPENGL_SIMD_SSE2 1
+#define LEARNOPENGL_SIMD 1
+#endif
+
+#if defined(LEARNOPENGL_SIMD_AVX)
+
+struct SimdFloat
+{
+	static constexpr size_t WIDTH = 8;
+	__m256 v;
+
+	static SimdFloat load(const float* p) { return {_mm256_loadu_ps(p)}; }
+	static SimdFloat set(const float x) { return {_mm256_set1_ps(x)}; }
+	void store(float* p) const { _mm256_store_ps(p, v); }
+	void storeUnaligned(float* p) const { _mm256_storeu_ps(p, v); }
+	static SimdFloat round(const SimdFloat a) { return {_mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)}; }
+	static SimdFloat min(const SimdFloat a, const SimdFloat b) { return {_mm256_min_ps(a.v, b.v)}; }
+	static SimdFloat max(const SimdFloat a, const SimdFloat b) { return {_mm256_max_ps(a.v, b.v)}; }
+	static SimdFloat sqrt(const SimdFloat a) { return {_mm256_sqrt_ps(a.v)}; }
+	static SimdFloat abs(const SimdFloat a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+	// Lanes of mask are all ones or all zeros, as produced by the comparisons
+	static SimdFloat select(const SimdFloat mask, const SimdFloat a, const SimdFloat b) { return {_mm256_blendv_ps(b.v, a.v, mask.v)}; }
+	friend SimdFloat operator>(const SimdFloat a, const SimdFloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+	friend SimdFloat operator+(const SimdFloat a, const SimdFloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+	friend SimdFloat operator-(const SimdFloat a, const SimdFloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+	friend SimdFloat operator*(const SimdFloat a, const SimdFloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+	friend SimdFloat operator/(const SimdFloat a, const SimdFloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+};
+
+#elif defined(LEARNOPENGL_SIMD_SSE2)
+
+struct SimdFloat
+{
+	static constexpr size_t WIDTH = 4;
+	__m128 v;
+
+	static SimdFloat load(const float* p) { return {_mm_loadu_ps(p)}; }
+	static SimdFloat set(const float x) { return {_mm_set1_ps(x)}; }
+	void store(float* p) const { _mm_store_ps(p, v); }
+	void storeUnaligned(float* p) const { _mm_storeu_ps(p, v); }
+	// SSE2 has no round instruction, the conversion rounds to nearest under the default MXCSR mode
+	static SimdFloat round(const SimdFloat a) { return {_mm_cvtepi32_ps(_mm_cvtps_epi32(a.v))}; }
+	static SimdFloat min(const SimdFloat a, const SimdFloat b) { return {_mm_min_ps(a.v, b.v)}; }
+	static SimdFloat max(const SimdFloat a, const SimdFloat b) { return {_mm_max_ps(a.v, b.v)}; }
+	static SimdFloat sqrt(const SimdFloat a) { return {_mm_sqrt_ps(a.v)}; }
+	static SimdFloat abs(const SimdFloat a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+	// Lanes of mask are all ones or all zeros, as produced by the comparisons
+	static SimdFloat select(const SimdFloat mask, const SimdFloat a, const SimdFloat b)
+	{
+		return {_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))};
+	}
+	friend SimdFloat operator>(const SimdFloat a, const SimdFloat b) { return {_mm_cmpgt_ps(a.v, b.v)}; }
+	friend SimdFloat operator+(const SimdFloat a, const SimdFloat b) { return {_mm_add_ps(a.v, b.v)}; }
+	friend SimdFloat operator-(const SimdFloat a, const SimdFloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+	friend SimdFloat operator*(const SimdFloat a, const SimdFloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+	friend SimdFloat operator/(const SimdFloat a, const SimdFloat b) { return {_mm_div_ps(a.v, b.v)}; }
+};
+
+#endif
+
+#if defined(LEARNOPENGL_SIMD)
+
+// sin(x): reduce to [-pi, pi] (2*pi split in two constants to keep precision), fold to [-pi/2, pi/2],
+// then an odd Taylor polynomial
+inline SimdFloat simdSin(SimdFloat x)
+{
+	const SimdFloat pi = SimdFloat::set(3.14159265358979f);
+	const SimdFloat turns = SimdFloat::round(x * SimdFloat::set(0.159154943091895f));
+	x = x - turns * SimdFloat::set(6.28125f);
+	x = x - turns * SimdFloat::set(1.93530717958647e-3f);
+	x = SimdFloat::min(x, pi - x);
+	x = SimdFloat::max(x, SimdFloat::set(-3.14159265358979f) - x);
+
+	const SimdFloat x2 = x * x;
+	SimdFloat p = SimdFloat::set(-2.50521083854417e-8f);
+	p = p * x2 + SimdFloat::set(2.75573192239859e-6f);
+	p = p * x2 + SimdFloat::set(-1.98412698412698e-4f);
+	p = p * x2 + SimdFloat::set(8.33333333333333e-3f);
+	p = p * x2 + SimdFloat::set(-1.66666666666667e-1f);
+	p = p * x2 + SimdFloat::set(1.0f);
+	return p * x;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include "SimulationThread.hpp"
+#include "Trace.hpp"
+#include <cassert>
+
+SimulationThread::SimulationThread()
+: worker(&SimulationThread::run, this)
+{}
+
+SimulationThread::~SimulationThread()
+{
+	{
+		lock_guard lock(jobMutex);
+		stopping = true;
+	}
+	jobReady.notify_one();
+	worker.join();
+}
+
+void SimulationThread::kick(function<void()> job)
+{
+	{
+		lock_guard lock(jobMutex);
+		assert(!hasJob && "SimulationThread::kick called before waiting for the previous job");
+		pendingJob = std::move(job);
+		hasJob = true;
+	}
+	jobReady.notify_one();
+}
+
+void SimulationThread::wait()
+{
+	unique_lock lock(jobMutex);
+	jobDone.wait(lock, [this] { return !hasJob; });
+	if(jobError)
+		rethrow_exception(std::exchange(jobError, nullptr));
+}
+
+bool SimulationThread::busy() const
+{
+	lock_guard lock(jobMutex);
+	return hasJob;
+}
+
+void SimulationThread::run()
+{
+	TRACE_THREAD_NAME("simulation");
+	unique_lock lock(jobMutex);
+	while(true)
+	{
+		jobReady.wait(lock, [this] { return hasJob || stopping; });
+		if(stopping)
+			return;
+
+		// The job runs unlocked, hasJob stays set until it is done so wait() keeps blocking
+		function<void()> job = std::move(pendingJob);
+		lock.unlock();
+		try
+		{
+			job();
+		}
+		catch(...)
+		{
+			lock.lock();
+			jobError = current_exception();
+			lock.unlock();
+		}
+		lock.lock();
+		hasJob = false;
+		jobDone.notify_all();
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace std;
+
+// Single persistent worker that runs one job at a time next to the render thread.
+// kick() hands over a job, wait() blocks until it is done and rethrows anything it threw.
+class SimulationThread
+{
+public:
+	SimulationThread();
+	~SimulationThread();
+
+	// non-copyable, owns a thread
+	SimulationThread(const SimulationThread&) = delete;
+	SimulationThread& operator=(const SimulationThread&) = delete;
+
+	// The previous job must have been waited for
+	void kick(function<void()> job);
+	void wait();
+
+	[[nodiscard]] bool busy() const;
+
+private:
+	void run();
+
+	thread worker;
+	mutable mutex jobMutex;
+	condition_variable jobReady;
+	condition_variable jobDone;
+	function<void()> pendingJob;
+	exception_ptr jobError;
+	bool hasJob = false;
+	bool stopping = false;
+};
@@ -1,44 +1,325 @@
 #include "Skybox.hpp"
 #include <stb_image.h>
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include "error_macro.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+#include "RenderStats.hpp"
+#include "Trace.hpp"
 
-GLuint CubeMapFromFile(const string& directory, const string textureFacePaths[6])
+namespace fs = std::filesystem;
+
+// ========== Cooked cube map cache ==========
+// Header, then every level from the largest, each level's faces in GL order as a byte count and the bytes
+static constexpr char CUBE_CACHE_MAGIC[8] = {'L', 'O', 'G', 'L', 'C', 'U', 'B', 'E'};
+static constexpr uint32_t CUBE_CACHE_VERSION = 2;
+static constexpr const char* CUBE_CACHE_FILE = "skybox.cubecache";
+
+struct CubeCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t size;           // face width and height of level 0
+	uint32_t levels;
+	uint32_t internalFormat; // CUBE_COMPRESSED_FORMAT, or GL_RGBA8 when compression is off or failed
+	uint32_t compressed;
+	uint32_t compressionRequested;
+	uint64_t sources[6][2];  // size and modification time of every face file, a change cooks again
+};
+
+// Sized, so every level is compressed explicitly. Core since 4.2, unlike S3TC.
+static constexpr GLenum CUBE_COMPRESSED_FORMAT = GL_COMPRESSED_RGBA_BPTC_UNORM;
+
+static void StampSources(const string paths[6], uint64_t (&out)[6][2])
+{
+	for (int i = 0; i < 6; i++)
+	{
+		error_code ec;
+		const uintmax_t size = fs::file_size(paths[i], ec);
+		out[i][0] = ec ? 0 : size;
+		const auto time = fs::last_write_time(paths[i], ec);
+		out[i][1] = ec ? 0 : static_cast<uint64_t>(time.time_since_epoch().count());
+	}
+}
+
+static void SetCubeMapParameters(const uint32_t levels)
+{
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels - 1));
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+// Uploads the cache when it was cooked from the same faces with the same compression setting, 0 otherwise
+static GLuint LoadCubeCache(const string& cachePath, const CubeCacheHeader& expected, size_t& outBytes)
+{
+	TRACE_ZONE_DETAIL("LoadCubeCache", cachePath);
+	ifstream file(cachePath, ios::binary);
+	if (!file)
+		return 0;
+
+	CubeCacheHeader header{};
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || memcmp(header.magic, CUBE_CACHE_MAGIC, sizeof(CUBE_CACHE_MAGIC)) != 0 || header.version != CUBE_CACHE_VERSION
+		|| header.compressionRequested != expected.compressionRequested
+		|| memcmp(header.sources, expected.sources, sizeof(header.sources)) != 0
+		|| header.levels == 0 || header.levels > 16)
+		return 0;
+
+	const vector<char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	size_t offset = 0;
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	outBytes = 0;
+	for (uint32_t level = 0; level < header.levels; level++)
+	{
+		const GLsizei size = std::max(1, static_cast<GLsizei>(header.size >> level));
+		for (int face = 0; face < 6; face++)
+		{
+			uint32_t bytes = 0;
+			if (offset + sizeof(bytes) <= data.size())
+				memcpy(&bytes, data.data() + offset, sizeof(bytes));
+			offset += sizeof(bytes);
+			if (bytes == 0 || offset + bytes > data.size())
+			{
+				std::cout << "Cube map cache is truncated: " << cachePath << std::endl;
+				glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				glDeleteTextures(1, &textureID);
+				return 0;
+			}
+
+			const GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+			if (header.compressed)
+				glCompressedTexImage2D(target, level, header.internalFormat, size, size, 0, bytes, data.data() + offset);
+			else
+				glTexImage2D(target, level, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data() + offset);
+			offset += bytes;
+			outBytes += bytes;
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	SetCubeMapParameters(header.levels);
+	return textureID;
+}
+
+// Reads every level of the bound cube map back and writes the cache, returns the bytes resident
+static size_t WriteCubeCache(const string& cachePath, CubeCacheHeader header)
+{
+	TRACE_ZONE_DETAIL("WriteCubeCache", cachePath);
+	GLint compressed = GL_FALSE, internalFormat = GL_RGBA8;
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	header.compressed = compressed == GL_TRUE;
+	header.internalFormat = header.compressed ? static_cast<uint32_t>(internalFormat) : GL_RGBA8;
+
+	ofstream file(cachePath, ios::binary | ios::trunc);
+	if (file)
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	vector<char> pixels;
+	size_t total = 0;
+	bool complete = true;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (uint32_t level = 0; level < header.levels; level++)
+	{
+		const GLsizei size = std::max(1, static_cast<GLsizei>(header.size >> level));
+		for (int face = 0; face < 6; face++)
+		{
+			const GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+			GLint bytes = size * size * 4;
+			if (header.compressed)
+				glGetTexLevelParameteriv(target, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+			pixels.resize(bytes);
+			if (header.compressed)
+				glGetCompressedTexImage(target, level, pixels.data());
+			else
+				glGetTexImage(target, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+			if (bytes <= 0)
+			{
+				complete = false;
+				continue;
+			}
+
+			const auto count = static_cast<uint32_t>(bytes);
+			if (file)
+			{
+				file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+				file.write(pixels.data(), bytes);
+			}
+			total += count;
+		}
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	if (!complete)
+	{
+		// A cache with empty levels would be rejected as truncated on every launch
+		file.close();
+		fs::remove(cachePath);
+		std::cout << "Cube map has empty levels, the cache is not written: " << cachePath << std::endl;
+	}
+	else if (!file)
+		std::cout << "Cube map cache could not be written: " << cachePath << std::endl;
+	return total;
+}
+
+// Every level of an RGBA8 cube map compressed to CUBE_COMPRESSED_FORMAT in a new one, left bound. 0 when the driver
+// refused, the source is left untouched.
+static GLuint CompressCubeMap(const GLuint source, const uint32_t size, const uint32_t levels)
+{
+	TRACE_ZONE("CompressCubeMap");
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	vector<unsigned char> pixels;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (uint32_t level = 0; level < levels; level++)
+	{
+		const GLsizei levelSize = std::max(1, static_cast<GLsizei>(size >> level));
+		pixels.resize(static_cast<size_t>(levelSize) * levelSize * 4);
+		for (int face = 0; face < 6; face++)
+		{
+			const GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+			glBindTexture(GL_TEXTURE_CUBE_MAP, source);
+			glGetTexImage(target, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+			glTexImage2D(target, level, CUBE_COMPRESSED_FORMAT, levelSize, levelSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		}
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	GLint compressed = GL_FALSE, smallest = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_COMPRESSED, &compressed);
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, static_cast<GLint>(levels - 1), GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &smallest);
+	if (glGetError() != GL_NO_ERROR || compressed != GL_TRUE || smallest <= 0)
+	{
+		glDeleteTextures(1, &textureID);
+		return 0;
+	}
+	SetCubeMapParameters(levels);
+	return textureID;
+}
+
+GLuint CubeMapFromFile(const string& directory, const string textureFacePaths[6], size_t& outBytes, JobSystem* jobs,
+					   const bool compress)
 {
+	using Clock = chrono::steady_clock;
+	const auto start = Clock::now();
+
+	string paths[6];
+	for (int i = 0; i < 6; i++)
+		paths[i] = directory + "/" + textureFacePaths[i];
+	const string cachePath = directory + "/" + CUBE_CACHE_FILE;
+
+	CubeCacheHeader header{};
+	memcpy(header.magic, CUBE_CACHE_MAGIC, sizeof(CUBE_CACHE_MAGIC));
+	header.version = CUBE_CACHE_VERSION;
+	header.compressionRequested = compress;
+	StampSources(paths, header.sources);
+
+	if (const GLuint cached = LoadCubeCache(cachePath, header, outBytes))
+	{
+		std::cout << "Skybox: loaded the cooked cube map in "
+				  << chrono::duration<double, milli>(Clock::now() - start).count() << " ms" << std::endl;
+		GpuMemory().track(ResidentMemory::Texture, cached, GpuMemoryCategory::Skybox, outBytes);
+		RenderCounters().recordTextureUpload(outBytes);
+		return cached;
+	}
+
+	// Every face on its own job, decoded to RGBA so all of them share one layout
+	struct Face
+	{
+		unsigned char* data = nullptr;
+		int width = 0;
+		int height = 0;
+	};
+	Face faces[6];
+	auto decode = [&faces, &paths](const size_t begin, const size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			TRACE_ZONE_DETAIL("DecodeCubeFace", paths[i]);
+			int channels = 0;
+			faces[i].data = stbi_load(paths[i].c_str(), &faces[i].width, &faces[i].height, &channels, 4);
+		}
+	};
+	if (jobs)
+		jobs->parallelFor(6, 1, decode);
+	else
+		decode(0, 6);
+	const auto decoded = Clock::now();
+
+	bool complete = true;
+	for (int i = 0; i < 6; i++)
+	{
+		if (!faces[i].data)
+		{
+			std::cout << "Cube map texture failed to load at path: " << paths[i] << std::endl;
+			complete = false;
+		}
+		else if (faces[i].width != faces[i].height || faces[i].width != faces[0].width || faces[i].height != faces[0].height)
+		{
+			std::cout << "Cube map face is not square or differs in size from the first: " << paths[i] << std::endl;
+			complete = false;
+		}
+	}
+	if (!complete)
+	{
+		for (const Face& face : faces)
+			stbi_image_free(face.data);
+		outBytes = 0;
+		return 0;
+	}
+
+	header.size = static_cast<uint32_t>(faces[0].width);
+	header.levels = static_cast<uint32_t>(bit_width(header.size));
+
+	// Mips are built from RGBA8, generic compressed formats can't be mip-mapped by the GL
 	GLuint textureID;
 	GL_CHECK(glGenTextures(1, &textureID));
 	GL_CHECK(glBindTexture(GL_TEXTURE_CUBE_MAP, textureID));
+	for (int i = 0; i < 6; i++)
+	{
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA8, faces[i].width, faces[i].height, 0, GL_RGBA,
+					 GL_UNSIGNED_BYTE, faces[i].data);
+		stbi_image_free(faces[i].data);
+	}
+	GL_CHECK(glGenerateMipmap(GL_TEXTURE_CUBE_MAP));
+	SetCubeMapParameters(header.levels);
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < 6; i++)
+	if (compress)
 	{
-		const string path = directory + "/" + textureFacePaths[i];
-		unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
-		if (data)
+		if (const GLuint compressedID = CompressCubeMap(textureID, header.size, header.levels))
 		{
-			GLint format = GL_RGB;
-			if (nrChannels == 1)
-				format = GL_RED;
-			else if (nrChannels == 3)
-				format = GL_RGB;
-			else if (nrChannels == 4)
-				format = GL_RGBA;
-
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
+			glDeleteTextures(1, &textureID);
+			textureID = compressedID;
 		}
 		else
 		{
-			std::cout << "Cube map texture failed to load at path: " << path << std::endl;
-			stbi_image_free(data);
+			std::cout << "Skybox: compression failed, keeping the cube map uncompressed" << std::endl;
+			glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 		}
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	outBytes = WriteCubeCache(cachePath, header);
+	const auto cooked = Clock::now();
+
+	std::cout << "Skybox: decoded 6 faces in " << chrono::duration<double, milli>(decoded - start).count()
+			  << " ms, uploaded and cooked the cache in " << chrono::duration<double, milli>(cooked - decoded).count()
+			  << " ms" << std::endl;
 
+	RenderCounters().recordTextureUpload(static_cast<size_t>(header.size) * header.size * 4 * 6);
+	GpuMemory().track(ResidentMemory::Texture, textureID, GpuMemoryCategory::Skybox, outBytes);
 	return textureID;
 }
 
@@ -92,28 +373,40 @@ Skybox::Skybox(const Shader& skyboxShader)
 
 	GL_CHECK(glGenVertexArrays(1, &skyboxVAO));
 	GL_CHECK(glGenBuffers(1, &skyboxVBO));
-	GL_CHECK(glBindVertexArray(skyboxVAO));
+	GLState().bindVertexArray(skyboxVAO);
 	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO));
 	GL_CHECK(glBufferData(GL_ARRAY_BUFFER, skyboxVertices.size() * sizeof(float), &skyboxVertices[0], GL_STATIC_DRAW));
 	GL_CHECK(glEnableVertexAttribArray(0));
 	GL_CHECK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), static_cast<void*>(nullptr)));
-	GL_CHECK(glBindVertexArray(0));
+	GLState().bindVertexArray(0);
+	RenderCounters().recordBufferUpload(skyboxVertices.size() * sizeof(float));
+	GpuMemory().track(ResidentMemory::Buffer, skyboxVBO, GpuMemoryCategory::Skybox, skyboxVertices.size() * sizeof(float));
 }
 
 Skybox::~Skybox()
 {
+	GpuMemory().untrack(ResidentMemory::Texture, skyboxTextureID);
 	glDeleteTextures(1, &skyboxTextureID);
 	if (skyboxVAO)
+	{
+		GLState().forgetVertexArray(skyboxVAO);
 		glDeleteVertexArrays(1, &skyboxVAO);
+	}
 	if (skyboxVBO)
+	{
+		GpuMemory().untrack(ResidentMemory::Buffer, skyboxVBO);
 		glDeleteBuffers(1, &skyboxVBO);
+	}
 }
 
-void Skybox::loadFaces(const string& directory, const string facePaths[6])
+void Skybox::loadFaces(const string& directory, const string facePaths[6], JobSystem* jobs)
 {
 	if (skyboxTextureID)
+	{
+		GpuMemory().untrack(ResidentMemory::Texture, skyboxTextureID);
 		glDeleteTextures(1, &skyboxTextureID);
-	skyboxTextureID = CubeMapFromFile(directory, facePaths);
+	}
+	skyboxTextureID = CubeMapFromFile(directory, facePaths, skyboxTextureBytes, jobs);
 }
 
 void Skybox::scale(const float scale)
@@ -123,14 +416,14 @@ void Skybox::scale(const float scale)
 
 void Skybox::draw() const
 {
-	glDepthFunc(GL_LEQUAL);
+	GLState().depthFunc(GL_LEQUAL);
 	cachedSkyboxShader.use();
 	cachedSkyboxShader.setInt("cubemap", 0);
 	cachedSkyboxShader.setFloat("scaleFactor", scaleFactor);
-	GL_CHECK(glBindVertexArray(skyboxVAO));
+	GLState().bindVertexArray(skyboxVAO);
 	GL_CHECK(glActiveTexture(GL_TEXTURE0));
 	GL_CHECK(glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTextureID));
 	GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, skyboxVertices.size()));
-	GL_CHECK(glBindVertexArray(0));
-	GL_CHECK(glDepthFunc(GL_LESS));
+	RenderCounters().recordDraw(1, skyboxVertices.size() / 9);
+	GLState().depthFunc(GL_LESS);
 }
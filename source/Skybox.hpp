@@ -1,11 +1,17 @@
 #pragma once
 #include <string>
 #include <glad/glad.h>
+#include "JobSystem.hpp"
 #include "Shader.hpp"
 
 using namespace std;
 
-GLuint CubeMapFromFile(const string textureFacePaths[6]);
+// Loads the cooked cache next to the faces when it is up to date. Otherwise the faces are decoded in parallel,
+// uploaded and mip-mapped as RGBA8, then every level is compressed to BPTC when asked, and the result is cooked
+// into the cache for the next launch.
+// outBytes receives the size of every level of every face.
+GLuint CubeMapFromFile(const string& directory, const string textureFacePaths[6], size_t& outBytes,
+					   JobSystem* jobs = nullptr, bool compress = true);
 
 class Skybox
 {
@@ -13,11 +19,13 @@ public:
 	Skybox(const Shader& skyboxShader);
 	~Skybox();
 
-	void loadFaces(const string& directory, const string facePaths[6]);
+	// Faces are decoded on the jobs when the cube map isn't cached yet
+	void loadFaces(const string& directory, const string facePaths[6], JobSystem* jobs = nullptr);
 	void scale(float scale);
 	void draw() const;
 private:
 	GLuint skyboxTextureID = 0;
+	size_t skyboxTextureBytes = 0;
 	float scaleFactor = 1.0f;
 	vector<float> skyboxVertices;
 	GLuint skyboxVAO = 0;
@@ -0,0 +1,522 @@
+#include "TextureStreamer.hpp"
+#include <stb_image.h>
+#include "RenderStats.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+static uint32_t LevelCount(const int width, const int height)
+{
+	return static_cast<uint32_t>(bit_width(static_cast<uint32_t>(std::max(width, height))));
+}
+
+// First level no larger than MIN_RESIDENT_SIZE, it and the ones below are uploaded at registration
+static uint32_t FloorLevel(const int width, const int height)
+{
+	const uint32_t levels = LevelCount(width, height);
+	const uint32_t residentLevels = static_cast<uint32_t>(bit_width(static_cast<uint32_t>(TextureStreamer::MIN_RESIDENT_SIZE)));
+	return levels > residentLevels ? levels - residentLevels : 0;
+}
+
+static GLenum SizedFormat(const int components)
+{
+	switch(components)
+	{
+		case 1: return GL_R8;
+		case 2: return GL_RG8;
+		case 3: return GL_RGB8;
+		default: return GL_RGBA8;
+	}
+}
+
+static GLenum PixelFormat(const int components)
+{
+	switch(components)
+	{
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+		default: return GL_RGBA;
+	}
+}
+
+// 2x2 box filter, the last row or column is repeated for odd sizes
+static vector<unsigned char> Downsample(const vector<unsigned char>& source, const int width, const int height, const int components)
+{
+	const int outWidth = std::max(1, width / 2);
+	const int outHeight = std::max(1, height / 2);
+	vector<unsigned char> result(static_cast<size_t>(outWidth) * outHeight * components);
+	for(int y = 0; y < outHeight; ++y)
+	{
+		const size_t row0 = static_cast<size_t>(std::min(2 * y, height - 1)) * width;
+		const size_t row1 = static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width;
+		for(int x = 0; x < outWidth; ++x)
+		{
+			const size_t x0 = std::min(2 * x, width - 1);
+			const size_t x1 = std::min(2 * x + 1, width - 1);
+			unsigned char* out = &result[(static_cast<size_t>(y) * outWidth + x) * components];
+			for(int c = 0; c < components; ++c)
+			{
+				const uint32_t sum = source[(row0 + x0) * components + c] + source[(row0 + x1) * components + c] +
+					source[(row1 + x0) * components + c] + source[(row1 + x1) * components + c];
+				out[c] = static_cast<unsigned char>((sum + 2) / 4);
+			}
+		}
+	}
+	return result;
+}
+
+// Decodes the whole image and keeps its levels from topLevel down to 1x1. topLevel is clamped to the floor level,
+// UINT32_MAX keeps only the mips resident from registration. Safe on job threads.
+static bool DecodeMips(const TextureSource& source, const uint32_t topLevel, DecodedMips& out)
+{
+	TRACE_ZONE_DETAIL("DecodeMips", source.path);
+	int width = 0, height = 0, components = 0;
+	vector<unsigned char> level;
+	if(!source.pixels.empty())
+	{
+		width = source.width;
+		height = source.height;
+		components = source.components;
+		level = source.pixels;
+	}
+	else
+	{
+		unsigned char* data = source.path.empty()
+			? stbi_load_from_memory(source.encoded.data(), static_cast<int>(source.encoded.size()), &width, &height, &components, 0)
+			: stbi_load(source.path.c_str(), &width, &height, &components, 0);
+		if(!data)
+			return false;
+		level.assign(data, data + static_cast<size_t>(width) * height * components);
+		stbi_image_free(data);
+	}
+	if(width <= 0 || height <= 0 || components < 1 || components > 4)
+		return false;
+
+	out.width = width;
+	out.height = height;
+	out.components = components;
+	out.topLevel = std::min(topLevel, FloorLevel(width, height));
+	out.levels.clear();
+	const uint32_t levelCount = LevelCount(width, height);
+	for(uint32_t l = 0; l < levelCount; ++l)
+	{
+		vector<unsigned char> next;
+		if(l + 1 < levelCount)
+			next = Downsample(level, width, height, components);
+		if(l >= out.topLevel)
+			out.levels.push_back(std::move(level));
+		level = std::move(next);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	return true;
+}
+
+uint32_t TextureStreamer::registerTexture(TextureSource source, GLuint& outTexture, GLuint64& outHandle)
+{
+	outTexture = 0;
+	outHandle = 0;
+
+	auto shared = make_shared<const TextureSource>(std::move(source));
+	DecodedMips mips;
+	if(!DecodeMips(*shared, UINT32_MAX, mips))
+		return NO_STREAM;
+
+	uint32_t stream;
+	if(!freeSlots.empty())
+	{
+		stream = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		stream = static_cast<uint32_t>(textures.size());
+		textures.emplace_back();
+	}
+
+	StreamedTexture& texture = textures[stream];
+	texture.source = std::move(shared);
+	texture.width = mips.width;
+	texture.height = mips.height;
+	texture.components = mips.components;
+	texture.levelCount = LevelCount(mips.width, mips.height);
+	texture.floorLevel = mips.topLevel;
+	texture.topLevel = texture.floorLevel;
+	texture.wantedLevel = texture.floorLevel;
+	texture.owner = GpuMemory().currentOwner();
+	texture.live = true;
+
+	const GLuint created = createTexture(texture, texture.floorLevel);
+	uploadLevels(created, mips, texture.floorLevel);
+	swapTexture(texture, created, texture.floorLevel);
+
+	outTexture = texture.texture;
+	outHandle = texture.handle;
+	return stream;
+}
+
+void TextureStreamer::release(const uint32_t stream)
+{
+	if(stream >= textures.size() || !textures[stream].live)
+		return;
+
+	StreamedTexture& texture = textures[stream];
+	retire(texture.texture, texture.handle, levelBytes(texture, texture.topLevel));
+
+	// A decode job still running finds another generation and drops its result
+	const uint32_t generation = texture.generation + 1;
+	texture = StreamedTexture{};
+	texture.generation = generation;
+	freeSlots.push_back(stream);
+}
+
+void TextureStreamer::addHandleReference(const uint32_t stream, const GLuint buffer, const uint32_t index)
+{
+	if(stream < textures.size() && textures[stream].live && buffer != 0)
+		textures[stream].references.push_back({buffer, index});
+}
+
+void TextureStreamer::forgetHandleBuffer(const GLuint buffer)
+{
+	for(StreamedTexture& texture : textures)
+	{
+		erase_if(texture.references, [buffer](const HandleReference& reference)
+		{
+			return reference.buffer == buffer;
+		});
+	}
+}
+
+void TextureStreamer::request(const uint32_t stream, const float pixels)
+{
+	if(stream < textures.size())
+		textures[stream].requestedPixels = std::max(textures[stream].requestedPixels, pixels);
+}
+
+void TextureStreamer::update()
+{
+	TRACE_ZONE("TextureStreamer::update");
+	collectRetired();
+	finishJobs();
+
+	// ========== Wanted detail ==========
+	order.clear();
+	uint64_t wantedBytes = 0;
+	for(uint32_t i = 0; i < textures.size(); ++i)
+	{
+		StreamedTexture& texture = textures[i];
+		if(!texture.live)
+			continue;
+		texture.wantedLevel = neededLevel(texture);
+		wantedBytes += levelBytes(texture, texture.wantedLevel);
+		order.push_back(i);
+	}
+
+	// Least requested first, textures nobody drew this frame lead
+	ranges::sort(order, [this](const uint32_t a, const uint32_t b)
+	{
+		return textures[a].requestedPixels < textures[b].requestedPixels;
+	});
+
+	// Over the budget every texture gives up a level per round, the least requested first
+	for(bool trimmed = true; wantedBytes > budget && trimmed;)
+	{
+		trimmed = false;
+		for(const uint32_t stream : order)
+		{
+			StreamedTexture& texture = textures[stream];
+			if(wantedBytes <= budget)
+				break;
+			if(texture.wantedLevel >= texture.floorLevel)
+				continue;
+			wantedBytes -= levelBytes(texture, texture.wantedLevel) - levelBytes(texture, texture.wantedLevel + 1);
+			++texture.wantedLevel;
+			trimmed = true;
+		}
+	}
+
+	// ========== Eviction ==========
+	// Detail nobody wants is only dropped when what is wanted would not fit next to it
+	uint64_t missingBytes = 0;
+	for(const uint32_t stream : order)
+	{
+		const StreamedTexture& texture = textures[stream];
+		if(!texture.pending && !texture.failed && texture.wantedLevel < texture.topLevel)
+			missingBytes += levelBytes(texture, texture.wantedLevel) - levelBytes(texture, texture.topLevel);
+	}
+	for(const uint32_t stream : order)
+	{
+		if(liveBytes + inFlightBytes + missingBytes <= budget)
+			break;
+		StreamedTexture& texture = textures[stream];
+		if(texture.topLevel < texture.wantedLevel)
+			coarsen(texture, texture.wantedLevel);
+	}
+
+	// ========== Stream in ==========
+	for(auto it = order.rbegin(); it != order.rend() && jobs.size() < MAX_JOBS_IN_FLIGHT; ++it)
+	{
+		const StreamedTexture& texture = textures[*it];
+		if(texture.pending || texture.failed || texture.wantedLevel >= texture.topLevel)
+			continue;
+		const uint64_t addedBytes = levelBytes(texture, texture.wantedLevel) - levelBytes(texture, texture.topLevel);
+		if(liveBytes + inFlightBytes + addedBytes > budget)
+			continue;
+		startJob(*it);
+	}
+
+	for(const uint32_t stream : order)
+		textures[stream].requestedPixels = 0.0f;
+
+	stats.textures = static_cast<uint32_t>(order.size());
+	stats.residentBytes = liveBytes + retiredBytes;
+	stats.wantedBytes = wantedBytes;
+	stats.jobsInFlight = static_cast<uint32_t>(jobs.size());
+	stats.retiring = static_cast<uint32_t>(retired.size());
+}
+
+void TextureStreamer::shutdown()
+{
+	for(const unique_ptr<DecodeJob>& job : jobs)
+	{
+		if(jobSystem)
+			jobSystem->wait(job->counter);
+	}
+	jobs.clear();
+	inFlightBytes = 0;
+
+	for(uint32_t stream = 0; stream < textures.size(); ++stream)
+		release(stream);
+
+	// The context is going away, whatever the GPU still does with them is finished by then
+	for(const RetiredTexture& texture : retired)
+	{
+		glDeleteSync(texture.fence);
+		glMakeTextureHandleNonResidentARB(texture.handle);
+		GpuMemory().untrack(ResidentMemory::Texture, texture.texture);
+		glDeleteTextures(1, &texture.texture);
+	}
+	retired.clear();
+	retiredBytes = 0;
+	textures.clear();
+	freeSlots.clear();
+}
+
+uint64_t TextureStreamer::residentBytes(const uint32_t stream) const
+{
+	if(stream >= textures.size() || !textures[stream].live)
+		return 0;
+	return levelBytes(textures[stream], textures[stream].topLevel);
+}
+
+void TextureStreamer::report(ostream& out) const
+{
+	constexpr double MB = 1024.0 * 1024.0;
+	out << "------------Texture streaming------------" << endl;
+	out << fixed << setprecision(1);
+	out << "Textures: " << stats.textures << ", resident " << static_cast<double>(liveBytes) / MB << " MB of a "
+		<< static_cast<double>(budget) / MB << " MB budget, retiring " << static_cast<double>(retiredBytes) / MB
+		<< " MB in " << retired.size() << " textures" << endl;
+	out << "Wanted: " << static_cast<double>(stats.wantedBytes) / MB << " MB, decodes in flight " << jobs.size() << endl;
+	out << "Streamed in " << stats.streamedIn << " times, evicted " << stats.evicted << " times, uploaded "
+		<< static_cast<double>(stats.uploadedBytes) / MB << " MB" << endl;
+	out << "----------------------------------------" << endl;
+}
+
+uint64_t TextureStreamer::levelBytes(const StreamedTexture& texture, const uint32_t topLevel) const
+{
+	uint64_t bytes = 0;
+	for(uint32_t l = topLevel; l < texture.levelCount; ++l)
+	{
+		bytes += static_cast<uint64_t>(std::max(1, texture.width >> l)) * std::max(1, texture.height >> l) *
+			texture.components;
+	}
+	return bytes;
+}
+
+// Level whose size matches the largest request, one texel per pixel
+uint32_t TextureStreamer::neededLevel(const StreamedTexture& texture) const
+{
+	if(texture.requestedPixels <= 0.0f)
+		return texture.floorLevel;
+	const float ratio = static_cast<float>(std::max(texture.width, texture.height)) / texture.requestedPixels;
+	if(ratio <= 1.0f)
+		return 0;
+	return std::min(static_cast<uint32_t>(floor(log2(ratio))), texture.floorLevel);
+}
+
+GLuint TextureStreamer::createTexture(const StreamedTexture& texture, const uint32_t topLevel) const
+{
+	GLuint created = 0;
+	glCreateTextures(GL_TEXTURE_2D, 1, &created);
+	glTextureStorage2D(created, static_cast<GLsizei>(texture.levelCount - topLevel), SizedFormat(texture.components),
+					   std::max(1, texture.width >> topLevel), std::max(1, texture.height >> topLevel));
+	glTextureParameteri(created, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTextureParameteri(created, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTextureParameteri(created, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(created, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return created;
+}
+
+void TextureStreamer::uploadLevels(const GLuint texture, const DecodedMips& mips, const uint32_t topLevel)
+{
+	TRACE_ZONE("uploadLevels");
+	// Rows of one and three component levels are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	uint64_t bytes = 0;
+	for(uint32_t l = topLevel; l < mips.topLevel + mips.levels.size(); ++l)
+	{
+		const vector<unsigned char>& level = mips.levels[l - mips.topLevel];
+		glTextureSubImage2D(texture, static_cast<GLint>(l - topLevel), 0, 0, std::max(1, mips.width >> l),
+							std::max(1, mips.height >> l), PixelFormat(mips.components), GL_UNSIGNED_BYTE, level.data());
+		bytes += level.size();
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	RenderCounters().recordTextureUpload(bytes);
+	stats.uploadedBytes += bytes;
+}
+
+void TextureStreamer::swapTexture(StreamedTexture& texture, const GLuint newTexture, const uint32_t newTopLevel)
+{
+	const GLuint64 handle = glGetTextureHandleARB(newTexture);
+	glMakeTextureHandleResidentARB(handle);
+
+	// Draws already submitted keep reading the old handle, the ones after this read the new one
+	for(const HandleReference& reference : texture.references)
+	{
+		glNamedBufferSubData(reference.buffer, static_cast<GLintptr>(reference.index * sizeof(GLuint64)),
+							 sizeof(GLuint64), &handle);
+	}
+
+	const uint64_t bytes = levelBytes(texture, newTopLevel);
+	GpuMemory().track(ResidentMemory::Texture, newTexture, GpuMemoryCategory::ModelTexture, bytes, texture.owner);
+	liveBytes += bytes;
+
+	if(texture.texture != 0)
+		retire(texture.texture, texture.handle, levelBytes(texture, texture.topLevel));
+
+	texture.texture = newTexture;
+	texture.handle = handle;
+	texture.topLevel = newTopLevel;
+}
+
+void TextureStreamer::retire(const GLuint texture, const GLuint64 handle, const uint64_t bytes)
+{
+	retired.push_back({texture, handle, bytes, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+	liveBytes -= bytes;
+	retiredBytes += bytes;
+}
+
+void TextureStreamer::collectRetired()
+{
+	erase_if(retired, [this](const RetiredTexture& texture)
+	{
+		const GLenum status = glClientWaitSync(texture.fence, 0, 0);
+		if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return false;
+
+		glDeleteSync(texture.fence);
+		glMakeTextureHandleNonResidentARB(texture.handle);
+		GpuMemory().untrack(ResidentMemory::Texture, texture.texture);
+		glDeleteTextures(1, &texture.texture);
+		retiredBytes -= texture.bytes;
+		return true;
+	});
+}
+
+void TextureStreamer::finishJobs()
+{
+	uint64_t uploadedBytes = 0;
+	for(size_t i = 0; i < jobs.size();)
+	{
+		DecodeJob& job = *jobs[i];
+		if(!job.counter.done())
+		{
+			++i;
+			continue;
+		}
+
+		StreamedTexture* texture = job.stream < textures.size() && textures[job.stream].generation == job.generation
+			? &textures[job.stream]
+			: nullptr;
+		if(texture)
+		{
+			// The file could have changed on disk since registration
+			if(!job.decoded || job.mips.width != texture->width || job.mips.height != texture->height ||
+				job.mips.components != texture->components)
+				texture->failed = true;
+			else
+			{
+				// Detail that is no longer wanted since the job started is not uploaded
+				const uint32_t topLevel = std::max(job.topLevel, texture->wantedLevel);
+				if(topLevel < texture->topLevel)
+				{
+					const uint64_t bytes = levelBytes(*texture, topLevel);
+					if(uploadedBytes > 0 && uploadedBytes + bytes > MAX_UPLOAD_BYTES_PER_FRAME)
+					{
+						++i;
+						continue;
+					}
+					const GLuint created = createTexture(*texture, topLevel);
+					uploadLevels(created, job.mips, topLevel);
+					swapTexture(*texture, created, topLevel);
+					uploadedBytes += bytes;
+					++stats.streamedIn;
+				}
+			}
+			texture->pending = false;
+		}
+
+		inFlightBytes -= job.addedBytes;
+		jobs.erase(jobs.begin() + static_cast<ptrdiff_t>(i));
+	}
+}
+
+void TextureStreamer::startJob(const uint32_t stream)
+{
+	StreamedTexture& texture = textures[stream];
+	texture.pending = true;
+
+	auto job = make_unique<DecodeJob>();
+	job->stream = stream;
+	job->generation = texture.generation;
+	job->topLevel = texture.wantedLevel;
+	job->addedBytes = levelBytes(texture, texture.wantedLevel) - levelBytes(texture, texture.topLevel);
+	inFlightBytes += job->addedBytes;
+
+	DecodeJob* decode = job.get();
+	auto work = [decode, source = texture.source]
+	{
+		decode->decoded = DecodeMips(*source, decode->topLevel, decode->mips);
+	};
+	jobs.push_back(std::move(job));
+	if(jobSystem)
+		jobSystem->run(work, &decode->counter);
+	else
+		work();
+}
+
+// Copies the levels kept from the current texture on the GPU, nothing is decoded again
+void TextureStreamer::coarsen(StreamedTexture& texture, const uint32_t newTopLevel)
+{
+	const GLuint created = createTexture(texture, newTopLevel);
+	for(uint32_t l = newTopLevel; l < texture.levelCount; ++l)
+	{
+		glCopyImageSubData(texture.texture, GL_TEXTURE_2D, static_cast<GLint>(l - texture.topLevel), 0, 0, 0,
+						   created, GL_TEXTURE_2D, static_cast<GLint>(l - newTopLevel), 0, 0, 0,
+						   std::max(1, texture.width >> l), std::max(1, texture.height >> l), 1);
+	}
+	swapTexture(texture, created, newTopLevel);
+	++stats.evicted;
+}
+
+TextureStreamer& TextureStreaming()
+{
+	static TextureStreamer streamer;
+	return streamer;
+}
@@ -0,0 +1,162 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "GpuMemory.hpp"
+#include "JobSystem.hpp"
+
+using namespace std;
+
+// What a streamed texture decodes its mips from, again every time it gains detail. One of the three is set.
+struct TextureSource
+{
+	string path;                   // image file on disk
+	vector<unsigned char> encoded; // PNG/JPEG bytes of an embedded texture
+	vector<unsigned char> pixels;  // uncompressed embedded texture, width x height x components
+	int width = 0;
+	int height = 0;
+	int components = 0;
+};
+
+// Mip levels decoded on the CPU, from the first level asked for down to 1x1
+struct DecodedMips
+{
+	int width = 0;  // of level 0
+	int height = 0;
+	int components = 0;
+	uint32_t topLevel = 0; // of levels[0]
+	vector<vector<unsigned char>> levels;
+};
+
+// Streams texture detail in and out of VRAM. A texture starts with only its mips of at most MIN_RESIDENT_SIZE
+// texels, every frame the renderer requests the on-screen size of what is drawn with it, and the finer mips are
+// decoded on job threads and uploaded once ready. Over the budget, detail nobody needs is evicted first.
+// Bindless textures are immutable once they have a handle, so every change creates a new texture, patches its
+// handle into the registered handle SSBO slots and keeps the old one resident until a fence says the GPU is done.
+// GL thread only, see TextureStreaming().
+class TextureStreamer
+{
+public:
+	struct Stats
+	{
+		uint32_t textures = 0;
+		uint64_t residentBytes = 0; // retiring textures included
+		uint64_t wantedBytes = 0;   // if every texture had the detail it was asked for, within the budget
+		uint32_t jobsInFlight = 0;
+		uint32_t retiring = 0;
+		uint64_t streamedIn = 0;    // totals since startup
+		uint64_t evicted = 0;
+		uint64_t uploadedBytes = 0;
+	};
+
+	void setJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+	void setBudget(uint64_t bytes) { budget = bytes; }
+	[[nodiscard]] uint64_t getBudget() const { return budget; }
+
+	// Decodes the source once and uploads its coarse mips. NO_STREAM when it can't be decoded.
+	// Its textures are tracked under the GPU memory owner current at registration.
+	uint32_t registerTexture(TextureSource source, GLuint& outTexture, GLuint64& outHandle);
+	// Retires the texture, its handle stays resident until the GPU is done with it
+	void release(uint32_t stream);
+
+	// Element index of a handle SSBO that holds the texture's handle, rewritten whenever the handle changes
+	void addHandleReference(uint32_t stream, GLuint buffer, uint32_t index);
+	// Before the buffer is deleted
+	void forgetHandleBuffer(GLuint buffer);
+
+	// On-screen size in pixels of something drawn with the texture this frame, the largest request counts
+	void request(uint32_t stream, float pixels);
+	// Once per frame: finishes decoded uploads, evicts over the budget and starts new decodes
+	void update();
+	// Waits for the decode jobs and deletes every texture, before the GL context goes away
+	void shutdown();
+
+	[[nodiscard]] uint64_t residentBytes(uint32_t stream) const;
+	[[nodiscard]] const Stats& getStats() const { return stats; }
+	void report(ostream& out) const;
+
+	static constexpr uint32_t NO_STREAM = UINT32_MAX;
+	static constexpr int MIN_RESIDENT_SIZE = 64;
+	static constexpr uint64_t DEFAULT_BUDGET = 512ull << 20;
+	static constexpr uint32_t MAX_JOBS_IN_FLIGHT = 4;
+	// Decoded detail uploaded per frame, one upload always goes through so large textures can't starve
+	static constexpr uint64_t MAX_UPLOAD_BYTES_PER_FRAME = 8ull << 20;
+
+private:
+	struct HandleReference
+	{
+		GLuint buffer;
+		uint32_t index;
+	};
+
+	struct StreamedTexture
+	{
+		shared_ptr<const TextureSource> source; // shared with decode jobs still running
+		int width = 0;  // of level 0
+		int height = 0;
+		int components = 0;
+		uint32_t levelCount = 0;
+		uint32_t floorLevel = 0;  // coarsest top level, the mips below it are always resident
+		uint32_t topLevel = 0;    // finest level resident
+		uint32_t wantedLevel = 0;
+		GLuint texture = 0;
+		GLuint64 handle = 0;
+		GpuMemoryOwner owner = GpuMemoryTracker::RENDERER;
+		float requestedPixels = 0.0f;
+		uint32_t generation = 0;  // bumped on release, so a reused slot ignores the old slot's jobs
+		bool live = false;
+		bool pending = false;     // decode job in flight
+		bool failed = false;      // the source stopped decoding, keeps what it has
+		vector<HandleReference> references;
+	};
+
+	struct DecodeJob
+	{
+		uint32_t stream;
+		uint32_t generation;
+		uint32_t topLevel;
+		uint64_t addedBytes; // counted in inFlightBytes until the job is finished
+		JobCounter counter;
+		DecodedMips mips;
+		bool decoded = false;
+	};
+
+	struct RetiredTexture
+	{
+		GLuint texture;
+		GLuint64 handle;
+		uint64_t bytes;
+		GLsync fence;
+	};
+
+	[[nodiscard]] uint64_t levelBytes(const StreamedTexture& texture, uint32_t topLevel) const;
+	[[nodiscard]] uint32_t neededLevel(const StreamedTexture& texture) const;
+	[[nodiscard]] GLuint createTexture(const StreamedTexture& texture, uint32_t topLevel) const;
+	// Levels of the decoded mips from topLevel on, into a texture created for topLevel
+	void uploadLevels(GLuint texture, const DecodedMips& mips, uint32_t topLevel);
+	// Makes the new texture current: handle, SSBO slots, accounting, and the old one retired
+	void swapTexture(StreamedTexture& texture, GLuint newTexture, uint32_t newTopLevel);
+	void retire(GLuint texture, GLuint64 handle, uint64_t bytes);
+	void collectRetired();
+	void finishJobs();
+	void startJob(uint32_t stream);
+	void coarsen(StreamedTexture& texture, uint32_t newTopLevel);
+
+	JobSystem* jobSystem = nullptr;
+	uint64_t budget = DEFAULT_BUDGET;
+	vector<StreamedTexture> textures;
+	vector<uint32_t> freeSlots;
+	vector<unique_ptr<DecodeJob>> jobs;
+	vector<RetiredTexture> retired;
+	vector<uint32_t> order; // scratch for the priority passes
+	uint64_t liveBytes = 0;     // current textures, what the budget is held against
+	uint64_t retiredBytes = 0;  // freed once their fences signal
+	uint64_t inFlightBytes = 0; // detail the running jobs will add
+	Stats stats;
+};
+
+// The texture streamer of the GL context, used by the thread owning it
+TextureStreamer& TextureStreaming();
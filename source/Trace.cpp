@@ -0,0 +1,186 @@
+#include "Trace.hpp"
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+Tracer::Tracer()
+{
+	gpuBuffer = &createBuffer();
+	gpuBuffer->name = "GPU";
+}
+
+void Tracer::start()
+{
+	{
+		lock_guard guard(buffersLock);
+		for(const auto& buffer : buffers)
+		{
+			lock_guard bufferGuard(buffer->lock);
+			buffer->events.clear();
+			buffer->text.clear();
+			buffer->dropped = 0;
+		}
+	}
+	startNs = now();
+	recording.store(true, memory_order_relaxed);
+}
+
+void Tracer::stop()
+{
+	recording.store(false, memory_order_relaxed);
+}
+
+void Tracer::setThreadName(const string_view name)
+{
+	ThreadBuffer& buffer = localBuffer();
+	lock_guard guard(buffer.lock);
+	buffer.name = name;
+}
+
+void Tracer::record(const char* name, const string_view detail, const uint64_t beginNs, const uint64_t endNs)
+{
+	if(!active())
+		return;
+
+	ThreadBuffer& buffer = localBuffer();
+	lock_guard guard(buffer.lock);
+	append(buffer, name, {}, detail, beginNs, endNs);
+}
+
+void Tracer::recordGpuZone(const string_view name, const uint64_t beginNs, const uint64_t endNs)
+{
+	if(!active())
+		return;
+
+	lock_guard guard(gpuBuffer->lock);
+	append(*gpuBuffer, nullptr, name, {}, beginNs, endNs);
+}
+
+void Tracer::writeChromeTrace(ostream& out) const
+{
+	lock_guard guard(buffersLock);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	out << fixed << setprecision(3);
+
+	bool first = true;
+	for(const auto& buffer : buffers)
+	{
+		lock_guard bufferGuard(buffer->lock);
+		if(buffer->events.empty())
+			continue;
+
+		out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+			<< ",\"args\":{\"name\":\"";
+		writeEscaped(out, buffer->name.empty() ? "thread " + to_string(buffer->tid) : buffer->name);
+		out << "\"}}";
+		first = false;
+
+		for(const Event& event : buffer->events)
+		{
+			// Zones opened before the capture started are clipped to its start
+			const uint64_t begin = std::max(event.beginNs, startNs);
+			const uint64_t end = std::max(event.endNs, begin);
+			out << ",\n{\"name\":\"";
+			writeEscaped(out, event.name ? string_view(event.name) : string_view(buffer->text.data() + event.nameText));
+			out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"ts\":" << static_cast<double>(begin - startNs) / 1e3
+				<< ",\"dur\":" << static_cast<double>(end - begin) / 1e3;
+			if(event.detailText != NO_TEXT)
+			{
+				out << ",\"args\":{\"detail\":\"";
+				writeEscaped(out, buffer->text.data() + event.detailText);
+				out << "\"}";
+			}
+			out << "}";
+		}
+
+		if(buffer->dropped > 0)
+			cout << "Trace: " << buffer->dropped << " zones dropped on thread " << buffer->tid
+				<< ", over " << MAX_EVENTS_PER_THREAD << " per thread" << endl;
+	}
+	out << defaultfloat << "\n]}\n";
+}
+
+bool Tracer::writeChromeTrace(const string& path) const
+{
+	ofstream file(path, ios::out | ios::trunc);
+	if(!file.is_open())
+	{
+		cerr << "Trace: failed to open file: " << path << endl;
+		return false;
+	}
+	writeChromeTrace(file);
+	cout << "Trace written to " << path << endl;
+	return file.good();
+}
+
+uint64_t Tracer::now()
+{
+	using namespace std::chrono;
+	return static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+Tracer::ThreadBuffer& Tracer::localBuffer()
+{
+	// Buffers outlive their threads, a capture keeps the zones of workers that already exited
+	thread_local ThreadBuffer* buffer = nullptr;
+	if(!buffer)
+		buffer = &createBuffer();
+	return *buffer;
+}
+
+Tracer::ThreadBuffer& Tracer::createBuffer()
+{
+	lock_guard guard(buffersLock);
+	auto& buffer = buffers.emplace_back(make_unique<ThreadBuffer>());
+	buffer->tid = static_cast<uint32_t>(buffers.size());
+	return *buffer;
+}
+
+void Tracer::append(ThreadBuffer& buffer, const char* name, const string_view dynamicName, const string_view detail,
+					const uint64_t beginNs, const uint64_t endNs)
+{
+	if(buffer.events.size() >= MAX_EVENTS_PER_THREAD)
+	{
+		++buffer.dropped;
+		return;
+	}
+
+	const uint32_t nameText = name ? NO_TEXT : appendText(buffer, dynamicName);
+	const uint32_t detailText = detail.empty() ? NO_TEXT : appendText(buffer, detail);
+	buffer.events.push_back({name, nameText, detailText, beginNs, endNs});
+}
+
+uint32_t Tracer::appendText(ThreadBuffer& buffer, const string_view text)
+{
+	const auto offset = static_cast<uint32_t>(buffer.text.size());
+	buffer.text.append(text);
+	buffer.text.push_back('\0');
+	return offset;
+}
+
+void Tracer::writeEscaped(ostream& out, const string_view text)
+{
+	for(const char c : text)
+	{
+		switch(c)
+		{
+			case '"': out << "\\\""; break;
+			case '\\': out << "\\\\"; break;
+			case '\n': out << "\\n"; break;
+			case '\t': out << "\\t"; break;
+			default:
+				if(static_cast<unsigned char>(c) < 0x20)
+					out << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+				else
+					out << c;
+		}
+	}
+}
+
+Tracer& Tracing()
+{
+	static Tracer tracer;
+	return tracer;
+}
@@ -0,0 +1,124 @@
+#pragma once
+// Scoped CPU zones recorded into per-thread buffers and written as Chrome trace events,
+// viewable in chrome://tracing or ui.perfetto.dev. LEARNOPENGL_TRACING=0 compiles every TRACE_* macro out.
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef LEARNOPENGL_TRACING
+#define LEARNOPENGL_TRACING 1
+#endif
+
+using namespace std;
+
+// Zones are only kept between start() and stop(), outside of it a zone costs one relaxed load.
+// Any thread may record, each into its own buffer, so recording threads never contend with each other.
+class Tracer
+{
+public:
+	Tracer();
+
+	// Drops the events of a previous capture
+	void start();
+	void stop();
+	[[nodiscard]] bool active() const { return recording.load(memory_order_relaxed); }
+
+	// Label of the calling thread's track
+	void setThreadName(string_view name);
+
+	// name is kept as a pointer and must be a literal, detail is copied
+	void record(const char* name, string_view detail, uint64_t beginNs, uint64_t endNs);
+	// GPU pass on its own track, times already converted to now()'s clock, GL thread only
+	void recordGpuZone(string_view name, uint64_t beginNs, uint64_t endNs);
+
+	// Chrome trace event JSON of everything recorded so far
+	void writeChromeTrace(ostream& out) const;
+	bool writeChromeTrace(const string& path) const;
+
+	// Steady clock in nanoseconds, the time base of every event
+	[[nodiscard]] static uint64_t now();
+
+	// Further zones of a thread are counted and dropped, a capture left running can't grow without bound
+	static constexpr size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+private:
+	static constexpr uint32_t NO_TEXT = UINT32_MAX;
+
+	struct Event
+	{
+		const char* name;  // nullptr when the name is in the text pool
+		uint32_t nameText;
+		uint32_t detailText;
+		uint64_t beginNs;
+		uint64_t endNs;
+	};
+
+	// Its lock is only contended while a capture starts or is written
+	struct ThreadBuffer
+	{
+		mutex lock;
+		uint32_t tid = 0;
+		string name;
+		vector<Event> events;
+		string text; // NUL separated names and details, indexed by offset
+		size_t dropped = 0;
+	};
+
+	ThreadBuffer& localBuffer();
+	ThreadBuffer& createBuffer();
+	static void append(ThreadBuffer& buffer, const char* name, string_view dynamicName, string_view detail,
+					   uint64_t beginNs, uint64_t endNs);
+	static uint32_t appendText(ThreadBuffer& buffer, string_view text);
+	static void writeEscaped(ostream& out, string_view text);
+
+	atomic<bool> recording{false};
+	uint64_t startNs = 0;
+	mutable mutex buffersLock;
+	vector<unique_ptr<ThreadBuffer>> buffers;
+	ThreadBuffer* gpuBuffer = nullptr;
+};
+
+// The process wide tracer
+Tracer& Tracing();
+
+// Records the enclosing block, detail must outlive it
+class TraceZone
+{
+public:
+	explicit TraceZone(const char* name, const string_view detail = {})
+	: name(name), detail(detail), recorded(Tracing().active()), beginNs(recorded ? Tracer::now() : 0)
+	{
+	}
+
+	~TraceZone()
+	{
+		if(recorded)
+			Tracing().record(name, detail, beginNs, Tracer::now());
+	}
+
+	TraceZone(const TraceZone&) = delete;
+	TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+	const char* name;
+	string_view detail;
+	bool recorded;
+	uint64_t beginNs;
+};
+
+#if LEARNOPENGL_TRACING
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_ZONE_DETAIL(name, detail) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name, detail)
+#define TRACE_THREAD_NAME(name) Tracing().setThreadName(name)
+#else
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_ZONE_DETAIL(name, detail) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
@@ -0,0 +1,210 @@
+#include "TransformSystem.hpp"
+#include "Simd.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+void TransformBatch::clear()
+{
+	px.clear(); py.clear(); pz.clear();
+	rx.clear(); ry.clear(); rz.clear();
+	sx.clear(); sy.clear(); sz.clear();
+	destinations.clear();
+}
+
+void TransformBatch::reserve(const size_t count)
+{
+	px.reserve(count); py.reserve(count); pz.reserve(count);
+	rx.reserve(count); ry.reserve(count); rz.reserve(count);
+	sx.reserve(count); sy.reserve(count); sz.reserve(count);
+	destinations.reserve(count);
+}
+
+void TransformBatch::push(const TransformComponent& transform, mat4* destination)
+{
+	px.push_back(transform.position.x);
+	py.push_back(transform.position.y);
+	pz.push_back(transform.position.z);
+	rx.push_back(transform.rotation.x);
+	ry.push_back(transform.rotation.y);
+	rz.push_back(transform.rotation.z);
+	sx.push_back(transform.scale.x);
+	sy.push_back(transform.scale.y);
+	sz.push_back(transform.scale.z);
+	destinations.push_back(destination);
+}
+
+#if defined(LEARNOPENGL_SIMD)
+
+static void bakeLanes(const TransformBatch& batch, const size_t first)
+{
+	constexpr size_t W = SimdFloat::WIDTH;
+	const SimdFloat halfPi = SimdFloat::set(1.57079632679490f);
+
+	const SimdFloat rx = SimdFloat::load(batch.rx.data() + first);
+	const SimdFloat ry = SimdFloat::load(batch.ry.data() + first);
+	const SimdFloat rz = SimdFloat::load(batch.rz.data() + first);
+	const SimdFloat sa = simdSin(rx), ca = simdSin(rx + halfPi);
+	const SimdFloat sb = simdSin(ry), cb = simdSin(ry + halfPi);
+	const SimdFloat sc = simdSin(rz), cc = simdSin(rz + halfPi);
+
+	const SimdFloat sx = SimdFloat::load(batch.sx.data() + first);
+	const SimdFloat sy = SimdFloat::load(batch.sy.data() + first);
+	const SimdFloat sz = SimdFloat::load(batch.sz.data() + first);
+	const SimdFloat sasb = sa * sb;
+	const SimdFloat casb = ca * sb;
+
+	// Upper 3x3 of translate * rotateX * rotateY * rotateZ * scale, column major
+	alignas(32) float m[9][W];
+	(sx * (cb * cc)).store(m[0]);
+	(sx * (ca * sc + sasb * cc)).store(m[1]);
+	(sx * (sa * sc - casb * cc)).store(m[2]);
+	(sy * (SimdFloat::set(0.0f) - cb * sc)).store(m[3]);
+	(sy * (ca * cc - sasb * sc)).store(m[4]);
+	(sy * (sa * cc + casb * sc)).store(m[5]);
+	(sz * sb).store(m[6]);
+	(sz * (SimdFloat::set(0.0f) - sa * cb)).store(m[7]);
+	(sz * (ca * cb)).store(m[8]);
+
+	for(size_t lane = 0; lane < W; ++lane)
+	{
+		const size_t i = first + lane;
+		mat4& out = *batch.destinations[i];
+		out[0] = vec4(m[0][lane], m[1][lane], m[2][lane], 0.0f);
+		out[1] = vec4(m[3][lane], m[4][lane], m[5][lane], 0.0f);
+		out[2] = vec4(m[6][lane], m[7][lane], m[8][lane], 0.0f);
+		out[3] = vec4(batch.px[i], batch.py[i], batch.pz[i], 1.0f);
+	}
+}
+
+#endif
+
+static void bakeRange(const TransformBatch& batch, const size_t begin, const size_t end)
+{
+	size_t i = begin;
+
+#if defined(LEARNOPENGL_SIMD)
+	for(; i + SimdFloat::WIDTH <= end; i += SimdFloat::WIDTH)
+		bakeLanes(batch, i);
+#endif
+
+	// Remainder, or everything on targets without SIMD
+	for(; i < end; ++i)
+	{
+		const TransformComponent transform{
+			{batch.px[i], batch.py[i], batch.pz[i]},
+			{batch.rx[i], batch.ry[i], batch.rz[i]},
+			{batch.sx[i], batch.sy[i], batch.sz[i]}
+		};
+		*batch.destinations[i] = transform.bake();
+	}
+}
+
+void BakeTransforms(const TransformBatch& batch, JobSystem* jobs)
+{
+	const size_t count = batch.size();
+	if(!jobs || count < TransformSystem::PARALLEL_BAKE_THRESHOLD)
+	{
+		bakeRange(batch, 0, count);
+		return;
+	}
+
+	// Split on whole lane groups so only the last chunk has a scalar remainder
+#if defined(LEARNOPENGL_SIMD)
+	constexpr size_t GROUP = SimdFloat::WIDTH;
+#else
+	constexpr size_t GROUP = 1;
+#endif
+	const size_t groups = (count + GROUP - 1) / GROUP;
+	jobs->parallelFor(groups, 1024 / GROUP, [&batch, count](const size_t begin, const size_t end)
+	{
+		bakeRange(batch, begin * GROUP, std::min(end * GROUP, count));
+	});
+}
+
+void TransformSystem::update(entt::registry& registry)
+{
+	using namespace std::chrono;
+
+	stats.bakedInstances = 0;
+	stats.bakeMs = 0.0;
+	bakedInstances.clear();
+	const auto& dirtyStorage = registry.storage<DirtyTransformTag>();
+	if(dirtyStorage.empty())
+		return;
+
+	// ========== Gather dirty instances ==========
+	const auto bakeStart = steady_clock::now();
+	batch.clear();
+	batch.reserve(dirtyStorage.size());
+	bakedInstances.reserve(dirtyStorage.size());
+
+	entt::entity cachedModelEntity = entt::null;
+	ModelComponent* cachedModel = nullptr;
+
+	const auto view = registry.view<DirtyTransformTag, InstanceComponent, TransformComponent>();
+	for(const entt::entity entity : view)
+	{
+		const InstanceComponent& instance = view.get<InstanceComponent>(entity);
+
+		// Instances of the same model are usually created together, so the lookup is mostly skipped
+		if(instance.modelEntity != cachedModelEntity)
+		{
+			cachedModelEntity = instance.modelEntity;
+			cachedModel = registry.valid(cachedModelEntity) ? registry.try_get<ModelComponent>(cachedModelEntity) : nullptr;
+		}
+		if(!cachedModel || instance.slot >= cachedModel->instanceMatrices.size())
+			continue;
+
+		if(!cachedModel->hasDirtyInstances())
+			registry.emplace_or_replace<DirtyInstancesTag>(cachedModelEntity);
+		cachedModel->markDirty(instance.slot);
+		batch.push(view.get<TransformComponent>(entity), &cachedModel->instanceMatrices[instance.slot]);
+		bakedInstances.push_back(entity);
+	}
+
+	// ========== Bake ==========
+	BakeTransforms(batch, jobSystem);
+	registry.clear<DirtyTransformTag>();
+
+	stats.bakedInstances = static_cast<uint32_t>(batch.size());
+	stats.bakeMs = duration<double, std::milli>(steady_clock::now() - bakeStart).count();
+}
+
+void TransformSystem::extract(entt::registry& registry, RenderSnapshot& snapshot)
+{
+	using namespace std::chrono;
+
+	const auto start = steady_clock::now();
+
+	// Also covers slots moved by instance removal, which carry no transform change
+	uint32_t extractedModels = 0;
+	const auto dirtyModels = registry.view<DirtyInstancesTag, ModelComponent>();
+	for(const entt::entity modelEntity : dirtyModels)
+	{
+		auto& modelComp = dirtyModels.get<ModelComponent>(modelEntity);
+		const auto instanceCount = static_cast<uint32_t>(modelComp.instanceMatrices.size());
+		uint32_t first = modelComp.dirtyBegin;
+		uint32_t last = std::min(modelComp.dirtyEnd, instanceCount);
+		// A growing instance buffer loses its contents, so it needs every slot
+		if(instanceCount > modelComp.model.getInstanceCapacity())
+		{
+			first = 0;
+			last = instanceCount;
+		}
+		modelComp.clearDirty();
+		if(first >= last)
+			continue;
+
+		snapshot.instanceUploads.push_back({
+			modelEntity, first, last - first, instanceCount, static_cast<uint32_t>(snapshot.uploadMatrices.size())
+		});
+		snapshot.uploadMatrices.insert(snapshot.uploadMatrices.end(),
+									   modelComp.instanceMatrices.begin() + first, modelComp.instanceMatrices.begin() + last);
+		++extractedModels;
+	}
+	registry.clear<DirtyInstancesTag>();
+
+	stats.extractedModels = extractedModels;
+	stats.extractMs = duration<double, std::milli>(steady_clock::now() - start).count();
+}
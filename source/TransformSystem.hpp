@@ -0,0 +1,84 @@
+#pragma once
+#include <entt/entity/registry.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Components.hpp"
+#include "JobSystem.hpp"
+#include "RenderSnapshot.hpp"
+
+using namespace std;
+using namespace glm;
+
+// Instances whose TransformComponent changed since the last TransformSystem::update
+struct DirtyTransformTag {};
+
+// Structure-of-arrays view of a batch of transforms, so several instances are baked per SIMD lane group
+struct TransformBatch
+{
+	vector<float> px, py, pz;
+	vector<float> rx, ry, rz;
+	vector<float> sx, sy, sz;
+	vector<mat4*> destinations; // Slot in ModelComponent::instanceMatrices that receives the baked matrix
+
+	[[nodiscard]] size_t size() const { return destinations.size(); }
+	void clear();
+	void reserve(size_t count);
+	void push(const TransformComponent& transform, mat4* destination);
+};
+
+// Non-owning structure-of-arrays transforms, e.g. straight from a mapped scene file
+struct TransformArraysView
+{
+	const float* px;
+	const float* py;
+	const float* pz;
+	const float* rx;
+	const float* ry;
+	const float* rz;
+	const float* sx;
+	const float* sy;
+	const float* sz;
+	size_t count;
+
+	[[nodiscard]] TransformComponent operator[](const size_t i) const
+	{
+		return {{px[i], py[i], pz[i]}, {rx[i], ry[i], rz[i]}, {sx[i], sy[i], sz[i]}};
+	}
+};
+
+// Bakes every transform of the batch into its destination, same result as TransformComponent::bake().
+// Large batches are split across the job system when one is given.
+void BakeTransforms(const TransformBatch& batch, JobSystem* jobs = nullptr);
+
+// Re-bakes only the instances tagged with DirtyTransformTag, then copies the dirty slot range of every model
+// tagged with DirtyInstancesTag into a render snapshot. Neither step touches GL.
+class TransformSystem
+{
+public:
+	struct Stats
+	{
+		uint32_t bakedInstances = 0;
+		uint32_t extractedModels = 0;
+		double bakeMs = 0.0;    // gather + SIMD bake
+		double extractMs = 0.0; // copying dirty ranges into the snapshot
+	};
+
+	void setJobSystem(JobSystem* jobs) { jobSystem = jobs; }
+
+	void update(entt::registry& registry);
+	// Appends the dirty slot ranges to the snapshot's instance uploads and clears them
+	void extract(entt::registry& registry, RenderSnapshot& snapshot);
+
+	[[nodiscard]] const Stats& getStats() const { return stats; }
+	// Instances re-baked by the last update, e.g. to refit spatial structures
+	[[nodiscard]] const vector<entt::entity>& getBakedInstances() const { return bakedInstances; }
+
+	// Below this many dirty instances the bake stays on the calling thread
+	static constexpr size_t PARALLEL_BAKE_THRESHOLD = 4096;
+
+private:
+	JobSystem* jobSystem = nullptr;
+	TransformBatch batch;
+	vector<entt::entity> bakedInstances;
+	Stats stats;
+};